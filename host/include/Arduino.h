@@ -0,0 +1,104 @@
+/****************************************************************************
+Arduino.h - Host shim of the Arduino/ESP8266 core for the native build.
+
+Time is virtual: millis()/micros() only advance through delay(), yield(),
+SPI transfers and hostAdvanceMicros(). That keeps every host run
+deterministic and lets the simulated radio model drain its FIFO at the
+configured bit rate without any real waiting.
+****************************************************************************/
+
+#ifndef HOST_ARDUINO_H
+  #define HOST_ARDUINO_H
+
+  #include <stdint.h>
+  #include <stdlib.h>
+  #include <stdio.h>
+  #include <string.h>
+  #include <math.h>
+  #include <algorithm>
+  #include <WString.h>
+  #include <Print.h>
+  #include <Esp.h>
+
+  #define MXHOST 1
+
+  using std::min;
+  using std::max;
+
+  typedef uint8_t byte;
+  typedef bool boolean;
+
+  #define HIGH 0x1
+  #define LOW  0x0
+  #define INPUT  0x00
+  #define OUTPUT 0x01
+  #define RISING 0x01
+  #define LED_BUILTIN 2
+  #define NOT_AN_INTERRUPT 255
+  #define SS 15
+
+  #define PROGMEM
+  #define ICACHE_RAM_ATTR
+  #define IRAM_ATTR
+  #define PSTR(s) (s)
+  #define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+  #define snprintf_P snprintf
+  #define strlen_P strlen
+  #define strcmp_P strcmp
+  #define strncmp_P strncmp
+  #define memcpy_P memcpy
+
+  #define bitRead(value, bit) (((value) >> (bit)) & 0x01)
+  #define bitSet(value, bit) ((value) |= (1UL << (bit)))
+  #define bitClear(value, bit) ((value) &= ~(1UL << (bit)))
+  #define digitalPinToInterrupt(p) ((int)(p))
+
+  // virtual time base
+  uint64_t hostMicros64();
+  void hostAdvanceMicros(uint32_t us);
+  // hooks called whenever virtual time advances, e.g. used by the radio model
+  typedef void (*hostTimeHook_t)(uint64_t nowUs);
+  void hostAddTimeHook(hostTimeHook_t hook);
+  // hooks called on every digitalWrite(), e.g. the chip select of the radio model
+  typedef void (*hostPinHook_t)(uint8_t pin, uint8_t val);
+  void hostAddPinHook(hostPinHook_t hook);
+
+  unsigned long millis();
+  unsigned long micros();
+  void delay(unsigned long ms);
+  void delayMicroseconds(unsigned int us);
+  void yield();
+  bool esp_delay(unsigned long ms, bool (*blocked)(), unsigned long intvl_ms);
+  void esp_schedule();
+
+  void pinMode(uint8_t pin, uint8_t mode);
+  void digitalWrite(uint8_t pin, uint8_t val);
+  int digitalRead(uint8_t pin);
+  void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
+  void detachInterrupt(uint8_t interruptNum);
+  void noInterrupts();
+  void interrupts();
+  // calls the handler attached to the interrupt pin, used by simulated peripherals
+  void hostRaiseInterrupt(uint8_t interruptNum);
+
+  long random(long howbig);
+  long random(long howsmall, long howbig);
+  void randomSeed(unsigned long seed);
+
+  // SNTP, the host keeps the system time
+  void configTime(int timezone, int daylightOffset_sec, const char *server1,
+                  const char *server2 = nullptr, const char *server3 = nullptr);
+
+  char *dtostrf(double number, signed char width, unsigned char prec, char *s);
+
+  class HardwareSerial : public Print {
+    public:
+      void begin(unsigned long baud) { (void)baud; }
+      size_t write(uint8_t c) override;
+      using Print::write;
+      operator bool() const { return true; }
+      // output is dropped unless enabled, host tools print their own reports
+      bool echo = false;
+  };
+  extern HardwareSerial Serial;
+#endif //HOST_ARDUINO_H
@@ -0,0 +1,47 @@
+/****************************************************************************
+EEPROM.h - Host shim of the ESP8266 EEPROM library (flash sector emulated
+EEPROM).
+****************************************************************************/
+
+#ifndef HOST_EEPROM_H
+  #define HOST_EEPROM_H
+
+  #include <stdint.h>
+  #include <stddef.h>
+  #include <string.h>
+
+  class EEPROMClass {
+    public:
+      void begin(size_t size);
+      uint8_t read(int address);
+      void write(int address, uint8_t value);
+      bool commit();
+      bool end();
+      size_t length() { return _size; }
+      uint8_t *getDataPtr() { _dirty = true; return _data; }
+
+      template<typename T> T &get(int address, T &t) {
+        if ((address >= 0) && (address + sizeof(T) <= _size)) {
+          memcpy((uint8_t*)&t, _data + address, sizeof(T));
+        }
+        return t;
+      }
+      template<typename T> const T &put(int address, const T &t) {
+        if ((address >= 0) && (address + sizeof(T) <= _size)) {
+          if (memcmp(_data + address, (const uint8_t*)&t, sizeof(T)) != 0) {
+            _dirty = true;
+            memcpy(_data + address, (const uint8_t*)&t, sizeof(T));
+          }
+        }
+        return t;
+      }
+
+      uint32_t commits = 0; // sector writes, a real flash sector survives ~10000 of them
+
+    private:
+      uint8_t *_data = NULL;
+      size_t _size = 0;
+      bool _dirty = false;
+  };
+  extern EEPROMClass EEPROM;
+#endif //HOST_EEPROM_H
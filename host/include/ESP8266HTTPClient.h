@@ -0,0 +1,18 @@
+/****************************************************************************
+ESP8266HTTPClient.h - Host shim, the firmware server is never reachable.
+****************************************************************************/
+
+#ifndef HOST_ESP8266HTTPCLIENT_H
+  #define HOST_ESP8266HTTPCLIENT_H
+
+  #include <Arduino.h>
+  #include <ESP8266WiFi.h>
+
+  class HTTPClient {
+    public:
+      bool begin(WiFiClient &client, const String &url) { (void)client; (void)url; return true; }
+      int GET() { return -1; } // HTTPC_ERROR_CONNECTION_FAILED
+      String getString() { return String(); }
+      void end() {}
+  };
+#endif //HOST_ESP8266HTTPCLIENT_H
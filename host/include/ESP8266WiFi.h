@@ -0,0 +1,52 @@
+/****************************************************************************
+ESP8266WiFi.h - Host shim, WiFi is always connected.
+****************************************************************************/
+
+#ifndef HOST_ESP8266WIFI_H
+  #define HOST_ESP8266WIFI_H
+
+  #include <Arduino.h>
+
+  #define WL_CONNECTED 3
+  #define WL_DISCONNECTED 6
+  enum WiFiMode_t { WIFI_OFF, WIFI_STA, WIFI_AP, WIFI_AP_STA };
+  enum WiFiSleepType_t { WIFI_NONE_SLEEP, WIFI_LIGHT_SLEEP, WIFI_MODEM_SLEEP };
+
+  class IPAddress {
+    public:
+      IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0) : _a{a, b, c, d} {}
+      String toString() const {
+        char buf[16];
+        snprintf(buf, sizeof(buf), "%u.%u.%u.%u", _a[0], _a[1], _a[2], _a[3]);
+        return String(buf);
+      }
+    private:
+      uint8_t _a[4];
+  };
+
+  class Client : public Print {
+    public:
+      size_t write(uint8_t c) override { (void)c; return 1; }
+      using Print::write;
+      virtual int available() { return 0; }
+      void setTimeout(unsigned long timeout) { (void)timeout; }
+  };
+
+  class WiFiClient : public Client {
+  };
+
+  class ESP8266WiFiClass {
+    public:
+      bool mode(WiFiMode_t mode) { (void)mode; return true; }
+      bool hostname(const String &name) { (void)name; return true; }
+      int begin(const char *ssid, const char *pass) { (void)ssid; (void)pass; return WL_CONNECTED; }
+      int status() { return connected ? WL_CONNECTED : WL_DISCONNECTED; }
+      bool setSleepMode(WiFiSleepType_t type, uint8_t listenInterval = 0) { (void)type; (void)listenInterval; return true; }
+      String macAddress() { return String("BC:DD:C2:24:79:27"); }
+      IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+      int32_t RSSI() { return -60; }
+
+      bool connected = true;
+  };
+  extern ESP8266WiFiClass WiFi;
+#endif //HOST_ESP8266WIFI_H
@@ -0,0 +1,28 @@
+/****************************************************************************
+ESP8266httpUpdate.h - Host shim, updates always fail.
+****************************************************************************/
+
+#ifndef HOST_ESP8266HTTPUPDATE_H
+  #define HOST_ESP8266HTTPUPDATE_H
+
+  #include <Arduino.h>
+  #include <ESP8266WiFi.h>
+
+  enum HTTPUpdateResult {
+    HTTP_UPDATE_FAILED,
+    HTTP_UPDATE_NO_UPDATES,
+    HTTP_UPDATE_OK
+  };
+  typedef HTTPUpdateResult t_httpUpdate_return;
+
+  class ESP8266HTTPUpdate {
+    public:
+      void rebootOnUpdate(bool reboot) { (void)reboot; }
+      t_httpUpdate_return update(WiFiClient &client, const String &url) {
+        (void)client; (void)url; return HTTP_UPDATE_FAILED;
+      }
+      int getLastError() { return -1; }
+      String getLastErrorString() { return String("host build"); }
+  };
+  extern ESP8266HTTPUpdate ESPhttpUpdate;
+#endif //HOST_ESP8266HTTPUPDATE_H
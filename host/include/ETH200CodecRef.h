@@ -0,0 +1,38 @@
+/****************************************************************************
+ETH200CodecRef.h - Frozen reference of the ETH200 codec kernels for the host
+build.
+
+Copies of ETH200RFM69::reverseByte, calcCRC16r, calcPacketCRC16r,
+destuffPayload, stuffPayload and packBits as of firmware 4.5, the version
+which interoperates with the real sensors and thermostats. They are the
+oracle for host/tools/codecfuzz, any optimisation of the firmware kernels
+has to produce exactly the same output for the same input, quirks
+included:
+  - destuffPayload writes up to destuffedBuf[length - 1], one byte more
+    than documented, and shifts into whatever destuffedBuf held before
+  - stuffPayload shifts the last byte by (8 - wasStuffed), which is only
+    defined for up to 8 stuffed bits, and with exactly 8 it touches
+    stuffedBuf[length + 1]
+  - calcPacketCRC16r includes the sync word 0x7E and returns the CRC byte
+    swapped
+
+Don't change this file to follow the firmware, it is meant to stay as it
+is. The MXLOG_DEBUG calls of the firmware are left out, they don't change
+any output.
+****************************************************************************/
+
+#ifndef HOST_ETH200CODECREF_H
+  #define HOST_ETH200CODECREF_H
+
+  #include <Arduino.h>
+
+  class ETH200CodecRef {
+    public:
+      static uint8_t reverseByte(uint8_t b);
+      static uint16_t calcCRC16r(uint16_t c, uint16_t crc, uint16_t mask);
+      static uint16_t calcPacketCRC16r(uint8_t packet[], uint8_t length, uint16_t crcStart, uint16_t crcMask);
+      static uint8_t destuffPayload(uint8_t inBuf[], uint8_t destuffedBuf[], uint8_t length);
+      static uint8_t stuffPayload(uint8_t inBuf[], uint8_t stuffedBuf[], uint8_t length);
+      static uint8_t packBits(const uint8_t packet[], uint8_t numBits, uint8_t out[], uint8_t &pendingByte, uint8_t &pendingBits);
+  };
+#endif // HOST_ETH200CODECREF_H
@@ -0,0 +1,71 @@
+/****************************************************************************
+ETH200Receiver.h - Bit accurate model of an ETH200 thermostat receiver for
+the host build.
+
+Decodes the on air chip stream of the transmitter (RFM69Model::txChips)
+the way a thermostat has to see it, bit by bit and without knowing where
+the bytes of the FIFO started:
+  - Manchester (10 -> 1, 01 -> 0), a 00 or 11 chip pair is a violation, the
+    decoder shifts by one chip and aborts the frame it was in
+  - the sync word 0x7E is searched in every bit position, so syncs directly
+    behind a stuffed tail are found as well
+  - after a sync the bits are destuffed (a 0 after five 1s is dropped, a 1
+    aborts the frame), the first two bytes give the device type and with it
+    the frame length, the frame is complete after that many bytes
+  - every byte is sent LSB first (reverseByte() before stuffing), the CRC is
+    checked like ETH200RFM69::interruptHandler() does it
+
+Nothing of the firmware is used for the decode, so encoding bugs of the
+transmit path can't hide behind the same bugs in the receive path.
+****************************************************************************/
+
+#ifndef HOST_ETH200RECEIVER_H
+  #define HOST_ETH200RECEIVER_H
+
+  #include <Arduino.h>
+  #include <vector>
+
+  enum eth200FrameStatus_t {
+    frameValid,       // complete with a correct CRC
+    frameCrcError,    // complete, wrong CRC
+    frameUnknownType, // the device type doesn't give a frame length
+    frameAborted,     // six 1s, a Manchester violation or a new sync inside the frame
+    frameTruncated,   // the stream ended inside the frame
+  };
+
+  struct eth200Frame {
+    eth200FrameStatus_t status;
+    size_t startChip;          // first chip after the sync word
+    size_t endChip;            // chip after the last bit of the frame or where it broke
+    std::vector<uint8_t> data; // destuffed and reversed, as far as received
+  };
+
+  class ETH200Receiver {
+    public:
+      // decodes chips (one entry 0/1 per chip), appends the frames found behind a sync word
+      void decode(const std::vector<uint8_t> &chips);
+      void clear();
+
+      std::vector<eth200Frame> frames;
+      uint32_t syncs = 0;                // sync words found
+      uint32_t manchesterViolations = 0; // 00/11 chip pairs
+      uint32_t stuffedBits = 0;          // 0 bits dropped by the destuffing
+
+      static uint16_t crcStart(uint8_t deviceType);  // 0 for an unknown device type
+      static uint8_t frameLength(uint8_t deviceType); // 0 for an unknown device type
+      static uint16_t crc(const uint8_t data[], uint8_t length, uint16_t crcStart);
+
+    private:
+      enum state_t { hunting, receiving };
+      state_t _state = hunting;
+      uint8_t _shift = 0;      // the last 8 bits, for the sync search
+      uint8_t _ones = 0;       // consecutive 1s inside the frame
+      uint8_t _byte = 0;
+      uint8_t _byteBits = 0;
+      uint8_t _length = 0;     // frame length once the device type is known
+      eth200Frame _frame;
+
+      void bit(uint8_t b, size_t chip);
+      void finish(eth200FrameStatus_t status, size_t chip);
+  };
+#endif //HOST_ETH200RECEIVER_H
@@ -0,0 +1,31 @@
+/****************************************************************************
+Esp.h - Host shim of the ESP8266 EspClass.
+****************************************************************************/
+
+#ifndef HOST_ESP_H
+  #define HOST_ESP_H
+
+  #include <stdint.h>
+  #include <stddef.h>
+  #include <WString.h>
+  #include <user_interface.h>
+
+  class EspClass {
+    public:
+      uint32_t getCycleCount();
+      uint32_t getCpuFreqMHz() { return 80; }
+      uint32_t getFreeHeap();
+      uint32_t getMaxFreeBlockSize();
+      uint8_t getHeapFragmentation();
+      uint32_t getChipId() { return 0x00A1B2C3; }
+      String getResetReason() { return resetReason; }
+      struct rst_info *getResetInfoPtr() { return &resetInfo; }
+      bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size);
+      bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size);
+      [[noreturn]] void restart();
+
+      String resetReason = "External System";
+      struct rst_info resetInfo = {REASON_EXT_SYS_RST, 0, 0, 0, 0, 0, 0};
+  };
+  extern EspClass ESP;
+#endif //HOST_ESP_H
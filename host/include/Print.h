@@ -0,0 +1,65 @@
+/****************************************************************************
+Print.h - Host shim of the Arduino Print class.
+****************************************************************************/
+
+#ifndef HOST_PRINT_H
+  #define HOST_PRINT_H
+
+  #include <stddef.h>
+  #include <stdint.h>
+  #include <WString.h>
+
+  #define DEC 10
+  #define HEX 16
+  #define OCT 8
+  #define BIN 2
+
+  class Print {
+    public:
+      virtual ~Print() {}
+      virtual size_t write(uint8_t c) = 0;
+      virtual size_t write(const uint8_t *buffer, size_t size) {
+        size_t n = 0;
+        while (size--) n += write(*buffer++);
+        return n;
+      }
+      size_t write(const char *str) { return str ? write((const uint8_t *)str, strlenSafe(str)) : 0; }
+      virtual void flush() {}
+
+      size_t print(const __FlashStringHelper *s) { return write(reinterpret_cast<const char *>(s)); }
+      size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+      size_t print(const char str[]) { return write(str); }
+      size_t print(char c) { return write((uint8_t)c); }
+      size_t print(unsigned char n, int base = DEC) { return printNumber(n, base); }
+      size_t print(int n, int base = DEC) { return printSigned(n, base); }
+      size_t print(unsigned int n, int base = DEC) { return printNumber(n, base); }
+      size_t print(long n, int base = DEC) { return printSigned(n, base); }
+      size_t print(unsigned long n, int base = DEC) { return printNumber(n, base); }
+      size_t print(double n, int digits = 2) { return print(String(n, (unsigned char)digits)); }
+
+      template <typename T> size_t println(const T &value) { size_t n = print(value); return n + println(); }
+      template <typename T> size_t println(const T &value, int format) { size_t n = print(value, format); return n + println(); }
+      size_t println() { return write("\r\n"); }
+
+      size_t printf(const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+    private:
+      static size_t strlenSafe(const char *s) { size_t n = 0; while (s[n]) n++; return n; }
+      size_t printSigned(long n, int base) {
+        if (base == DEC && n < 0) return print('-') + printNumber((unsigned long)(-n), base);
+        return printNumber((unsigned long)n, base);
+      }
+      size_t printNumber(unsigned long n, int base) {
+        char buf[8 * sizeof(long) + 1];
+        char *str = &buf[sizeof(buf) - 1];
+        *str = '\0';
+        if (base < 2) base = 10;
+        do {
+          char c = n % base;
+          n /= base;
+          *--str = c < 10 ? c + '0' : c + 'A' - 10;
+        } while (n);
+        return write(str);
+      }
+  };
+#endif //HOST_PRINT_H
@@ -0,0 +1,99 @@
+/****************************************************************************
+PubSubClient.h - Host shim of the PubSubClient MQTT library.
+
+Connects to an in-process stub broker (MQTTStubBroker) instead of a real
+socket. The broker records every publish, keeps retained messages, matches
+subscriptions including "+" and "#" wildcards and can be taken down to
+test the reconnect handling.
+
+Like PubSubClient 2.8 the client has one MQTT_MAX_PACKET_SIZE buffer: the
+callback gets topic and payload pointing into it and publish() builds its
+packet there, so a callback which publishes before it copied the payload
+sees it overwritten like on the device.
+****************************************************************************/
+
+#ifndef HOST_PUBSUBCLIENT_H
+  #define HOST_PUBSUBCLIENT_H
+
+  #include <Arduino.h>
+  #include <ESP8266WiFi.h>
+  #include <deque>
+  #include <map>
+  #include <string>
+  #include <vector>
+
+  #ifndef MQTT_MAX_PACKET_SIZE
+    #define MQTT_MAX_PACKET_SIZE 256
+  #endif
+
+  #define MQTT_CONNECTION_TIMEOUT     -4
+  #define MQTT_CONNECTION_LOST        -3
+  #define MQTT_CONNECT_FAILED         -2
+  #define MQTT_DISCONNECTED           -1
+  #define MQTT_CONNECTED               0
+
+  #define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+
+  struct MQTTStubMessage {
+    std::string topic;
+    std::string payload;
+    bool retained;
+    uint64_t timeUs; // virtual time of the publish
+  };
+
+  class MQTTStubBroker {
+    public:
+      // broker availability, a client can only connect while it is up and
+      // gets disconnected when it goes down
+      bool up = true;
+      // every message published by the device
+      std::vector<MQTTStubMessage> published;
+      // messages waiting to be delivered to the device with the next loop()
+      std::deque<MQTTStubMessage> inbound;
+      std::vector<std::string> subscriptions;
+      // last retained payload per topic, delivered on subscribe like a real broker
+      std::map<std::string, std::string> retained;
+      unsigned long connectAttempts = 0;
+      unsigned long connects = 0;
+
+      // queues a message from "another client", delivered if the device subscribed to it
+      void inject(const std::string &topic, const std::string &payload);
+      bool isSubscribed(const std::string &topic) const;
+      static bool topicMatches(const std::string &filter, const std::string &topic);
+      // number of published messages on a given topic
+      size_t count(const std::string &topic) const;
+      void clear() { published.clear(); }
+  };
+  extern MQTTStubBroker mqttStubBroker;
+
+  class PubSubClient {
+    public:
+      PubSubClient(Client &client) { (void)client; }
+      PubSubClient &setServer(IPAddress ip, uint16_t port) { (void)ip; (void)port; return *this; }
+      PubSubClient &setCallback(MQTT_CALLBACK_SIGNATURE) { _callback = callback; return *this; }
+      PubSubClient &setSocketTimeout(uint16_t timeout) { (void)timeout; return *this; }
+      PubSubClient &setKeepAlive(uint16_t keepAlive) { (void)keepAlive; return *this; }
+      bool setBufferSize(uint16_t size) { (void)size; return true; }
+
+      bool connect(const char *id, const char *user, const char *pass,
+                   const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage);
+      void disconnect();
+      bool connected();
+      int state() { return _state; }
+      bool loop();
+      bool subscribe(const char *topic);
+      bool unsubscribe(const char *topic);
+      bool publish(const char *topic, const char *payload);
+      bool publish(const char *topic, const char *payload, bool retained);
+      bool publish(const char *topic, const uint8_t *payload, unsigned int plength);
+      bool publish(const char *topic, const uint8_t *payload, unsigned int plength, bool retained);
+
+    private:
+      uint8_t _buffer[MQTT_MAX_PACKET_SIZE];
+      void (*_callback)(char *, uint8_t *, unsigned int) = nullptr;
+      int _state = MQTT_DISCONNECTED;
+      std::string _willTopic;
+      std::string _willMessage;
+      bool _willRetain = false;
+  };
+#endif //HOST_PUBSUBCLIENT_H
@@ -0,0 +1,71 @@
+/****************************************************************************
+RFM69.h - Host port of the LowPowerLab RFM69 base class.
+
+Only the members ETH200RFM69 builds on are provided, with the same names,
+signatures and static/instance layout as LowPowerLab/RFM69 1.4.x, so
+ETH200RFM69.cpp compiles unmodified. Register access goes through the SPI
+shim into the simulated RFM69 (see RFM69Model.h).
+****************************************************************************/
+
+#ifndef HOST_RFM69_H
+  #define HOST_RFM69_H
+
+  #include <Arduino.h>
+  #include <SPI.h>
+
+  #define RF69_MAX_DATA_LEN 61
+  #define RF69_SPI_CS       SS
+  #define RF69_IRQ_PIN      4
+  #define CSMA_LIMIT        -90 // upper RX signal sensitivity threshold in dBm for carrier sense access
+  #define RF69_MODE_SLEEP   0
+  #define RF69_MODE_STANDBY 1
+  #define RF69_MODE_SYNTH   2
+  #define RF69_MODE_RX      3
+  #define RF69_MODE_TX      4
+  #define RF69_CSMA_LIMIT_MS 1000
+  #define RF69_TX_LIMIT_MS   1000
+  #define ISR_PREFIX
+
+  class RFM69 {
+    public:
+      static uint8_t DATA[RF69_MAX_DATA_LEN + 1];
+      static uint8_t DATALEN;
+      static uint8_t PAYLOADLEN;
+      static int16_t RSSI;
+      static uint8_t _mode;
+
+      RFM69(uint8_t slaveSelectPin = RF69_SPI_CS, uint8_t interruptPin = RF69_IRQ_PIN,
+            bool isRFM69HW = false, SPIClass *spi = nullptr);
+      virtual ~RFM69() {}
+
+      bool canSend();
+      virtual bool receiveDone();
+      void encrypt(const char *key);
+      int16_t readRSSI(bool forceTrigger = false);
+      virtual void setHighPower(bool onOFF = true);
+      virtual void setPowerLevel(uint8_t level);
+      uint8_t getPowerLevel() { return _powerLevel; }
+      uint8_t readReg(uint8_t addr);
+      void writeReg(uint8_t addr, uint8_t val);
+      void readAllRegs();
+      void readAllRegsCompact();
+
+    protected:
+      static void isr0();
+      static volatile bool _haveData;
+
+      uint8_t _slaveSelectPin;
+      uint8_t _interruptPin;
+      uint8_t _interruptNum;
+      uint8_t _powerLevel = 31;
+      bool _isRFM69HW;
+      SPISettings _settings;
+      SPIClass *_spi;
+
+      virtual void receiveBegin();
+      virtual void setMode(uint8_t mode);
+      virtual void setHighPowerRegs(bool onOff);
+      virtual void select();
+      virtual void unselect();
+  };
+#endif //HOST_RFM69_H
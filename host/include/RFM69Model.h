@@ -0,0 +1,128 @@
+/****************************************************************************
+RFM69Model.h - Behavioural model of the RFM69 (SX1231) for the host build.
+
+The model sits behind the SPI shim and the chip select pin and behaves
+like the module as far as ETH200RFM69 and the RFM69 base class can tell:
+  - register file with the power on defaults, burst access with address
+    auto increment, REG_FIFO doesn't increment
+  - 66 byte FIFO with FifoFull/FifoNotEmpty/FifoLevel/FifoOverrun, FifoLevel
+    is set when the FIFO holds strictly more than FifoThreshold bytes
+  - mode transitions, ModeReady/RxReady/TxReady are set modeReadyUs after
+    the OpMode write
+  - TX in packet mode: starts on FifoNotEmpty or FifoLevel (TxStartCondition),
+    sends preamble, sync word and PayloadLength bytes from the FIFO at the
+    configured bit rate (Manchester doubles the chips per bit), sets
+    PacketSent and starts over with the next packet while the FIFO isn't
+    empty. Fixed packet format only, PayloadLength 0 (unlimited) never
+    sets PacketSent.
+  - RX: injectPacket() puts a received payload into the FIFO and sets
+    PayloadReady, but only if the receiver is ready and the last payload
+    was read or dropped by a restart
+  - the reset pin, high puts the module into the power on state
+  - DIO0 with the mapping of RegDioMapping1, a rising edge raises the
+    attached interrupt (hostRaiseInterrupt())
+
+Time is taken from the virtual time of the Arduino shim, internally in
+ticks of the 32 MHz crystal, so the bit time of every bit rate setting is
+exact. Everything sent is recorded (txFifoBytes, txChips) so host tools
+can inspect the on air stream.
+****************************************************************************/
+
+#ifndef HOST_RFM69MODEL_H
+  #define HOST_RFM69MODEL_H
+
+  #include <Arduino.h>
+  #include <RFM69registers.h>
+  #include <vector>
+
+  #define RFM69MODEL_FIFO_SIZE 66
+  #define RFM69MODEL_NUM_REGS 0x80
+  #define RFM69MODEL_TICKS_PER_US 32 // the 32 MHz crystal
+
+  class RFM69Model {
+    public:
+      RFM69Model();
+      // connects the model to the chip select pin, the DIO0 interrupt and the reset pin
+      // (high resets the module), registers the pin and time hooks, needs to be called
+      // once before the radio is initialized
+      void attach(uint8_t csPin, uint8_t dio0Interrupt, uint8_t resetPin = 0xFF);
+      // power on state, keeps the recordings
+      void reset();
+
+      // SPI side, called by the shims
+      void chipSelect(uint8_t pin, uint8_t val);
+      uint8_t spiTransfer(uint8_t data);
+      void advanceTo(uint64_t nowUs);
+
+      // receives a payload, bytes as they would end up in the FIFO (Manchester decoded),
+      // padded with 0 or cut to PayloadLength
+      // rssiValue - RegRssiValue during the packet, -dBm * 2
+      // returns false if the receiver wasn't ready and the packet was lost
+      bool injectPacket(const uint8_t *payload, uint8_t length, uint8_t rssiValue = 120);
+
+      // register value without side effects, e.g. for assertions
+      uint8_t peekReg(uint8_t addr);
+      uint8_t fifoCount() { return _fifoCount; }
+      // clears txFifoBytes, txChips and the TX counters
+      void clearTx();
+
+      // environment
+      uint8_t noiseRssiValue = 200; // RegRssiValue without a packet, -100 dBm
+      uint32_t modeReadyUs = 50;    // time from the OpMode write until ModeReady
+
+      // recordings and counters
+      std::vector<uint8_t> txFifoBytes; // every byte the transmitter took from the FIFO
+      std::vector<uint8_t> txChips;     // on air stream, one entry (0/1) per chip
+      uint64_t txFirstChipUs = 0;       // start of the first recorded chip
+      uint64_t txLastChipUs = 0;        // end of the last recorded chip
+      uint32_t txPackets = 0;           // packets completed (PacketSent)
+      uint32_t txUnderruns = 0;         // the FIFO ran empty inside a packet
+      uint32_t rxPackets = 0;           // injected packets which made it into the FIFO
+      uint32_t rxDropped = 0;           // injected packets lost, receiver not ready
+      uint32_t fifoOverruns = 0;        // writes into a full FIFO
+      uint32_t dio0Edges = 0;           // rising edges of DIO0
+
+    private:
+      enum txState_t { txIdle, txPayload, txUnderrun };
+
+      uint8_t _regs[RFM69MODEL_NUM_REGS];
+      uint8_t _fifo[RFM69MODEL_FIFO_SIZE];
+      uint8_t _fifoHead = 0;
+      uint8_t _fifoCount = 0;
+      uint8_t _csPin = SS;
+      uint8_t _dio0Interrupt = NOT_AN_INTERRUPT;
+      uint8_t _resetPin = 0xFF;
+      bool _attached = false;
+      bool _selected = false;
+      bool _addrPhase = false;
+      bool _write = false;
+      uint8_t _addr = 0;
+
+      uint64_t _nowTicks = 0;
+      uint64_t _modeReadyTicks = 0;
+      bool _modeReady = true;
+      bool _fifoOverrun = false;
+      bool _packetSent = false;
+      bool _payloadReady = false;
+      bool _dio0 = false;
+
+      txState_t _txState = txIdle;
+      uint64_t _txNextTicks = 0;      // end of the unit (header or byte) on air
+      uint16_t _txPayloadLeft = 0;
+      bool _txUnlimited = false;      // PayloadLength 0, the packet never ends
+
+      uint8_t mode() { return (_regs[REG_OPMODE] >> 2) & 0x07; }
+      uint8_t readReg(uint8_t addr);
+      void writeReg(uint8_t addr, uint8_t val);
+      void setOpMode(uint8_t val);
+      void fifoClear();
+      boolean fifoPush(uint8_t b);
+      uint8_t fifoPop();
+      uint32_t chipTicks();
+      boolean txStartCondition();
+      void recordChips(uint8_t b, boolean manchester, uint64_t startTicks);
+      void runTx(uint64_t untilTicks);
+      void updateDio0();
+  };
+  extern RFM69Model rfm69Model;
+#endif //HOST_RFM69MODEL_H
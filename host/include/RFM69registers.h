@@ -0,0 +1,183 @@
+/****************************************************************************
+RFM69registers.h - Host copy of the RFM69 register definitions.
+
+Subset of LowPowerLab RFM69registers.h (register addresses and the bit
+values used by ETH200RFM69 and the host RFM69 base class). Values are
+taken from the Semtech SX1231/HopeRF RFM69 datasheet.
+****************************************************************************/
+
+#ifndef HOST_RFM69REGISTERS_H
+  #define HOST_RFM69REGISTERS_H
+
+  // registers
+  #define REG_FIFO          0x00
+  #define REG_OPMODE        0x01
+  #define REG_DATAMODUL     0x02
+  #define REG_BITRATEMSB    0x03
+  #define REG_BITRATELSB    0x04
+  #define REG_FDEVMSB       0x05
+  #define REG_FDEVLSB       0x06
+  #define REG_FRFMSB        0x07
+  #define REG_FRFMID        0x08
+  #define REG_FRFLSB        0x09
+  #define REG_OSC1          0x0A
+  #define REG_VERSION       0x10
+  #define REG_PALEVEL       0x11
+  #define REG_PARAMP        0x12
+  #define REG_OCP           0x13
+  #define REG_LNA           0x18
+  #define REG_RXBW          0x19
+  #define REG_AFCBW         0x1A
+  #define REG_RSSICONFIG    0x23
+  #define REG_RSSIVALUE     0x24
+  #define REG_DIOMAPPING1   0x25
+  #define REG_DIOMAPPING2   0x26
+  #define REG_IRQFLAGS1     0x27
+  #define REG_IRQFLAGS2     0x28
+  #define REG_RSSITHRESH    0x29
+  #define REG_RXTIMEOUT1    0x2A
+  #define REG_RXTIMEOUT2    0x2B
+  #define REG_PREAMBLEMSB   0x2C
+  #define REG_PREAMBLELSB   0x2D
+  #define REG_SYNCCONFIG    0x2E
+  #define REG_SYNCVALUE1    0x2F
+  #define REG_SYNCVALUE2    0x30
+  #define REG_PACKETCONFIG1 0x37
+  #define REG_PAYLOADLENGTH 0x38
+  #define REG_NODEADRS      0x39
+  #define REG_BROADCASTADRS 0x3A
+  #define REG_AUTOMODES     0x3B
+  #define REG_FIFOTHRESH    0x3C
+  #define REG_PACKETCONFIG2 0x3D
+  #define REG_AESKEY1       0x3E
+  #define REG_TESTLNA       0x58
+  #define REG_TESTPA1       0x5A
+  #define REG_TESTPA2       0x5C
+  #define REG_TESTDAGC      0x6F
+
+  // RegOpMode
+  #define RF_OPMODE_SEQUENCER_OFF 0x80
+  #define RF_OPMODE_SEQUENCER_ON  0x00
+  #define RF_OPMODE_LISTEN_ON     0x40
+  #define RF_OPMODE_LISTEN_OFF    0x00
+  #define RF_OPMODE_LISTENABORT   0x20
+  #define RF_OPMODE_SLEEP         0x00
+  #define RF_OPMODE_STANDBY       0x04
+  #define RF_OPMODE_SYNTHESIZER   0x08
+  #define RF_OPMODE_TRANSMITTER   0x0C
+  #define RF_OPMODE_RECEIVER      0x10
+
+  // RegDataModul
+  #define RF_DATAMODUL_DATAMODE_PACKET            0x00
+  #define RF_DATAMODUL_DATAMODE_CONTINUOUSNOBSYNC 0x60
+  #define RF_DATAMODUL_MODULATIONTYPE_FSK         0x00
+  #define RF_DATAMODUL_MODULATIONTYPE_OOK         0x08
+  #define RF_DATAMODUL_MODULATIONSHAPING_00       0x00
+
+  // RegBitRate (bits/sec)
+  #define RF_BITRATEMSB_4800  0x1A
+  #define RF_BITRATELSB_4800  0x0B
+  #define RF_BITRATEMSB_9600  0x0D
+  #define RF_BITRATELSB_9600  0x05
+  #define RF_BITRATEMSB_19200 0x06
+  #define RF_BITRATELSB_19200 0x83
+
+  // RegFdev
+  #define RF_FDEVMSB_5000  0x00
+  #define RF_FDEVLSB_5000  0x52
+  #define RF_FDEVMSB_15000 0x00
+  #define RF_FDEVLSB_15000 0xF6
+  #define RF_FDEVMSB_25000 0x01
+  #define RF_FDEVLSB_25000 0x9A
+
+  // RegPaLevel
+  #define RF_PALEVEL_PA0_ON  0x80
+  #define RF_PALEVEL_PA0_OFF 0x00
+  #define RF_PALEVEL_PA1_ON  0x40
+  #define RF_PALEVEL_PA1_OFF 0x00
+  #define RF_PALEVEL_PA2_ON  0x20
+  #define RF_PALEVEL_PA2_OFF 0x00
+  #define RF_PALEVEL_OUTPUTPOWER_11111 0x1F
+
+  // RegOcp
+  #define RF_OCP_OFF     0x0F
+  #define RF_OCP_ON      0x1A
+  #define RF_OCP_TRIM_95 0x0A
+
+  // RegRxBw
+  #define RF_RXBW_DCCFREQ_010 0x40
+  #define RF_RXBW_MANT_16     0x00
+  #define RF_RXBW_MANT_20     0x08
+  #define RF_RXBW_MANT_24     0x10
+  #define RF_RXBW_EXP_2       0x02
+  #define RF_RXBW_EXP_3       0x03
+  #define RF_RXBW_EXP_5       0x05
+
+  // RegRssiConfig
+  #define RF_RSSI_START 0x01
+  #define RF_RSSI_DONE  0x02
+
+  // RegDioMapping1/2
+  #define RF_DIOMAPPING1_DIO0_00   0x00
+  #define RF_DIOMAPPING1_DIO0_01   0x40
+  #define RF_DIOMAPPING1_DIO0_10   0x80
+  #define RF_DIOMAPPING1_DIO0_11   0xC0
+  #define RF_DIOMAPPING2_CLKOUT_OFF 0x07
+
+  // RegIrqFlags1
+  #define RF_IRQFLAGS1_MODEREADY        0x80
+  #define RF_IRQFLAGS1_RXREADY          0x40
+  #define RF_IRQFLAGS1_TXREADY          0x20
+  #define RF_IRQFLAGS1_PLLLOCK          0x10
+  #define RF_IRQFLAGS1_RSSI             0x08
+  #define RF_IRQFLAGS1_TIMEOUT          0x04
+  #define RF_IRQFLAGS1_AUTOMODE         0x02
+  #define RF_IRQFLAGS1_SYNCADDRESSMATCH 0x01
+
+  // RegIrqFlags2
+  #define RF_IRQFLAGS2_FIFOFULL     0x80
+  #define RF_IRQFLAGS2_FIFONOTEMPTY 0x40
+  #define RF_IRQFLAGS2_FIFOLEVEL    0x20
+  #define RF_IRQFLAGS2_FIFOOVERRUN  0x10
+  #define RF_IRQFLAGS2_PACKETSENT   0x08
+  #define RF_IRQFLAGS2_PAYLOADREADY 0x04
+  #define RF_IRQFLAGS2_CRCOK        0x02
+
+  // RegSyncConfig
+  #define RF_SYNC_ON            0x80
+  #define RF_SYNC_OFF           0x00
+  #define RF_SYNC_FIFOFILL_AUTO 0x00
+  #define RF_SYNC_SIZE_1        0x00
+  #define RF_SYNC_SIZE_2        0x08
+  #define RF_SYNC_TOL_0         0x00
+
+  // RegPacketConfig1
+  #define RF_PACKET1_FORMAT_FIXED       0x00
+  #define RF_PACKET1_FORMAT_VARIABLE    0x80
+  #define RF_PACKET1_DCFREE_OFF         0x00
+  #define RF_PACKET1_DCFREE_MANCHESTER  0x20
+  #define RF_PACKET1_DCFREE_WHITENING   0x40
+  #define RF_PACKET1_CRC_ON             0x10
+  #define RF_PACKET1_CRC_OFF            0x00
+  #define RF_PACKET1_CRCAUTOCLEAR_ON    0x00
+  #define RF_PACKET1_CRCAUTOCLEAR_OFF   0x08
+  #define RF_PACKET1_ADRSFILTERING_OFF  0x00
+
+  // RegFifoThresh
+  #define RF_FIFOTHRESH_TXSTART_FIFOTHRESH   0x00
+  #define RF_FIFOTHRESH_TXSTART_FIFONOTEMPTY 0x80
+  #define RF_FIFOTHRESH_VALUE                0x0F
+
+  // RegPacketConfig2
+  #define RF_PACKET2_RXRESTARTDELAY_2BITS 0x10
+  #define RF_PACKET2_RXRESTART            0x04
+  #define RF_PACKET2_AUTORXRESTART_ON     0x02
+  #define RF_PACKET2_AUTORXRESTART_OFF    0x00
+  #define RF_PACKET2_AES_ON               0x01
+  #define RF_PACKET2_AES_OFF              0x00
+
+  // RegTestDagc
+  #define RF_DAGC_NORMAL             0x00
+  #define RF_DAGC_IMPROVED_LOWBETA1  0x20
+  #define RF_DAGC_IMPROVED_LOWBETA0  0x30
+#endif //HOST_RFM69REGISTERS_H
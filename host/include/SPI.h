@@ -0,0 +1,35 @@
+/****************************************************************************
+SPI.h - Host shim of the Arduino SPI class.
+
+Transfers are routed to the simulated RFM69 register/FIFO model, chip
+select is forwarded through beginTransaction()/endTransaction() and the
+slave select pin (see RFM69Model).
+****************************************************************************/
+
+#ifndef HOST_SPI_H
+  #define HOST_SPI_H
+
+  #include <Arduino.h>
+
+  #define SPI_HAS_TRANSACTION
+  #define MSBFIRST 1
+  #define SPI_MODE0 0x00
+
+  class SPISettings {
+    public:
+      SPISettings() {}
+      SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) {
+        (void)clock; (void)bitOrder; (void)dataMode;
+      }
+  };
+
+  class SPIClass {
+    public:
+      void begin() {}
+      void end() {}
+      void beginTransaction(SPISettings settings) { (void)settings; }
+      void endTransaction() {}
+      uint8_t transfer(uint8_t data);
+  };
+  extern SPIClass SPI;
+#endif //HOST_SPI_H
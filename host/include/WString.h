@@ -0,0 +1,207 @@
+/****************************************************************************
+WString.h - Host shim of the Arduino String class.
+
+Only the subset of the Arduino String API used by MXETHControl is provided.
+Backed by std::basic_string so it behaves like the original for everything
+the firmware does with it (concatenation, compare, substring, conversions).
+The buffer is allocated with malloc() like the Arduino String does, so the
+linker wrapped allocator of MXHeapTracker.h sees the String allocations in
+host builds too, std::string itself would go through operator new.
+****************************************************************************/
+
+#ifndef HOST_WSTRING_H
+  #define HOST_WSTRING_H
+
+  #include <stdint.h>
+  #include <stdlib.h>
+  #include <new>
+  #include <string>
+
+  class __FlashStringHelper;
+  #define FPSTR(pstr_pointer) (reinterpret_cast<const __FlashStringHelper *>(pstr_pointer))
+  #define F(string_literal) (FPSTR(string_literal))
+
+  class StringSumHelper;
+
+  // allocates the String buffer with malloc()/free(), see above
+  template <typename T> struct hostStringAllocator {
+    typedef T value_type;
+    hostStringAllocator() = default;
+    template <typename U> hostStringAllocator(const hostStringAllocator<U> &) {}
+    T *allocate(size_t n) {
+      T *p = static_cast<T *>(malloc(n * sizeof(T)));
+      if (!p) throw std::bad_alloc();
+      return p;
+    }
+    void deallocate(T *p, size_t) { free(p); }
+    template <typename U> bool operator==(const hostStringAllocator<U> &) const { return true; }
+    template <typename U> bool operator!=(const hostStringAllocator<U> &) const { return false; }
+  };
+  typedef std::basic_string<char, std::char_traits<char>, hostStringAllocator<char>> hostString;
+
+  class String {
+    public:
+      String(const char *cstr = "") : _s(cstr ? cstr : "") {}
+      String(const __FlashStringHelper *str) : _s(reinterpret_cast<const char *>(str)) {}
+      String(const std::string &str) : _s(str.data(), str.length()) {}
+      String(const String &str) = default;
+      String(char c) : _s(1, c) {}
+      String(unsigned char value, unsigned char base = 10) { fromUnsigned(value, base); }
+      String(int value, unsigned char base = 10) { fromSigned(value, base); }
+      String(unsigned int value, unsigned char base = 10) { fromUnsigned(value, base); }
+      String(long value, unsigned char base = 10) { fromSigned(value, base); }
+      String(unsigned long value, unsigned char base = 10) { fromUnsigned(value, base); }
+      String(float value, unsigned char decimalPlaces = 2) { fromDouble(value, decimalPlaces); }
+      String(double value, unsigned char decimalPlaces = 2) { fromDouble(value, decimalPlaces); }
+
+      unsigned int length() const { return _s.length(); }
+      bool reserve(unsigned int size) { _s.reserve(size); return true; }
+      const char *c_str() const { return _s.c_str(); }
+      char *begin() { return &_s[0]; }
+
+      String &operator=(const String &rhs) { _s = rhs._s; return *this; }
+      String &operator=(const char *cstr) { _s = cstr ? cstr : ""; return *this; }
+
+      bool concat(const String &str) { _s += str._s; return true; }
+      bool concat(const char *cstr) { _s += cstr ? cstr : ""; return true; }
+      bool concat(char c) { _s += c; return true; }
+      bool concat(unsigned char num) { return concat(String(num)); }
+      bool concat(int num) { return concat(String(num)); }
+      bool concat(unsigned int num) { return concat(String(num)); }
+      bool concat(long num) { return concat(String(num)); }
+      bool concat(unsigned long num) { return concat(String(num)); }
+      bool concat(float num) { return concat(String(num)); }
+      bool concat(double num) { return concat(String(num)); }
+      bool concat(const __FlashStringHelper *str) { return concat(reinterpret_cast<const char *>(str)); }
+
+      template <typename T> String &operator+=(const T &rhs) { concat(rhs); return *this; }
+      String &operator+=(const char *cstr) { concat(cstr); return *this; }
+
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, const String &rhs);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, const char *cstr);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, char c);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, unsigned char num);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, int num);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, unsigned int num);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, long num);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, unsigned long num);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, float num);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, double num);
+      friend StringSumHelper &operator+(const StringSumHelper &lhs, const __FlashStringHelper *rhs);
+
+      bool equals(const String &s) const { return _s == s._s; }
+      bool equals(const char *cstr) const { return _s == (cstr ? cstr : ""); }
+      bool operator==(const String &rhs) const { return equals(rhs); }
+      bool operator==(const char *cstr) const { return equals(cstr); }
+      bool operator!=(const String &rhs) const { return !equals(rhs); }
+      bool operator!=(const char *cstr) const { return !equals(cstr); }
+      bool startsWith(const String &prefix) const { return _s.compare(0, prefix._s.length(), prefix._s) == 0; }
+      bool endsWith(const String &suffix) const {
+        return _s.length() >= suffix._s.length() &&
+               _s.compare(_s.length() - suffix._s.length(), suffix._s.length(), suffix._s) == 0;
+      }
+
+      char charAt(unsigned int index) const { return index < _s.length() ? _s[index] : 0; }
+      char operator[](unsigned int index) const { return charAt(index); }
+      char &operator[](unsigned int index) { return _s[index]; }
+      void toCharArray(char *buf, unsigned int bufsize, unsigned int index = 0) const {
+        if (!bufsize || !buf) return;
+        hostString part = index < _s.length() ? _s.substr(index, bufsize - 1) : hostString();
+        part.copy(buf, part.length());
+        buf[part.length()] = '\0';
+      }
+
+      int indexOf(char ch, unsigned int fromIndex = 0) const {
+        size_t pos = _s.find(ch, fromIndex);
+        return pos == hostString::npos ? -1 : (int)pos;
+      }
+      int indexOf(const String &str, unsigned int fromIndex = 0) const {
+        size_t pos = _s.find(str._s, fromIndex);
+        return pos == hostString::npos ? -1 : (int)pos;
+      }
+      String substring(unsigned int beginIndex) const { return substring(beginIndex, _s.length()); }
+      String substring(unsigned int beginIndex, unsigned int endIndex) const {
+        if (beginIndex > endIndex) { unsigned int t = endIndex; endIndex = beginIndex; beginIndex = t; }
+        if (beginIndex >= _s.length()) return String();
+        if (endIndex > _s.length()) endIndex = _s.length();
+        return String(_s.substr(beginIndex, endIndex - beginIndex));
+      }
+
+      void replace(const String &find, const String &replace) {
+        if (find._s.empty()) return;
+        size_t pos = 0;
+        while ((pos = _s.find(find._s, pos)) != hostString::npos) {
+          _s.replace(pos, find._s.length(), replace._s);
+          pos += replace._s.length();
+        }
+      }
+      void trim() {
+        size_t first = _s.find_first_not_of(" \t\r\n\f\v");
+        if (first == hostString::npos) { _s.clear(); return; }
+        size_t last = _s.find_last_not_of(" \t\r\n\f\v");
+        _s = _s.substr(first, last - first + 1);
+      }
+
+      long toInt() const { return atol(_s.c_str()); }
+      float toFloat() const { return (float)atof(_s.c_str()); }
+      double toDouble() const { return atof(_s.c_str()); }
+
+    protected:
+      hostString _s;
+
+      String(const hostString &str) : _s(str) {}
+
+    private:
+      void fromSigned(long value, unsigned char base);
+      void fromUnsigned(unsigned long value, unsigned char base);
+      void fromDouble(double value, unsigned char decimalPlaces);
+  };
+
+  class StringSumHelper : public String {
+    public:
+      StringSumHelper(const String &s) : String(s) {}
+      StringSumHelper(const char *p) : String(p) {}
+      StringSumHelper(char c) : String(c) {}
+      StringSumHelper(unsigned char num) : String(num) {}
+      StringSumHelper(int num) : String(num) {}
+      StringSumHelper(unsigned int num) : String(num) {}
+      StringSumHelper(long num) : String(num) {}
+      StringSumHelper(unsigned long num) : String(num) {}
+      StringSumHelper(float num) : String(num) {}
+      StringSumHelper(double num) : String(num) {}
+  };
+
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, const String &rhs) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(rhs); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, const char *cstr) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(cstr); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, char c) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(c); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, unsigned char num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(num); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, int num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(num); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, unsigned int num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(num); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, long num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(num); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, unsigned long num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(num); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, float num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(num); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, double num) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(num); return a;
+  }
+  inline StringSumHelper &operator+(const StringSumHelper &lhs, const __FlashStringHelper *rhs) {
+    StringSumHelper &a = const_cast<StringSumHelper &>(lhs); a.concat(rhs); return a;
+  }
+#endif //HOST_WSTRING_H
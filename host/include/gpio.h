@@ -0,0 +1,25 @@
+/****************************************************************************
+gpio.h - Host shim of the ESP8266 NONOS SDK gpio.h.
+
+Only the light sleep wakeup used by MXETHControl.
+****************************************************************************/
+
+#ifndef HOST_GPIO_H
+  #define HOST_GPIO_H
+
+  #include <stdint.h>
+
+  #define GPIO_ID_PIN(n) (n)
+
+  typedef enum {
+    GPIO_PIN_INTR_DISABLE = 0,
+    GPIO_PIN_INTR_POSEDGE = 1,
+    GPIO_PIN_INTR_NEGEDGE = 2,
+    GPIO_PIN_INTR_ANYEDGE = 3,
+    GPIO_PIN_INTR_LOLEVEL = 4,
+    GPIO_PIN_INTR_HILEVEL = 5,
+  } GPIO_INT_TYPE;
+
+  static inline void gpio_pin_wakeup_enable(uint32_t pin, GPIO_INT_TYPE type) { (void)pin; (void)type; }
+  static inline void gpio_pin_wakeup_disable() {}
+#endif //HOST_GPIO_H
@@ -0,0 +1,31 @@
+/****************************************************************************
+user_interface.h - Host shim of the ESP8266 NONOS SDK user_interface.h.
+
+Only the reset information used by MXETHControl.
+****************************************************************************/
+
+#ifndef HOST_USER_INTERFACE_H
+  #define HOST_USER_INTERFACE_H
+
+  #include <stdint.h>
+
+  enum rst_reason {
+    REASON_DEFAULT_RST = 0,
+    REASON_WDT_RST = 1,
+    REASON_EXCEPTION_RST = 2,
+    REASON_SOFT_WDT_RST = 3,
+    REASON_SOFT_RESTART = 4,
+    REASON_DEEP_SLEEP_AWAKE = 5,
+    REASON_EXT_SYS_RST = 6,
+  };
+
+  struct rst_info {
+    uint32_t reason;
+    uint32_t exccause;
+    uint32_t epc1;
+    uint32_t epc2;
+    uint32_t epc3;
+    uint32_t excvaddr;
+    uint32_t depc;
+  };
+#endif //HOST_USER_INTERFACE_H
@@ -0,0 +1,186 @@
+/****************************************************************************
+Arduino.cpp - Host shim of the Arduino/ESP8266 core, see Arduino.h.
+
+Virtual time, pins and interrupts. An interrupt attached to a pin is only
+ever raised by a simulated peripheral through hostRaiseInterrupt(), it runs
+synchronously in the context of whatever advanced the time.
+****************************************************************************/
+
+#include <Arduino.h>
+#include <time.h>
+#include <vector>
+
+#define HOST_YIELD_US 5       // virtual time a yield() costs
+#define HOST_NUM_PINS 17
+
+HardwareSerial Serial;
+
+static uint64_t hostNowUs = 0;
+static std::vector<hostTimeHook_t> hostTimeHooks;
+static std::vector<hostPinHook_t> hostPinHooks;
+static uint8_t hostPins[HOST_NUM_PINS] = {0};
+static void (*hostIsr[HOST_NUM_PINS])(void) = {nullptr};
+static bool hostInterruptsEnabled = true;
+static bool hostScheduled = false;
+static bool hostInTimeHook = false;
+
+uint64_t hostMicros64() {
+  return hostNowUs;
+}
+
+void hostAdvanceMicros(uint32_t us) {
+  hostNowUs += us;
+  if (hostInTimeHook) {
+    // a hook advancing the time itself, e.g. via an SPI transfer inside an interrupt
+    // handler, is picked up by the outer call
+    return;
+  }
+  hostInTimeHook = true;
+  for (hostTimeHook_t hook : hostTimeHooks) {
+    hook(hostNowUs);
+  }
+  hostInTimeHook = false;
+}
+
+void hostAddTimeHook(hostTimeHook_t hook) {
+  hostTimeHooks.push_back(hook);
+}
+
+void hostAddPinHook(hostPinHook_t hook) {
+  hostPinHooks.push_back(hook);
+}
+
+unsigned long millis() {
+  return (unsigned long)(hostNowUs / 1000);
+}
+
+unsigned long micros() {
+  return (unsigned long)hostNowUs;
+}
+
+void delay(unsigned long ms) {
+  // in 1ms steps, so peripherals see the time pass like on the device
+  for (unsigned long i = 0; i < ms; i++) {
+    hostAdvanceMicros(1000);
+  }
+}
+
+void delayMicroseconds(unsigned int us) {
+  hostAdvanceMicros(us);
+}
+
+void yield() {
+  hostAdvanceMicros(HOST_YIELD_US);
+}
+
+bool esp_delay(unsigned long ms, bool (*blocked)(), unsigned long intvl_ms) {
+  // like the core: waits until ms passed, blocked() returns false or esp_schedule() was called,
+  // blocked() is checked every intvl_ms
+  hostScheduled = false;
+  unsigned long start = millis();
+  unsigned long lastCheck = start;
+  while (millis() - start < ms) {
+    hostAdvanceMicros(1000);
+    if (hostScheduled) {
+      break;
+    }
+    if (millis() - lastCheck >= intvl_ms) {
+      lastCheck = millis();
+      if (!blocked()) {
+        break;
+      }
+    }
+  }
+  hostScheduled = false;
+  return millis() - start >= ms;
+}
+
+void esp_schedule() {
+  hostScheduled = true;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  if (pin < HOST_NUM_PINS) {
+    hostPins[pin] = val;
+  }
+  for (hostPinHook_t hook : hostPinHooks) {
+    hook(pin, val);
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return (pin < HOST_NUM_PINS) ? hostPins[pin] : LOW;
+}
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode) {
+  (void)mode; // only RISING is used, the peripheral decides when to raise it
+  if (interruptNum < HOST_NUM_PINS) {
+    hostIsr[interruptNum] = userFunc;
+  }
+}
+
+void detachInterrupt(uint8_t interruptNum) {
+  if (interruptNum < HOST_NUM_PINS) {
+    hostIsr[interruptNum] = nullptr;
+  }
+}
+
+void noInterrupts() {
+  hostInterruptsEnabled = false;
+}
+
+void interrupts() {
+  hostInterruptsEnabled = true;
+}
+
+void hostRaiseInterrupt(uint8_t interruptNum) {
+  // interrupts raised while disabled are lost, the sections are short and
+  // single threaded on the host, so that doesn't happen in practice
+  if (hostInterruptsEnabled && (interruptNum < HOST_NUM_PINS) && hostIsr[interruptNum]) {
+    hostIsr[interruptNum]();
+  }
+}
+
+long random(long howbig) {
+  if (howbig <= 0) {
+    return 0;
+  }
+  return rand() % howbig;
+}
+
+long random(long howsmall, long howbig) {
+  if (howsmall >= howbig) {
+    return howsmall;
+  }
+  return howsmall + random(howbig - howsmall);
+}
+
+void randomSeed(unsigned long seed) {
+  srand((unsigned int)seed);
+}
+
+void configTime(int timezone, int daylightOffset_sec, const char *server1,
+                const char *server2, const char *server3) {
+  (void)timezone;
+  (void)daylightOffset_sec;
+  (void)server1;
+  (void)server2;
+  (void)server3;
+}
+
+char *dtostrf(double number, signed char width, unsigned char prec, char *s) {
+  sprintf(s, "%*.*f", width, prec, number);
+  return s;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  if (echo) {
+    fputc(c, stdout);
+  }
+  return 1;
+}
@@ -0,0 +1,70 @@
+/****************************************************************************
+EEPROM.cpp - Host shim of the ESP8266 EEPROM library, see EEPROM.h.
+
+The flash sector is kept in RAM, so it survives ESP.restart() inside a host
+run like it survives a reset on the device. A fresh sector is erased (0xFF)
+like the real one.
+****************************************************************************/
+
+#include <Arduino.h>
+#include <EEPROM.h>
+
+#define HOST_EEPROM_SECTOR 4096 // bytes, the ESP8266 emulates the EEPROM in one flash sector
+
+EEPROMClass EEPROM;
+
+static uint8_t hostFlashSector[HOST_EEPROM_SECTOR];
+static bool hostFlashErased = false;
+
+void EEPROMClass::begin(size_t size) {
+  if ((size == 0) || (size > HOST_EEPROM_SECTOR)) {
+    return;
+  }
+  if (!hostFlashErased) {
+    memset(hostFlashSector, 0xFF, sizeof(hostFlashSector));
+    hostFlashErased = true;
+  }
+  delete[] _data;
+  _size = (size + 3) & ~3; // rounded up to 4 bytes like the ESP8266 library
+  _data = new uint8_t[_size];
+  memcpy(_data, hostFlashSector, _size);
+  _dirty = false;
+}
+
+uint8_t EEPROMClass::read(int address) {
+  if ((address < 0) || ((size_t)address >= _size)) {
+    return 0;
+  }
+  return _data[address];
+}
+
+void EEPROMClass::write(int address, uint8_t value) {
+  if ((address < 0) || ((size_t)address >= _size)) {
+    return;
+  }
+  if (_data[address] != value) {
+    _data[address] = value;
+    _dirty = true;
+  }
+}
+
+bool EEPROMClass::commit() {
+  if (_size == 0) {
+    return false;
+  }
+  if (!_dirty) {
+    return true;
+  }
+  memcpy(hostFlashSector, _data, _size);
+  commits++;
+  _dirty = false;
+  return true;
+}
+
+bool EEPROMClass::end() {
+  bool ret = commit();
+  delete[] _data;
+  _data = NULL;
+  _size = 0;
+  return ret;
+}
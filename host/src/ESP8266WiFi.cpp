@@ -0,0 +1,9 @@
+/****************************************************************************
+ESP8266WiFi.cpp - Host shim globals of the ESP8266 network libraries.
+****************************************************************************/
+
+#include <ESP8266WiFi.h>
+#include <ESP8266httpUpdate.h>
+
+ESP8266WiFiClass WiFi;
+ESP8266HTTPUpdate ESPhttpUpdate;
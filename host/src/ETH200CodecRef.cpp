@@ -0,0 +1,145 @@
+/****************************************************************************
+ETH200CodecRef.cpp - Frozen reference of the ETH200 codec kernels, see
+ETH200CodecRef.h. Taken from src/ETH200RFM69.cpp of firmware 4.5, the
+logic and the integer types are unchanged on purpose.
+****************************************************************************/
+
+#include <ETH200CodecRef.h>
+
+uint8_t ETH200CodecRef::reverseByte(uint8_t b) {
+  uint8_t result = 0;
+  for (uint8_t i = 0; i < 8; i++) {
+    if (b & (1 << i)) {
+      result = result << 1 | 1;
+    } else {
+      result = result << 1;
+    }
+  }
+  return result;
+}
+
+uint16_t ETH200CodecRef::calcCRC16r(uint16_t c, uint16_t crc, uint16_t mask) {
+  uint8_t i;
+  for (i = 0; i < 8; i++) {
+    if ((crc ^ c) & 1) {
+      crc = (crc >> 1) ^ mask;
+    } else {
+      crc >>= 1;
+    }
+    c >>= 1;
+  };
+  return(crc);
+}
+
+uint16_t ETH200CodecRef::calcPacketCRC16r(uint8_t packet[], uint8_t length, uint16_t crcStart, uint16_t crcMask) {
+  uint16_t crcResult = 0;
+  uint16_t crcCalculated = crcStart;
+  crcCalculated = calcCRC16r(0x7E, crcCalculated, crcMask);
+  for (uint8_t i = 0; i < length; i++) {
+    crcCalculated = calcCRC16r(packet[i], crcCalculated, crcMask);
+  }
+  uint8_t hiByte = (crcCalculated & 0xFF00) >> 8;
+  uint8_t loByte = (crcCalculated & 0x00FF);
+  crcResult = loByte << 8 | hiByte;
+  return crcResult;
+}
+
+uint8_t ETH200CodecRef::destuffPayload(uint8_t inBuf[], uint8_t destuffedBuf[], uint8_t length) {
+  uint8_t wasStuffed = 0;
+  uint8_t oneCounter = 0;
+  uint8_t i = 0;
+  int8_t j = 0;
+  uint8_t curByte = 0;
+  uint8_t curBit = 0;
+  uint8_t outArrPos = 0;
+  uint8_t outBitCounter = 0;
+
+  for (i = 0; i < length; i++) {
+    curByte = inBuf[i];
+    for (j = 7; j >= 0; j--) {
+      curBit = bitRead(curByte, j);
+      if (oneCounter == 5) {
+        wasStuffed++;
+        oneCounter = 0;
+      } else if (curBit == 1) {
+        destuffedBuf[outArrPos] = destuffedBuf[outArrPos] << 1 | 1;
+        outBitCounter++;
+        oneCounter++;
+      } else if (curBit == 0) {
+        destuffedBuf[outArrPos] = destuffedBuf[outArrPos] << 1 | 0;
+        outBitCounter++;
+        oneCounter = 0;
+      }
+      if (outBitCounter == 8) {
+        outArrPos++;
+        outBitCounter = 0;
+      }
+      if (outArrPos == length - 1) {
+        // only leaves the bit loop, the next byte of inBuf writes to destuffedBuf[length - 1] again
+        break;
+      }
+    }
+  }
+  return wasStuffed;
+}
+
+uint8_t ETH200CodecRef::stuffPayload(uint8_t inBuf[], uint8_t stuffedBuf[], uint8_t length) {
+  uint8_t wasStuffed = 0;
+  uint8_t oneCounter = 0;
+  uint8_t i = 0;
+  int8_t j = 0;
+  uint8_t curByte = 0;
+  uint8_t curBit = 0;
+  uint8_t outArrPos = 0;
+  uint8_t outBitCounter = 0;
+
+  for (i = 0; i < length; i++) {
+    curByte = inBuf[i];
+    for (j = 7; j >= 0; j--) {
+      curBit = bitRead(curByte, j);
+      if (oneCounter == 5) {
+        stuffedBuf[outArrPos] = stuffedBuf[outArrPos] << 1 | 0;
+        outBitCounter++;
+        if (outBitCounter == 8) {
+          outArrPos++;
+          outBitCounter = 0;
+        }
+        wasStuffed++;
+        oneCounter = 0;
+      }
+      if (curBit == 1) {
+        stuffedBuf[outArrPos] = stuffedBuf[outArrPos] << 1 | 1;
+        outBitCounter++;
+        oneCounter++;
+      } else if (curBit == 0) {
+        stuffedBuf[outArrPos] = stuffedBuf[outArrPos] << 1 | 0;
+        outBitCounter++;
+        oneCounter = 0;
+      }
+      if (outBitCounter == 8) {
+        outArrPos++;
+        outBitCounter = 0;
+      }
+    }
+    if (i == length - 1) {
+      // the tail the thermostats expect, assumes the last byte holds exactly wasStuffed bits
+      stuffedBuf[outArrPos] = stuffedBuf[outArrPos] << (8 - wasStuffed) | 0;
+    }
+  }
+  return wasStuffed;
+}
+
+uint8_t ETH200CodecRef::packBits(const uint8_t packet[], uint8_t numBits, uint8_t out[], uint8_t &pendingByte, uint8_t &pendingBits) {
+  uint8_t numOut = 0;
+  for (uint8_t curBitPos = 0; curBitPos < numBits; curBitPos++) {
+    uint8_t curBit = bitRead(packet[curBitPos / 8], 7 - (curBitPos % 8));
+    pendingByte = pendingByte << 1 | curBit;
+    pendingBits++;
+    if (pendingBits == 8) {
+      out[numOut] = pendingByte;
+      numOut++;
+      pendingBits = 0;
+    }
+  }
+  return numOut;
+}
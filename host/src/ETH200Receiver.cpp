@@ -0,0 +1,135 @@
+/****************************************************************************
+ETH200Receiver.cpp - Bit accurate model of an ETH200 thermostat receiver,
+see ETH200Receiver.h.
+****************************************************************************/
+
+#include <ETH200Receiver.h>
+
+#define ETH200RECEIVER_SYNC 0x7E
+#define ETH200RECEIVER_CRCMASK 0x8408
+
+uint16_t ETH200Receiver::crcStart(uint8_t deviceType) {
+  if (deviceType == 0x10) {
+    return 0xC11F; // RemoteControl
+  } else if (deviceType == 0x20) {
+    return 0xBDB7; // WindowSensor
+  }
+  return 0;
+}
+
+uint8_t ETH200Receiver::frameLength(uint8_t deviceType) {
+  if (deviceType == 0x10) {
+    return 9;
+  } else if (deviceType == 0x20) {
+    return 8;
+  }
+  return 0;
+}
+
+// reflected CRC16 over the sync word and data[0 ... length - 1], the result is sent
+// low byte first
+uint16_t ETH200Receiver::crc(const uint8_t data[], uint8_t length, uint16_t crcStart) {
+  uint16_t crc = crcStart;
+  for (int16_t i = -1; i < length; i++) {
+    crc ^= (i < 0) ? ETH200RECEIVER_SYNC : data[i];
+    for (uint8_t j = 0; j < 8; j++) {
+      crc = (crc & 0x0001) ? (crc >> 1) ^ ETH200RECEIVER_CRCMASK : crc >> 1;
+    }
+  }
+  return (crc << 8) | (crc >> 8);
+}
+
+void ETH200Receiver::clear() {
+  frames.clear();
+  syncs = 0;
+  manchesterViolations = 0;
+  stuffedBits = 0;
+  _state = hunting;
+  _shift = 0;
+}
+
+void ETH200Receiver::decode(const std::vector<uint8_t> &chips) {
+  size_t i = 0;
+  while (i + 1 < chips.size()) {
+    if (chips[i] == chips[i + 1]) {
+      // no Manchester symbol, we are off by one chip or it's noise
+      manchesterViolations++;
+      if (_state == receiving) {
+        finish(frameAborted, i);
+      }
+      _shift = 0;
+      i++;
+      continue;
+    }
+    bit(chips[i], i);
+    i += 2;
+  }
+  if (_state == receiving) {
+    finish(frameTruncated, chips.size());
+  }
+}
+
+void ETH200Receiver::bit(uint8_t b, size_t chip) {
+  _shift = _shift << 1 | b;
+  if (_shift == ETH200RECEIVER_SYNC) {
+    // a sync word can't be part of a frame, stuffing prevents six 1s
+    if (_state == receiving) {
+      finish(frameAborted, chip - 14);
+    }
+    syncs++;
+    _state = receiving;
+    _ones = 0;
+    _byte = 0;
+    _byteBits = 0;
+    _length = 0;
+    _frame = eth200Frame();
+    _frame.startChip = chip + 2;
+    return;
+  }
+  if (_state != receiving) {
+    return;
+  }
+  if (_ones == 5) {
+    _ones = 0;
+    if (b == 0) {
+      stuffedBits++;
+      return;
+    }
+    // six 1s, the start of a sync word or garbage, the sync search takes it from here
+    finish(frameAborted, chip);
+    return;
+  }
+  _ones = b ? _ones + 1 : 0;
+  _byte = _byte << 1 | b;
+  _byteBits++;
+  if (_byteBits < 8) {
+    return;
+  }
+  // LSB first on air
+  uint8_t reversed = 0;
+  for (uint8_t j = 0; j < 8; j++) {
+    reversed = reversed << 1 | ((_byte >> j) & 0x01);
+  }
+  _frame.data.push_back(reversed);
+  _byteBits = 0;
+  if (_frame.data.size() == 2) {
+    _length = frameLength(_frame.data[1]);
+    if (_length == 0) {
+      finish(frameUnknownType, chip + 2);
+      return;
+    }
+  }
+  if ((_length > 0) && (_frame.data.size() == _length)) {
+    uint16_t expected = crc(_frame.data.data(), _length - 2, crcStart(_frame.data[1]));
+    boolean crcOk = (_frame.data[_length - 2] == (uint8_t)(expected >> 8)) &&
+                    (_frame.data[_length - 1] == (uint8_t)expected);
+    finish(crcOk ? frameValid : frameCrcError, chip + 2);
+  }
+}
+
+void ETH200Receiver::finish(eth200FrameStatus_t status, size_t chip) {
+  _frame.status = status;
+  _frame.endChip = chip;
+  frames.push_back(_frame);
+  _state = hunting;
+}
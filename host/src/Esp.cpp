@@ -0,0 +1,55 @@
+/****************************************************************************
+Esp.cpp - Host shim of the ESP8266 EspClass, see Esp.h.
+
+The RTC user memory is kept in RAM, so it survives ESP.restart() inside a
+host run like it survives a reset on the device. restart() itself ends the
+process, there is nothing to reboot into.
+****************************************************************************/
+
+#include <Arduino.h>
+#include <Esp.h>
+
+#define HOST_RTC_USER_MEMORY 512 // bytes, same as the ESP8266
+#define HOST_HEAP_SIZE 81920     // the ESP8266 has ~80kB DRAM, reported as always free
+
+EspClass ESP;
+
+static uint32_t hostRtcUserMemory[HOST_RTC_USER_MEMORY / 4] = {0};
+
+uint32_t EspClass::getCycleCount() {
+  // the virtual time at 80 MHz, wraps like the real one
+  return (uint32_t)(hostMicros64() * 80);
+}
+
+uint32_t EspClass::getFreeHeap() {
+  return HOST_HEAP_SIZE;
+}
+
+uint32_t EspClass::getMaxFreeBlockSize() {
+  return HOST_HEAP_SIZE;
+}
+
+uint8_t EspClass::getHeapFragmentation() {
+  return 0;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+  if ((offset * 4 + size > HOST_RTC_USER_MEMORY) || (size % 4 != 0)) {
+    return false;
+  }
+  memcpy(data, &hostRtcUserMemory[offset], size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+  if ((offset * 4 + size > HOST_RTC_USER_MEMORY) || (size % 4 != 0)) {
+    return false;
+  }
+  memcpy(&hostRtcUserMemory[offset], data, size);
+  return true;
+}
+
+void EspClass::restart() {
+  fflush(stdout);
+  exit(0);
+}
@@ -0,0 +1,30 @@
+/****************************************************************************
+HostMain.cpp - Runs the firmware on the host, like the ESP8266 core does.
+
+The radio is the simulated RFM69 (RFM69Model.h), MQTT goes to the stub
+broker (PubSubClient.h). Time is virtual, the run ends after the given
+number of seconds of virtual time (default 60), serial output goes to
+stdout.
+
+  .pio/build/native/program [seconds]
+****************************************************************************/
+
+#include <Arduino.h>
+#include <config.h>
+#include <RFM69Model.h>
+
+void setup();
+void loop();
+
+int main(int argc, char *argv[]) {
+  unsigned long seconds = (argc > 1) ? strtoul(argv[1], NULL, 10) : 60;
+  rfm69Model.attach(CFG_RF69_SPI_CS, digitalPinToInterrupt(CFG_RF69_IRQ_PIN), CFG_RF69_RST_PIN);
+  Serial.echo = true;
+
+  setup();
+  while (hostMicros64() < (uint64_t)seconds * 1000000) {
+    loop();
+  }
+  printf("\nhost run finished after %lus virtual time\n", seconds);
+  return 0;
+}
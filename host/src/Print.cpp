@@ -0,0 +1,27 @@
+/****************************************************************************
+Print.cpp - Host shim of the Arduino Print class, see Print.h.
+****************************************************************************/
+
+#include <Print.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <vector>
+
+size_t Print::printf(const char *format, ...) {
+  va_list arg;
+  va_start(arg, format);
+  char buf[64];
+  int len = vsnprintf(buf, sizeof(buf), format, arg);
+  va_end(arg);
+  if (len < 0) {
+    return 0;
+  }
+  if ((size_t)len < sizeof(buf)) {
+    return write((const uint8_t *)buf, len);
+  }
+  std::vector<char> big(len + 1);
+  va_start(arg, format);
+  vsnprintf(big.data(), big.size(), format, arg);
+  va_end(arg);
+  return write((const uint8_t *)big.data(), len);
+}
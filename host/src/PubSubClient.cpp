@@ -0,0 +1,212 @@
+/****************************************************************************
+PubSubClient.cpp - Host shim of the PubSubClient MQTT library, see
+PubSubClient.h.
+****************************************************************************/
+
+#include <PubSubClient.h>
+#include <algorithm>
+
+MQTTStubBroker mqttStubBroker;
+
+void MQTTStubBroker::inject(const std::string &topic, const std::string &payload) {
+  inbound.push_back({topic, payload, false, hostMicros64()});
+}
+
+bool MQTTStubBroker::isSubscribed(const std::string &topic) const {
+  for (const std::string &filter : subscriptions) {
+    if (topicMatches(filter, topic)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// MQTT topic filter matching, "+" matches one level, "#" all remaining levels
+bool MQTTStubBroker::topicMatches(const std::string &filter, const std::string &topic) {
+  size_t f = 0;
+  size_t t = 0;
+  while (f < filter.length()) {
+    if (filter[f] == '#') {
+      return true;
+    }
+    if (filter[f] == '+') {
+      while ((t < topic.length()) && (topic[t] != '/')) {
+        t++;
+      }
+      f++;
+      continue;
+    }
+    if ((t >= topic.length()) || (filter[f] != topic[t])) {
+      // "a/#" also matches "a"
+      return (t >= topic.length()) && (filter.compare(f, std::string::npos, "/#") == 0);
+    }
+    f++;
+    t++;
+  }
+  return t == topic.length();
+}
+
+size_t MQTTStubBroker::count(const std::string &topic) const {
+  size_t n = 0;
+  for (const MQTTStubMessage &msg : published) {
+    if (msg.topic == topic) {
+      n++;
+    }
+  }
+  return n;
+}
+
+bool PubSubClient::connect(const char *id, const char *user, const char *pass,
+                           const char *willTopic, uint8_t willQos, bool willRetain, const char *willMessage) {
+  (void)id;
+  (void)user;
+  (void)pass;
+  (void)willQos;
+  mqttStubBroker.connectAttempts++;
+  if (!mqttStubBroker.up || !WiFi.connected) {
+    _state = MQTT_CONNECT_FAILED;
+    return false;
+  }
+  _willTopic = willTopic ? willTopic : "";
+  _willMessage = willMessage ? willMessage : "";
+  _willRetain = willRetain;
+  // a new session, the device has to subscribe again
+  mqttStubBroker.subscriptions.clear();
+  mqttStubBroker.connects++;
+  _state = MQTT_CONNECTED;
+  return true;
+}
+
+void PubSubClient::disconnect() {
+  // a clean disconnect, the will isn't published
+  _state = MQTT_DISCONNECTED;
+  mqttStubBroker.subscriptions.clear();
+}
+
+bool PubSubClient::connected() {
+  if ((_state == MQTT_CONNECTED) && (!mqttStubBroker.up || !WiFi.connected)) {
+    // connection lost, the broker publishes the will
+    _state = MQTT_CONNECTION_LOST;
+    mqttStubBroker.subscriptions.clear();
+    if (!_willTopic.empty()) {
+      mqttStubBroker.published.push_back({_willTopic, _willMessage, _willRetain, hostMicros64()});
+      if (_willRetain) {
+        mqttStubBroker.retained[_willTopic] = _willMessage;
+      }
+    }
+  }
+  return _state == MQTT_CONNECTED;
+}
+
+bool PubSubClient::loop() {
+  if (!connected()) {
+    return false;
+  }
+  // only the messages queued so far, a callback might inject new ones
+  size_t pending = mqttStubBroker.inbound.size();
+  for (size_t i = 0; (i < pending) && connected(); i++) {
+    MQTTStubMessage msg = mqttStubBroker.inbound.front();
+    mqttStubBroker.inbound.pop_front();
+    if (!mqttStubBroker.isSubscribed(msg.topic) || !_callback) {
+      continue;
+    }
+    // the PUBLISH packet as the real client reads it into its buffer: fixed header,
+    // remaining length (1 - 4 bytes), topic length, topic, payload. Bigger packets
+    // are dropped like there.
+    size_t remaining = 2 + msg.topic.length() + msg.payload.length();
+    uint8_t llen = 1;
+    for (size_t rest = remaining >> 7; rest > 0; rest >>= 7) {
+      llen++;
+    }
+    if (1 + llen + remaining > MQTT_MAX_PACKET_SIZE) {
+      continue;
+    }
+    _buffer[0] = 0x30 | (msg.retained ? 0x01 : 0x00);
+    size_t rest = remaining;
+    for (uint8_t i = 1; i <= llen; i++) {
+      _buffer[i] = (rest & 0x7F) | ((i < llen) ? 0x80 : 0x00);
+      rest >>= 7;
+    }
+    uint16_t tl = msg.topic.length();
+    _buffer[llen + 1] = tl >> 8;
+    _buffer[llen + 2] = tl;
+    memcpy(_buffer + llen + 3, msg.topic.data(), tl);
+    memcpy(_buffer + llen + 3 + tl, msg.payload.data(), msg.payload.length());
+    // the real client moves the topic one byte to the front to null terminate it in place
+    memmove(_buffer + llen + 2, _buffer + llen + 3, tl);
+    _buffer[llen + 2 + tl] = '\0';
+    _callback((char *)_buffer + llen + 2, _buffer + llen + 3 + tl, msg.payload.length());
+  }
+  return true;
+}
+
+bool PubSubClient::subscribe(const char *topic) {
+  if (!connected()) {
+    return false;
+  }
+  std::vector<std::string> &subs = mqttStubBroker.subscriptions;
+  if (std::find(subs.begin(), subs.end(), topic) == subs.end()) {
+    subs.push_back(topic);
+  }
+  for (const auto &entry : mqttStubBroker.retained) {
+    if (MQTTStubBroker::topicMatches(topic, entry.first)) {
+      mqttStubBroker.inbound.push_back({entry.first, entry.second, true, hostMicros64()});
+    }
+  }
+  return true;
+}
+
+bool PubSubClient::unsubscribe(const char *topic) {
+  if (!connected()) {
+    return false;
+  }
+  std::vector<std::string> &subs = mqttStubBroker.subscriptions;
+  subs.erase(std::remove(subs.begin(), subs.end(), topic), subs.end());
+  return true;
+}
+
+bool PubSubClient::publish(const char *topic, const char *payload) {
+  return publish(topic, (const uint8_t *)payload, payload ? strlen(payload) : 0, false);
+}
+
+bool PubSubClient::publish(const char *topic, const char *payload, bool retained) {
+  return publish(topic, (const uint8_t *)payload, payload ? strlen(payload) : 0, retained);
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int plength) {
+  return publish(topic, payload, plength, false);
+}
+
+bool PubSubClient::publish(const char *topic, const uint8_t *payload, unsigned int plength, bool retained) {
+  if (!connected()) {
+    return false;
+  }
+  // same limit as the real client: fixed header + topic length + topic + payload
+  // have to fit into the MQTT_MAX_PACKET_SIZE buffer
+  if (5 + 2 + strlen(topic) + plength > MQTT_MAX_PACKET_SIZE) {
+    return false;
+  }
+  // built in the buffer like the real client: cleared, topic after the 5 byte header
+  // space, then the payload, all copied from pointers which may point into the buffer
+  memset(_buffer, 0, sizeof(_buffer));
+  size_t length = 5 + 2;
+  for (const char *c = topic; *c != '\0'; c++) {
+    _buffer[length++] = *c;
+  }
+  uint16_t tl = length - 7;
+  _buffer[5] = tl >> 8;
+  _buffer[6] = tl;
+  for (unsigned int i = 0; i < plength; i++) {
+    _buffer[length++] = payload[i];
+  }
+  std::string data((const char *)_buffer + 7 + tl, plength);
+  mqttStubBroker.published.push_back({std::string((const char *)_buffer + 7, tl), data, retained, hostMicros64()});
+  if (retained) {
+    if (data.empty()) {
+      mqttStubBroker.retained.erase(topic);
+    } else {
+      mqttStubBroker.retained[topic] = data;
+    }
+  }
+  return true;
+}
@@ -0,0 +1,191 @@
+/****************************************************************************
+RFM69.cpp - Host port of the LowPowerLab RFM69 base class, see RFM69.h.
+
+Same behaviour as LowPowerLab/RFM69 1.4.x for the members ETH200RFM69
+uses, everything packet/ACK/listen mode related is left out.
+
+Based on:
+  RFM69 library:
+    https://github.com/LowPowerLab/RFM69
+****************************************************************************/
+
+#include <RFM69.h>
+#include <RFM69registers.h>
+
+uint8_t RFM69::DATA[RF69_MAX_DATA_LEN + 1];
+uint8_t RFM69::DATALEN;
+uint8_t RFM69::PAYLOADLEN;
+int16_t RFM69::RSSI;
+uint8_t RFM69::_mode;
+volatile bool RFM69::_haveData;
+
+RFM69::RFM69(uint8_t slaveSelectPin, uint8_t interruptPin, bool isRFM69HW, SPIClass *spi) {
+  _slaveSelectPin = slaveSelectPin;
+  _interruptPin = interruptPin;
+  _interruptNum = NOT_AN_INTERRUPT;
+  _mode = RF69_MODE_STANDBY;
+  _isRFM69HW = isRFM69HW;
+  _spi = spi;
+}
+
+void RFM69::setMode(uint8_t newMode) {
+  if (newMode == _mode) {
+    return;
+  }
+  switch (newMode) {
+    case RF69_MODE_TX:
+      writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_TRANSMITTER);
+      if (_isRFM69HW) setHighPowerRegs(true);
+      break;
+    case RF69_MODE_RX:
+      writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_RECEIVER);
+      if (_isRFM69HW) setHighPowerRegs(false);
+      break;
+    case RF69_MODE_SYNTH:
+      writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_SYNTHESIZER);
+      break;
+    case RF69_MODE_STANDBY:
+      writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_STANDBY);
+      break;
+    case RF69_MODE_SLEEP:
+      writeReg(REG_OPMODE, (readReg(REG_OPMODE) & 0xE3) | RF_OPMODE_SLEEP);
+      break;
+    default:
+      return;
+  }
+  // we are using packet mode, so this check is not really needed
+  // but waiting for mode ready is necessary when going from sleep because the FIFO may not be immediately available from previous mode
+  while (_mode == RF69_MODE_SLEEP && (readReg(REG_IRQFLAGS1) & RF_IRQFLAGS1_MODEREADY) == 0x00); // wait for ModeReady
+  _mode = newMode;
+}
+
+bool RFM69::canSend() {
+  if (_mode == RF69_MODE_RX && PAYLOADLEN == 0 && readRSSI() < CSMA_LIMIT) { // if signal stronger than -100dBm is detected assume channel activity
+    setMode(RF69_MODE_STANDBY);
+    return true;
+  }
+  return false;
+}
+
+void RFM69::isr0() {
+  _haveData = true;
+}
+
+void RFM69::receiveBegin() {
+  DATALEN = 0;
+  PAYLOADLEN = 0;
+  RSSI = 0;
+  if (readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_PAYLOADREADY)
+    writeReg(REG_PACKETCONFIG2, (readReg(REG_PACKETCONFIG2) & 0xFB) | RF_PACKET2_RXRESTART); // avoid RX deadlocks
+  writeReg(REG_DIOMAPPING1, RF_DIOMAPPING1_DIO0_01); // set DIO0 to "PAYLOADREADY" in receive mode
+  setMode(RF69_MODE_RX);
+}
+
+bool RFM69::receiveDone() {
+  if (_haveData) {
+    _haveData = false;
+  }
+  if (_mode == RF69_MODE_RX && PAYLOADLEN > 0) {
+    setMode(RF69_MODE_STANDBY); // enables interrupts
+    return true;
+  } else if (_mode == RF69_MODE_RX) { // already in RX no payload yet
+    return false;
+  }
+  receiveBegin();
+  return false;
+}
+
+// To enable encryption: radio.encrypt("ABCDEFGHIJKLMNOP");
+// To disable encryption: radio.encrypt(null) or radio.encrypt(0)
+// KEY HAS TO BE 16 bytes !!!
+void RFM69::encrypt(const char *key) {
+  setMode(RF69_MODE_STANDBY);
+  uint8_t validKey = key != 0 && strlen(key) != 0;
+  if (validKey) {
+    select();
+    _spi->transfer(REG_AESKEY1 | 0x80);
+    for (uint8_t i = 0; i < 16; i++)
+      _spi->transfer(key[i]);
+    unselect();
+  }
+  writeReg(REG_PACKETCONFIG2, (readReg(REG_PACKETCONFIG2) & 0xFE) | (validKey ? 1 : 0));
+}
+
+// get the received signal strength indicator (RSSI)
+int16_t RFM69::readRSSI(bool forceTrigger) {
+  int16_t rssi = 0;
+  if (forceTrigger) {
+    // RSSI trigger not needed if DAGC is in continuous mode
+    writeReg(REG_RSSICONFIG, RF_RSSI_START);
+    while ((readReg(REG_RSSICONFIG) & RF_RSSI_DONE) == 0x00); // wait for RSSI_Ready
+  }
+  rssi = -readReg(REG_RSSIVALUE);
+  rssi >>= 1;
+  return rssi;
+}
+
+// for RFM69HW only: you must call setHighPower(true) after initialize() or else transmission won't work
+void RFM69::setHighPower(bool onOff) {
+  _isRFM69HW = onOff;
+  writeReg(REG_OCP, _isRFM69HW ? RF_OCP_OFF : RF_OCP_ON);
+  if (_isRFM69HW) // turning ON
+    writeReg(REG_PALEVEL, (readReg(REG_PALEVEL) & 0x1F) | RF_PALEVEL_PA1_ON | RF_PALEVEL_PA2_ON); // enable P1 & P2 amplifier stages
+  else
+    writeReg(REG_PALEVEL, RF_PALEVEL_PA0_ON | RF_PALEVEL_PA1_OFF | RF_PALEVEL_PA2_OFF | _powerLevel); // enable P0 only
+}
+
+// set *transmit/TX* output power: 0=min, 31=max
+void RFM69::setPowerLevel(uint8_t powerLevel) {
+  _powerLevel = (powerLevel > 31 ? 31 : powerLevel);
+  if (_isRFM69HW) _powerLevel /= 2;
+  writeReg(REG_PALEVEL, (readReg(REG_PALEVEL) & 0xE0) | _powerLevel);
+}
+
+// internal function
+void RFM69::setHighPowerRegs(bool onOff) {
+  writeReg(REG_TESTPA1, onOff ? 0x5D : 0x55);
+  writeReg(REG_TESTPA2, onOff ? 0x7C : 0x70);
+}
+
+uint8_t RFM69::readReg(uint8_t addr) {
+  select();
+  _spi->transfer(addr & 0x7F);
+  uint8_t regval = _spi->transfer(0);
+  unselect();
+  return regval;
+}
+
+void RFM69::writeReg(uint8_t addr, uint8_t value) {
+  select();
+  _spi->transfer(addr | 0x80);
+  _spi->transfer(value);
+  unselect();
+}
+
+// select the RFM69 transceiver (save SPI settings, set CS low)
+void RFM69::select() {
+  _spi->beginTransaction(_settings);
+  digitalWrite(_slaveSelectPin, LOW);
+}
+
+// unselect the RFM69 transceiver (set CS high, restore SPI settings)
+void RFM69::unselect() {
+  digitalWrite(_slaveSelectPin, HIGH);
+  _spi->endTransaction();
+}
+
+void RFM69::readAllRegs() {
+  for (uint8_t regAddr = 1; regAddr <= 0x4F; regAddr++) {
+    Serial.print(regAddr, HEX);
+    Serial.print(" - ");
+    Serial.println(readReg(regAddr), HEX);
+  }
+}
+
+void RFM69::readAllRegsCompact() {
+  for (uint8_t regAddr = 1; regAddr <= 0x4F; regAddr++) {
+    Serial.print(readReg(regAddr), HEX);
+    Serial.print(" ");
+  }
+  Serial.println();
+}
@@ -0,0 +1,427 @@
+/****************************************************************************
+RFM69Model.cpp - Behavioural model of the RFM69 for the host build, see
+RFM69Model.h.
+
+Register values and bit semantics follow the Semtech SX1231/HopeRF RFM69
+datasheet.
+****************************************************************************/
+
+#include <RFM69Model.h>
+
+// RegOpMode Mode bits, (RegOpMode >> 2) & 0x07
+#define MODEL_MODE_SLEEP   0
+#define MODEL_MODE_STANDBY 1
+#define MODEL_MODE_FS      2
+#define MODEL_MODE_TX      3
+#define MODEL_MODE_RX      4
+
+RFM69Model rfm69Model;
+
+static void rfm69ModelPinHook(uint8_t pin, uint8_t val) {
+  rfm69Model.chipSelect(pin, val);
+}
+
+static void rfm69ModelTimeHook(uint64_t nowUs) {
+  rfm69Model.advanceTo(nowUs);
+}
+
+RFM69Model::RFM69Model() {
+  reset();
+}
+
+void RFM69Model::attach(uint8_t csPin, uint8_t dio0Interrupt, uint8_t resetPin) {
+  _csPin = csPin;
+  _dio0Interrupt = dio0Interrupt;
+  _resetPin = resetPin;
+  if (!_attached) {
+    _attached = true;
+    hostAddPinHook(rfm69ModelPinHook);
+    hostAddTimeHook(rfm69ModelTimeHook);
+  }
+}
+
+void RFM69Model::reset() {
+  memset(_regs, 0, sizeof(_regs));
+  // power on defaults, datasheet table 23
+  _regs[REG_OPMODE] = 0x04;
+  _regs[REG_BITRATEMSB] = 0x1A;
+  _regs[REG_BITRATELSB] = 0x0B;
+  _regs[REG_FDEVLSB] = 0x52;
+  _regs[REG_FRFMSB] = 0xE4;
+  _regs[REG_FRFMID] = 0xC0;
+  _regs[REG_OSC1] = 0x41;
+  _regs[REG_VERSION] = 0x24;
+  _regs[REG_PALEVEL] = 0x9F;
+  _regs[REG_PARAMP] = 0x09;
+  _regs[REG_OCP] = 0x1A;
+  _regs[REG_LNA] = 0x08;
+  _regs[REG_RXBW] = 0x86;
+  _regs[REG_AFCBW] = 0x8A;
+  _regs[REG_RSSICONFIG] = 0x02;
+  _regs[REG_DIOMAPPING2] = 0x05;
+  _regs[REG_RSSITHRESH] = 0xE4;
+  _regs[REG_PREAMBLELSB] = 0x03;
+  _regs[REG_SYNCCONFIG] = 0x98;
+  for (uint8_t i = 0; i < 8; i++) {
+    _regs[REG_SYNCVALUE1 + i] = 0x01;
+  }
+  _regs[REG_PACKETCONFIG1] = 0x10;
+  _regs[REG_PAYLOADLENGTH] = 0x40;
+  _regs[REG_FIFOTHRESH] = 0x0F;
+  _regs[REG_PACKETCONFIG2] = 0x02;
+  _regs[REG_TESTDAGC] = 0x30;
+  _regs[REG_RSSIVALUE] = noiseRssiValue;
+
+  fifoClear();
+  _selected = false;
+  _modeReady = true;
+  _packetSent = false;
+  _dio0 = false;
+  _txState = txIdle;
+}
+
+void RFM69Model::clearTx() {
+  txFifoBytes.clear();
+  txChips.clear();
+  txFirstChipUs = 0;
+  txLastChipUs = 0;
+  txPackets = 0;
+  txUnderruns = 0;
+}
+
+void RFM69Model::chipSelect(uint8_t pin, uint8_t val) {
+  if ((pin == _resetPin) && (val == HIGH)) {
+    reset();
+    return;
+  }
+  if (pin != _csPin) {
+    return;
+  }
+  // active low, the first byte of every access is the address
+  _selected = (val == LOW);
+  _addrPhase = _selected;
+}
+
+uint8_t RFM69Model::spiTransfer(uint8_t data) {
+  if (!_selected) {
+    return 0;
+  }
+  if (_addrPhase) {
+    _addrPhase = false;
+    _write = data & 0x80;
+    _addr = data & 0x7F;
+    return 0;
+  }
+  uint8_t result = 0;
+  if (_write) {
+    writeReg(_addr, data);
+  } else {
+    result = readReg(_addr);
+  }
+  if (_addr != REG_FIFO) {
+    _addr = (_addr + 1) & 0x7F;
+  }
+  return result;
+}
+
+void RFM69Model::advanceTo(uint64_t nowUs) {
+  uint64_t nowTicks = nowUs * RFM69MODEL_TICKS_PER_US;
+  if (!_modeReady && (nowTicks >= _modeReadyTicks)) {
+    _modeReady = true;
+    updateDio0();
+  }
+  runTx(nowTicks);
+  _nowTicks = nowTicks;
+}
+
+bool RFM69Model::injectPacket(const uint8_t *payload, uint8_t length, uint8_t rssiValue) {
+  if ((mode() != MODEL_MODE_RX) || !_modeReady || _payloadReady) {
+    rxDropped++;
+    return false;
+  }
+  fifoClear();
+  uint8_t payloadLength = _regs[REG_PAYLOADLENGTH];
+  if ((payloadLength == 0) || (payloadLength > RFM69MODEL_FIFO_SIZE)) {
+    payloadLength = min(length, (uint8_t)RFM69MODEL_FIFO_SIZE);
+  }
+  for (uint8_t i = 0; i < payloadLength; i++) {
+    fifoPush((i < length) ? payload[i] : 0);
+  }
+  _regs[REG_RSSIVALUE] = rssiValue;
+  _payloadReady = true;
+  rxPackets++;
+  updateDio0();
+  return true;
+}
+
+uint8_t RFM69Model::peekReg(uint8_t addr) {
+  addr &= 0x7F;
+  if (addr == REG_FIFO) {
+    return _fifoCount ? _fifo[_fifoHead] : 0;
+  }
+  return readReg(addr);
+}
+
+uint8_t RFM69Model::readReg(uint8_t addr) {
+  uint8_t threshold = _regs[REG_FIFOTHRESH] & 0x7F;
+  switch (addr) {
+    case REG_FIFO:
+      return fifoPop();
+    case REG_IRQFLAGS1: {
+      uint8_t flags = 0;
+      if (_modeReady) {
+        flags |= RF_IRQFLAGS1_MODEREADY;
+        if (mode() == MODEL_MODE_RX) {
+          flags |= RF_IRQFLAGS1_RXREADY | RF_IRQFLAGS1_PLLLOCK;
+        } else if (mode() == MODEL_MODE_TX) {
+          flags |= RF_IRQFLAGS1_TXREADY | RF_IRQFLAGS1_PLLLOCK;
+        } else if (mode() == MODEL_MODE_FS) {
+          flags |= RF_IRQFLAGS1_PLLLOCK;
+        }
+      }
+      return flags;
+    }
+    case REG_IRQFLAGS2: {
+      uint8_t flags = 0;
+      if (_fifoCount == RFM69MODEL_FIFO_SIZE) {
+        flags |= RF_IRQFLAGS2_FIFOFULL;
+      }
+      if (_fifoCount > 0) {
+        flags |= RF_IRQFLAGS2_FIFONOTEMPTY;
+      }
+      if (_fifoCount > threshold) {
+        flags |= RF_IRQFLAGS2_FIFOLEVEL;
+      }
+      if (_fifoOverrun) {
+        flags |= RF_IRQFLAGS2_FIFOOVERRUN;
+      }
+      if (_packetSent) {
+        flags |= RF_IRQFLAGS2_PACKETSENT;
+      }
+      if (_payloadReady) {
+        flags |= RF_IRQFLAGS2_PAYLOADREADY;
+      }
+      return flags;
+    }
+    case REG_RSSICONFIG:
+      // the measurement is instant
+      return _regs[addr] | RF_RSSI_DONE;
+    case REG_PACKETCONFIG2:
+      // RestartRx always reads 0
+      return _regs[addr] & ~RF_PACKET2_RXRESTART;
+    default:
+      return _regs[addr];
+  }
+}
+
+void RFM69Model::writeReg(uint8_t addr, uint8_t val) {
+  switch (addr) {
+    case REG_FIFO:
+      fifoPush(val);
+      break;
+    case REG_OPMODE:
+      setOpMode(val);
+      break;
+    case REG_IRQFLAGS1:
+    case REG_VERSION:
+    case REG_RSSIVALUE:
+      // read only, or flags we don't model clearing
+      break;
+    case REG_IRQFLAGS2:
+      if (val & RF_IRQFLAGS2_FIFOOVERRUN) {
+        // clears the FIFO and the flags
+        fifoClear();
+        _fifoOverrun = false;
+        _payloadReady = false;
+        updateDio0();
+      }
+      break;
+    case REG_PACKETCONFIG2:
+      _regs[addr] = val & ~RF_PACKET2_RXRESTART;
+      if ((val & RF_PACKET2_RXRESTART) && (mode() == MODEL_MODE_RX)) {
+        fifoClear();
+        _payloadReady = false;
+        _regs[REG_RSSIVALUE] = noiseRssiValue;
+        updateDio0();
+      }
+      break;
+    case REG_DIOMAPPING1:
+      _regs[addr] = val;
+      updateDio0();
+      break;
+    default:
+      _regs[addr] = val;
+      break;
+  }
+}
+
+void RFM69Model::setOpMode(uint8_t val) {
+  uint8_t oldMode = mode();
+  _regs[REG_OPMODE] = val & ~RF_OPMODE_LISTENABORT; // ListenAbort always reads 0
+  uint8_t newMode = mode();
+  if (newMode == oldMode) {
+    return;
+  }
+  _modeReadyTicks = _nowTicks + (uint64_t)modeReadyUs * RFM69MODEL_TICKS_PER_US;
+  _modeReady = (modeReadyUs == 0);
+  if (oldMode == MODEL_MODE_TX) {
+    // leaving TX aborts the packet on air
+    _packetSent = false;
+    _txState = txIdle;
+  }
+  if ((newMode == MODEL_MODE_RX) || (newMode == MODEL_MODE_SLEEP)) {
+    fifoClear();
+    _payloadReady = false;
+    _regs[REG_RSSIVALUE] = noiseRssiValue;
+  }
+  if (newMode == MODEL_MODE_TX) {
+    _txNextTicks = _modeReadyTicks;
+  }
+  updateDio0();
+}
+
+void RFM69Model::fifoClear() {
+  _fifoHead = 0;
+  _fifoCount = 0;
+}
+
+boolean RFM69Model::fifoPush(uint8_t b) {
+  if (_fifoCount == RFM69MODEL_FIFO_SIZE) {
+    _fifoOverrun = true;
+    fifoOverruns++;
+    return false;
+  }
+  _fifo[(_fifoHead + _fifoCount) % RFM69MODEL_FIFO_SIZE] = b;
+  _fifoCount++;
+  return true;
+}
+
+uint8_t RFM69Model::fifoPop() {
+  if (_fifoCount == 0) {
+    return 0;
+  }
+  uint8_t b = _fifo[_fifoHead];
+  _fifoHead = (_fifoHead + 1) % RFM69MODEL_FIFO_SIZE;
+  _fifoCount--;
+  if ((_fifoCount == 0) && _payloadReady) {
+    // PayloadReady is cleared when the FIFO is empty
+    _payloadReady = false;
+    updateDio0();
+  }
+  return b;
+}
+
+// duration of one chip in 32 MHz ticks, BitRate = FXOSC / RegBitrate
+uint32_t RFM69Model::chipTicks() {
+  uint32_t value = (uint32_t)_regs[REG_BITRATEMSB] << 8 | _regs[REG_BITRATELSB];
+  return value ? value : 1;
+}
+
+boolean RFM69Model::txStartCondition() {
+  if (_regs[REG_FIFOTHRESH] & RF_FIFOTHRESH_TXSTART_FIFONOTEMPTY) {
+    return _fifoCount > 0;
+  }
+  return _fifoCount > (_regs[REG_FIFOTHRESH] & 0x7F);
+}
+
+void RFM69Model::recordChips(uint8_t b, boolean manchester, uint64_t startTicks) {
+  if (txChips.empty()) {
+    txFirstChipUs = startTicks / RFM69MODEL_TICKS_PER_US;
+  }
+  for (int8_t i = 7; i >= 0; i--) {
+    uint8_t bit = (b >> i) & 0x01;
+    if (manchester) {
+      // 1 -> 10, 0 -> 01, e.g. the sync word 0x7E becomes 0x6AA9
+      txChips.push_back(bit);
+      txChips.push_back(bit ^ 0x01);
+    } else {
+      txChips.push_back(bit);
+    }
+  }
+  uint64_t endTicks = startTicks + (uint64_t)chipTicks() * (manchester ? 16 : 8);
+  txLastChipUs = endTicks / RFM69MODEL_TICKS_PER_US;
+}
+
+// runs the transmitter up to untilTicks, a byte is taken from the FIFO when it
+// goes on air and recorded right away, the time it takes is accounted in _txNextTicks
+void RFM69Model::runTx(uint64_t untilTicks) {
+  boolean manchester = (_regs[REG_PACKETCONFIG1] & 0x60) == RF_PACKET1_DCFREE_MANCHESTER;
+  while ((mode() == MODEL_MODE_TX) && _modeReady && (_txNextTicks <= untilTicks)) {
+    if (_txState == txIdle) {
+      if (!txStartCondition()) {
+        return;
+      }
+      // the FIFO didn't change since the last advance, so the earliest start is then
+      _txNextTicks = max(_txNextTicks, _nowTicks);
+      // preamble and sync word aren't Manchester encoded
+      uint16_t preamble = (uint16_t)_regs[REG_PREAMBLEMSB] << 8 | _regs[REG_PREAMBLELSB];
+      for (uint16_t i = 0; i < preamble; i++) {
+        recordChips(0xAA, false, _txNextTicks);
+        _txNextTicks += (uint64_t)chipTicks() * 8;
+      }
+      if (_regs[REG_SYNCCONFIG] & RF_SYNC_ON) {
+        uint8_t syncSize = ((_regs[REG_SYNCCONFIG] >> 3) & 0x07) + 1;
+        for (uint8_t i = 0; i < syncSize; i++) {
+          recordChips(_regs[REG_SYNCVALUE1 + i], false, _txNextTicks);
+          _txNextTicks += (uint64_t)chipTicks() * 8;
+        }
+      }
+      _txPayloadLeft = _regs[REG_PAYLOADLENGTH];
+      _txUnlimited = (_txPayloadLeft == 0);
+      _txState = txPayload;
+    } else if (_txState == txPayload) {
+      if (!_txUnlimited && (_txPayloadLeft == 0)) {
+        // the last byte is out, next packet starts as soon as the start condition is met
+        _packetSent = true;
+        txPackets++;
+        _txState = txIdle;
+        updateDio0();
+        continue;
+      }
+      if (_fifoCount == 0) {
+        txUnderruns++;
+        _txState = txUnderrun;
+        return;
+      }
+      uint8_t b = fifoPop();
+      txFifoBytes.push_back(b);
+      recordChips(b, manchester, _txNextTicks);
+      _txNextTicks += (uint64_t)chipTicks() * (manchester ? 16 : 8);
+      if (!_txUnlimited) {
+        _txPayloadLeft--;
+      }
+    } else { // txUnderrun
+      if (_fifoCount == 0) {
+        return;
+      }
+      _txNextTicks = max(_txNextTicks, _nowTicks);
+      _txState = txPayload;
+    }
+  }
+}
+
+// DIO0 mapping, datasheet table 21
+void RFM69Model::updateDio0() {
+  uint8_t mapping = _regs[REG_DIOMAPPING1] >> 6;
+  boolean level = false;
+  if (mode() == MODEL_MODE_RX) {
+    if (mapping == 0x00) {
+      // CrcOk, only with the CRC check enabled
+      level = _payloadReady && (_regs[REG_PACKETCONFIG1] & RF_PACKET1_CRC_ON);
+    } else if (mapping == 0x01) {
+      level = _payloadReady;
+    }
+  } else if (mode() == MODEL_MODE_TX) {
+    if (mapping == 0x00) {
+      level = _packetSent;
+    } else if (mapping == 0x01) {
+      level = _modeReady; // TxReady
+    }
+  }
+  if (level && !_dio0) {
+    dio0Edges++;
+    _dio0 = true;
+    hostRaiseInterrupt(_dio0Interrupt);
+  }
+  _dio0 = level;
+}
@@ -0,0 +1,16 @@
+/****************************************************************************
+SPI.cpp - Host shim of the Arduino SPI class, see SPI.h.
+****************************************************************************/
+
+#include <SPI.h>
+#include <RFM69Model.h>
+
+#define HOST_SPI_BYTE_US 1 // one byte at the 8 MHz the radio is clocked with
+
+SPIClass SPI;
+
+uint8_t SPIClass::transfer(uint8_t data) {
+  // the time passes first, so the model sees the FIFO as it was during the transfer
+  hostAdvanceMicros(HOST_SPI_BYTE_US);
+  return rfm69Model.spiTransfer(data);
+}
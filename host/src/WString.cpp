@@ -0,0 +1,38 @@
+/****************************************************************************
+WString.cpp - Host shim of the Arduino String class, see WString.h.
+****************************************************************************/
+
+#include <WString.h>
+#include <stdio.h>
+
+void String::fromSigned(long value, unsigned char base) {
+  if (base == 10) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", value);
+    _s = buf;
+    return;
+  }
+  // like the Arduino core, other bases print the two's complement
+  fromUnsigned((unsigned long)value, base);
+}
+
+void String::fromUnsigned(unsigned long value, unsigned char base) {
+  if (base < 2 || base > 36) {
+    base = 10;
+  }
+  char buf[8 * sizeof(unsigned long) + 1];
+  char *str = &buf[sizeof(buf) - 1];
+  *str = '\0';
+  do {
+    char c = value % base;
+    value /= base;
+    *--str = c < 10 ? c + '0' : c + 'a' - 10;
+  } while (value);
+  _s = str;
+}
+
+void String::fromDouble(double value, unsigned char decimalPlaces) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*f", decimalPlaces, value);
+  _s = buf;
+}
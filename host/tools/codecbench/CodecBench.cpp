@@ -0,0 +1,425 @@
+/****************************************************************************
+CodecBench.cpp - Micro-benchmarks of the ETH200 codec kernels on the host.
+
+Measures the kernels of ETH200RFM69 which run once per frame (RX) or once
+per repeat (TX) on a fixed corpus:
+  - calcCRC16r        byte wise CRC, fed with every payload byte
+  - calcPacketCRC16r  CRC of a complete payload
+  - reverseByte       every payload byte
+  - stuffPayload      reversed payload -> zero stuffed bit string (TX)
+  - destuffPayload    FIFO content -> destuffed payload (RX)
+  - packBits          sync word + stuffed payload into FIFO bytes, the inner
+                      loop of sendFrame, the bit offset is carried over from
+                      frame to frame like between the repeats
+
+The corpus is generated, every frame is encoded like sendPacket does it:
+every window sensor and remote control command, every temperature command
+-9.5 ... +29.5 in 0.5 steps plus the absolute 0xCA, for a couple of
+addresses and changing counters. It contains stuffed and unstuffed
+payloads, every frame is checked to decode to itself before measuring.
+
+Every kernel runs over the whole corpus until a run takes about
+CODECBENCH_RUN_NS, the best of CODECBENCH_RUNS runs is reported as ns per
+frame and payload bytes per second. A fixed calibration loop is measured
+the same way, the regression check compares kernel/calibration, so the
+baseline doesn't depend too much on the speed of the machine (it still
+depends on compiler and flags, use the codecbench env). A kernel over its
+baseline is measured again up to CODECBENCH_ATTEMPTS times before it counts
+as regression, the fastest attempt is reported. A new baseline is the median
+of CODECBENCH_BASELINE_RUNS runs over all kernels, the file header has the
+run-to-run spread of these runs, the tolerance has to be above it.
+
+  .pio/build/codecbench/program [options]
+    --baseline <file>    default host/tools/codecbench/baseline.txt
+    --tolerance <n>      allowed slow down in percent, default 50
+    --update-baseline    writes the results as new baseline
+
+Exit code is 1 if a kernel is slower than its baseline plus tolerance or
+the corpus doesn't decode correctly.
+****************************************************************************/
+
+#include <Arduino.h>
+#include <config.h>
+#include <ETH200RFM69.h>
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define CODECBENCH_RUN_NS 2000000 // 2 ms per run, short runs are less likely to be interrupted
+#define CODECBENCH_RUNS 31
+#define CODECBENCH_ATTEMPTS 5     // measurements of a kernel before it counts as regression
+#define CODECBENCH_BASELINE_RUNS 7 // runs over all kernels for a new baseline, the median is written
+#define CODECBENCH_CRCMASK 0x8408
+
+uint8_t convertTemp2Hex(float temp); // main.cpp
+
+// the codec kernels of ETH200RFM69 are protected
+class BenchCodec : public ETH200RFM69 {
+  public:
+    using ETH200RFM69::reverseByte;
+    using ETH200RFM69::calcCRC16r;
+    using ETH200RFM69::calcPacketCRC16r;
+    using ETH200RFM69::stuffPayload;
+    using ETH200RFM69::destuffPayload;
+    using ETH200RFM69::packBits;
+};
+
+// one frame of the corpus in every stage of the encoding
+struct benchFrame {
+  std::vector<uint8_t> data;     // counter, type, address, cmd, cmds, CRC
+  std::vector<uint8_t> reversed; // reverseByte of every data byte
+  std::vector<uint8_t> fifo;     // zero stuffed, as a receiver has it in the FIFO
+  std::vector<uint8_t> packet;   // sync word + stuffed payload, as sendFrame packs it
+  uint8_t numBits = 0;           // valid bits in packet
+  uint8_t numStuffedBits = 0;
+  uint16_t crcStart = 0;
+};
+
+struct benchResult {
+  std::string name;
+  double nsPerFrame = 0;
+  double bytesPerSecond = 0;
+  double relative = 0;           // nsPerFrame / nsPerFrame of the calibration
+  double spreadMin = 0;          // baseline only, fastest and slowest run against the median in %
+  double spreadMax = 0;
+};
+
+static BenchCodec codec;
+static std::vector<benchFrame> corpus;
+static volatile uint32_t benchSink = 0; // keeps the compiler from dropping the kernels
+
+static uint16_t crcStartOf(uint8_t deviceType) {
+  return (deviceType == 0x10) ? 0xC11F : 0xBDB7; // RemoteControl : WindowSensor
+}
+
+// encodes the frame like ETH200RFM69::sendPacket
+static benchFrame encodeFrame(uint8_t counter, uint8_t deviceType, uint32_t address, uint8_t cmd,
+                              const std::vector<uint8_t> &cmds) {
+  benchFrame frame;
+  frame.crcStart = crcStartOf(deviceType);
+  frame.data = {counter, deviceType, (uint8_t)(address >> 16), (uint8_t)(address >> 8), (uint8_t)address, cmd};
+  for (uint8_t b : cmds) {
+    frame.data.push_back(b);
+  }
+  uint16_t crc = codec.calcPacketCRC16r(frame.data.data(), frame.data.size(), frame.crcStart, CODECBENCH_CRCMASK);
+  frame.data.push_back(crc >> 8);
+  frame.data.push_back(crc);
+  uint8_t length = frame.data.size();
+  for (uint8_t b : frame.data) {
+    frame.reversed.push_back(codec.reverseByte(b));
+  }
+  std::vector<uint8_t> stuffed(length + 1, 0);
+  frame.numStuffedBits = codec.stuffPayload(frame.reversed.data(), stuffed.data(), length);
+  uint8_t stuffedLength = (frame.numStuffedBits > 0) ? length + 1 : length;
+  stuffed.resize(stuffedLength);
+  frame.fifo = stuffed;
+  frame.fifo.resize(CFG_ETH200MAXPACKETSIZE, 0);
+  frame.packet.push_back(0x7E);
+  frame.packet.insert(frame.packet.end(), stuffed.begin(), stuffed.end());
+  if (frame.numStuffedBits == 0) {
+    frame.numBits = 8 + (8 * stuffedLength);
+  } else {
+    frame.numBits = 8 + (8 * (stuffedLength - 1)) + frame.numStuffedBits;
+  }
+  return frame;
+}
+
+// the counters wander through 1 ... 255
+static uint8_t nextCounter(uint8_t counter) {
+  return (counter <= 218) ? counter + 37 : counter - 218;
+}
+
+static void buildCorpus() {
+  // 0xFFFFFF and 0x7E7E7E force stuffing in the address bytes
+  const uint32_t addresses[] = {0x010101, 0x014F5E, 0x7E7E7E, 0xFFFFFF};
+  std::vector<std::pair<uint8_t, std::vector<uint8_t>>> windowCmds = {
+    {0x41, {}}, {0x40, {}}, {0xC1, {}}, {0xC0, {}}, // opened, closed, with low battery
+  };
+  std::vector<std::pair<uint8_t, std::vector<uint8_t>>> remoteCmds = {
+    {0x42, {0x00}}, {0x43, {0x00}}, {0x40, {0xCA}}, // DayMode, NightMode, absolute temperature first step
+  };
+  for (int t = -19; t <= 59; t++) {
+    // every temperature command accepted by mqttCallback
+    remoteCmds.push_back({0x40, {convertTemp2Hex(t * 0.5)}});
+  }
+  uint8_t counter = 1;
+  for (uint32_t address : addresses) {
+    for (auto &cmd : windowCmds) {
+      corpus.push_back(encodeFrame(counter, 0x20, address, cmd.first, cmd.second));
+      counter = nextCounter(counter);
+    }
+    for (auto &cmd : remoteCmds) {
+      corpus.push_back(encodeFrame(counter, 0x10, address, cmd.first, cmd.second));
+      counter = nextCounter(counter);
+    }
+  }
+}
+
+// decodes every frame like interruptHandler and compares it with the encoded data
+static uint32_t checkCorpus() {
+  uint32_t errors = 0;
+  for (benchFrame &frame : corpus) {
+    uint8_t destuffed[CFG_ETH200MAXPACKETSIZE - 1] = {0};
+    codec.destuffPayload(frame.fifo.data(), destuffed, CFG_ETH200MAXPACKETSIZE);
+    uint8_t length = frame.data.size();
+    boolean ok = true;
+    for (uint8_t i = 0; i < length; i++) {
+      ok = ok && (codec.reverseByte(destuffed[i]) == frame.data[i]);
+    }
+    uint16_t crc = codec.calcPacketCRC16r(frame.data.data(), length - 2, frame.crcStart, CODECBENCH_CRCMASK);
+    ok = ok && (frame.data[length - 2] == (uint8_t)(crc >> 8)) && (frame.data[length - 1] == (uint8_t)crc);
+    if (!ok) {
+      errors++;
+    }
+  }
+  return errors;
+}
+
+// runs kernel over the whole corpus, returns the best time of a corpus pass in ns
+template <typename kernel_t>
+static double measure(kernel_t kernel) {
+  using clock = std::chrono::steady_clock;
+  // warm up and find the number of passes for one run
+  uint32_t passes = 1;
+  while (true) {
+    clock::time_point start = clock::now();
+    for (uint32_t p = 0; p < passes; p++) {
+      kernel();
+    }
+    uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    if ((ns >= CODECBENCH_RUN_NS) || (passes >= (1UL << 30))) {
+      break;
+    }
+    passes *= 2;
+  }
+  double best = 0;
+  for (uint8_t run = 0; run < CODECBENCH_RUNS; run++) {
+    clock::time_point start = clock::now();
+    for (uint32_t p = 0; p < passes; p++) {
+      kernel();
+    }
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    if ((run == 0) || (ns < best)) {
+      best = ns;
+    }
+  }
+  return best / passes;
+}
+
+static std::map<std::string, double> loadBaseline(const std::string &path) {
+  std::map<std::string, double> baseline;
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.empty() || (line[0] == '#')) {
+      continue;
+    }
+    std::istringstream fields(line);
+    std::string name;
+    double nsPerFrame = 0;
+    double relative = 0;
+    if (fields >> name >> nsPerFrame >> relative) {
+      baseline[name] = relative;
+    }
+  }
+  return baseline;
+}
+
+static boolean writeBaseline(const std::string &path, const std::vector<benchResult> &results) {
+  double spreadMin = 0;
+  double spreadMax = 0;
+  for (const benchResult &result : results) {
+    spreadMin = min(spreadMin, result.spreadMin);
+    spreadMax = max(spreadMax, result.spreadMax);
+  }
+  std::ofstream out(path);
+  char line[128];
+  out << "# codec kernel baseline, written by CodecBench --update-baseline\n";
+  snprintf(line, sizeof(line), "# median of %u runs, run-to-run spread of relative %+.0f%% ... %+.0f%%\n",
+           CODECBENCH_BASELINE_RUNS, spreadMin, spreadMax);
+  out << line;
+  out << "# kernel ns/frame relative(ns/frame of the calibration loop = 1) spread(fastest/slowest run in %)\n";
+  for (const benchResult &result : results) {
+    snprintf(line, sizeof(line), "%-16s %10.2f %8.4f %+5.0f %+5.0f\n", result.name.c_str(), result.nsPerFrame,
+             result.relative, result.spreadMin, result.spreadMax);
+    out << line;
+  }
+  return out.good();
+}
+
+int main(int argc, char *argv[]) {
+  std::string baselinePath = "host/tools/codecbench/baseline.txt";
+  double tolerance = 50;
+  boolean update = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--baseline") && (i + 1 < argc)) {
+      baselinePath = argv[++i];
+    } else if ((arg == "--tolerance") && (i + 1 < argc)) {
+      tolerance = atof(argv[++i]);
+    } else if (arg == "--update-baseline") {
+      update = true;
+    } else {
+      fprintf(stderr, "usage: %s [--baseline file] [--tolerance percent] [--update-baseline]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  buildCorpus();
+  uint32_t numWindow = 0;
+  uint32_t numStuffed = 0;
+  uint64_t payloadBytes = 0;
+  uint64_t fifoBytes = 0;
+  uint64_t packetBytes = 0;
+  for (benchFrame &frame : corpus) {
+    numWindow += (frame.data[1] == 0x20) ? 1 : 0;
+    numStuffed += (frame.numStuffedBits > 0) ? 1 : 0;
+    payloadBytes += frame.data.size();
+    fifoBytes += frame.fifo.size();
+    packetBytes += frame.numBits / 8;
+  }
+  uint32_t corpusErrors = checkCorpus();
+  printf("corpus  : %zu frames, window sensor %u, remote control %zu, stuffed %u, unstuffed %zu, decode errors %u\n",
+         corpus.size(), numWindow, corpus.size() - numWindow, numStuffed, corpus.size() - numStuffed, corpusErrors);
+  if ((corpusErrors > 0) || (numStuffed == 0) || (numStuffed == corpus.size())) {
+    printf("FAIL corpus\n");
+    return 1;
+  }
+
+  std::vector<uint8_t> out(CFG_ETH200MAXPACKETSIZE + 2, 0);
+  uint8_t pendingByte = 0;
+  uint8_t pendingBits = 0;
+  // name, kernel, bytes per corpus pass
+  std::vector<std::pair<std::string, std::pair<std::function<void()>, uint64_t>>> kernels = {
+    {"calibration", {[&]() {
+      // fixed xorshift loop, independent of the firmware
+      uint32_t x = benchSink | 1;
+      for (size_t i = 0; i < corpus.size() * 64; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+      }
+      benchSink = x;
+    }, 0}},
+    {"calcCRC16r", {[&]() {
+      for (benchFrame &frame : corpus) {
+        uint16_t crc = frame.crcStart;
+        for (size_t i = 0; i < frame.data.size() - 2; i++) {
+          crc = codec.calcCRC16r(frame.data[i], crc, CODECBENCH_CRCMASK);
+        }
+        benchSink += crc;
+      }
+    }, payloadBytes - 2 * corpus.size()}},
+    {"calcPacketCRC16r", {[&]() {
+      for (benchFrame &frame : corpus) {
+        benchSink += codec.calcPacketCRC16r(frame.data.data(), frame.data.size() - 2, frame.crcStart, CODECBENCH_CRCMASK);
+      }
+    }, payloadBytes - 2 * corpus.size()}},
+    {"reverseByte", {[&]() {
+      for (benchFrame &frame : corpus) {
+        for (size_t i = 0; i < frame.data.size(); i++) {
+          out[i] = codec.reverseByte(frame.data[i]);
+        }
+        benchSink += out[0];
+      }
+    }, payloadBytes}},
+    {"stuffPayload", {[&]() {
+      for (benchFrame &frame : corpus) {
+        benchSink += codec.stuffPayload(frame.reversed.data(), out.data(), frame.reversed.size());
+      }
+    }, payloadBytes}},
+    {"destuffPayload", {[&]() {
+      for (benchFrame &frame : corpus) {
+        benchSink += codec.destuffPayload(frame.fifo.data(), out.data(), CFG_ETH200MAXPACKETSIZE);
+      }
+    }, fifoBytes}},
+    {"packBits", {[&]() {
+      for (benchFrame &frame : corpus) {
+        benchSink += codec.packBits(frame.packet.data(), frame.numBits, out.data(), pendingByte, pendingBits);
+      }
+    }, packetBytes}},
+  };
+
+  std::map<std::string, double> baseline;
+  if (!update) {
+    baseline = loadBaseline(baselinePath);
+    if (baseline.empty()) {
+      printf("baseline: %s not found, no regression check\n", baselinePath.c_str());
+    }
+  }
+  // a check is one run over all kernels, a new baseline takes CODECBENCH_BASELINE_RUNS runs,
+  // one after the other, so a slow phase of the machine doesn't hit all runs of a kernel
+  uint8_t runs = update ? CODECBENCH_BASELINE_RUNS : 1;
+  std::vector<std::vector<benchResult>> runResults(kernels.size());
+  for (uint8_t run = 0; run < runs; run++) {
+    for (size_t k = 0; k < kernels.size(); k++) {
+      auto &kernel = kernels[k];
+      benchResult result;
+      result.name = kernel.first;
+      double expected = ((kernel.first != "calibration") && (baseline.count(kernel.first) > 0)) ? baseline[kernel.first] : 0;
+      // other processes on the machine make single measurements slower, never faster, so
+      // the fastest attempt counts. A new baseline takes all attempts, a check stops as soon
+      // as the kernel is within its tolerance.
+      for (uint8_t attempt = 0; attempt < CODECBENCH_ATTEMPTS; attempt++) {
+        // the calibration is measured again right before the kernel, so a change of the
+        // clock frequency during the benchmark doesn't show up as regression
+        double calibrationNs = measure(kernels[0].second.first);
+        double passNs = (kernel.first == "calibration") ? calibrationNs : measure(kernel.second.first);
+        if ((attempt == 0) || (passNs / calibrationNs < result.relative)) {
+          result.nsPerFrame = passNs / corpus.size();
+          result.bytesPerSecond = kernel.second.second * 1e9 / passNs;
+          result.relative = passNs / calibrationNs;
+        }
+        if (!update && ((expected == 0) || (result.relative <= expected * (1 + tolerance / 100)))) {
+          break;
+        }
+      }
+      runResults[k].push_back(result);
+    }
+  }
+
+  std::vector<benchResult> results;
+  uint32_t regressions = 0;
+  printf("%-16s %10s %12s %9s %9s\n", "kernel", "ns/frame", "MB/s", "relative", "baseline");
+  for (std::vector<benchResult> &kernelRuns : runResults) {
+    std::sort(kernelRuns.begin(), kernelRuns.end(),
+              [](const benchResult &a, const benchResult &b) { return a.relative < b.relative; });
+    benchResult result = kernelRuns[kernelRuns.size() / 2];
+    result.spreadMin = (kernelRuns.front().relative / result.relative - 1) * 100;
+    result.spreadMax = (kernelRuns.back().relative / result.relative - 1) * 100;
+    double expected = ((result.name != "calibration") && (baseline.count(result.name) > 0)) ? baseline[result.name] : 0;
+    char bytesText[32] = "-";
+    if (result.bytesPerSecond > 0) {
+      snprintf(bytesText, sizeof(bytesText), "%.1f", result.bytesPerSecond / 1e6);
+    }
+    char baselineText[32] = "-";
+    const char *verdict = "";
+    if (expected > 0) {
+      snprintf(baselineText, sizeof(baselineText), "%+.0f%%", (result.relative / expected - 1) * 100);
+      if (result.relative > expected * (1 + tolerance / 100)) {
+        verdict = "  REGRESSION";
+        regressions++;
+      }
+    }
+    printf("%-16s %10.2f %12s %9.4f %9s%s\n", result.name.c_str(), result.nsPerFrame,
+           bytesText, result.relative, baselineText, verdict);
+    results.push_back(result);
+  }
+
+  if (update) {
+    if (!writeBaseline(baselinePath, results)) {
+      fprintf(stderr, "writing %s failed\n", baselinePath.c_str());
+      return 2;
+    }
+    printf("baseline: median of %u runs written to %s\n", CODECBENCH_BASELINE_RUNS, baselinePath.c_str());
+  }
+  if (regressions > 0) {
+    printf("FAIL %u kernel(s) slower than baseline + %.0f%%\n", regressions, tolerance);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,465 @@
+/****************************************************************************
+CodecFuzz.cpp - Differential fuzzing of the ETH200 codec kernels against
+the frozen reference (host/include/ETH200CodecRef.h).
+
+Every input runs through the kernel of the firmware (ETH200RFM69, the
+implementation an optimisation changes) and the reference, return values,
+output buffers including a guard area behind them and the in/out
+parameters have to be identical. The first input byte selects the kernel,
+the rest is its input:
+  reverseByte       data
+  calcCRC16r        (c, crc, mask) as 3 x 16 bit, big endian, repeated
+  calcPacketCRC16r  crcStart, crcMask (16 bit each), packet
+  destuffPayload    initial value of the output buffer, FIFO content
+  stuffPayload      initial value of the output buffer, payload
+  packBits          pendingByte, pendingBits, numBits, packet
+Inputs outside the domain the reference is defined for are skipped and
+counted: more than 8 stuffed bits for stuffPayload (negative shift),
+pendingBits > 7 or numBits beyond the packet for packBits.
+
+A mismatch prints the kernel, the input and both outputs, writes the input
+to --crash-file and aborts, so libFuzzer and AFL keep it as crash. Every
+run ends with a throughput report per kernel: calls, bytes, ns per call of
+the firmware and the reference (timer overhead subtracted) and the speed up.
+
+Builds three ways:
+  pio run -e codecfuzz      standalone, random inputs biased to runs of 1s
+                            and real frames, or replays input files (AFL @@)
+  libFuzzer                 clang++ -fsanitize=fuzzer,address,undefined
+                            -DCODECFUZZ_LIBFUZZER ..., see readme.txt
+  AFL                       afl-clang-fast++ ..., afl-fuzz ... -- program @@
+
+  .pio/build/codecfuzz/program [options] [input file ...]
+    --iterations <n>   random inputs, default 1000000, 0 with input files
+    --max-len <n>      max payload bytes of a random input, default 40
+    --seed <n>         default 1
+    --crash-file <f>   default codecfuzz-mismatch.bin
+
+Exit code is 0 if all inputs matched, a mismatch aborts.
+****************************************************************************/
+
+#include <Arduino.h>
+#include <config.h>
+#include <ETH200RFM69.h>
+#include <ETH200CodecRef.h>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+
+#define CODECFUZZ_GUARD 16      // bytes behind every output buffer which have to stay the same
+#define CODECFUZZ_GUARD_BYTE 0xA5
+
+// the codec kernels of ETH200RFM69 are protected
+class FuzzCodec : public ETH200RFM69 {
+  public:
+    using ETH200RFM69::reverseByte;
+    using ETH200RFM69::calcCRC16r;
+    using ETH200RFM69::calcPacketCRC16r;
+    using ETH200RFM69::stuffPayload;
+    using ETH200RFM69::destuffPayload;
+    using ETH200RFM69::packBits;
+};
+
+enum fuzzKernel_t {
+  kernelReverseByte,
+  kernelCalcCRC16r,
+  kernelCalcPacketCRC16r,
+  kernelDestuffPayload,
+  kernelStuffPayload,
+  kernelPackBits,
+  kernelCount,
+};
+
+static const char *kernelNames[kernelCount] = {
+  "reverseByte", "calcCRC16r", "calcPacketCRC16r", "destuffPayload", "stuffPayload", "packBits",
+};
+
+struct fuzzStats {
+  uint64_t calls = 0;
+  uint64_t skipped = 0;  // outside the domain of the reference
+  uint64_t bytes = 0;    // input bytes of the kernel
+  double firmwareNs = 0;
+  double referenceNs = 0;
+};
+
+static FuzzCodec *codec = NULL; // created on first use, the RFM69 constructor wants the Arduino shims
+static fuzzStats stats[kernelCount];
+static double clockOverheadNs = 0;
+static uint64_t inputs = 0;
+static std::string crashPath = "codecfuzz-mismatch.bin";
+static std::chrono::steady_clock::time_point fuzzStart;
+
+static void calibrateClock() {
+  using clock = std::chrono::steady_clock;
+  double best = 0;
+  for (uint32_t i = 0; i < 10000; i++) {
+    clock::time_point start = clock::now();
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count();
+    if ((i == 0) || (ns < best)) {
+      best = ns;
+    }
+  }
+  clockOverheadNs = best;
+}
+
+// runs fn once, adds its time without the timer overhead to ns
+template <typename fn_t>
+static void timed(double &ns, fn_t fn) {
+  using clock = std::chrono::steady_clock;
+  clock::time_point start = clock::now();
+  fn();
+  double elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start).count() - clockOverheadNs;
+  ns += (elapsed > 0) ? elapsed : 0;
+}
+
+static std::string hex(const uint8_t data[], size_t size) {
+  std::string text;
+  for (size_t i = 0; i < size; i++) {
+    char buf[4];
+    snprintf(buf, sizeof(buf), (i == 0) ? "%02X" : " %02X", data[i]);
+    text += buf;
+  }
+  return text;
+}
+
+static void mismatch(fuzzKernel_t kernel, const uint8_t *input, size_t size, const std::string &firmware,
+                     const std::string &reference) {
+  fprintf(stderr, "MISMATCH %s\n  input     %s\n  firmware  %s\n  reference %s\n", kernelNames[kernel],
+          hex(input, size).c_str(), firmware.c_str(), reference.c_str());
+  if (!crashPath.empty()) {
+    std::ofstream out(crashPath, std::ios::binary);
+    out.write((const char *)input, size);
+    fprintf(stderr, "  input written to %s\n", crashPath.c_str());
+  }
+  fflush(stderr);
+  abort();
+}
+
+// the number of 0 bits stuffPayload inserts, same rule as the firmware
+static uint32_t countStuffedBits(const uint8_t data[], size_t size) {
+  uint32_t stuffed = 0;
+  uint8_t ones = 0;
+  for (size_t i = 0; i < size * 8; i++) {
+    if (ones == 5) {
+      stuffed++;
+      ones = 0;
+    }
+    ones = bitRead(data[i / 8], 7 - (i % 8)) ? ones + 1 : 0;
+  }
+  return stuffed;
+}
+
+// one output buffer of the firmware and the reference, initialised the same
+struct fuzzBuffers {
+  std::vector<uint8_t> firmware;
+  std::vector<uint8_t> reference;
+  fuzzBuffers(size_t size, uint8_t fill) {
+    firmware.assign(size + CODECFUZZ_GUARD, CODECFUZZ_GUARD_BYTE);
+    std::fill(firmware.begin(), firmware.begin() + size, fill);
+    reference = firmware;
+  }
+};
+
+static void fuzzOne(const uint8_t *input, size_t size) {
+  if (codec == NULL) {
+    codec = new FuzzCodec();
+  }
+  if (size < 1) {
+    return;
+  }
+  inputs++;
+  fuzzKernel_t kernel = (fuzzKernel_t)(input[0] % kernelCount);
+  const uint8_t *data = input + 1;
+  size_t length = size - 1;
+  fuzzStats &kernelStats = stats[kernel];
+  char text[64];
+
+  switch (kernel) {
+    case kernelReverseByte: {
+      for (size_t i = 0; i < length; i++) {
+        uint8_t firmware = 0;
+        uint8_t reference = 0;
+        timed(kernelStats.firmwareNs, [&]() { firmware = codec->reverseByte(data[i]); });
+        timed(kernelStats.referenceNs, [&]() { reference = ETH200CodecRef::reverseByte(data[i]); });
+        kernelStats.calls++;
+        kernelStats.bytes++;
+        if (firmware != reference) {
+          snprintf(text, sizeof(text), "reverseByte(%02X) = %02X", data[i], firmware);
+          std::string firmwareText = text;
+          snprintf(text, sizeof(text), "reverseByte(%02X) = %02X", data[i], reference);
+          mismatch(kernel, input, size, firmwareText, text);
+        }
+      }
+      break;
+    }
+    case kernelCalcCRC16r: {
+      for (size_t i = 0; i + 6 <= length; i += 6) {
+        uint16_t c = data[i] << 8 | data[i + 1];
+        uint16_t crc = data[i + 2] << 8 | data[i + 3];
+        uint16_t mask = data[i + 4] << 8 | data[i + 5];
+        uint16_t firmware = 0;
+        uint16_t reference = 0;
+        timed(kernelStats.firmwareNs, [&]() { firmware = codec->calcCRC16r(c, crc, mask); });
+        timed(kernelStats.referenceNs, [&]() { reference = ETH200CodecRef::calcCRC16r(c, crc, mask); });
+        kernelStats.calls++;
+        kernelStats.bytes++;
+        if (firmware != reference) {
+          snprintf(text, sizeof(text), "%04X", firmware);
+          std::string firmwareText = text;
+          snprintf(text, sizeof(text), "%04X", reference);
+          mismatch(kernel, input, size, firmwareText, text);
+        }
+      }
+      break;
+    }
+    case kernelCalcPacketCRC16r: {
+      if (length < 4) {
+        kernelStats.skipped++;
+        break;
+      }
+      uint16_t crcStart = data[0] << 8 | data[1];
+      uint16_t crcMask = data[2] << 8 | data[3];
+      std::vector<uint8_t> packet(data + 4, data + min(length, (size_t)4 + 255));
+      std::vector<uint8_t> packetReference = packet;
+      uint16_t firmware = 0;
+      uint16_t reference = 0;
+      timed(kernelStats.firmwareNs,
+            [&]() { firmware = codec->calcPacketCRC16r(packet.data(), packet.size(), crcStart, crcMask); });
+      timed(kernelStats.referenceNs, [&]() {
+        reference = ETH200CodecRef::calcPacketCRC16r(packetReference.data(), packetReference.size(), crcStart, crcMask);
+      });
+      kernelStats.calls++;
+      kernelStats.bytes += packet.size();
+      if ((firmware != reference) || (packet != packetReference)) {
+        snprintf(text, sizeof(text), "%04X, packet %s", firmware, (packet == packetReference) ? "same" : "changed");
+        std::string firmwareText = text;
+        snprintf(text, sizeof(text), "%04X", reference);
+        mismatch(kernel, input, size, firmwareText, text);
+      }
+      break;
+    }
+    case kernelDestuffPayload:
+    case kernelStuffPayload: {
+      if (length < 1) {
+        kernelStats.skipped++;
+        break;
+      }
+      std::vector<uint8_t> in(data + 1, data + min(length, (size_t)1 + 255));
+      if ((kernel == kernelStuffPayload) && (countStuffedBits(in.data(), in.size()) > 8)) {
+        kernelStats.skipped++;
+        break;
+      }
+      std::vector<uint8_t> inReference = in;
+      // destuffPayload writes up to [length - 1], stuffPayload up to [length + 1]
+      fuzzBuffers out(in.size() + 2, data[0]);
+      uint8_t firmware = 0;
+      uint8_t reference = 0;
+      if (kernel == kernelDestuffPayload) {
+        timed(kernelStats.firmwareNs, [&]() { firmware = codec->destuffPayload(in.data(), out.firmware.data(), in.size()); });
+        timed(kernelStats.referenceNs, [&]() {
+          reference = ETH200CodecRef::destuffPayload(inReference.data(), out.reference.data(), inReference.size());
+        });
+      } else {
+        timed(kernelStats.firmwareNs, [&]() { firmware = codec->stuffPayload(in.data(), out.firmware.data(), in.size()); });
+        timed(kernelStats.referenceNs, [&]() {
+          reference = ETH200CodecRef::stuffPayload(inReference.data(), out.reference.data(), inReference.size());
+        });
+      }
+      kernelStats.calls++;
+      kernelStats.bytes += in.size();
+      if ((firmware != reference) || (out.firmware != out.reference) || (in != inReference)) {
+        mismatch(kernel, input, size, std::to_string(firmware) + ": " + hex(out.firmware.data(), out.firmware.size()),
+                 std::to_string(reference) + ": " + hex(out.reference.data(), out.reference.size()));
+      }
+      break;
+    }
+    case kernelPackBits: {
+      if (length < 3) {
+        kernelStats.skipped++;
+        break;
+      }
+      std::vector<uint8_t> packet(data + 3, data + min(length, (size_t)3 + 32));
+      uint8_t numBits = data[2];
+      if ((data[1] > 7) || (numBits > packet.size() * 8)) {
+        kernelStats.skipped++;
+        break;
+      }
+      uint8_t pendingByte = data[0];
+      uint8_t pendingBits = data[1];
+      uint8_t pendingByteReference = data[0];
+      uint8_t pendingBitsReference = data[1];
+      fuzzBuffers out(numBits / 8 + 1, 0);
+      uint8_t firmware = 0;
+      uint8_t reference = 0;
+      timed(kernelStats.firmwareNs,
+            [&]() { firmware = codec->packBits(packet.data(), numBits, out.firmware.data(), pendingByte, pendingBits); });
+      timed(kernelStats.referenceNs, [&]() {
+        reference = ETH200CodecRef::packBits(packet.data(), numBits, out.reference.data(), pendingByteReference,
+                                             pendingBitsReference);
+      });
+      kernelStats.calls++;
+      kernelStats.bytes += (numBits + 7) / 8;
+      if ((firmware != reference) || (out.firmware != out.reference) || (pendingByte != pendingByteReference) ||
+          (pendingBits != pendingBitsReference)) {
+        snprintf(text, sizeof(text), "%u, pending %02X/%u: ", firmware, pendingByte, pendingBits);
+        std::string firmwareText = text + hex(out.firmware.data(), out.firmware.size());
+        snprintf(text, sizeof(text), "%u, pending %02X/%u: ", reference, pendingByteReference, pendingBitsReference);
+        mismatch(kernel, input, size, firmwareText, text + hex(out.reference.data(), out.reference.size()));
+      }
+      break;
+    }
+    case kernelCount:
+      break;
+  }
+}
+
+static void printReport() {
+  double wallS = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - fuzzStart).count() / 1e6;
+  printf("inputs  : %llu in %.2f s, %.0f inputs/s, all matched the reference\n", (unsigned long long)inputs, wallS,
+         (wallS > 0) ? inputs / wallS : 0);
+  printf("%-16s %10s %8s %11s %10s %10s %10s %10s %8s\n", "kernel", "calls", "skipped", "bytes", "fw ns", "ref ns",
+         "fw MB/s", "ref MB/s", "speedup");
+  for (uint8_t k = 0; k < kernelCount; k++) {
+    const fuzzStats &s = stats[k];
+    double calls = (s.calls > 0) ? s.calls : 1;
+    printf("%-16s %10llu %8llu %11llu %10.1f %10.1f %10.1f %10.1f %7.2fx\n", kernelNames[k], (unsigned long long)s.calls,
+           (unsigned long long)s.skipped, (unsigned long long)s.bytes, s.firmwareNs / calls, s.referenceNs / calls,
+           (s.firmwareNs > 0) ? s.bytes * 1e3 / s.firmwareNs : 0, (s.referenceNs > 0) ? s.bytes * 1e3 / s.referenceNs : 0,
+           (s.firmwareNs > 0) ? s.referenceNs / s.firmwareNs : 0);
+  }
+  fflush(stdout);
+}
+
+#ifdef CODECFUZZ_LIBFUZZER
+
+extern "C" int LLVMFuzzerInitialize(int *argc, char ***argv) {
+  calibrateClock();
+  fuzzStart = std::chrono::steady_clock::now();
+  atexit(printReport); // libFuzzer exits normally after -runs or -max_total_time
+  return 0;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  fuzzOne(data, size);
+  return 0;
+}
+
+#else
+
+// a frame like sendPacket builds it, in the stage the kernel gets it
+static std::vector<uint8_t> frameInput(fuzzKernel_t kernel, std::mt19937 &rng) {
+  const uint32_t addresses[] = {0x010101, 0x014F5E, 0x7E7E7E, 0xFFFFFF, (uint32_t)(rng() & 0xFFFFFF)};
+  uint8_t deviceType = (rng() & 1) ? 0x10 : 0x20;
+  uint32_t address = addresses[rng() % 5];
+  std::vector<uint8_t> frame = {(uint8_t)rng(), deviceType, (uint8_t)(address >> 16), (uint8_t)(address >> 8),
+                                (uint8_t)address, (uint8_t)rng()};
+  if (deviceType == 0x10) {
+    frame.push_back(rng());
+  }
+  uint16_t crc = ETH200CodecRef::calcPacketCRC16r(frame.data(), frame.size(), (deviceType == 0x10) ? 0xC11F : 0xBDB7, 0x8408);
+  frame.push_back(crc >> 8);
+  frame.push_back(crc);
+  std::vector<uint8_t> reversed;
+  for (uint8_t b : frame) {
+    reversed.push_back(ETH200CodecRef::reverseByte(b));
+  }
+  std::vector<uint8_t> input = {(uint8_t)kernel};
+  switch (kernel) {
+    case kernelCalcPacketCRC16r:
+      input.insert(input.end(), {(uint8_t)(crc >> 8), (uint8_t)crc, 0x84, 0x08});
+      input.insert(input.end(), frame.begin(), frame.end());
+      break;
+    case kernelDestuffPayload: {
+      std::vector<uint8_t> fifo(CFG_ETH200MAXPACKETSIZE + 1, 0);
+      ETH200CodecRef::stuffPayload(reversed.data(), fifo.data(), reversed.size());
+      fifo.resize(CFG_ETH200MAXPACKETSIZE);
+      input.push_back(rng());
+      input.insert(input.end(), fifo.begin(), fifo.end());
+      break;
+    }
+    case kernelStuffPayload:
+      input.push_back(rng());
+      input.insert(input.end(), reversed.begin(), reversed.end());
+      break;
+    case kernelPackBits:
+      input.insert(input.end(), {(uint8_t)rng(), (uint8_t)(rng() % 8), (uint8_t)(8 + 8 * reversed.size() - rng() % 8)});
+      input.push_back(0x7E);
+      input.insert(input.end(), reversed.begin(), reversed.end());
+      break;
+    default:
+      input.insert(input.end(), frame.begin(), frame.end());
+      break;
+  }
+  return input;
+}
+
+// random bytes, biased to 0xFF/0x7E/0x00 so runs of 1s around the stuffing limit are frequent
+static std::vector<uint8_t> randomInput(size_t maxLen, std::mt19937 &rng) {
+  std::vector<uint8_t> input = {(uint8_t)(rng() % kernelCount)};
+  size_t length = rng() % (maxLen + 1) + 4;
+  const uint8_t biased[] = {0xFF, 0x7E, 0x00, 0x1F, 0xF8, 0xFE, 0x7F};
+  for (size_t i = 0; i < length; i++) {
+    uint32_t r = rng();
+    input.push_back(((r & 3) == 0) ? biased[(r >> 2) % sizeof(biased)] : (uint8_t)(r >> 8));
+  }
+  if (input[0] == kernelPackBits) {
+    input[2] %= 8;                           // pendingBits in its domain most of the time
+    input[3] = rng() % (min(length - 3, (size_t)31) * 8 + 1); // numBits within the packet
+  }
+  return input;
+}
+
+int main(int argc, char *argv[]) {
+  uint64_t iterations = 1000000;
+  boolean iterationsSet = false;
+  size_t maxLen = 40;
+  unsigned long seed = 1;
+  std::vector<std::string> files;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--iterations") && (i + 1 < argc)) {
+      iterations = strtoull(argv[++i], NULL, 10);
+      iterationsSet = true;
+    } else if ((arg == "--max-len") && (i + 1 < argc)) {
+      maxLen = min(max(1UL, strtoul(argv[++i], NULL, 10)), 250UL);
+    } else if ((arg == "--seed") && (i + 1 < argc)) {
+      seed = strtoul(argv[++i], NULL, 10);
+    } else if ((arg == "--crash-file") && (i + 1 < argc)) {
+      crashPath = argv[++i];
+    } else if (arg[0] != '-') {
+      files.push_back(arg);
+    } else {
+      fprintf(stderr, "usage: %s [--iterations n] [--max-len n] [--seed n] [--crash-file file] [input file ...]\n", argv[0]);
+      return 2;
+    }
+  }
+  if (!files.empty() && !iterationsSet) {
+    iterations = 0;
+  }
+
+  calibrateClock();
+  fuzzStart = std::chrono::steady_clock::now();
+  for (const std::string &path : files) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+      fprintf(stderr, "can't read %s\n", path.c_str());
+      return 2;
+    }
+    std::vector<uint8_t> input((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    fuzzOne(input.data(), input.size());
+  }
+  std::mt19937 rng(seed);
+  for (uint64_t i = 0; i < iterations; i++) {
+    // every 4th input is a real frame, the rest random
+    std::vector<uint8_t> input = ((i & 3) == 0) ? frameInput((fuzzKernel_t)(rng() % kernelCount), rng)
+                                                : randomInput(maxLen, rng);
+    fuzzOne(input.data(), input.size());
+  }
+  printReport();
+  return 0;
+}
+
+#endif // CODECFUZZ_LIBFUZZER
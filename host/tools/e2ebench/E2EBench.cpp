@@ -0,0 +1,480 @@
+/****************************************************************************
+E2EBench.cpp - End-to-end benchmark of the firmware under combined RX and
+cmd load, results as json.
+
+setup()/loop() of the firmware run unmodified over the simulated RFM69 and
+the in-process stub broker (PubSubClient.h). For --duration-s of virtual
+time the benchmark generates, both as Poisson arrivals:
+  - sensor events of --sensors random sensors, every event is a burst of
+    168 (window sensor) or 151 (remote control) frames injected into the
+    radio, frames arriving while the radio sends or the last frame wasn't
+    read yet are lost like on the device
+  - thermostat cmds on thermostat/<ID>/set/cmd for the first --thermostats
+    thermostats (010101, 020202, ...), picked from --cmd-mix
+Afterwards it runs until every cmd got its final get/ack and every
+captured event is published, then takes status/stats.
+
+Air collisions between the sensors aren't modelled, see LoadGen.cpp for
+that, here the sensors only compete for the receiver and the messages
+queue and with sending.
+
+The json on stdout (or --out) has:
+  - sensor: events sent/published/missing, frames lost while sending or
+    while the receiver wasn't ready, latency first frame -> json
+  - publish: MQTT publishes per virtual second, total and sensor events
+  - cmds: final status of every cmd (get/ack), queue wait (received ->
+    dequeued), latency (received -> txEnd), cmd queue high-water mark
+  - dropped: everything that got lost on the way in one place
+  - device: status/stats of the run, perf: the last status/perf
+  - heap: status/heap/<site> of the run, only with MXHEAPTRACK, see the
+    e2ebench_heaptrack env in platformio.ini
+  - wallS: host time of the run, only comparable on the same machine
+Latencies are virtual ms, p50/p90/p99/max.
+
+With --radio loopback the firmware runs over MXRadioLoopback instead of
+the simulated RFM69 (see MXRadio.h): the frames are queued as decoded
+packets, up to CFG_RADIO_LOOPBACK_SIZE, and sending only takes
+--airtime-us per repeat. That measures the pipeline and the scheduling
+without SPI and codec, the frame losses differ from the RFM69 run.
+
+  .pio/build/e2ebench/program [options]
+    --duration-s <n>       virtual time with load, default 600
+    --sensors <n>          number of sensors, default 20
+    --events-per-min <n>   sensor events of all sensors, default 4
+    --cmds-per-min <n>     thermostat cmds, default 2
+    --thermostats <n>      cmds go to the first n thermostats, default CFG_ETH200NUMTHERMOSTATS
+    --cmd-mix <cmd:w,...>  cmds and their weights, default
+                           DayMode:2,NightMode:2,+0.5:2,-0.5:2,21.5:1,WindowOpened:1
+    --period-ms <n>        frame period of the sensor bursts, default 60
+    --seed <n>             default 1
+    --radio <rfm69|loopback>  radio backend, default rfm69
+    --airtime-us <n>       loopback only, airtime of every repeat, default 0
+    --out <file>           writes the json to file instead of stdout
+****************************************************************************/
+
+#include <Arduino.h>
+#include <config.h>
+#include <MXRadio.h>
+#include <PubSubClient.h>
+#include <RFM69Model.h>
+#include <chrono>
+#include <ETH200RFM69.h>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define E2EBENCH_START_US 3000000 // load starts after setup() is done and MQTT is connected
+
+void setup();
+void loop();
+extern String mqtt_root; // main.cpp
+extern MXRadio* radioBackend; // main.cpp
+
+struct benchParams {
+  double durationS = 600;
+  uint32_t sensors = 20;
+  double eventsPerMin = 4;
+  double cmdsPerMin = 2;
+  uint32_t thermostats = CFG_ETH200NUMTHERMOSTATS;
+  std::string cmdMix = "DayMode:2,NightMode:2,+0.5:2,-0.5:2,21.5:1,WindowOpened:1";
+  double periodMs = 60;
+  unsigned long seed = 1;
+  std::string radio = "rfm69";
+  uint32_t airtimeUs = 0;
+};
+
+struct benchFrame {
+  uint64_t atUs;
+  uint8_t rssiValue;
+  std::vector<uint8_t> fifo;
+  std::vector<uint8_t> packet; // decoded, for the loopback backend
+};
+
+struct benchCmd {
+  uint64_t atUs;
+  std::string topic;
+  std::string value;
+};
+
+// encodes packets like ETH200RFM69::sendPacket, exposes its protected helpers
+class BenchCodec : public ETH200RFM69 {
+  public:
+    // fills in the CRC of data, returns the FIFO content a receiver would see
+    std::vector<uint8_t> encode(std::vector<uint8_t> &data) {
+      uint16_t crcStart = (data[1] == 0x10) ? 0xC11F : 0xBDB7; // RemoteControl : WindowSensor
+      uint8_t length = data.size();
+      uint16_t crc = calcPacketCRC16r(data.data(), length - 2, crcStart, 0x8408);
+      data[length - 2] = crc >> 8;
+      data[length - 1] = crc;
+      std::vector<uint8_t> reversed(length);
+      for (uint8_t i = 0; i < length; i++) {
+        reversed[i] = reverseByte(data[i]);
+      }
+      std::vector<uint8_t> fifo(CFG_ETH200MAXPACKETSIZE, 0);
+      stuffPayload(reversed.data(), fifo.data(), length);
+      return fifo;
+    }
+};
+
+static BenchCodec codec;
+static MXRadioLoopback loopback;
+static boolean useLoopback = false;
+static std::vector<benchFrame> frames; // sorted by atUs
+static size_t nextFrame = 0;
+static uint32_t framesLostTx = 0;      // the radio was sending
+static uint32_t framesLostBusy = 0;    // the last frame wasn't read yet
+
+// injects the frames which are due, runs whenever the virtual time advances, so the
+// frames arrive while the firmware is busy, sends or waits like on the device
+static void benchTimeHook(uint64_t nowUs) {
+  while ((nextFrame < frames.size()) && (frames[nextFrame].atUs <= nowUs)) {
+    const benchFrame &frame = frames[nextFrame++];
+    if (useLoopback) {
+      if (loopback.transmitting()) {
+        framesLostTx++;
+      } else if (!loopback.inject(frame.packet.data(), frame.packet.size(), -(int16_t)frame.rssiValue / 2)) {
+        framesLostBusy++;
+      }
+      continue;
+    }
+    if (!rfm69Model.injectPacket(frame.fifo.data(), frame.fifo.size(), frame.rssiValue)) {
+      if (((rfm69Model.peekReg(REG_OPMODE) >> 2) & 0x07) == (RF_OPMODE_TRANSMITTER >> 2)) {
+        framesLostTx++;
+      } else {
+        framesLostBusy++;
+      }
+    }
+  }
+}
+
+static void runUntil(uint64_t endUs) {
+  while (hostMicros64() < endUs) {
+    loop();
+  }
+}
+
+static std::vector<uint8_t> parseHex(const std::string &text) {
+  std::vector<uint8_t> bytes;
+  std::istringstream in(text);
+  std::string token;
+  while (in >> token) {
+    if ((token.length() != 2) || !isxdigit(token[0]) || !isxdigit(token[1])) {
+      break;
+    }
+    bytes.push_back(strtoul(token.c_str(), NULL, 16));
+  }
+  return bytes;
+}
+
+// value of a string or number field of a flat json object, empty if missing
+static std::string jsonField(const std::string &json, const std::string &key) {
+  size_t pos = json.find("\"" + key + "\":");
+  if (pos == std::string::npos) {
+    return "";
+  }
+  pos += key.length() + 3;
+  if ((pos < json.length()) && (json[pos] == '"')) {
+    size_t end = json.find('"', pos + 1);
+    return json.substr(pos + 1, end - pos - 1);
+  }
+  size_t end = json.find_first_of(",}", pos);
+  return json.substr(pos, end - pos);
+}
+
+static boolean endsWith(const std::string &text, const std::string &suffix) {
+  return (text.length() >= suffix.length()) && (text.compare(text.length() - suffix.length(), suffix.length(), suffix) == 0);
+}
+
+static uint32_t eventKey(const std::vector<uint8_t> &data) {
+  // the firmware merges packets with the same device ID and counter into one message
+  return (uint32_t)data[2] << 24 | (uint32_t)data[3] << 16 | (uint32_t)data[4] << 8 | data[0];
+}
+
+// {"n":12,"p50":..,"p90":..,"p99":..,"max":..} of values in us, as ms
+static std::string percentiles(std::vector<uint64_t> values) {
+  std::sort(values.begin(), values.end());
+  auto at = [&](double p) { return values.empty() ? 0.0 : values[(size_t)((values.size() - 1) * p)] / 1000.0; };
+  char json[160];
+  snprintf(json, sizeof(json), "{\"n\":%zu,\"p50\":%.1f,\"p90\":%.1f,\"p99\":%.1f,\"max\":%.1f}", values.size(), at(0.5),
+           at(0.9), at(0.99), at(1));
+  return json;
+}
+
+static std::string jsonString(const std::string &text) {
+  std::string quoted = "\"";
+  for (char c : text) {
+    if ((c == '"') || (c == '\\')) {
+      quoted += '\\';
+    }
+    quoted += c;
+  }
+  return quoted + "\"";
+}
+
+int main(int argc, char *argv[]) {
+  benchParams params;
+  std::string outPath;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--duration-s") && (i + 1 < argc)) {
+      params.durationS = atof(argv[++i]);
+    } else if ((arg == "--sensors") && (i + 1 < argc)) {
+      params.sensors = max(1UL, strtoul(argv[++i], NULL, 10));
+    } else if ((arg == "--events-per-min") && (i + 1 < argc)) {
+      params.eventsPerMin = atof(argv[++i]);
+    } else if ((arg == "--cmds-per-min") && (i + 1 < argc)) {
+      params.cmdsPerMin = atof(argv[++i]);
+    } else if ((arg == "--thermostats") && (i + 1 < argc)) {
+      params.thermostats = min(max(1UL, strtoul(argv[++i], NULL, 10)), (unsigned long)CFG_ETH200NUMTHERMOSTATS);
+    } else if ((arg == "--cmd-mix") && (i + 1 < argc)) {
+      params.cmdMix = argv[++i];
+    } else if ((arg == "--period-ms") && (i + 1 < argc)) {
+      params.periodMs = atof(argv[++i]);
+    } else if ((arg == "--seed") && (i + 1 < argc)) {
+      params.seed = strtoul(argv[++i], NULL, 10);
+    } else if ((arg == "--radio") && (i + 1 < argc) && ((std::string(argv[i + 1]) == "rfm69") || (std::string(argv[i + 1]) == "loopback"))) {
+      params.radio = argv[++i];
+    } else if ((arg == "--airtime-us") && (i + 1 < argc)) {
+      params.airtimeUs = strtoul(argv[++i], NULL, 10);
+    } else if ((arg == "--out") && (i + 1 < argc)) {
+      outPath = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--duration-s n] [--sensors n] [--events-per-min n] [--cmds-per-min n] "
+                      "[--thermostats n] [--cmd-mix cmd:w,...] [--period-ms n] [--seed n] [--radio rfm69|loopback] [--airtime-us n] [--out file]\n", argv[0]);
+      return 2;
+    }
+  }
+  std::vector<std::string> mixCmds;
+  std::vector<double> mixWeights;
+  std::istringstream mix(params.cmdMix);
+  std::string entry;
+  while (std::getline(mix, entry, ',')) {
+    size_t colon = entry.rfind(':');
+    mixCmds.push_back(entry.substr(0, colon));
+    mixWeights.push_back((colon == std::string::npos) ? 1 : atof(entry.c_str() + colon + 1));
+  }
+  if (mixCmds.empty()) {
+    fprintf(stderr, "--cmd-mix needs at least one cmd\n");
+    return 2;
+  }
+
+  // the load, both as Poisson arrivals
+  std::mt19937 rng(params.seed);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::discrete_distribution<size_t> pickCmd(mixWeights.begin(), mixWeights.end());
+  uint64_t loadEndUs = E2EBENCH_START_US + (uint64_t)(params.durationS * 1e6);
+  struct benchSensor {
+    uint32_t id;
+    boolean remote;
+    uint8_t counter;
+    uint8_t rssiValue;
+  };
+  std::vector<benchSensor> sensors;
+  std::set<uint32_t> ids;
+  while (sensors.size() < params.sensors) {
+    uint32_t id = rng() & 0xFFFFFF;
+    if ((id != 0) && ids.insert(id).second) {
+      sensors.push_back({id, uniform(rng) < 0.2, (uint8_t)rng(), (uint8_t)(100 + uniform(rng) * 90)});
+    }
+  }
+  std::map<uint32_t, uint64_t> events; // eventKey -> start of the first frame
+  if (params.eventsPerMin > 0) {
+    std::exponential_distribution<double> nextEvent(params.eventsPerMin / 60e6);
+    for (double at = E2EBENCH_START_US + nextEvent(rng); at < loadEndUs; at += nextEvent(rng)) {
+      benchSensor &sensor = sensors[rng() % sensors.size()];
+      std::vector<uint8_t> data = {sensor.counter++, (uint8_t)(sensor.remote ? 0x10 : 0x20), (uint8_t)(sensor.id >> 16),
+                                   (uint8_t)(sensor.id >> 8), (uint8_t)sensor.id};
+      if (sensor.remote) {
+        data.insert(data.end(), {(uint8_t)(0x42 + (rng() & 0x01)), 0x00}); // DayMode, NightMode
+      } else {
+        data.push_back(0x40 + (rng() & 0x01)); // WindowClosed, WindowOpened
+      }
+      data.insert(data.end(), {0, 0});
+      std::vector<uint8_t> fifo = codec.encode(data);
+      if (!events.insert({eventKey(data), (uint64_t)at}).second) {
+        continue; // the counter wrapped within the run, keep the first event
+      }
+      uint32_t repeats = sensor.remote ? 151 : 168;
+      for (uint32_t r = 0; r < repeats; r++) {
+        frames.push_back({(uint64_t)(at + r * params.periodMs * 1000), sensor.rssiValue, fifo, data});
+      }
+    }
+  }
+  std::stable_sort(frames.begin(), frames.end(), [](const benchFrame &a, const benchFrame &b) { return a.atUs < b.atUs; });
+  std::vector<benchCmd> cmds;
+  if (params.cmdsPerMin > 0) {
+    std::exponential_distribution<double> nextCmd(params.cmdsPerMin / 60e6);
+    for (double at = E2EBENCH_START_US + nextCmd(rng); at < loadEndUs; at += nextCmd(rng)) {
+      uint8_t thermostat = rng() % params.thermostats + 1;
+      char id[8];
+      snprintf(id, sizeof(id), "%02X%02X%02X", thermostat, thermostat, thermostat);
+      cmds.push_back({(uint64_t)at, std::string(mqtt_root.c_str()) + "/thermostat/" + id + "/set/cmd",
+                      mixCmds[pickCmd(rng)]});
+    }
+  }
+
+  rfm69Model.attach(CFG_RF69_SPI_CS, digitalPinToInterrupt(CFG_RF69_IRQ_PIN), CFG_RF69_RST_PIN);
+  useLoopback = (params.radio == "loopback");
+  if (useLoopback) {
+    loopback.setAirtime(params.airtimeUs);
+    radioBackend = &loopback;
+  }
+  hostAddTimeHook(benchTimeHook);
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+  setup();
+  runUntil(E2EBENCH_START_US);
+  std::string statsTopic = std::string(mqtt_root.c_str()) + "/set/stats";
+  mqttStubBroker.inject(statsTopic, "reset");
+  #ifdef MXHEAPTRACK
+    std::string heapTopic = std::string(mqtt_root.c_str()) + "/set/heap";
+    mqttStubBroker.inject(heapTopic, "reset");
+  #endif //MXHEAPTRACK
+  runUntil(hostMicros64() + 1000);
+  mqttStubBroker.clear();
+
+  // the cmds are handed to the broker when they are due, they queue up there while
+  // the firmware sends, like with a real broker
+  for (const benchCmd &cmd : cmds) {
+    runUntil(cmd.atUs);
+    mqttStubBroker.inject(cmd.topic, cmd.value);
+  }
+  runUntil(loadEndUs);
+  // drain, every cmd gets a final ack, latest after CFG_MQTTCMD_MAX_AGE
+  uint64_t drainLimitUs = loadEndUs + (CFG_MQTTCMD_MAX_AGE + (CFG_MESSAGE_DELAY + 60) * 1000ULL) * 1000;
+  size_t acks = 0;
+  while (hostMicros64() < drainLimitUs) {
+    runUntil(hostMicros64() + 1000000);
+    acks = 0;
+    for (const MQTTStubMessage &msg : mqttStubBroker.published) {
+      acks += endsWith(msg.topic, "/get/ack") ? 1 : 0;
+    }
+    uint64_t lastFrameUs = frames.empty() ? 0 : frames.back().atUs;
+    if ((acks >= cmds.size()) && (hostMicros64() > lastFrameUs + (CFG_MESSAGE_DELAY + 2) * 1000000ULL)) {
+      break;
+    }
+  }
+  uint64_t runEndUs = hostMicros64();
+  mqttStubBroker.inject(statsTopic, "1");
+  #ifdef MXHEAPTRACK
+    mqttStubBroker.inject(heapTopic, "1");
+  #endif //MXHEAPTRACK
+  runUntil(hostMicros64() + 1000);
+  double wallS = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+
+  // collect
+  std::string deviceStats = "{}";
+  std::string devicePerf = "{}";
+  std::string heapSites;
+  uint32_t publishes = 0;
+  uint32_t sensorPublishes = 0;
+  uint32_t falseEvents = 0;
+  std::set<uint32_t> published;
+  std::vector<uint64_t> eventLatencies;
+  std::map<std::string, uint32_t> cmdStatus;
+  std::vector<uint64_t> queueWaits;
+  std::vector<uint64_t> cmdLatencies;
+  std::vector<std::pair<uint64_t, int>> queueChanges; // (ms, +1/-1), for the cmd queue high-water mark
+  for (const MQTTStubMessage &msg : mqttStubBroker.published) {
+    if (endsWith(msg.topic, "/status/stats")) {
+      deviceStats = msg.payload;
+      continue;
+    }
+    if (endsWith(msg.topic, "/status/perf")) {
+      devicePerf = msg.payload;
+    }
+    size_t heapSite = msg.topic.find("/status/heap/");
+    if ((heapSite != std::string::npos) && (msg.timeUs > runEndUs)) {
+      heapSites += (heapSites.empty() ? "" : ",") + jsonString(msg.topic.substr(heapSite + 13)) + ":" + msg.payload;
+      continue;
+    }
+    if (msg.timeUs > runEndUs) {
+      continue;
+    }
+    publishes++;
+    if ((msg.topic.find("/sensor/") != std::string::npos) && endsWith(msg.topic, "/get")) {
+      sensorPublishes++;
+      std::vector<uint8_t> raw = parseHex(jsonField(msg.payload, "raw"));
+      auto it = (raw.size() >= 5) ? events.find(eventKey(raw)) : events.end();
+      if (it == events.end()) {
+        falseEvents++;
+      } else if (published.insert(it->first).second) {
+        eventLatencies.push_back(msg.timeUs - it->second);
+      }
+    } else if (endsWith(msg.topic, "/get/ack")) {
+      std::string status = jsonField(msg.payload, "status");
+      std::string reason = jsonField(msg.payload, "reason");
+      cmdStatus[reason.empty() ? status : status + ":" + reason]++;
+      uint64_t received = strtoull(jsonField(msg.payload, "received").c_str(), NULL, 10);
+      std::string dequeued = jsonField(msg.payload, "dequeued");
+      std::string txEnd = jsonField(msg.payload, "txEnd");
+      if (status != "rejected") {
+        // in the queue until it's dequeued, or until the ack for coalesced/expired cmds
+        uint64_t leftMs = dequeued.empty() ? msg.timeUs / 1000 : strtoull(dequeued.c_str(), NULL, 10);
+        queueChanges.push_back({received, +1});
+        queueChanges.push_back({leftMs, -1});
+      }
+      if (!dequeued.empty()) {
+        queueWaits.push_back((strtoull(dequeued.c_str(), NULL, 10) - received) * 1000);
+      }
+      if (!txEnd.empty()) {
+        cmdLatencies.push_back((strtoull(txEnd.c_str(), NULL, 10) - received) * 1000);
+      }
+    }
+  }
+  std::sort(queueChanges.begin(), queueChanges.end());
+  int queued = 0;
+  int cmdQueueMax = 0;
+  for (const auto &change : queueChanges) {
+    queued += change.second;
+    cmdQueueMax = max(cmdQueueMax, queued);
+  }
+  double virtualS = (runEndUs - E2EBENCH_START_US) / 1e6;
+  uint32_t missing = events.size() - published.size();
+  uint32_t cmdsDropped = 0;
+  std::string statusJson;
+  for (const auto &status : cmdStatus) {
+    if (status.first != "sent") {
+      cmdsDropped += status.second;
+    }
+    statusJson += (statusJson.empty() ? "" : ",") + jsonString(status.first) + ":" + std::to_string(status.second);
+  }
+
+  std::ostringstream json;
+  json << "{\"fwVersion\":" << jsonString(CFG_FW_VERSION)
+       << ",\"params\":{\"durationS\":" << params.durationS << ",\"sensors\":" << params.sensors
+       << ",\"eventsPerMin\":" << params.eventsPerMin << ",\"cmdsPerMin\":" << params.cmdsPerMin
+       << ",\"thermostats\":" << params.thermostats << ",\"cmdMix\":" << jsonString(params.cmdMix)
+       << ",\"periodMs\":" << params.periodMs << ",\"seed\":" << params.seed
+       << ",\"radio\":" << jsonString(params.radio) << ",\"airtimeUs\":" << params.airtimeUs << "}"
+       << ",\"virtualS\":" << virtualS << ",\"wallS\":" << wallS
+       << ",\"sensor\":{\"events\":" << events.size() << ",\"published\":" << published.size()
+       << ",\"missing\":" << missing << ",\"false\":" << falseEvents << ",\"frames\":" << frames.size()
+       << ",\"framesLostTx\":" << framesLostTx << ",\"framesLostBusy\":" << framesLostBusy
+       << ",\"latencyMs\":" << percentiles(eventLatencies) << "}"
+       << ",\"publish\":{\"messages\":" << publishes << ",\"perS\":" << publishes / virtualS
+       << ",\"sensorEvents\":" << sensorPublishes << ",\"sensorEventsPerS\":" << sensorPublishes / virtualS << "}"
+       << ",\"cmds\":{\"injected\":" << cmds.size() << ",\"acked\":" << acks << ",\"status\":{" << statusJson << "}"
+       << ",\"queueWaitMs\":" << percentiles(queueWaits) << ",\"latencyMs\":" << percentiles(cmdLatencies)
+       << ",\"queueMax\":" << cmdQueueMax << "}"
+       << ",\"dropped\":{\"sensorEvents\":" << missing << ",\"frames\":" << framesLostTx + framesLostBusy
+       << ",\"messagesQueue\":" << (jsonField(deviceStats, "queueDrops").empty() ? "0" : jsonField(deviceStats, "queueDrops"))
+       << ",\"cmds\":" << cmdsDropped + (cmds.size() - acks) << "}"
+       << ",\"device\":" << deviceStats << ",\"perf\":" << devicePerf;
+  if (!heapSites.empty()) {
+    json << ",\"heap\":{" << heapSites << "}";
+  }
+  json << "}\n";
+  if (outPath.empty()) {
+    fputs(json.str().c_str(), stdout);
+  } else {
+    FILE *out = fopen(outPath.c_str(), "w");
+    if ((out == NULL) || (fputs(json.str().c_str(), out) < 0) || (fclose(out) != 0)) {
+      fprintf(stderr, "writing %s failed\n", outPath.c_str());
+      return 2;
+    }
+  }
+  return 0;
+}
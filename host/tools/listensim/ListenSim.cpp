@@ -0,0 +1,276 @@
+/****************************************************************************
+ListenSim.cpp - Monte Carlo simulation of the thermostat listen windows to
+pick the number of TX repeats.
+
+The thermostats don't listen all the time, they wake up about every 5 s
+and look for a sync word for a short time. A cmd has to cover one wake up
+to be received at all, if it covers two wake ups the thermostat acts twice,
+which is harmless for DayMode/NightMode/window states but doubles a
+relative temperature step.
+
+Frame timing is taken from the firmware itself: one window sensor and one
+remote control cmd are sent with ETH200RFM69::sendPacket() over the
+simulated RFM69 and decoded with ETH200Receiver (see VirtualThermostat.cpp).
+That gives the start of the first frame, the frame period and which of the
+repeats are broken on air. A sweep then sends N repeats with an additional
+gap between the frames, the pattern of broken repeats is kept.
+
+Thermostat model per trial:
+  - wake up period wake * (1 + drift), drift uniform in +-drift-pct, the
+    first wake up uniform within one period after the TX started
+  - at every wake up it listens for listen-ms, every frame whose sync word
+    starts inside that window is tried until one is received
+  - a repeat which is fine on air is received with probability p-frame
+  - delivered: at least one wake up received the cmd, double: two or more
+
+For every frame type and gap the minimum repeats with delivered >= target
+are reported, for relative temperatures additionally the maximum repeats
+with double <= max-double, so there is a window of repeats or not.
+
+  .pio/build/listensim/program [options]
+    --wake-ms <n>      wake up period, default 5000
+    --drift-pct <n>    max deviation of the wake up period, default 2
+    --listen-ms <n>    listen window after a wake up, default 50
+    --p-frame <n>      reception probability of a fine frame, default 0.95
+    --repeats <a:b:s>  sweep of the repeats, default 50:450:10
+    --gaps <a,b,...>   additional gaps between the frames in ms, default 0,5,20
+    --trials <n>       trials per point, default 20000
+    --target <n>       delivery probability to reach, default 0.99
+    --max-double <n>   accepted double trigger probability for relative
+                       temperatures, default 0.001
+    --seed <n>         default 1
+    --csv              the curves as csv instead of tables
+****************************************************************************/
+
+#include <Arduino.h>
+#include <config.h>
+#include <ETH200RFM69.h>
+#include <ETH200Receiver.h>
+#include <RFM69Model.h>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+extern ETH200RFM69 radio; // main.cpp
+
+// frame timing of one frame type as it is on air
+struct listenFrameTiming {
+  const char *name;
+  double firstMs = 0;         // start of the first repeat after the TX started
+  double periodMs = 0;        // start to start of two repeats
+  std::vector<boolean> fine;  // per repeat, false if it's broken on air
+};
+
+struct listenParams {
+  double wakeMs = 5000;
+  double driftPct = 2;
+  double listenMs = 50;
+  double pFrame = 0.95;
+  uint32_t trials = 20000;
+};
+
+struct listenResult {
+  double delivered = 0;
+  double doubled = 0;
+};
+
+// sends one cmd with the firmware and decodes it like a thermostat
+static listenFrameTiming measureTiming(const char *name, uint8_t deviceType, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize) {
+  listenFrameTiming timing;
+  timing.name = name;
+  rfm69Model.clearTx();
+  radio.sendPacket(deviceType, 0x010101, cmd, cmds, cmdsSize);
+  ETH200Receiver receiver;
+  receiver.decode(rfm69Model.txChips);
+  double chipMs = (rfm69Model.txLastChipUs - rfm69Model.txFirstChipUs) / 1000.0 / rfm69Model.txChips.size();
+  std::vector<double> starts;
+  for (eth200Frame &frame : receiver.frames) {
+    if (frame.status == frameValid) {
+      starts.push_back(frame.startChip * chipMs);
+    }
+  }
+  if (starts.size() < 2) {
+    return timing;
+  }
+  std::vector<double> periods;
+  for (size_t i = 1; i < starts.size(); i++) {
+    periods.push_back(starts[i] - starts[i - 1]);
+  }
+  std::sort(periods.begin(), periods.end());
+  timing.periodMs = periods[periods.size() / 2];
+  timing.firstMs = starts[0];
+  // every repeat up to the last valid one, fine if a valid frame starts in its slot
+  size_t numRepeats = (size_t)((starts.back() - starts[0]) / timing.periodMs + 1.5);
+  timing.fine.assign(numRepeats, false);
+  for (double start : starts) {
+    size_t repeat = (size_t)((start - starts[0]) / timing.periodMs + 0.5);
+    if (repeat < numRepeats) {
+      timing.fine[repeat] = true;
+    }
+  }
+  return timing;
+}
+
+// from the start of the TX until the last repeat is out
+static double durationMs(const listenFrameTiming &timing, uint32_t repeats, double gapMs) {
+  return timing.firstMs + repeats * (timing.periodMs + gapMs);
+}
+
+// time the transmitter is on, the gaps don't count
+static double airtimeMs(const listenFrameTiming &timing, uint32_t repeats) {
+  return timing.firstMs + repeats * timing.periodMs;
+}
+
+static listenResult simulate(const listenFrameTiming &timing, uint32_t repeats, double gapMs,
+                             const listenParams &params, std::mt19937 &rng) {
+  std::uniform_real_distribution<double> uniform(0, 1);
+  double periodMs = timing.periodMs + gapMs;
+  double txEndMs = durationMs(timing, repeats, gapMs);
+  uint32_t delivered = 0;
+  uint32_t doubled = 0;
+  for (uint32_t trial = 0; trial < params.trials; trial++) {
+    double wakeMs = params.wakeMs * (1 + (uniform(rng) * 2 - 1) * params.driftPct / 100);
+    uint32_t received = 0;
+    for (double wake = uniform(rng) * wakeMs; wake < txEndMs; wake += wakeMs) {
+      // first repeat starting inside the listen window
+      double first = ceil((wake - timing.firstMs) / periodMs);
+      for (double repeat = max(0.0, first); repeat < repeats; repeat++) {
+        double start = timing.firstMs + repeat * periodMs;
+        if (start > wake + params.listenMs) {
+          break;
+        }
+        if (timing.fine[(size_t)repeat % timing.fine.size()] && (uniform(rng) < params.pFrame)) {
+          received++;
+          break;
+        }
+      }
+    }
+    delivered += (received > 0) ? 1 : 0;
+    doubled += (received > 1) ? 1 : 0;
+  }
+  listenResult result;
+  result.delivered = (double)delivered / params.trials;
+  result.doubled = (double)doubled / params.trials;
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  listenParams params;
+  uint32_t repeatsFrom = 50;
+  uint32_t repeatsTo = 450;
+  uint32_t repeatsStep = 10;
+  std::vector<double> gaps = {0, 5, 20};
+  double target = 0.99;
+  double maxDouble = 0.001;
+  unsigned long seed = 1;
+  boolean csv = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--wake-ms") && (i + 1 < argc)) {
+      params.wakeMs = atof(argv[++i]);
+    } else if ((arg == "--drift-pct") && (i + 1 < argc)) {
+      params.driftPct = atof(argv[++i]);
+    } else if ((arg == "--listen-ms") && (i + 1 < argc)) {
+      params.listenMs = atof(argv[++i]);
+    } else if ((arg == "--p-frame") && (i + 1 < argc)) {
+      params.pFrame = atof(argv[++i]);
+    } else if ((arg == "--trials") && (i + 1 < argc)) {
+      params.trials = max(1UL, strtoul(argv[++i], NULL, 10));
+    } else if ((arg == "--repeats") && (i + 1 < argc)) {
+      if (sscanf(argv[++i], "%u:%u:%u", &repeatsFrom, &repeatsTo, &repeatsStep) != 3 || (repeatsStep == 0)) {
+        fprintf(stderr, "--repeats needs from:to:step\n");
+        return 2;
+      }
+    } else if ((arg == "--gaps") && (i + 1 < argc)) {
+      gaps.clear();
+      std::istringstream list(argv[++i]);
+      std::string gap;
+      while (std::getline(list, gap, ',')) {
+        gaps.push_back(atof(gap.c_str()));
+      }
+    } else if ((arg == "--target") && (i + 1 < argc)) {
+      target = atof(argv[++i]);
+    } else if ((arg == "--max-double") && (i + 1 < argc)) {
+      maxDouble = atof(argv[++i]);
+    } else if ((arg == "--seed") && (i + 1 < argc)) {
+      seed = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "--csv") {
+      csv = true;
+    } else {
+      fprintf(stderr, "usage: %s [--wake-ms n] [--drift-pct n] [--listen-ms n] [--p-frame n] [--repeats a:b:s] "
+                      "[--gaps a,b,...] [--trials n] [--target n] [--max-double n] [--seed n] [--csv]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  rfm69Model.attach(CFG_RF69_SPI_CS, digitalPinToInterrupt(CFG_RF69_IRQ_PIN), CFG_RF69_RST_PIN);
+  radio.initialize();
+  radio.setPowerLevel(CFG_RF69_POWERLEVEL);
+  uint8_t dayMode[1] = {0x00};
+  std::vector<listenFrameTiming> timings = {
+    measureTiming("WindowSensor", 0x20, 0x41, NULL, 0),
+    measureTiming("RemoteControl", 0x10, 0x42, dayMode, 1),
+  };
+  for (listenFrameTiming &timing : timings) {
+    if (timing.fine.empty()) {
+      fprintf(stderr, "no valid frames on air for %s, check with the thermostat tool\n", timing.name);
+      return 1;
+    }
+  }
+
+  std::mt19937 rng(seed);
+  if (csv) {
+    printf("frame,gap_ms,repeats,duration_ms,airtime_ms,delivered,double\n");
+  } else {
+    printf("thermostat: wake up every %.0f ms +-%.1f%%, listens %.0f ms, frame received with p %.3f, %u trials\n",
+           params.wakeMs, params.driftPct, params.listenMs, params.pFrame, params.trials);
+    for (listenFrameTiming &timing : timings) {
+      uint32_t fine = std::count(timing.fine.begin(), timing.fine.end(), true);
+      printf("%-13s: first frame at %.1f ms, period %.2f ms, %u of %zu repeats fine on air\n", timing.name,
+             timing.firstMs, timing.periodMs, fine, timing.fine.size());
+    }
+  }
+  for (listenFrameTiming &timing : timings) {
+    for (double gap : gaps) {
+      uint32_t minRepeats = 0;
+      uint32_t maxRepeatsRelative = 0;
+      if (!csv) {
+        printf("\n%s, gap %.1f ms\n%8s %12s %11s %10s %10s\n", timing.name, gap, "repeats", "duration ms", "airtime ms",
+               "delivered", "double");
+      }
+      for (uint32_t repeats = repeatsFrom; repeats <= repeatsTo; repeats += repeatsStep) {
+        listenResult result = simulate(timing, repeats, gap, params, rng);
+        if (csv) {
+          printf("%s,%.1f,%u,%.0f,%.0f,%.5f,%.5f\n", timing.name, gap, repeats, durationMs(timing, repeats, gap),
+                 airtimeMs(timing, repeats), result.delivered, result.doubled);
+        } else {
+          printf("%8u %12.0f %11.0f %10.5f %10.5f%s\n", repeats, durationMs(timing, repeats, gap), airtimeMs(timing, repeats),
+                 result.delivered, result.doubled,
+                 (repeats == CFG_ETH200NUMPACKETSENDREPEATS) ? "  <- CFG_ETH200NUMPACKETSENDREPEATS" : "");
+        }
+        if ((minRepeats == 0) && (result.delivered >= target)) {
+          minRepeats = repeats;
+        }
+        if (result.doubled <= maxDouble) {
+          maxRepeatsRelative = repeats;
+        }
+      }
+      if (csv) {
+        continue;
+      }
+      if (minRepeats == 0) {
+        printf("  delivered >= %.4f not reached up to %u repeats\n", target, repeatsTo);
+        continue;
+      }
+      printf("  min repeats for delivered >= %.4f: %u (%.0f ms airtime, %.0f ms duration)\n", target, minRepeats,
+             airtimeMs(timing, minRepeats), durationMs(timing, minRepeats, gap));
+      if (maxRepeatsRelative >= minRepeats) {
+        printf("  relative temperature: %u ... %u repeats keep double <= %.4f\n", minRepeats, maxRepeatsRelative, maxDouble);
+      } else {
+        printf("  relative temperature: no repeat count reaches the target with double <= %.4f\n", maxDouble);
+      }
+    }
+  }
+  return 0;
+}
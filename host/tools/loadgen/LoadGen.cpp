@@ -0,0 +1,444 @@
+/****************************************************************************
+LoadGen.cpp - Synthetic multi sensor RF load for the firmware RX pipeline.
+
+N sensors with random IDs, communication counters and signal strengths
+send their events as bursts of repeated frames (168 per window sensor
+event, 151 per remote control event, like the real ones). The bursts of
+different sensors interleave and collide on air. The resulting frames are
+injected into the simulated RFM69 while setup()/loop() of the firmware run
+unmodified, so the frames take the real path interruptHandler ->
+convertPacket2Message -> pushMessages -> publishMessagesMQTT.
+
+Air model, per frame:
+  - on air from its start for preamble + sync + PayloadLength Manchester
+    bytes at the configured bit rate (taken from the radio registers)
+  - the receiver locks on the first sync word, a frame starting while it is
+    locked is lost (collided)
+  - a locked frame overlapped by any other frame which isn't at least
+    capture-db weaker gets garbage from the start of the overlap on, so it
+    reaches the FIFO with a CRC error
+  - every bit of a locked frame is flipped with probability ber
+  - the frame is injected at its end, the model drops it if the firmware
+    didn't read the last one yet (not ready)
+
+The sensor counts are run one after the other, every run ends after the
+last message was published and takes the counters from status/stats.
+The report has per sensor count:
+  - events sent and captured (published with the right content), frames
+    sent, collided, corrupted by a collision, lost because the receiver
+    wasn't ready, CRC errors seen by the firmware
+  - queueMax/queueDrops of the messages queue (CFG_MESSAGES_SIZE)
+  - latency from the start of the first frame on air to the published json
+    and to the first frame the firmware got (rxUs), p50/p95/max
+
+  .pio/build/loadgen/program [options]
+    --sensors <a,b,...>  sensor counts, default 1,2,5,10,20,40
+    --events <n>         events per sensor, default 1
+    --window-s <n>       the events start uniformly within this time, default 60
+    --remote-pct <n>     share of remote controls, default 20
+    --period-ms <n>      frame period within a burst, default 60
+    --rssi <a:b>         range of the sensor signal strength in dBm, default -95:-50
+    --capture-db <n>     a locked frame survives an overlap this much weaker, default 6
+    --ber <n>            bit error rate of the locked frames, default 0.0001
+    --seed <n>           default 1
+    --csv                one csv line per sensor count instead of the table
+
+A published event which wasn't sent is a corrupted frame with a correct
+CRC by chance (false), expected about once per 65536 corrupted frames.
+****************************************************************************/
+
+#include <Arduino.h>
+#include <config.h>
+#include <ETH200RFM69.h>
+#include <PubSubClient.h>
+#include <RFM69Model.h>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define LOADGEN_START_US 3000000 // first run after setup() is done and MQTT is connected
+#define LOADGEN_RUN_GAP_US 1000000
+
+void setup();
+void loop();
+extern String mqtt_root; // main.cpp
+
+struct loadParams {
+  unsigned long events = 1;
+  double windowS = 60;
+  double remotePct = 20;
+  double periodMs = 60;
+  double rssiFrom = -95;
+  double rssiTo = -50;
+  double captureDb = 6;
+  double ber = 0.0001;
+};
+
+struct loadEvent {
+  std::vector<uint8_t> data; // the packet incl. CRC
+  uint64_t firstUs;          // start of the first frame on air
+  uint32_t publishes = 0;
+};
+
+struct loadFrame {
+  uint64_t startUs;
+  uint64_t endUs;
+  double rssi;               // in dBm
+  size_t event;
+  std::vector<uint8_t> fifo; // zero stuffed, what reaches the FIFO
+  boolean locked = false;    // the receiver synced on it
+};
+
+struct loadResult {
+  uint32_t sensors = 0;
+  uint32_t sent = 0;
+  uint32_t captured = 0;
+  uint32_t wrong = 0;         // published events which weren't sent, false decodes
+  uint32_t frames = 0;
+  uint32_t collided = 0;
+  uint32_t corrupted = 0;
+  uint32_t notReady = 0;
+  std::string stats;         // status/stats json of the run
+  std::vector<uint64_t> latencies;
+  std::vector<uint64_t> firstRx;
+};
+
+// encodes packets like ETH200RFM69::sendPacket, exposes its protected helpers
+class LoadCodec : public ETH200RFM69 {
+  public:
+    // fills in the CRC of data, returns the FIFO content a receiver would see
+    std::vector<uint8_t> encode(std::vector<uint8_t> &data) {
+      uint16_t crcStart = (data[1] == 0x10) ? 0xC11F : 0xBDB7; // RemoteControl : WindowSensor
+      uint8_t length = data.size();
+      uint16_t crc = calcPacketCRC16r(data.data(), length - 2, crcStart, 0x8408);
+      data[length - 2] = crc >> 8;
+      data[length - 1] = crc;
+      std::vector<uint8_t> reversed(length);
+      for (uint8_t i = 0; i < length; i++) {
+        reversed[i] = reverseByte(data[i]);
+      }
+      std::vector<uint8_t> fifo(CFG_ETH200MAXPACKETSIZE, 0);
+      stuffPayload(reversed.data(), fifo.data(), length);
+      return fifo;
+    }
+};
+
+static LoadCodec codec;
+static std::vector<loadFrame> frames;  // sorted by endUs, the injection order
+static size_t nextFrame = 0;
+static uint32_t framesNotReady = 0;
+
+// injects the frames which are due, runs whenever the virtual time advances, so the
+// frames arrive while the firmware is busy or waits like on the device
+static void loadTimeHook(uint64_t nowUs) {
+  while ((nextFrame < frames.size()) && (frames[nextFrame].endUs <= nowUs)) {
+    const loadFrame &frame = frames[nextFrame++];
+    if (frame.locked && !rfm69Model.injectPacket(frame.fifo.data(), frame.fifo.size(), (uint8_t)(-2 * frame.rssi))) {
+      framesNotReady++;
+    }
+  }
+}
+
+static void runUntil(uint64_t endUs) {
+  while (hostMicros64() < endUs) {
+    loop();
+  }
+}
+
+static std::vector<uint8_t> parseHex(const std::string &text) {
+  std::vector<uint8_t> bytes;
+  std::istringstream in(text);
+  std::string token;
+  while (in >> token) {
+    if ((token.length() != 2) || !isxdigit(token[0]) || !isxdigit(token[1])) {
+      break;
+    }
+    bytes.push_back(strtoul(token.c_str(), NULL, 16));
+  }
+  return bytes;
+}
+
+// value of a string or number field of a flat json object, empty if missing
+static std::string jsonField(const std::string &json, const std::string &key) {
+  size_t pos = json.find("\"" + key + "\":");
+  if (pos == std::string::npos) {
+    return "";
+  }
+  pos += key.length() + 3;
+  if ((pos < json.length()) && (json[pos] == '"')) {
+    size_t end = json.find('"', pos + 1);
+    return json.substr(pos + 1, end - pos - 1);
+  }
+  size_t end = json.find_first_of(",}", pos);
+  return json.substr(pos, end - pos);
+}
+
+static uint32_t eventKey(const std::vector<uint8_t> &data) {
+  // the firmware merges packets with the same device ID and counter into one message
+  return (uint32_t)data[2] << 24 | (uint32_t)data[3] << 16 | (uint32_t)data[4] << 8 | data[0];
+}
+
+static uint64_t percentile(const std::vector<uint64_t> &sorted, double p) {
+  return sorted.empty() ? 0 : sorted[(size_t)((sorted.size() - 1) * p)];
+}
+
+// on air time of a frame and of one payload byte, from the radio registers
+static void frameTiming(double &frameUs, double &payloadByteUs, double &headerUs) {
+  double bitRate = 32e6 / (rfm69Model.peekReg(REG_BITRATEMSB) << 8 | rfm69Model.peekReg(REG_BITRATELSB));
+  uint32_t preamble = rfm69Model.peekReg(REG_PREAMBLEMSB) << 8 | rfm69Model.peekReg(REG_PREAMBLELSB);
+  uint32_t sync = ((rfm69Model.peekReg(REG_SYNCCONFIG) >> 3) & 0x07) + 1;
+  // the preamble and the sync word are raw chips, the payload is Manchester encoded
+  headerUs = (preamble + sync) * 8 * 1e6 / bitRate;
+  payloadByteUs = 16 * 1e6 / bitRate;
+  frameUs = headerUs + rfm69Model.peekReg(REG_PAYLOADLENGTH) * payloadByteUs;
+}
+
+// builds the bursts of all sensors and decides per frame what the receiver gets
+static std::map<uint32_t, loadEvent> schedule(uint32_t sensors, const loadParams &params, uint64_t startUs,
+                                              std::mt19937 &rng, loadResult &result) {
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::normal_distribution<double> fading(0, 2);
+  double frameUs, payloadByteUs, headerUs;
+  frameTiming(frameUs, payloadByteUs, headerUs);
+
+  std::map<uint32_t, loadEvent> events;
+  std::set<uint32_t> ids;
+  std::vector<loadEvent> eventList;
+  frames.clear();
+  nextFrame = 0;
+  for (uint32_t s = 0; s < sensors; s++) {
+    uint32_t id;
+    do {
+      id = rng() & 0xFFFFFF;
+    } while ((id == 0) || !ids.insert(id).second);
+    boolean remote = uniform(rng) * 100 < params.remotePct;
+    double rssi = params.rssiFrom + uniform(rng) * (params.rssiTo - params.rssiFrom);
+    uint8_t counter = rng();
+    uint32_t repeats = remote ? 151 : 168;
+    for (unsigned long e = 0; e < params.events; e++) {
+      std::vector<uint8_t> data = {counter++, (uint8_t)(remote ? 0x10 : 0x20), (uint8_t)(id >> 16), (uint8_t)(id >> 8),
+                                   (uint8_t)id};
+      if (remote) {
+        data.push_back(0x42 + (rng() & 0x01)); // DayMode, NightMode
+        data.push_back(0x00);
+      } else {
+        data.push_back(0x40 + (rng() & 0x01)); // WindowClosed, WindowOpened
+      }
+      data.push_back(0);
+      data.push_back(0);
+      std::vector<uint8_t> fifo = codec.encode(data);
+      loadEvent event;
+      event.data = data;
+      event.firstUs = startUs + (uint64_t)(uniform(rng) * params.windowS * 1e6);
+      // the sensors don't use a crystal, the period differs a bit from sensor to sensor
+      double periodUs = params.periodMs * 1000 * (0.95 + uniform(rng) * 0.1);
+      for (uint32_t r = 0; r < repeats; r++) {
+        loadFrame frame;
+        frame.startUs = event.firstUs + (uint64_t)(r * periodUs);
+        frame.endUs = frame.startUs + (uint64_t)frameUs;
+        frame.rssi = rssi + fading(rng);
+        frame.event = eventList.size();
+        frame.fifo = fifo;
+        frames.push_back(frame);
+      }
+      eventList.push_back(event);
+    }
+  }
+
+  // the receiver locks on the first sync word and is busy until the end of that frame
+  std::sort(frames.begin(), frames.end(), [](const loadFrame &a, const loadFrame &b) { return a.startUs < b.startUs; });
+  uint64_t lockedUntil = 0;
+  for (loadFrame &frame : frames) {
+    if (frame.startUs >= lockedUntil) {
+      frame.locked = true;
+      lockedUntil = frame.endUs;
+    } else {
+      result.collided++;
+    }
+  }
+  // every frame overlapping a locked one which isn't capture-db weaker destroys its tail
+  for (size_t i = 0; i < frames.size(); i++) {
+    loadFrame &frame = frames[i];
+    if (!frame.locked) {
+      continue;
+    }
+    uint64_t overlapUs = frame.endUs;
+    // all frames are equally long, so the earlier ones still on air are right before it
+    for (size_t j = i; (j-- > 0) && (frames[j].endUs > frame.startUs);) {
+      if (frames[j].rssi > frame.rssi - params.captureDb) {
+        overlapUs = frame.startUs;
+      }
+    }
+    for (size_t j = i + 1; (j < frames.size()) && (frames[j].startUs < frame.endUs); j++) {
+      if (frames[j].rssi > frame.rssi - params.captureDb) {
+        overlapUs = min(overlapUs, frames[j].startUs);
+      }
+    }
+    if (overlapUs < frame.endUs) {
+      result.corrupted++;
+      double payloadUs = (overlapUs > frame.startUs + headerUs) ? overlapUs - frame.startUs - headerUs : 0;
+      for (size_t b = (size_t)(payloadUs / payloadByteUs); b < frame.fifo.size(); b++) {
+        frame.fifo[b] ^= rng();
+      }
+    }
+    for (uint8_t &b : frame.fifo) {
+      for (uint8_t bit = 0; bit < 8; bit++) {
+        if (uniform(rng) < params.ber) {
+          b ^= 1 << bit;
+        }
+      }
+    }
+  }
+  std::sort(frames.begin(), frames.end(), [](const loadFrame &a, const loadFrame &b) { return a.endUs < b.endUs; });
+
+  for (loadEvent &event : eventList) {
+    events[eventKey(event.data)] = event;
+  }
+  result.sent = eventList.size();
+  result.frames = frames.size();
+  return events;
+}
+
+static loadResult runLoad(uint32_t sensors, const loadParams &params, std::mt19937 &rng) {
+  loadResult result;
+  result.sensors = sensors;
+  uint64_t startUs = hostMicros64() + LOADGEN_RUN_GAP_US;
+  std::map<uint32_t, loadEvent> events = schedule(sensors, params, startUs, rng, result);
+  framesNotReady = 0;
+  mqttStubBroker.clear();
+  runUntil(frames.back().endUs + (CFG_MESSAGE_DELAY + 2) * 1000000ULL);
+
+  // the counters of this run, the reset starts the next one from 0
+  mqttStubBroker.inject(std::string(mqtt_root.c_str()) + "/set/stats", "reset");
+  runUntil(hostMicros64() + 100000);
+  result.notReady = framesNotReady;
+
+  for (const MQTTStubMessage &msg : mqttStubBroker.published) {
+    if (msg.topic.compare(msg.topic.length() - 13, 13, "/status/stats") == 0) {
+      result.stats = msg.payload;
+      continue;
+    }
+    if ((msg.topic.find("/sensor/") == std::string::npos) || (msg.topic.compare(msg.topic.length() - 4, 4, "/get") != 0)) {
+      continue;
+    }
+    std::vector<uint8_t> raw = parseHex(jsonField(msg.payload, "raw"));
+    if (raw.size() < 5) {
+      continue;
+    }
+    auto it = events.find(eventKey(raw));
+    if ((it == events.end()) || (raw != it->second.data)) {
+      // a corrupted frame which passed the CRC, 1 in 65536 of them
+      result.wrong++;
+      continue;
+    }
+    loadEvent &event = it->second;
+    if (event.publishes++ == 0) {
+      result.captured++;
+      result.latencies.push_back(msg.timeUs - event.firstUs);
+      // rxUs is micros() of the device, the low 32 bit of the virtual time
+      uint32_t rxUs = strtoul(jsonField(msg.payload, "rxUs").c_str(), NULL, 10);
+      result.firstRx.push_back((uint32_t)(rxUs - (uint32_t)event.firstUs));
+    }
+  }
+  std::sort(result.latencies.begin(), result.latencies.end());
+  std::sort(result.firstRx.begin(), result.firstRx.end());
+  return result;
+}
+
+int main(int argc, char *argv[]) {
+  loadParams params;
+  std::vector<uint32_t> sensorCounts = {1, 2, 5, 10, 20, 40};
+  unsigned long seed = 1;
+  boolean csv = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--sensors") && (i + 1 < argc)) {
+      sensorCounts.clear();
+      std::istringstream list(argv[++i]);
+      std::string count;
+      while (std::getline(list, count, ',')) {
+        sensorCounts.push_back(max(1UL, strtoul(count.c_str(), NULL, 10)));
+      }
+    } else if ((arg == "--events") && (i + 1 < argc)) {
+      params.events = max(1UL, strtoul(argv[++i], NULL, 10));
+    } else if ((arg == "--window-s") && (i + 1 < argc)) {
+      params.windowS = atof(argv[++i]);
+    } else if ((arg == "--remote-pct") && (i + 1 < argc)) {
+      params.remotePct = atof(argv[++i]);
+    } else if ((arg == "--period-ms") && (i + 1 < argc)) {
+      params.periodMs = atof(argv[++i]);
+    } else if ((arg == "--rssi") && (i + 1 < argc)) {
+      if (sscanf(argv[++i], "%lf:%lf", &params.rssiFrom, &params.rssiTo) != 2) {
+        fprintf(stderr, "--rssi needs from:to in dBm\n");
+        return 2;
+      }
+    } else if ((arg == "--capture-db") && (i + 1 < argc)) {
+      params.captureDb = atof(argv[++i]);
+    } else if ((arg == "--ber") && (i + 1 < argc)) {
+      params.ber = atof(argv[++i]);
+    } else if ((arg == "--seed") && (i + 1 < argc)) {
+      seed = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "--csv") {
+      csv = true;
+    } else {
+      fprintf(stderr, "usage: %s [--sensors a,b,...] [--events n] [--window-s n] [--remote-pct n] [--period-ms n] "
+                      "[--rssi a:b] [--capture-db n] [--ber n] [--seed n] [--csv]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  rfm69Model.attach(CFG_RF69_SPI_CS, digitalPinToInterrupt(CFG_RF69_IRQ_PIN), CFG_RF69_RST_PIN);
+  hostAddTimeHook(loadTimeHook);
+  setup();
+  runUntil(LOADGEN_START_US);
+  mqttStubBroker.inject(std::string(mqtt_root.c_str()) + "/set/stats", "reset");
+  runUntil(hostMicros64() + 100000);
+
+  std::mt19937 rng(seed);
+  double frameUs, payloadByteUs, headerUs;
+  frameTiming(frameUs, payloadByteUs, headerUs);
+  if (csv) {
+    printf("sensors,events,captured,false,frames,collided,corrupted,not_ready,crc_errors,queue_max,queue_drops,"
+           "latency_p50_ms,latency_p95_ms,latency_max_ms,first_rx_p50_ms,first_rx_max_ms\n");
+  } else {
+    printf("%lu event(s) per sensor within %.0f s, %.0f ms frame period, %.1f ms on air per frame, %.0f%% remote controls\n",
+           params.events, params.windowS, params.periodMs, frameUs / 1000, params.remotePct);
+    printf("rssi %.0f ... %.0f dBm, capture %.0f dB, ber %g, CFG_MESSAGES_SIZE %u, CFG_MESSAGE_DELAY %us\n\n",
+           params.rssiFrom, params.rssiTo, params.captureDb, params.ber, CFG_MESSAGES_SIZE, CFG_MESSAGE_DELAY);
+    printf("%7s %16s %5s %7s %8s %9s %9s %7s %10s %11s %20s %16s\n", "sensors", "events capt/sent", "false", "frames",
+           "collided", "corrupted", "not ready", "crc err", "queue max", "queue drops", "latency p50/p95/max",
+           "first rx p50/max");
+  }
+  for (uint32_t sensors : sensorCounts) {
+    loadResult result = runLoad(sensors, params, rng);
+    unsigned long crcErrors = strtoul(jsonField(result.stats, "crcErrors").c_str(), NULL, 10);
+    unsigned long queueMax = strtoul(jsonField(result.stats, "queueMax").c_str(), NULL, 10);
+    unsigned long queueDrops = strtoul(jsonField(result.stats, "queueDrops").c_str(), NULL, 10);
+    if (csv) {
+      printf("%u,%u,%u,%u,%u,%u,%u,%u,%lu,%lu,%lu,%llu,%llu,%llu,%llu,%llu\n", sensors, result.sent, result.captured,
+             result.wrong, result.frames, result.collided, result.corrupted, result.notReady, crcErrors, queueMax, queueDrops,
+             (unsigned long long)percentile(result.latencies, 0.5) / 1000,
+             (unsigned long long)percentile(result.latencies, 0.95) / 1000,
+             (unsigned long long)percentile(result.latencies, 1) / 1000,
+             (unsigned long long)percentile(result.firstRx, 0.5) / 1000,
+             (unsigned long long)percentile(result.firstRx, 1) / 1000);
+      continue;
+    }
+    char events[24];
+    snprintf(events, sizeof(events), "%u/%u", result.captured, result.sent);
+    char latency[64];
+    snprintf(latency, sizeof(latency), "%llu/%llu/%llu ms", (unsigned long long)percentile(result.latencies, 0.5) / 1000,
+             (unsigned long long)percentile(result.latencies, 0.95) / 1000,
+             (unsigned long long)percentile(result.latencies, 1) / 1000);
+    char firstRx[48];
+    snprintf(firstRx, sizeof(firstRx), "%llu/%llu ms", (unsigned long long)percentile(result.firstRx, 0.5) / 1000,
+             (unsigned long long)percentile(result.firstRx, 1) / 1000);
+    printf("%7u %16s %5u %7u %8u %9u %9u %7lu %7lu/%-2u %11lu %20s %16s\n", sensors, events, result.wrong, result.frames,
+           result.collided, result.corrupted, result.notReady, crcErrors, queueMax, CFG_MESSAGES_SIZE, queueDrops, latency,
+           firstRx);
+  }
+  return 0;
+}
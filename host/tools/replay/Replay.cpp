@@ -0,0 +1,483 @@
+/****************************************************************************
+Replay.cpp - Replays captured RX frames through the firmware on the host.
+
+Reads FIFO dumps in the format of readme_packet_samples.txt (the raw
+packet after "raw packet(zero stuffed, manchester decoded):", the expected
+decode after "packet(proper length, ...)" and the published json) or a
+binary capture (see below), and injects them into the simulated RFM69 at
+a configurable rate. setup()/loop() of the firmware run unmodified, so
+every frame takes the real path interruptHandler -> convertPacket2Message
+-> pushMessages -> publishMessagesMQTT into the stub broker.
+
+Every published sensor json is checked against the golden output of its
+sample (id, type, battery, cmd, raw). The report has:
+  - decode frames/s, host CPU time of interruptHandler + convertPacket2Message
+    (MXPROFILE_SCOPE statistics)
+  - publish events/s, host CPU time of publishMessagesMQTT
+  - end-to-end events/s, delivered events per wall time of the whole run and
+    per virtual time, and the virtual latency from the first frame to the json
+  - correctness: events delivered/correct/wrong/missing, frames lost because
+    the receiver wasn't ready, CRC/length errors
+  - messages queue: queueDrops and queueMax of status/stats, a missing event
+    is "queue full" if the firmware received a frame of it but the messages
+    queue (CFG_MESSAGES_SIZE) had no room, otherwise "not decoded"
+
+By default every event gets its own communication counter and is encoded
+again (CRC, reversed bytes, zero stuffing) like a sensor would send it, so
+the events don't collapse into one message per sample. --raw replays the
+FIFO bytes exactly as captured.
+
+  .pio/build/replay/program [options] [file]   default readme_packet_samples.txt
+    --rate <n>     frames per second of virtual time, default 20
+    --repeat <n>   frames per event, sensors send every event many times, default 1
+    --events <n>   number of events, cycles through the samples, default one per sample
+    --raw          replay the captured FIFO bytes, no new counters
+    --write <file> writes the replayed frames as binary capture
+
+Binary capture, all values little endian:
+  "MXCAP" 0x01, then per frame: uint32 time since the previous frame in us,
+  uint8 RegRssiValue, uint8 length, length bytes FIFO content
+Captures have no golden output, the expected decode is taken from a decode
+outside of the firmware pipeline, so only the delivery is checked.
+
+Exit code is 1 if a published event doesn't match its golden output or if
+an event is missing for another reason than a full messages queue.
+****************************************************************************/
+
+#include <Arduino.h>
+#include <config.h>
+#include <ETH200RFM69.h>
+#include <MXProfiler.h>
+#include <MXRadio.h>
+#include <PubSubClient.h>
+#include <RFM69Model.h>
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#define REPLAY_START_US 3000000 // first frame after setup() is done and MQTT is connected
+
+void setup();
+void loop();
+extern String mqtt_root; // main.cpp
+extern ETH200RFM69 radio; // main.cpp
+extern MXRadio* radioBackend; // main.cpp
+
+// a captured frame and what it should decode to
+struct replaySample {
+  std::string title;
+  std::vector<uint8_t> fifo;  // zero stuffed, Manchester decoded
+  std::vector<uint8_t> data;  // expected DATA after interruptHandler, empty if unknown
+  uint8_t rssiValue = 120;    // RegRssiValue
+  std::string golden;         // expected sensor json, empty if unknown
+  uint32_t gapUs = 0;         // captures only, time since the previous frame
+};
+
+struct replayFrame {
+  uint64_t atUs;              // virtual time of the injection
+  size_t sample;
+  std::vector<uint8_t> fifo;
+  std::vector<uint8_t> data;  // expected DATA, empty if unknown
+};
+
+struct replayEvent {
+  size_t sample;
+  std::vector<uint8_t> data;
+  uint64_t firstUs;           // virtual time of the first frame
+  uint32_t publishes = 0;
+  boolean wrong = false;
+};
+
+// encodes packets like ETH200RFM69::sendPacket, exposes its protected helpers
+class ReplayCodec : public ETH200RFM69 {
+  public:
+    // fills in the CRC of data, returns the FIFO content a receiver would see
+    std::vector<uint8_t> encode(std::vector<uint8_t> &data) {
+      uint16_t crcStart = (data[1] == 0x10) ? 0xC11F : 0xBDB7; // RemoteControl : WindowSensor
+      uint8_t length = data.size();
+      uint16_t crc = calcPacketCRC16r(data.data(), length - 2, crcStart, 0x8408);
+      data[length - 2] = crc >> 8;
+      data[length - 1] = crc;
+      std::vector<uint8_t> reversed(length);
+      for (uint8_t i = 0; i < length; i++) {
+        reversed[i] = reverseByte(data[i]);
+      }
+      std::vector<uint8_t> fifo(CFG_ETH200MAXPACKETSIZE, 0);
+      stuffPayload(reversed.data(), fifo.data(), length);
+      return fifo;
+    }
+
+    // decodes the FIFO content like interruptHandler, empty if it isn't a valid packet
+    std::vector<uint8_t> decode(std::vector<uint8_t> fifo) {
+      fifo.resize(CFG_ETH200MAXPACKETSIZE, 0);
+      std::vector<uint8_t> data(CFG_ETH200MAXPACKETSIZE - 1, 0);
+      destuffPayload(fifo.data(), data.data(), fifo.size());
+      for (uint8_t &b : data) {
+        b = reverseByte(b);
+      }
+      uint8_t length = (data[1] == 0x10) ? 9 : ((data[1] == 0x20) ? 8 : 0);
+      if (length == 0) {
+        return std::vector<uint8_t>();
+      }
+      data.resize(length);
+      uint16_t crc = calcPacketCRC16r(data.data(), length - 2, (length == 9) ? 0xC11F : 0xBDB7, 0x8408);
+      if ((data[length - 2] != (uint8_t)(crc >> 8)) || (data[length - 1] != (uint8_t)crc)) {
+        return std::vector<uint8_t>();
+      }
+      return data;
+    }
+};
+
+static ReplayCodec codec;
+
+static uint32_t eventKey(const std::vector<uint8_t> &data);
+
+// the RFM69 backend of the firmware, remembers every frame handed to the pipeline, so a
+// missing event can be told apart: received but dropped by pushMessages, or never decoded
+class ReplayRadio : public MXRadioRFM69 {
+  public:
+    std::set<uint32_t> received; // eventKey() of every received frame
+    ReplayRadio() : MXRadioRFM69(radio) {}
+    boolean receive(mxRadioFrame& frame) {
+      if (!MXRadioRFM69::receive(frame)) {
+        return false;
+      }
+      if (frame.length >= 5) {
+        received.insert(eventKey(std::vector<uint8_t>(frame.data, frame.data + frame.length)));
+      }
+      return true;
+    }
+};
+
+static ReplayRadio replayRadio;
+
+static std::vector<replayFrame> frames;
+static size_t nextFrame = 0;
+static std::vector<replaySample> samples;
+static uint32_t framesLost = 0;
+
+// injects the frames which are due, runs whenever the virtual time advances, so the
+// frames arrive while the firmware is busy or waits like on the device
+static void replayTimeHook(uint64_t nowUs) {
+  while ((nextFrame < frames.size()) && (frames[nextFrame].atUs <= nowUs)) {
+    const replayFrame &frame = frames[nextFrame++];
+    if (!rfm69Model.injectPacket(frame.fifo.data(), frame.fifo.size(), samples[frame.sample].rssiValue)) {
+      framesLost++;
+    }
+  }
+}
+
+static std::vector<uint8_t> parseHex(const std::string &line) {
+  std::vector<uint8_t> bytes;
+  std::istringstream in(line);
+  std::string token;
+  while (in >> token) {
+    if ((token.length() != 2) || !isxdigit(token[0]) || !isxdigit(token[1])) {
+      break;
+    }
+    bytes.push_back(strtoul(token.c_str(), NULL, 16));
+  }
+  return bytes;
+}
+
+static std::string toHex(const std::vector<uint8_t> &bytes) {
+  std::string hex;
+  char buf[4];
+  for (size_t i = 0; i < bytes.size(); i++) {
+    snprintf(buf, sizeof(buf), (i == 0) ? "%02X" : " %02X", bytes[i]);
+    hex += buf;
+  }
+  return hex;
+}
+
+// value of a string or number field of a flat json object, empty if missing
+static std::string jsonField(const std::string &json, const std::string &key) {
+  size_t pos = json.find("\"" + key + "\":");
+  if (pos == std::string::npos) {
+    return "";
+  }
+  pos += key.length() + 3;
+  if ((pos < json.length()) && (json[pos] == '"')) {
+    size_t end = json.find('"', pos + 1);
+    return json.substr(pos + 1, end - pos - 1);
+  }
+  size_t end = json.find_first_of(",}", pos);
+  return json.substr(pos, end - pos);
+}
+
+static boolean loadText(const std::string &path) {
+  std::ifstream in(path);
+  if (!in) {
+    return false;
+  }
+  std::string line;
+  replaySample sample;
+  while (std::getline(in, line)) {
+    if (line.compare(0, 4, "### ") == 0) {
+      if (!sample.fifo.empty()) {
+        samples.push_back(sample);
+      }
+      sample = replaySample();
+      sample.title = line.substr(4);
+    } else if (line.find("raw packet(zero stuffed, manchester decoded):") != std::string::npos) {
+      std::getline(in, line);
+      sample.fifo = parseHex(line);
+    } else if (line.find("packet(proper length") != std::string::npos) {
+      std::getline(in, line);
+      sample.data = parseHex(line);
+    } else if (line.find("[RX_RSSI:") != std::string::npos) {
+      sample.rssiValue = -2 * atoi(line.c_str() + line.find("[RX_RSSI:") + 9);
+    } else if (line.compare(0, 6, "{\"id\":") == 0) {
+      sample.golden = line;
+    }
+  }
+  if (!sample.fifo.empty()) {
+    samples.push_back(sample);
+  }
+  return true;
+}
+
+static boolean loadCapture(const std::string &path) {
+  std::ifstream in(path, std::ios::binary);
+  char magic[6];
+  if (!in.read(magic, sizeof(magic)) || (memcmp(magic, "MXCAP\x01", sizeof(magic)) != 0)) {
+    return false;
+  }
+  uint8_t header[6];
+  while (in.read((char *)header, sizeof(header))) {
+    replaySample sample;
+    sample.title = "capture";
+    sample.gapUs = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t)header[3] << 24;
+    sample.rssiValue = header[4];
+    sample.fifo.resize(header[5]);
+    if (!in.read((char *)sample.fifo.data(), header[5])) {
+      break;
+    }
+    sample.data = codec.decode(sample.fifo);
+    samples.push_back(sample);
+  }
+  return true;
+}
+
+static boolean writeCapture(const std::string &path) {
+  std::ofstream out(path, std::ios::binary);
+  out.write("MXCAP\x01", 6);
+  uint64_t last = REPLAY_START_US;
+  for (const replayFrame &frame : frames) {
+    uint32_t gap = frame.atUs - last;
+    last = frame.atUs;
+    uint8_t header[6] = {(uint8_t)gap, (uint8_t)(gap >> 8), (uint8_t)(gap >> 16), (uint8_t)(gap >> 24),
+                         samples[frame.sample].rssiValue, (uint8_t)frame.fifo.size()};
+    out.write((const char *)header, sizeof(header));
+    out.write((const char *)frame.fifo.data(), frame.fifo.size());
+  }
+  return (bool)out;
+}
+
+static uint32_t eventKey(const std::vector<uint8_t> &data) {
+  // the firmware merges packets with the same device ID and counter into one message
+  return (uint32_t)data[2] << 24 | (uint32_t)data[3] << 16 | (uint32_t)data[4] << 8 | data[0];
+}
+
+static const mxProfileStat *profileStat(const char *name) {
+  for (const mxProfileStat *stat = mxProfileList(); stat != NULL; stat = stat->next) {
+    if (strcmp(stat->name, name) == 0) {
+      return stat;
+    }
+  }
+  return NULL;
+}
+
+static double perSecond(uint32_t count, uint64_t ns) {
+  return ns ? count * 1e9 / ns : 0;
+}
+
+int main(int argc, char *argv[]) {
+  std::string path = "readme_packet_samples.txt";
+  std::string writePath;
+  double rate = 20;
+  unsigned long repeat = 1;
+  unsigned long numEvents = 0;
+  boolean raw = false;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--rate") && (i + 1 < argc)) {
+      rate = atof(argv[++i]);
+    } else if ((arg == "--repeat") && (i + 1 < argc)) {
+      repeat = max(1UL, strtoul(argv[++i], NULL, 10));
+    } else if ((arg == "--events") && (i + 1 < argc)) {
+      numEvents = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "--raw") {
+      raw = true;
+    } else if ((arg == "--write") && (i + 1 < argc)) {
+      writePath = argv[++i];
+    } else if (arg[0] != '-') {
+      path = arg;
+    } else {
+      fprintf(stderr, "usage: %s [--rate n] [--repeat n] [--events n] [--raw] [--write file] [file]\n", argv[0]);
+      return 2;
+    }
+  }
+  boolean capture = loadCapture(path);
+  if (!capture && (!loadText(path) || samples.empty())) {
+    fprintf(stderr, "no frames found in %s\n", path.c_str());
+    return 2;
+  }
+  if (capture) {
+    raw = true; // replay as captured
+  }
+  if (numEvents == 0) {
+    numEvents = samples.size();
+  }
+
+  // the schedule, captures keep their timing unless a rate is given
+  boolean keepTiming = capture && (rate == 20) && (repeat == 1);
+  uint64_t periodUs = (uint64_t)(1000000 / rate);
+  uint64_t at = REPLAY_START_US;
+  std::map<uint32_t, replayEvent> events;
+  for (unsigned long e = 0; e < numEvents; e++) {
+    size_t s = e % samples.size();
+    std::vector<uint8_t> data = samples[s].data;
+    std::vector<uint8_t> fifo = samples[s].fifo;
+    if (!raw && !data.empty()) {
+      data[0] = e; // the communication counter
+      fifo = codec.encode(data);
+    }
+    if (e > 0) {
+      at += keepTiming ? samples[s].gapUs : periodUs;
+    }
+    if (!data.empty() && (events.find(eventKey(data)) == events.end())) {
+      events[eventKey(data)] = {s, data, at};
+    }
+    for (unsigned long r = 0; r < repeat; r++) {
+      if (r > 0) {
+        at += periodUs;
+      }
+      frames.push_back({at, s, fifo, data});
+    }
+  }
+  if (!writePath.empty() && !writeCapture(writePath)) {
+    fprintf(stderr, "writing %s failed\n", writePath.c_str());
+    return 2;
+  }
+
+  rfm69Model.attach(CFG_RF69_SPI_CS, digitalPinToInterrupt(CFG_RF69_IRQ_PIN), CFG_RF69_RST_PIN);
+  hostAddTimeHook(replayTimeHook);
+  radioBackend = &replayRadio;
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+  setup();
+  mqttStubBroker.clear();
+  uint64_t endUs = frames.back().atUs + (CFG_MESSAGE_DELAY + 2) * 1000000ULL;
+  while (hostMicros64() < endUs) {
+    loop();
+  }
+  double wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  mqttStubBroker.inject(std::string(mqtt_root.c_str()) + "/set/stats", "1");
+  uint64_t statsUs = hostMicros64() + 1000;
+  while (hostMicros64() < statsUs) {
+    loop();
+  }
+
+  // check every published sensor json against its golden output
+  uint32_t publishes = 0;
+  uint32_t unknown = 0;
+  std::vector<uint64_t> latencies;
+  std::string deviceStats;
+  for (const MQTTStubMessage &msg : mqttStubBroker.published) {
+    if (msg.topic.find("/status/stats") != std::string::npos) {
+      deviceStats = msg.payload;
+      continue;
+    }
+    if ((msg.topic.find("/sensor/") == std::string::npos) || (msg.topic.compare(msg.topic.length() - 4, 4, "/get") != 0)) {
+      continue;
+    }
+    publishes++;
+    std::vector<uint8_t> rawBytes = parseHex(jsonField(msg.payload, "raw"));
+    if (rawBytes.size() < 5) {
+      unknown++;
+      continue;
+    }
+    auto it = events.find(eventKey(rawBytes));
+    if (it == events.end()) {
+      // a decode which doesn't belong to any replayed event
+      unknown++;
+      continue;
+    }
+    replayEvent &event = it->second;
+    const replaySample &sample = samples[event.sample];
+    boolean wrong = (rawBytes != event.data);
+    for (const char *field : {"id", "type", "battery", "cmd"}) {
+      if (!sample.golden.empty() && (jsonField(msg.payload, field) != jsonField(sample.golden, field))) {
+        wrong = true;
+      }
+    }
+    if (wrong) {
+      event.wrong = true;
+      printf("WRONG %s: %s\n  expected %s\n", sample.title.c_str(), msg.payload.c_str(),
+             sample.golden.empty() ? toHex(event.data).c_str() : sample.golden.c_str());
+    }
+    if (event.publishes == 0) {
+      latencies.push_back(msg.timeUs - event.firstUs);
+    }
+    event.publishes++;
+  }
+  uint32_t delivered = 0;
+  uint32_t correct = 0;
+  uint32_t wrong = 0;
+  uint32_t missingQueueFull = 0;
+  for (const auto &entry : events) {
+    if (entry.second.publishes > 0) {
+      delivered++;
+      if (entry.second.wrong) {
+        wrong++;
+      } else {
+        correct++;
+      }
+    } else if (replayRadio.received.count(entry.first) > 0) {
+      missingQueueFull++;
+    }
+  }
+  // every message which doesn't fit is a queue drop, more received but missing events
+  // than drops means the pipeline lost them somewhere else
+  uint32_t queueDrops = strtoul(jsonField(deviceStats, "queueDrops").c_str(), NULL, 10);
+  missingQueueFull = min(missingQueueFull, queueDrops);
+  uint32_t missingNotDecoded = events.size() - delivered - missingQueueFull;
+  std::sort(latencies.begin(), latencies.end());
+
+  const ETH200RFM69Stats &stats = ETH200RFM69::stats;
+  const mxProfileStat *decodeStat = profileStat("interruptHandler");
+  const mxProfileStat *convertStat = profileStat("convertPacket2Message");
+  const mxProfileStat *publishStat = profileStat("publishMessagesMQTT");
+  uint64_t decodeNs = (decodeStat ? decodeStat->sum : 0) + (convertStat ? convertStat->sum : 0);
+  double virtualSeconds = (endUs - REPLAY_START_US) / 1e6;
+
+  if (capture) {
+    printf("replay of capture %s: %zu frames\n", path.c_str(), frames.size());
+  } else {
+    printf("replay of %s: %zu samples, %zu frames, %lu events, %s\n", path.c_str(), samples.size(), frames.size(),
+           numEvents, raw ? "raw" : "new counter per event");
+  }
+  printf("frames  : injected %zu, lost (receiver not ready) %u, decoded %u, crc errors %u, length errors %u, unknown types %u\n",
+         frames.size(), framesLost, stats.fifoReads, stats.crcErrors, stats.lengthErrors, stats.unknownTypes);
+  printf("events  : expected %zu, delivered %u, correct %u, wrong %u, missing (queue full) %u, missing (not decoded) %u, "
+         "publishes %u, not replayed %u\n",
+         events.size(), delivered, correct, wrong, missingQueueFull, missingNotDecoded, publishes, unknown);
+  printf("queue   : queueDrops %u, queueMax %s of CFG_MESSAGES_SIZE %u\n",
+         queueDrops, jsonField(deviceStats, "queueMax").c_str(), CFG_MESSAGES_SIZE);
+  printf("decode  : %.0f frames/s (host CPU, interruptHandler + convertPacket2Message)\n",
+         perSecond(stats.fifoReads, decodeNs));
+  printf("publish : %.0f events/s (host CPU, publishMessagesMQTT)\n",
+         perSecond(publishStat ? publishStat->count : 0, publishStat ? publishStat->sum : 0));
+  printf("e2e     : %.1f events/s wall (%.3fs), %.3f events/s virtual (%.1fs)\n",
+         wallSeconds > 0 ? delivered / wallSeconds : 0, wallSeconds, delivered / virtualSeconds, virtualSeconds);
+  if (!latencies.empty()) {
+    printf("latency : first frame to json p50 %llu ms, max %llu ms (virtual, CFG_MESSAGE_DELAY %us)\n",
+           (unsigned long long)latencies[latencies.size() / 2] / 1000,
+           (unsigned long long)latencies.back() / 1000, CFG_MESSAGE_DELAY);
+  }
+  return ((wrong > 0) || (missingNotDecoded > 0)) ? 1 : 0;
+}
@@ -0,0 +1,198 @@
+/****************************************************************************
+VirtualThermostat.cpp - Checks the TX output of the firmware with a bit
+accurate thermostat receiver on the host.
+
+Every command is sent with ETH200RFM69::sendPacket() of the firmware over
+the simulated RFM69. The chip stream the model put on air, custom preamble,
+the syncs behind stuffed tails and everything the RFM69 adds itself,
+is decoded by ETH200Receiver bit by bit like a thermostat sees it. A frame
+counts as valid if its CRC is correct and it is the packet sendPacket()
+built.
+
+The report has per command:
+  - valid frames out of CFG_ETH200NUMPACKETSENDREPEATS, frames with a CRC
+    error, aborted (six 1s, Manchester violation) or of an unknown type
+  - airtime from the first to the last chip and airtime per valid frame,
+    the figure of merit for any change of the TX encoding
+  - offset of the first and last valid frame from the start of the airtime
+
+  .pio/build/thermostat/program [options] [cmd ...]   default every cmd
+    --address <hex>    thermostat address, default 010101
+    --min-valid <n>    fails if a cmd has fewer valid frames, default 1
+    --frames           prints every decoded frame
+  cmd is WindowOpened, WindowClosed, DayMode, NightMode, a temperature
+  offset -9.5 ... +29.5 or Absolute (0xCA, the first step of an absolute
+  temperature)
+
+Exit code is 1 if a cmd couldn't be sent, has fewer valid frames than
+--min-valid or a frame with a correct CRC but the wrong content.
+****************************************************************************/
+
+#include <Arduino.h>
+#include <config.h>
+#include <ETH200RFM69.h>
+#include <ETH200Receiver.h>
+#include <RFM69Model.h>
+#include <string>
+#include <vector>
+
+extern ETH200RFM69 radio;            // main.cpp
+uint8_t convertTemp2Hex(float temp); // main.cpp
+
+struct thermostatCmd {
+  std::string name;
+  uint8_t deviceType;
+  uint8_t cmd;
+  std::vector<uint8_t> cmds;
+};
+
+static std::vector<thermostatCmd> allCmds() {
+  std::vector<thermostatCmd> cmds = {
+    {"WindowOpened", 0x20, 0x41, {}},
+    {"WindowClosed", 0x20, 0x40, {}},
+    {"DayMode", 0x10, 0x42, {0x00}},
+    {"NightMode", 0x10, 0x43, {0x00}},
+    {"Absolute", 0x10, 0x40, {0xCA}},
+  };
+  for (int t = -19; t <= 59; t++) {
+    char name[8];
+    snprintf(name, sizeof(name), "%+.1f", t * 0.5);
+    cmds.push_back({name, 0x10, 0x40, {convertTemp2Hex(t * 0.5)}});
+  }
+  return cmds;
+}
+
+static const char *statusName(eth200FrameStatus_t status) {
+  switch (status) {
+    case frameValid:       return "valid";
+    case frameCrcError:    return "crc error";
+    case frameUnknownType: return "unknown type";
+    case frameAborted:     return "aborted";
+    case frameTruncated:   return "truncated";
+  }
+  return "?";
+}
+
+static std::string hex(const std::vector<uint8_t> &bytes) {
+  std::string text;
+  for (size_t i = 0; i < bytes.size(); i++) {
+    char buf[4];
+    snprintf(buf, sizeof(buf), (i == 0) ? "%02X" : " %02X", bytes[i]);
+    text += buf;
+  }
+  return text;
+}
+
+int main(int argc, char *argv[]) {
+  uint32_t address = 0x010101;
+  unsigned long minValid = 1;
+  boolean printFrames = false;
+  std::vector<std::string> selected;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if ((arg == "--address") && (i + 1 < argc)) {
+      address = strtoul(argv[++i], NULL, 16);
+    } else if ((arg == "--min-valid") && (i + 1 < argc)) {
+      minValid = strtoul(argv[++i], NULL, 10);
+    } else if (arg == "--frames") {
+      printFrames = true;
+    } else if ((arg[0] != '-') || ((arg.size() > 1) && isdigit(arg[1]))) {
+      selected.push_back(arg);
+    } else {
+      fprintf(stderr, "usage: %s [--address hex] [--min-valid n] [--frames] [cmd ...]\n", argv[0]);
+      return 2;
+    }
+  }
+  std::vector<thermostatCmd> cmds;
+  for (thermostatCmd &cmd : allCmds()) {
+    if (selected.empty() || (std::find(selected.begin(), selected.end(), cmd.name) != selected.end())) {
+      cmds.push_back(cmd);
+    }
+  }
+  if (cmds.empty()) {
+    fprintf(stderr, "no known cmd given\n");
+    return 2;
+  }
+
+  rfm69Model.attach(CFG_RF69_SPI_CS, digitalPinToInterrupt(CFG_RF69_IRQ_PIN), CFG_RF69_RST_PIN);
+  radio.initialize();
+  radio.setPowerLevel(CFG_RF69_POWERLEVEL);
+
+  ETH200Receiver receiver;
+  uint32_t failed = 0;
+  uint64_t totalValid = 0;
+  uint64_t totalAirUs = 0;
+  printf("address %06X, %u repeats per cmd\n", address, CFG_ETH200NUMPACKETSENDREPEATS);
+  printf("%-12s %-27s %7s %5s %7s %5s %9s %11s %15s\n", "cmd", "packet", "stuffed", "valid", "crc err",
+         "abort", "airtime", "per valid", "first/last ms");
+  for (thermostatCmd &cmd : cmds) {
+    rfm69Model.clearTx();
+    uint32_t underruns = rfm69Model.txUnderruns;
+    // the packet sendPacket() is going to build, independent of the firmware encoding
+    std::vector<uint8_t> expected = {radio.currentPacketCounter, cmd.deviceType, (uint8_t)(address >> 16),
+                                     (uint8_t)(address >> 8), (uint8_t)address, cmd.cmd};
+    expected.insert(expected.end(), cmd.cmds.begin(), cmd.cmds.end());
+    uint16_t crc = ETH200Receiver::crc(expected.data(), expected.size(), ETH200Receiver::crcStart(cmd.deviceType));
+    expected.push_back(crc >> 8);
+    expected.push_back(crc);
+    boolean sent = radio.sendPacket(cmd.deviceType, address, cmd.cmd, cmd.cmds.data(), cmd.cmds.size());
+
+    receiver.clear();
+    receiver.decode(rfm69Model.txChips);
+    uint32_t valid = 0;
+    uint32_t wrong = 0;
+    uint32_t crcErrors = 0;
+    uint32_t aborted = 0;
+    size_t firstValidChip = 0;
+    size_t lastValidChip = 0;
+    for (eth200Frame &frame : receiver.frames) {
+      if (frame.status == frameValid) {
+        if (frame.data != expected) {
+          wrong++;
+          continue;
+        }
+        if (valid == 0) {
+          firstValidChip = frame.startChip;
+        }
+        lastValidChip = frame.endChip;
+        valid++;
+      } else if (frame.status == frameCrcError) {
+        crcErrors++;
+      } else {
+        aborted++;
+      }
+    }
+    uint64_t airUs = rfm69Model.txLastChipUs - rfm69Model.txFirstChipUs;
+    double chipUs = rfm69Model.txChips.empty() ? 0 : (double)airUs / rfm69Model.txChips.size();
+    totalValid += valid;
+    totalAirUs += airUs;
+
+    char perValid[16] = "-";
+    if (valid > 0) {
+      snprintf(perValid, sizeof(perValid), "%.2f ms", airUs / 1000.0 / valid);
+    }
+    printf("%-12s %-27s %7s %5u %7u %5u %6.0f ms %11s %7.0f/%-7.0f%s%s\n", cmd.name.c_str(), hex(expected).c_str(),
+           (receiver.stuffedBits > 0) ? "yes" : "no", valid, crcErrors, aborted, airUs / 1000.0, perValid,
+           firstValidChip * chipUs / 1000, lastValidChip * chipUs / 1000,
+           sent ? "" : "  SEND FAILED", (rfm69Model.txUnderruns > underruns) ? "  FIFO UNDERRUN" : "");
+    if (wrong > 0) {
+      printf("  %u frame(s) with a correct CRC but not the packet sent\n", wrong);
+    }
+    if (printFrames) {
+      for (eth200Frame &frame : receiver.frames) {
+        printf("  %9.2f ms %-12s %s\n", frame.startChip * chipUs / 1000, statusName(frame.status), hex(frame.data).c_str());
+      }
+    }
+    if (!sent || (valid < minValid) || (wrong > 0)) {
+      failed++;
+    }
+  }
+  printf("total   : %zu cmds, %llu valid frames, %.2f ms airtime per valid frame, %.1f%% of %u repeats valid\n",
+         cmds.size(), (unsigned long long)totalValid, totalValid ? totalAirUs / 1000.0 / totalValid : 0,
+         100.0 * totalValid / (cmds.size() * CFG_ETH200NUMPACKETSENDREPEATS), CFG_ETH200NUMPACKETSENDREPEATS);
+  if (failed > 0) {
+    printf("FAIL %u cmd(s)\n", failed);
+    return 1;
+  }
+  return 0;
+}
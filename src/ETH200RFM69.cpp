@@ -33,11 +33,15 @@ and copyright notices in any redistribution of this code
 
 #include <ETH200RFM69.h>
 #include <MXDebugUtils.h>      // for debugging function support
+#include <MXProfiler.h>        // for profiling the RX/TX path
 
 uint8_t ETH200RFM69::PAYLOADETH200;
-uint16_t ETH200RFM69::ETH200CRCStartWindowSensor;
-uint16_t ETH200RFM69::ETH200CRCStartRemoteControl;
-uint16_t ETH200RFM69::ETH200CRCMask;
+// also set in initialize(), encodePacket() can be used without an initialized module
+uint16_t ETH200RFM69::ETH200CRCStartWindowSensor = 0xBDB7;
+uint16_t ETH200RFM69::ETH200CRCStartRemoteControl = 0xC11F;
+uint16_t ETH200RFM69::ETH200CRCMask = 0x8408;
+ETH200RFM69Stats ETH200RFM69::stats;
+volatile uint32_t ETH200RFM69::_irqMicros = 0;
 
 // for ETH200 packet analysis
 enum deviceType_t {
@@ -66,7 +70,7 @@ bool ETH200RFM69::initialize() {
                       // after the 5 ones, and this one "0" bit shifts all the others bits to the right and we have another byte added.
                       // so in the end, we have a max of 10 byte
 
-  uint8_t initLastSentPacket[CFG_ETH200MAXPACKETSIZE] = {0}; // pointer to empty initialized proper sized array
+  static uint8_t initLastSentPacket[CFG_ETH200MAXPACKETSIZE] = {0}; // static, the pointer must stay valid after initialize() returned
   lastSentPacket = initLastSentPacket;
   // start and mask values used for CRC caculation
   // Dietmar Weisser - https://www.mikrocontroller.net/topic/172034
@@ -369,9 +373,21 @@ uint8_t ETH200RFM69::stuffPayload(uint8_t inBuf[], uint8_t stuffedBuf[], uint8_t
 
 // internal function
  ISR_PREFIX void ETH200RFM69::isr0() {
+   // the loop might be busy (sending, publishing) when the packet arrives, so the arrival
+   // time is taken right here
+   _irqMicros = micros();
    _haveData = true;
+   stats.interrupts++;
+   // wakes up loop() if it waits in esp_delay(), see waitForEvent()
+   esp_schedule();
  }
 
+void ETH200RFM69::resetStats() {
+  noInterrupts();
+  stats = ETH200RFM69Stats();
+  interrupts();
+}
+
 // copied from RFM69, just for adding debug output
 bool ETH200RFM69::receiveDone() {
   if (_haveData) {
@@ -392,6 +408,7 @@ bool ETH200RFM69::receiveDone() {
 
 // internal function - interrupt gets called when a packet is received
 void ETH200RFM69::interruptHandler() {
+  MXPROFILE_SCOPE("interruptHandler");
   //MXDEBUG_PRINTLLN(F("IRQ triggered."));
   if (_mode == RF69_MODE_RX && (readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_PAYLOADREADY)) {
     setMode(RF69_MODE_STANDBY);
@@ -406,55 +423,26 @@ void ETH200RFM69::interruptHandler() {
     for (uint8_t i = 0; i < PAYLOADETH200; i++) {
       buf[i] = _spi->transfer(0);
     }
-    #ifdef MXDEBUG
-      MXDEBUG_PRINTLLN(F("raw packet(zero stuffed, manchester decoded):"));
-      for (uint8_t i = 0; i < PAYLOADETH200; i++) {
-        printHexWithZeroPad(Serial, buf[i]);
-        //Serial.print(F(" "));
-        Serial.print(F("       "));
-      }
-      Serial.println();
-      for (uint8_t i = 0; i < PAYLOADETH200; i++) {
-        printBinWithZeroPad(Serial, buf[i]);
-        Serial.print(F(" "));
-      }
-      Serial.println();
-    #endif //MXDEBUG
+    stats.fifoReads++;
+    // this is the RX path, only deferred logging here, see MXLOG_DEBUG
+    MXLOG_DEBUG_HEX("raw packet(zero stuffed, manchester decoded):", buf, PAYLOADETH200);
+    MXLOG_DEBUG_BIN("raw packet(zero stuffed, manchester decoded):", buf, PAYLOADETH200);
 
     uint8_t destuffedBufLength = PAYLOADETH200 - 1; // we are always one byte shorter than the stuffed array
     uint8_t destuffedBuf[destuffedBufLength];
     uint8_t wasStuffed __attribute__((unused));
     wasStuffed = destuffPayload(buf, destuffedBuf, PAYLOADETH200);
-    #ifdef MXDEBUG
-      MXDEBUG_PRINTLLN(F("packet(zero destuffed, manchester decoded):"));
-      if (wasStuffed > 0) {
-        Serial.print("packet was stuffed: ");
-        Serial.print(wasStuffed);
-        Serial.println(" times");
-      }
-      for (uint8_t i = 0; i < destuffedBufLength; i++) {
-        printHexWithZeroPad(Serial, destuffedBuf[i]);
-        //Serial.print(F(" "));
-        Serial.print(F("       "));
-      }
-      Serial.println();
-      for (uint8_t i = 0; i < destuffedBufLength; i++) {
-        printBinWithZeroPad(Serial, destuffedBuf[i]);
-        Serial.print(F(" "));
-      }
-      Serial.println();
-    #endif //MXDEBUG
+    if (wasStuffed > 0) {
+      MXLOG_DEBUG("packet was stuffed: %u times", wasStuffed);
+    }
+    MXLOG_DEBUG_HEX("packet(zero destuffed, manchester decoded):", destuffedBuf, destuffedBufLength);
+    MXLOG_DEBUG_BIN("packet(zero destuffed, manchester decoded):", destuffedBuf, destuffedBufLength);
 
     // 2. step: reverse the byte order
-    MXDEBUG_PRINTLLN(F("packet(reversed byte order, zero destuffed, manchester decoded):"));
     for (uint8_t i = 0; i < destuffedBufLength; i++) {
       destuffedBuf[i] = reverseByte(destuffedBuf[i]);
-      #ifdef MXDEBUG
-        printHexWithZeroPad(Serial, destuffedBuf[i]);
-        Serial.print(F(" "));
-      #endif //MXDEBUG
     }
-    MXDEBUG_PRINTLN(F(""));
+    MXLOG_DEBUG_HEX("packet(reversed byte order, zero destuffed, manchester decoded):", destuffedBuf, destuffedBufLength);
 
     // 3. determine device type
     // we need this to determine where the CRC is located and how long the packet is
@@ -463,15 +451,7 @@ void ETH200RFM69::interruptHandler() {
     communicationCounter = destuffedBuf[0];
     // byte 2 - ETH200 device type
     uint8_t deviceType = destuffedBuf[1];
-    #ifdef MXDEBUG
-      MXDEBUG_PRINTLLN(F("packet analysis"));
-      Serial.print(F("communicationCounter -> 0x"));
-      printHexWithZeroPad(Serial, communicationCounter);
-      Serial.println();
-      Serial.print(F("deviceType -> 0x"));
-      printHexWithZeroPad(Serial, deviceType);
-      Serial.println();
-    #endif
+    MXLOG_DEBUG("packet analysis, communicationCounter -> 0x%02X, deviceType -> 0x%02X", communicationCounter, deviceType);
 
     // 4. step: check if packet is of a known device type
     uint16_t crcStart = 0;
@@ -487,68 +467,43 @@ void ETH200RFM69::interruptHandler() {
       // 0x30 = wall thermostat, 
       // 0x31 - 0x33 USB-program stick 
       //  (0x33 = learn, 0x32 = time sync, 0x33 = week program)
-      MXDEBUG_PRINTLLN(F("Received deviceType which is not implemented. Ignoring packet."));
+      MXLOG_DEBUG("Received deviceType which is not implemented. Ignoring packet.");
+      stats.unknownTypes++;
       PAYLOADLEN = 0;
     }
     PAYLOADLEN = PAYLOADLEN > 66 ? 0 : PAYLOADLEN; // precaution
-    #ifdef MXDEBUG
-      MXDEBUG_PRINTLLN(F("Payload length based on device type."));
-      Serial.print(F("PAYLOADLEN -> "));
-      Serial.println(PAYLOADLEN);
-    #endif //MXDEBUG
+    MXLOG_DEBUG("Payload length based on device type, PAYLOADLEN -> %u", PAYLOADLEN);
 
     if ((PAYLOADLEN > 9) || (PAYLOADLEN == 0)) {
       // reset, packet isn't for us
-      MXDEBUG_PRINTLLN(F("Packet received but packet length too long or too short, discarded."));
+      MXLOG_DEBUG("Packet received but packet length too long or too short, discarded.");
+      if (PAYLOADLEN > 0) {
+        // unknown device types are already counted
+        stats.lengthErrors++;
+      }
       PAYLOADLEN = 0;
       unselect();
       receiveBegin();
       return;
     }
 
-    #ifdef MXDEBUG
-      MXDEBUG_PRINTLLN(F("packet(proper length, reversed, destuffed, manchester decoded):"));
-      for (uint8_t i = 0; i < PAYLOADLEN; i++) {
-        printHexWithZeroPad(Serial, destuffedBuf[i]);
-        Serial.print(F(" "));
-      }
-      Serial.println(F(""));
-    #endif //MXDEBUG
+    MXLOG_DEBUG_HEX("packet(proper length, reversed, destuffed, manchester decoded):", destuffedBuf, PAYLOADLEN);
 
     // 5. step: calculate the CRC
-    MXDEBUG_PRINTLLN(F("Calculating and comparing CRC:"));
     uint16_t crcCalculated = 0; // the CRC we calculated from Byte #1 to Byte #PAYLOADLEN - 2
     uint16_t crcPacket = 0;     // the CRC extracted from the packet
     crcCalculated = calcPacketCRC16r(destuffedBuf, PAYLOADLEN - 2, crcStart, ETH200CRCMask);
     crcPacket = crcPacket << 8 | destuffedBuf[PAYLOADLEN - 2]; // we are shifting the next to last Byte int the two Byte CRC
     crcPacket = crcPacket << 8 | destuffedBuf[PAYLOADLEN - 1]; // we are shifting the last Byte int the two Byte CRC
-    #ifdef MXDEBUG
-      Serial.print(F("Packet CRC: "));
-      printHexWithZeroPad(Serial, crcPacket);
-      Serial.print(F(", Calculated CRC: "));
-      printHexWithZeroPad(Serial, crcCalculated);
-      Serial.println();
-    #endif //MXDEBUG
+    MXLOG_DEBUG("Packet CRC: %04X, Calculated CRC: %04X", crcPacket, crcCalculated);
 
     // 6. step: check that CRC matches packet
     if (crcPacket != crcCalculated) {
       // reset, packet isn't for us
       // we are more verbose because the length of the packet matches already
       // so if the CRC is wrong, maybe we have a bug?
-      MXDEBUG_PRINTLLN(F("Packet CRC does not match, discarding."));
-      #ifdef MXDEBUG
-        MXDEBUG_PRINTLLN(F("packet(proper length, reversed, destuffed, manchester decoded):"));
-        for (uint8_t i = 0; i < PAYLOADLEN; i++) {
-          printHexWithZeroPad(Serial, destuffedBuf[i]);
-          Serial.print(F(" "));
-        }
-        Serial.println();
-        Serial.print(F("Packet CRC: "));
-        printHexWithZeroPad(Serial, crcPacket);
-        Serial.print(F(", Calculated CRC: "));
-        printHexWithZeroPad(Serial, crcCalculated);
-        Serial.println();
-      #endif //MXDEBUG
+      MXLOG_DEBUG("Packet CRC %04X does not match calculated CRC %04X, discarding.", crcPacket, crcCalculated);
+      stats.crcErrors++;
       PAYLOADLEN = 0;
       unselect();
       receiveBegin();
@@ -556,6 +511,8 @@ void ETH200RFM69::interruptHandler() {
     }
 
     // packet is correct, fill the DATA array
+    stats.accepted++;
+    DATAMICROS = _irqMicros;
     DATALEN = PAYLOADLEN;
     for (uint8_t i = 0; i < DATALEN; i++) {
       // just copy it one byte at a time
@@ -624,46 +581,23 @@ uint16_t ETH200RFM69::calcCRC16r( uint16_t c, uint16_t crc, uint16_t mask) {
 uint16_t ETH200RFM69::calcPacketCRC16r(uint8_t packet[], uint8_t length, uint16_t crcStart, uint16_t crcMask) {
   uint16_t crcResult = 0;
   uint16_t crcCalculated = crcStart;
-  #ifdef MXDEBUG
-    MXDEBUG_PRINTLLN(F("CRC Calc start"));
-    Serial.print(F("length: "));
-    Serial.print(length);
-    Serial.print(F(", crcCalculated: "));
-    printHexWithZeroPad(Serial, crcCalculated);
-    Serial.print(F(", crcMask: "));
-    printHexWithZeroPad(Serial, crcMask);
-    Serial.println();
-  #endif //MXDEBUG
+  // called in the RX path, only deferred logging here, see MXLOG_DEBUG
+  MXLOG_DEBUG("CRC Calc start, length: %u, crcCalculated: %04X, crcMask: %04X", length, crcCalculated, crcMask);
 
   // in the CRC calculation the sync word needs to be included, since it's not
   // included in our packet[] payload, do it hard coded as the first calculation step
   crcCalculated = calcCRC16r(0x7E, crcCalculated, crcMask);
-  #ifdef MXDEBUG
-    Serial.print(F("sync word iteration: -1"));
-    Serial.print(F(", crcCalculated: "));
-    printHexWithZeroPad(Serial, crcCalculated);
-    Serial.println();
-  #endif //MXDEBUG
+  MXLOG_DEBUG("sync word iteration: -1, crcCalculated: %04X", crcCalculated);
 
   for (uint8_t i = 0; i < length; i++) {
     crcCalculated = calcCRC16r(packet[i], crcCalculated, crcMask);
-    #ifdef MXDEBUG
-      Serial.print(F("iteration: "));
-      Serial.print(i);
-      Serial.print(F(", crcCalculated: "));
-      printHexWithZeroPad(Serial, crcCalculated);
-      Serial.println();
-    #endif //MXDEBUG
+    MXLOG_DEBUG("iteration: %u, crcCalculated: %04X", i, crcCalculated);
   }
   // at the end we need to swap the CRC bytes
   uint8_t hiByte = (crcCalculated & 0xFF00) >> 8;
   uint8_t loByte = (crcCalculated & 0x00FF);
   crcResult = loByte << 8 | hiByte; // shift the hiByte left into the result
-  #ifdef MXDEBUG
-    Serial.print(F("Swapped CRC: "));
-    printHexWithZeroPad(Serial, crcResult);
-    Serial.println();
-  #endif //MXDEBUG
+  MXLOG_DEBUG("Swapped CRC: %04X", crcResult);
 
   return crcResult;
 }
@@ -695,13 +629,14 @@ boolean ETH200RFM69::send(uint8_t buffer[], uint8_t bufferSize, uint8_t numStuff
   }
   MXDEBUG_PRINTLLN(F("Radio is ready to send data, sending the frame."));
   MXDEBUG_PRINT(F("Sending it "));
-  MXDEBUG_PRINT(CFG_ETH200NUMPACKETSENDREPEATS);
+  MXDEBUG_PRINT(numRepeats);
   MXDEBUG_PRINTLN(F(" times."));
   
   yield();
-  MXTIME_PRINT(F("Timer just before sending."));
-  sendFrame(buffer, bufferSize, numStuffedBits);
-  MXTIME_PRINT(F("Timer just after sending."));
+  if (!sendFrame(buffer, bufferSize, numStuffedBits)) {
+    MXINFO_PRINTLLN(F("ERROR: Sending the frame failed, the radio module stalled."));
+    return false;
+  }
 
   // we sent something update the last packet variables
   // copy the packet into the lastSentPacket array
@@ -726,10 +661,13 @@ boolean ETH200RFM69::send(uint8_t buffer[], uint8_t bufferSize, uint8_t numStuff
  numStuffedBits - Number of Bits which were stuffed into the last byte, we need that
                   to squeeze the following sync word and data directly after those bits
 */
-void ETH200RFM69::sendFrame(uint8_t buffer[], uint8_t bufferSize, uint8_t numStuffedBits) {
+boolean ETH200RFM69::sendFrame(uint8_t buffer[], uint8_t bufferSize, uint8_t numStuffedBits) {
+  MXPROFILE_SCOPE("sendFrame");
+  stats.txFrames++;
+  lastStall = stallNone;
   setMode(RF69_MODE_STANDBY); // turn off receiver to prevent reception while filling fifo
-  while ((readReg(REG_IRQFLAGS1) & RF_IRQFLAGS1_MODEREADY) == 0x00) {
-    // wait for ModeReady
+  if (!waitForFlag(REG_IRQFLAGS1, RF_IRQFLAGS1_MODEREADY, CFG_RF69_MODEREADY_TIMEOUT, stallModeReady)) {
+    return false;
   }
   MXDEBUG_PRINTLLN(F("RFM69 signaled STANDBY ModeReady."))
 
@@ -777,11 +715,14 @@ void ETH200RFM69::sendFrame(uint8_t buffer[], uint8_t bufferSize, uint8_t numStu
 
   uint8_t byteForFIFO = 0;           // the byte we are going to push into the FIFO
   uint8_t byteForFIFOBitCounter = 0; // number of used bits inside byteForFIFO
+  uint8_t packedBytes[bufferSize + 1]; // the full bytes of one packet, see packBits()
+  unsigned long lastFIFOWrite = millis(); // to detect a FIFO which doesn't drain
+  unsigned long txStart = 0;              // millis() of the TX start, for stats.txAirtime
 
   //MXDEBUG_PRINTLN(F("Will print for every 10 frames a . during sending."));
   // any debugging output inside this loop is problematic since the FIFO must not run
   // empty and serial output takes a lot of time.
-  for (uint16_t i = 0; i < CFG_ETH200NUMPACKETSENDREPEATS; i++) {
+  for (uint16_t i = 0; i < numRepeats; i++) {
     /*
     if (i % 10 == 0) {
       MXDEBUG_PRINT(F("."));
@@ -795,6 +736,10 @@ void ETH200RFM69::sendFrame(uint8_t buffer[], uint8_t bufferSize, uint8_t numStu
       // so only write to fifo if it has not yet exceeded the threshold level because we know at least one full
       // packet + sync word still fits into it.
 
+      // the bits are packed before selecting the module, so the chip select is only
+      // held for the SPI transfers
+      uint8_t numPackedBytes = packBits(packet, numBitsInPacket, packedBytes, byteForFIFO, byteForFIFOBitCounter);
+
       // write to FIFO
       select();  
       _spi->transfer(REG_FIFO | 0x80);
@@ -815,59 +760,29 @@ void ETH200RFM69::sendFrame(uint8_t buffer[], uint8_t bufferSize, uint8_t numStu
       }
 
       //MXDEBUG_PRINTLLN(F("Pushing packet into FIFO:"));
-      //MXDEBUG_PRINT(F("Bytes: "));
-      for (uint8_t curBitPos = 0; curBitPos < numBitsInPacket; curBitPos++) {
-        /*
-          need to construct the byte first before we can push it into the FIFO
-
-          All this construction is needed because a stuffed payload/bit stream does not
-          end on a byte boundary and the thermostats expects payload bits are followed
-          directly by sync word bits.
-        */
-        /*
-        current position of our cursor inside the packet
-        curBitPos = 0, packet[0], bit 7,  pPos = curBitPos / 8, bPos = 7 - (curBitPos % 8)
-        curBitPos = 1, packet[0], bit 6
-        curBitPos = 2, packet[0], bit 5
-        ...
-        curBitPos = 7, packet[0], bit 0
-        curBitPos = 8, packet[1], bit 7
-        curBitPos = 9, packet[1], bit 6
-        ...
-        curBitPos = numBitsInPacket - 1, packet[buffersize - 1], bit X
-        */            
-        uint8_t curBit = bitRead(packet[curBitPos / 8], 7 - (curBitPos % 8)); // current Bit at curBitPos in packet
-        if (curBit == 0) {
-          byteForFIFO = byteForFIFO << 1 | 0;
-        } else if (curBit == 1) {
-          byteForFIFO = byteForFIFO << 1 | 1;
-        }
-        byteForFIFOBitCounter++;  // we have added one bit
-
-        if (byteForFIFOBitCounter == 8) {
-          // we have one full byte, push it into the FIFO
-          /*
-          #ifdef MXDEBUG
-            printBinWithZeroPad(Serial, byteForFIFO);
-            Serial.print(F(" "));
-          #endif //MXDEBUG
-          */
-          _spi->transfer(byteForFIFO);
-          byteForFIFOBitCounter = 0;
-        } // else keep filling the byteForFIFO until it's full
+      for (uint8_t j = 0; j < numPackedBytes; j++) {
+        _spi->transfer(packedBytes[j]);
       }
       // when we reach this position and the byteForFIFO is not full yet, we'll
       // use it for the next packet loop. And the last packets last byte we just ignore.
       //MXDEBUG_PRINTLN(F(""));
       unselect();
+      stats.txRepeats++;
+      lastFIFOWrite = millis();
     } else {
       if (_mode != RF69_MODE_TX) {
         // wait until FIFO is prefilled before enabling transmit.
         MXDEBUG_PRINTLLN(F("Fifo threshold reached, TX not enabled yet."));
         MXDEBUG_PRINTLLN(F("Starting RFM69 TX."));
         setMode(RF69_MODE_TX);
+        txStart = millis();
       }
       //MXDEBUG_PRINTLN(F("Fifo threshold reached, wait."));
+      if (millis() - lastFIFOWrite > CFG_RF69_TX_FIFO_TIMEOUT) {
+        lastStall = stallTxFifo;
+        stopTx(txStart);
+        return false;
+      }
       // since we ran through the loop without sending a packet, reduce the loop counter again.
       i--;
 
@@ -878,21 +793,99 @@ void ETH200RFM69::sendFrame(uint8_t buffer[], uint8_t bufferSize, uint8_t numStu
     yield(); 
   }
 
-  while ((readReg(REG_IRQFLAGS2) & RF_IRQFLAGS2_PACKETSENT) == 0x00) {
-    // wait for last PacketSent
-    yield(); 
+  // wait for last PacketSent
+  if (!waitForFlag(REG_IRQFLAGS2, RF_IRQFLAGS2_PACKETSENT, CFG_RF69_PACKETSENT_TIMEOUT, stallPacketSent)) {
+    stopTx(txStart);
+    return false;
   }
   MXDEBUG_PRINTLLN(F("Last packet sent, going into STANDBY mode."));
-  setMode(RF69_MODE_STANDBY);
+  stopTx(txStart);
   MXDEBUG_PRINTLLN(F("Resetting RFM69 fixed packet payload length to default value."));
   MXDEBUG_PRINTL(F("New packet length: "));
   MXDEBUG_PRINTLN(PAYLOADETH200);
   writeReg(REG_PAYLOADLENGTH, PAYLOADETH200);
+  return true;
 }
 
+/* internal function
+ leaves TX mode and adds the time since txStart to stats.txAirtime, if TX was started
+*/
+void ETH200RFM69::stopTx(unsigned long txStart) {
+  if (_mode == RF69_MODE_TX) {
+    stats.txAirtime += millis() - txStart;
+  }
+  setMode(RF69_MODE_STANDBY);
+}
 
-// sends a package
-boolean ETH200RFM69::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize) {
+/* internal function
+ appends numBits bits of packet (starting with bit 7 of packet[0]) to a bit stream and
+ writes every byte which got full to out.
+ All this construction is needed because a stuffed payload/bit stream does not
+ end on a byte boundary and the thermostats expects payload bits are followed
+ directly by sync word bits.
+ pendingByte, pendingBits - the bits which didn't fill a full byte yet, carried over from
+                            the last call and updated for the next one
+ returns the number of bytes written to out, out needs space for numBits / 8 + 1 bytes
+*/
+uint8_t ETH200RFM69::packBits(const uint8_t packet[], uint8_t numBits, uint8_t out[], uint8_t &pendingByte, uint8_t &pendingBits) {
+  uint8_t numOut = 0;
+  for (uint8_t curBitPos = 0; curBitPos < numBits; curBitPos++) {
+    /*
+    current position of our cursor inside the packet
+    curBitPos = 0, packet[0], bit 7,  pPos = curBitPos / 8, bPos = 7 - (curBitPos % 8)
+    curBitPos = 1, packet[0], bit 6
+    curBitPos = 2, packet[0], bit 5
+    ...
+    curBitPos = 7, packet[0], bit 0
+    curBitPos = 8, packet[1], bit 7
+    curBitPos = 9, packet[1], bit 6
+    ...
+    curBitPos = numBits - 1, packet[(numBits - 1) / 8], bit X
+    */
+    uint8_t curBit = bitRead(packet[curBitPos / 8], 7 - (curBitPos % 8)); // current Bit at curBitPos in packet
+    pendingByte = pendingByte << 1 | curBit;
+    pendingBits++;  // we have added one bit
+
+    if (pendingBits == 8) {
+      // we have one full byte
+      out[numOut] = pendingByte;
+      numOut++;
+      pendingBits = 0;
+    } // else keep filling the pendingByte until it's full
+  }
+  return numOut;
+}
+
+/* internal function
+ busy waits until flag is set in register reg, gives up after timeout ms
+ stall - recorded in lastStall if the wait gives up
+ returns false if it gave up
+*/
+boolean ETH200RFM69::waitForFlag(uint8_t reg, uint8_t flag, unsigned long timeout, ETH200RFM69Stall_t stall) {
+  unsigned long start = millis();
+  while ((readReg(reg) & flag) == 0x00) {
+    if (millis() - start > timeout) {
+      lastStall = stall;
+      return false;
+    }
+    yield();
+  }
+  return true;
+}
+
+
+/* encodes a packet the way the thermostats expect it, doesn't touch the radio module
+ counter, deviceType, address, cmd, cmds[] - content of the packet, the CRC is added
+ packet[]       - returns the packet including the CRC, needs CFG_ETH200MAXPACKETSIZE bytes
+ packetSize     - returns the number of bytes in packet[]
+ stream[]       - returns the reversed and zero stuffed packet for send(), needs
+                  CFG_ETH200MAXPACKETSIZE + 1 bytes
+ numStuffedBits - returns the number of stuffed bits, see send()
+ returns the number of bytes in stream[], 0 for an unknown device type
+*/
+uint8_t ETH200RFM69::encodePacket(uint8_t counter, uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[],
+                                  uint8_t cmdsSize, uint8_t packet[], uint8_t &packetSize, uint8_t stream[],
+                                  uint8_t &numStuffedBits) {
   uint16_t crcStart = 0; // crc start value, depends on device type
   // 0. step is construct the raw packet
   //    without the sync word, that's added by the RFM69 module automatically
@@ -906,15 +899,14 @@ boolean ETH200RFM69::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cm
     payloadLength = 8;
     crcStart = ETH200CRCStartWindowSensor;
   } else {
-    MXINFO_PRINTLLN(F("Was instructed to send package for unknown device type, aborting"));
-    return false;
+    return 0;
   }
   uint8_t payload[payloadLength];
   for (uint8_t i = 0; i < payloadLength; i++) {
     // init payload
     payload[i] = 0;
   }
-  payload[0] = currentPacketCounter;
+  payload[0] = counter;
   payload[1] = deviceType;
   // we are shifting the Byte we want to the right most position, that will be cast/assigned
   // to the variable
@@ -942,16 +934,15 @@ boolean ETH200RFM69::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cm
   #endif //MXDEBUG
 
   MXDEBUG_PRINTLLN(F("Packet constructed, including CRC:"));
-  // copy the packet into the lastSentPacket array
   for (uint8_t i = 0; i < payloadPos; i++) {
-    lastSentPacket[i] = payload[i];
+    packet[i] = payload[i];
     #ifdef MXDEBUG
       printHexWithZeroPad(Serial, payload[i]);
       Serial.print(F(" "));
     #endif //MXDEBUG
   }
   MXDEBUG_PRINTLN(F(""));
-  lastSentPacketSize = payloadPos;
+  packetSize = payloadPos;
 
   // 2. step: reverse the byte order
   MXDEBUG_PRINTLLN(F("packet(crc calculated, reversed byte order):"));
@@ -987,7 +978,7 @@ boolean ETH200RFM69::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cm
 
   uint8_t stuffedPayloadLength = payloadLength + 1; // we are always one byte longer than the original array
                                                     // because we may need to add some overflow bits
-  uint8_t stuffedPayload[stuffedPayloadLength];
+  uint8_t* stuffedPayload = stream;
   uint8_t wasStuffed = 0;
   wasStuffed = stuffPayload(reversedPayload, stuffedPayload, payloadLength);
 
@@ -1018,20 +1009,34 @@ boolean ETH200RFM69::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cm
     Serial.println();
   #endif //MXDEBUG
 
+  numStuffedBits = wasStuffed;
+  return stuffedPayloadLength;
+}
+
+// sends a package
+boolean ETH200RFM69::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize) {
+  MXPROFILE_SCOPE("sendPacket"); // includes sendFrame, the difference is the packet encoding
+  uint8_t stuffedPayload[CFG_ETH200MAXPACKETSIZE + 1];
+  uint8_t wasStuffed = 0;
+  uint8_t stuffedPayloadLength = encodePacket(currentPacketCounter, deviceType, address, cmd, cmds, cmdsSize,
+                                              lastSentPacket, lastSentPacketSize, stuffedPayload, wasStuffed);
+  if (stuffedPayloadLength == 0) {
+    MXINFO_PRINTLLN(F("Was instructed to send package for unknown device type, aborting"));
+    return false;
+  }
+
   // packet (stuffedPayload) is prepared for sending
   // manchester encoding and sync word prefix will be added by RFM69
   yield(); // before we starting the transmit give the microcontroller time to do other stuff
   MXDEBUG_PRINTLLN(F("Handing packet over to RFM69 module."));
-  MXTIME_PRINT(F("Start sending packets."));
-  send(stuffedPayload, stuffedPayloadLength, wasStuffed);
-  MXTIME_PRINT(F("Finished sending packets."));
+  boolean sent = send(stuffedPayload, stuffedPayloadLength, wasStuffed);
   // we sent a packet so we need to increase the counter for the next packet
+  // also if sending failed, the thermostat might have got a part of the repeats
   if (currentPacketCounter < 255) {
     currentPacketCounter++;
   } else {
     // rollover
     currentPacketCounter = 1;
   }
-  // if we reach this point the packet was sent successfully
-  return true;
+  return sent;
 }
\ No newline at end of file
@@ -34,11 +34,34 @@ and copyright notices in any redistribution of this code
 #ifndef ETH200RFM69_h
   #define ETH200RFM69_h
 
+  #include <config.h>            // project settings file, for CFG_ETH200NUMPACKETSENDREPEATS
   #include <RFM69.h>
   #include <RFM69registers.h>
 
+  // radio pipeline counters, only ever incremented, see ETH200RFM69::resetStats()
+  struct ETH200RFM69Stats {
+    volatile uint32_t interrupts = 0; // DIO0 interrupts, incremented in isr0
+    uint32_t fifoReads = 0;           // payloads read from the FIFO
+    uint32_t unknownTypes = 0;        // payloads with a device type we don't handle
+    uint32_t lengthErrors = 0;        // payloads with a wrong length
+    uint32_t crcErrors = 0;           // payloads with a CRC mismatch
+    uint32_t accepted = 0;            // valid packets handed over via DATA
+    uint32_t txFrames = 0;            // calls of sendFrame
+    uint32_t txRepeats = 0;           // packets pushed into the FIFO while sending
+    uint32_t txAirtime = 0;           // in ms, time spent in TX mode
+  };
+
+  // busy waits which gave up, see ETH200RFM69::lastStall
+  enum ETH200RFM69Stall_t {
+    stallNone,
+    stallModeReady,   // the module didn't signal ModeReady after a mode change
+    stallTxFifo,      // the TX FIFO didn't drain
+    stallPacketSent,  // the module didn't signal PacketSent
+  };
+
   class ETH200RFM69: public RFM69 {
     public:
+      static ETH200RFM69Stats stats;
       static uint8_t PAYLOADETH200;
       static uint16_t ETH200CRCStartWindowSensor;
       static uint16_t ETH200CRCStartRemoteControl;
@@ -46,20 +69,32 @@ and copyright notices in any redistribution of this code
       uint8_t currentPacketCounter = 1; // the current packet counter, will be incremented whenever a packet is sent
       uint8_t *lastSentPacket; // the last raw packet we sent out, pointer to an array which will be initialized during constructor
       uint8_t lastSentPacketSize = 0;
+      ETH200RFM69Stall_t lastStall = stallNone; // why the last send failed, stallNone if it didn't
+      uint32_t DATAMICROS = 0; // micros() of the DIO0 interrupt of the packet in DATA
+      uint16_t numRepeats = CFG_ETH200NUMPACKETSENDREPEATS; // repeats of every packet sent, see MXTxProfiles.h
       ETH200RFM69(uint8_t slaveSelectPin=RF69_SPI_CS, uint8_t interruptPin=RF69_IRQ_PIN, bool isRFM69HW=false); //override
       bool initialize(); //override
       void readAllRegs(); //override
       virtual bool receiveDone(); //override
       boolean send(uint8_t buffer[], uint8_t bufferSize, uint8_t numStuffedBits = 0); //override and signature change
       boolean sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize); // sends a packet
+      static uint8_t encodePacket(uint8_t counter, uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[],
+                                  uint8_t cmdsSize, uint8_t packet[], uint8_t &packetSize, uint8_t stream[],
+                                  uint8_t &numStuffedBits); // the packet and the stream sendPacket sends, see MXRadio.h
+      static void resetStats(); // sets all stats counters to 0
+      static boolean dataPending() { return _haveData; } // DIO0 fired and receiveDone() didn't handle it yet
     protected:
+      static volatile uint32_t _irqMicros; // micros() of the last DIO0 interrupt, set in isr0
       static void isr0(); //override
       void interruptHandler(); //override
-      void sendFrame(uint8_t buffer[], uint8_t bufferSize, uint8_t numStuffedBits = 0); //override and signature change
-      uint8_t reverseByte(uint8_t b);
-      uint16_t calcCRC16r(uint16_t c,uint16_t crc, uint16_t mask);
-      uint16_t calcPacketCRC16r(uint8_t packet[], uint8_t length, uint16_t crcStart, uint16_t crcMask);
-      uint8_t destuffPayload(uint8_t inBuf[], uint8_t destuffedBuf[], uint8_t length);
-      uint8_t stuffPayload(uint8_t inBuf[], uint8_t stuffedBuf[], uint8_t length);
+      boolean sendFrame(uint8_t buffer[], uint8_t bufferSize, uint8_t numStuffedBits = 0); //override and signature change
+      boolean waitForFlag(uint8_t reg, uint8_t flag, unsigned long timeout, ETH200RFM69Stall_t stall);
+      void stopTx(unsigned long txStart);
+      static uint8_t reverseByte(uint8_t b);
+      static uint16_t calcCRC16r(uint16_t c,uint16_t crc, uint16_t mask);
+      static uint16_t calcPacketCRC16r(uint8_t packet[], uint8_t length, uint16_t crcStart, uint16_t crcMask);
+      static uint8_t destuffPayload(uint8_t inBuf[], uint8_t destuffedBuf[], uint8_t length);
+      static uint8_t stuffPayload(uint8_t inBuf[], uint8_t stuffedBuf[], uint8_t length);
+      uint8_t packBits(const uint8_t packet[], uint8_t numBits, uint8_t out[], uint8_t &pendingByte, uint8_t &pendingBits);
   };
 #endif // ETH200RFM69_h
\ No newline at end of file
@@ -178,6 +178,191 @@ and copyright notices in any redistribution of this code
       do { if (0) mxDebugTime("", "", "", 0, text); } while (0)
   #endif //MXDEBUG_TIME
 
+  /*
+    Deferred logger
+    Printing to Serial takes several ms per line, inside the RX path that is enough to
+    miss most of the packets. The MXLOG_* macros therefore only record a compact event
+    (timestamp, pointer to the format string in flash and up to MXLOG_MAX_ARGS numeric
+    arguments, or up to MXLOG_MAX_DUMP raw bytes) into a RAM ring in O(1). The
+    formatting and printing happens later in mxLogDrain(), which should be called when
+    nothing time critical is going on.
+    Format strings are printf formats, all arguments are passed as 32 bit unsigned
+    values, so use %u, %d, %X, %02X, %c, but not %f or %s.
+    If the ring is full new events are dropped and counted, the count is logged with
+    the next drain.
+  */
+  #define MXLOG_MAX_ARGS 4
+  #define MXLOG_MAX_DUMP (MXLOG_MAX_ARGS * 4)
+  #define MXLOG_LINE_SIZE 192
+
+  enum mxLogKind_t : uint8_t {
+    mxLogText,
+    mxLogHex,   // dump of data bytes as hex, format is used as label
+    mxLogBin,   // dump of data bytes as binary, format is used as label
+  };
+
+  struct mxLogEvent {
+    unsigned long time;  // micros() when the event was recorded
+    const char* format;  // format string or label, stays in flash
+    const char* prefix;  // log level, e.g. "DEBUG: "
+    mxLogKind_t kind;
+    uint8_t length;      // number of arguments or dumped bytes
+    union {
+      uint32_t args[MXLOG_MAX_ARGS];
+      uint8_t data[MXLOG_MAX_DUMP];
+    };
+  };
+
+  struct mxLogRing {
+    mxLogEvent events[CFG_LOG_RING_SIZE];
+    uint16_t head;       // next event to write
+    uint16_t tail;       // next event to drain
+    uint16_t dropped;    // events dropped since the last drain because the ring was full
+    // optional additional output, e.g. MQTT. If it returns false the line goes to Serial.
+    bool (*sink)(const char* line);
+  };
+
+  // there must be exactly one ring for all translation units, a static local of an
+  // inline function is shared by all of them. It's zero initialized, so there is no
+  // guard variable checked on every call.
+  inline mxLogRing& mxLogGetRing() {
+    static mxLogRing ring;
+    return ring;
+  }
+
+  // returns the next free event or NULL if the ring is full
+  inline mxLogEvent* mxLogAlloc(const char* prefix, const char* format, mxLogKind_t kind) {
+    mxLogRing& ring = mxLogGetRing();
+    uint16_t next = (ring.head + 1) % CFG_LOG_RING_SIZE;
+    if (next == ring.tail) {
+      ring.dropped++;
+      return NULL;
+    }
+    mxLogEvent* event = &ring.events[ring.head];
+    event->time = micros();
+    event->prefix = prefix;
+    event->format = format;
+    event->kind = kind;
+    event->length = 0;
+    ring.head = next;
+    return event;
+  }
+
+  template <typename... Args>
+  inline void mxLogPush(const char* prefix, const char* format, Args... args) {
+    static_assert(sizeof...(Args) <= MXLOG_MAX_ARGS, "too many MXLOG arguments");
+    mxLogEvent* event = mxLogAlloc(prefix, format, mxLogKind_t::mxLogText);
+    if (event == NULL) {
+      return;
+    }
+    const uint32_t values[sizeof...(Args) + 1] = {(uint32_t)args..., 0};
+    for (uint8_t i = 0; i < sizeof...(Args); i++) {
+      event->args[i] = values[i];
+    }
+    event->length = sizeof...(Args);
+  }
+
+  inline void mxLogPushDump(const char* prefix, const char* label, mxLogKind_t kind,
+                            const uint8_t* data, uint8_t length) {
+    mxLogEvent* event = mxLogAlloc(prefix, label, kind);
+    if (event == NULL) {
+      return;
+    }
+    if (length > MXLOG_MAX_DUMP) {
+      length = MXLOG_MAX_DUMP;
+    }
+    memcpy(event->data, data, length);
+    event->length = length;
+  }
+
+  // formats a single event into line
+  static void mxLogFormat(const mxLogEvent& event, char* line, size_t size) __attribute__((unused));
+  static void mxLogFormat(const mxLogEvent& event, char* line, size_t size) {
+    int pos = snprintf(line, size, "%s%lu: ", event.prefix, event.time / 1000);
+    if (event.kind == mxLogKind_t::mxLogText) {
+      // surplus arguments are ignored by printf
+      snprintf_P(line + pos, size - pos, event.format,
+                 (unsigned int)event.args[0], (unsigned int)event.args[1],
+                 (unsigned int)event.args[2], (unsigned int)event.args[3]);
+      return;
+    }
+    pos += snprintf_P(line + pos, size - pos, event.format);
+    for (uint8_t i = 0; (i < event.length) && (pos < (int)size - 10); i++) {
+      if (event.kind == mxLogKind_t::mxLogHex) {
+        pos += snprintf(line + pos, size - pos, " %02X", event.data[i]);
+      } else {
+        line[pos++] = ' ';
+        for (int8_t bit = 7; bit >= 0; bit--) {
+          line[pos++] = bitRead(event.data[i], bit) ? '1' : '0';
+        }
+        line[pos] = '\0';
+      }
+    }
+  }
+
+  static void mxLogOutput(const char* line) __attribute__((unused));
+  static void mxLogOutput(const char* line) {
+    mxLogRing& ring = mxLogGetRing();
+    if ((ring.sink == NULL) || !ring.sink(line)) {
+      Serial.println(line);
+    }
+  }
+
+  // prints up to maxEvents recorded events, returns the number of events printed
+  static uint16_t mxLogDrain(uint16_t maxEvents) __attribute__((unused));
+  static uint16_t mxLogDrain(uint16_t maxEvents) {
+    mxLogRing& ring = mxLogGetRing();
+    char line[MXLOG_LINE_SIZE];
+    if (ring.dropped > 0) {
+      snprintf(line, sizeof(line), "LOG: %u events dropped, ring full", ring.dropped);
+      ring.dropped = 0;
+      mxLogOutput(line);
+    }
+    uint16_t drained = 0;
+    while ((ring.tail != ring.head) && (drained < maxEvents)) {
+      mxLogFormat(ring.events[ring.tail], line, sizeof(line));
+      ring.tail = (ring.tail + 1) % CFG_LOG_RING_SIZE;
+      mxLogOutput(line);
+      drained++;
+    }
+    return drained;
+  }
+
+  // sets an additional output for the drained lines, see mxLogRing
+  static void mxLogSetSink(bool (*sink)(const char* line)) __attribute__((unused));
+  static void mxLogSetSink(bool (*sink)(const char* line)) {
+    mxLogGetRing().sink = sink;
+  }
+
+  #ifdef MXDEBUG
+    #define MXLOG_DEBUG(format, ...) \
+      mxLogPush("DEBUG: ", PSTR(format), ##__VA_ARGS__);
+      //record a deferred debug line, e.g. MXLOG_DEBUG("CRC: %04X", crc)
+    #define MXLOG_DEBUG_HEX(label, data, length) \
+      mxLogPushDump("DEBUG: ", PSTR(label), mxLogKind_t::mxLogHex, data, length);
+      //record a deferred hex dump of up to MXLOG_MAX_DUMP bytes
+    #define MXLOG_DEBUG_BIN(label, data, length) \
+      mxLogPushDump("DEBUG: ", PSTR(label), mxLogKind_t::mxLogBin, data, length);
+      //record a deferred binary dump of up to MXLOG_MAX_DUMP bytes
+  #else
+    // compiled out, see MXDEBUG_PRINT
+    #define MXLOG_DEBUG(format, ...) \
+      do { if (0) mxLogPush("", format, ##__VA_ARGS__); } while (0);
+    #define MXLOG_DEBUG_HEX(label, data, length) \
+      do { if (0) mxLogPushDump("", label, mxLogKind_t::mxLogHex, data, length); } while (0);
+    #define MXLOG_DEBUG_BIN(label, data, length) \
+      do { if (0) mxLogPushDump("", label, mxLogKind_t::mxLogBin, data, length); } while (0);
+  #endif //MXDEBUG
+
+  #ifdef MXINFO
+    #define MXLOG_INFO(format, ...) \
+      mxLogPush("INFO: ", PSTR(format), ##__VA_ARGS__);
+      //record a deferred info line
+  #else
+    #define MXLOG_INFO(format, ...) \
+      do { if (0) mxLogPush("", format, ##__VA_ARGS__); } while (0);
+  #endif //MXINFO
+
   /*
     Printing binary and hex values with leading zeros
     Author: septillion
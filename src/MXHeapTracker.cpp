@@ -0,0 +1,61 @@
+/****************************************************************************
+MXHeapTracker.cpp - Linker wrapped allocator functions for MXHeapTracker.h.
+
+Only built into the firmware if MXHEAPTRACK is defined, the linker then
+needs -Wl,--wrap=malloc -Wl,--wrap=realloc -Wl,--wrap=calloc to route the
+allocator calls through the __wrap_ functions below.
+
+Copyright 2020 mt-mrx <64284703+mt-mrx@users.noreply.github.com>
+*****************************************************************************
+License
+*****************************************************************************
+This program is free software; you can redistribute it
+and/or modify it under the terms of the GNU General
+Public License as published by the Free Software
+Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public
+License for more details.
+
+Licence can be viewed at
+http://www.gnu.org/licenses/gpl-3.0.txt
+
+Please maintain this license information along with authorship
+and copyright notices in any redistribution of this code
+****************************************************************************/
+
+#include <MXHeapTracker.h>
+
+#ifdef MXHEAPTRACK
+  static inline void mxHeapRecord(size_t size, bool realloc) {
+    mxHeapSite* site = mxHeapCurrentSite();
+    (site ? *site : mxHeapOtherSite()).record(size, realloc);
+  }
+
+  extern "C" {
+    void* __real_malloc(size_t size);
+    void* __real_realloc(void* ptr, size_t size);
+    void* __real_calloc(size_t num, size_t size);
+
+    void* __wrap_malloc(size_t size) {
+      mxHeapRecord(size, false);
+      return __real_malloc(size);
+    }
+
+    void* __wrap_realloc(void* ptr, size_t size) {
+      // realloc(NULL, size) is a plain allocation, that's how String allocates
+      // its first buffer
+      mxHeapRecord(size, ptr != NULL);
+      return __real_realloc(ptr, size);
+    }
+
+    void* __wrap_calloc(size_t num, size_t size) {
+      mxHeapRecord(num * size, false);
+      return __real_calloc(num, size);
+    }
+  }
+#endif //MXHEAPTRACK
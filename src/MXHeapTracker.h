@@ -0,0 +1,135 @@
+/****************************************************************************
+MXHeapTracker.h - Heap allocations accounted by call site.
+
+MXHEAP_SITE("name") makes "name" the call site of all malloc/realloc/calloc
+calls until the end of the enclosing block, nested sites take precedence.
+Allocations outside of any site are accounted to the "other" site. Every
+site counts its runs (calls), allocations, reallocations, bytes and the
+largest request, so allocsPerCall shows which code path churns the heap.
+
+The allocator functions are wrapped by the linker, so the accounting only
+works if MXHEAPTRACK is defined together with
+  -Wl,--wrap=malloc -Wl,--wrap=realloc -Wl,--wrap=calloc
+see the d1_mini_heaptrack and e2ebench_heaptrack envs in platformio.ini. Without MXHEAPTRACK the
+macro is compiled out completely.
+
+Copyright 2020 mt-mrx <64284703+mt-mrx@users.noreply.github.com>
+*****************************************************************************
+License
+*****************************************************************************
+This program is free software; you can redistribute it
+and/or modify it under the terms of the GNU General
+Public License as published by the Free Software
+Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public
+License for more details.
+
+Licence can be viewed at
+http://www.gnu.org/licenses/gpl-3.0.txt
+
+Please maintain this license information along with authorship
+and copyright notices in any redistribution of this code
+****************************************************************************/
+
+#ifndef MXHEAPTRACKER_H
+  #define MXHEAPTRACKER_H
+  #include <Arduino.h>
+
+  // allocation statistics of one named call site
+  // all sites are linked into a single list when they are run the first time
+  struct mxHeapSite {
+    const char* name;
+    mxHeapSite* next;
+    bool registered;
+    uint32_t calls;
+    uint32_t allocs;
+    uint32_t reallocs;
+    uint32_t bytes;
+    uint32_t maxSize;
+
+    // constexpr so a static mxHeapSite is initialized at compile time, see mxProfileStat
+    constexpr mxHeapSite(const char* siteName)
+      : name(siteName), next(NULL), registered(false), calls(0), allocs(0), reallocs(0), bytes(0), maxSize(0) {}
+
+    void registerSite();
+    void record(size_t size, bool realloc);
+    void reset();
+  };
+
+  // head of the list of all sites run at least once
+  inline mxHeapSite*& mxHeapSiteList() {
+    static mxHeapSite* head = NULL;
+    return head;
+  }
+
+  // site allocations are accounted to, NULL outside of any MXHEAP_SITE
+  inline mxHeapSite*& mxHeapCurrentSite() {
+    static mxHeapSite* current = NULL;
+    return current;
+  }
+
+  // site of all allocations outside of MXHEAP_SITE scopes
+  inline mxHeapSite& mxHeapOtherSite() {
+    static mxHeapSite other("other");
+    return other;
+  }
+
+  inline void mxHeapSite::registerSite() {
+    if (!registered) {
+      registered = true;
+      next = mxHeapSiteList();
+      mxHeapSiteList() = this;
+    }
+  }
+
+  // called by the wrapped allocator functions, must not allocate itself
+  inline void mxHeapSite::record(size_t size, bool realloc) {
+    registerSite();
+    if (realloc) {
+      reallocs++;
+    } else {
+      allocs++;
+    }
+    bytes += size;
+    if (size > maxSize) {
+      maxSize = size;
+    }
+  }
+
+  inline void mxHeapSite::reset() {
+    calls = 0;
+    allocs = 0;
+    reallocs = 0;
+    bytes = 0;
+    maxSize = 0;
+  }
+
+  // makes a site the current one for the lifetime of the object, see MXHEAP_SITE
+  class MXHeapSiteScope {
+    private:
+      mxHeapSite* _previous;
+    public:
+      MXHeapSiteScope(mxHeapSite& site) : _previous(mxHeapCurrentSite()) {
+        site.registerSite();
+        site.calls++;
+        mxHeapCurrentSite() = &site;
+      }
+      ~MXHeapSiteScope() { mxHeapCurrentSite() = _previous; }
+  };
+
+  #define MXHEAP_CONCAT_(a, b) a##b
+  #define MXHEAP_CONCAT(a, b) MXHEAP_CONCAT_(a, b)
+  #ifdef MXHEAPTRACK
+    #define MXHEAP_SITE(name) \
+      static mxHeapSite MXHEAP_CONCAT(mxHeapSite_, __LINE__)(name); \
+      MXHeapSiteScope MXHEAP_CONCAT(mxHeapSiteScope_, __LINE__)(MXHEAP_CONCAT(mxHeapSite_, __LINE__));
+      //accounts the allocations until the end of the enclosing block to name
+  #else
+    #define MXHEAP_SITE(name)
+  #endif //MXHEAPTRACK
+#endif //MXHEAPTRACKER_H
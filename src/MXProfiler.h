@@ -0,0 +1,203 @@
+/****************************************************************************
+MXProfiler.h - Simple scoped profiler.
+
+MXPROFILE_SCOPE("name") measures the time from the macro to the end of the
+enclosing block. Every named scope aggregates count, min, max, sum and a
+log2 histogram of its run times. Time is measured in ticks, CPU cycles
+(ESP.getCycleCount()) on the ESP8266 and nanoseconds (std::chrono) on the
+host, see mxProfileTicksPerUs().
+
+Costs a few cycles per scope, so it can stay enabled in production builds
+and the statistics can be read via MQTT (see set/profile in readme.txt).
+If MXPROFILE isn't defined the macros are compiled out completely.
+
+mxLatencyHist is a small histogram for percentile estimates of run times
+measured in us, e.g. the loop() stages.
+
+Copyright 2020 mt-mrx <64284703+mt-mrx@users.noreply.github.com>
+*****************************************************************************
+License
+*****************************************************************************
+This program is free software; you can redistribute it
+and/or modify it under the terms of the GNU General
+Public License as published by the Free Software
+Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public
+License for more details.
+
+Licence can be viewed at
+http://www.gnu.org/licenses/gpl-3.0.txt
+
+Please maintain this license information along with authorship
+and copyright notices in any redistribution of this code
+****************************************************************************/
+
+#ifndef MXPROFILER_H
+  #define MXPROFILER_H
+  #include <config.h>            // project settings file, need to include to use MXPROFILE
+  #include <Arduino.h>
+  #ifdef MXHOST
+    #include <chrono>
+  #endif //MXHOST
+
+  #define MXPROFILE_HIST_SIZE 32  // one bucket per bit of the 32 bit tick values
+
+  // current time in ticks, wraps around, only differences are meaningful
+  inline uint32_t mxProfileTicks() {
+    #ifdef MXHOST
+      return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch()).count();
+    #else
+      return ESP.getCycleCount();
+    #endif //MXHOST
+  }
+
+  inline uint32_t mxProfileTicksPerUs() {
+    #ifdef MXHOST
+      return 1000;
+    #else
+      return ESP.getCpuFreqMHz();
+    #endif //MXHOST
+  }
+
+  // statistics of one named scope
+  // all scopes are linked into a single list when they are run the first time
+  struct mxProfileStat {
+    const char* name;
+    mxProfileStat* next;
+    bool registered;
+    uint32_t count;
+    uint32_t min;
+    uint32_t max;
+    uint64_t sum;
+    uint32_t hist[MXPROFILE_HIST_SIZE]; // hist[i] counts run times of 2^i to 2^(i+1)-1 ticks
+
+    // constexpr so a static mxProfileStat is initialized at compile time and doesn't need
+    // a guard variable checked on every run of the scope
+    constexpr mxProfileStat(const char* statName)
+      : name(statName), next(NULL), registered(false), count(0), min(UINT32_MAX), max(0), sum(0), hist{} {}
+
+    void record(uint32_t ticks);
+    void reset();
+  };
+
+  // head of the list of all scopes run at least once
+  inline mxProfileStat*& mxProfileList() {
+    static mxProfileStat* head = NULL;
+    return head;
+  }
+
+  inline void mxProfileStat::record(uint32_t ticks) {
+    if (!registered) {
+      registered = true;
+      next = mxProfileList();
+      mxProfileList() = this;
+    }
+    count++;
+    sum += ticks;
+    if (ticks < min) {
+      min = ticks;
+    }
+    if (ticks > max) {
+      max = ticks;
+    }
+    hist[(ticks == 0) ? 0 : (31 - __builtin_clz(ticks))]++;
+  }
+
+  inline void mxProfileStat::reset() {
+    count = 0;
+    min = UINT32_MAX;
+    max = 0;
+    sum = 0;
+    memset(hist, 0, sizeof(hist));
+  }
+
+  // measures the lifetime of the object, see MXPROFILE_SCOPE
+  class MXProfileScope {
+    private:
+      mxProfileStat& _stat;
+      uint32_t _start;
+    public:
+      MXProfileScope(mxProfileStat& stat) : _stat(stat), _start(mxProfileTicks()) {}
+      ~MXProfileScope() { _stat.record(mxProfileTicks() - _start); }
+  };
+
+  // latency histogram in us for percentile estimates, used for the loop() stages
+  // 4 buckets per power of 2, so a percentile is off by at most 25%. Values below 4us
+  // get their own bucket, values above ~134s all end up in the last one.
+  #define MXLATENCY_HIST_SIZE 104
+  struct mxLatencyHist {
+    uint32_t count = 0;
+    uint32_t max = 0;
+    uint16_t hist[MXLATENCY_HIST_SIZE] = {0};
+
+    static uint8_t bucket(uint32_t us) {
+      if (us < 4) {
+        return us;
+      }
+      uint8_t octave = 31 - __builtin_clz(us);        // >= 2
+      uint8_t sub = (us >> (octave - 2)) & 0x03;      // the 2 bits following the highest bit
+      uint16_t index = (octave - 1) * 4 + sub;
+      return (index < MXLATENCY_HIST_SIZE) ? index : MXLATENCY_HIST_SIZE - 1;
+    }
+    // highest value which ends up in the bucket
+    static uint32_t bucketMax(uint8_t index) {
+      if (index < 4) {
+        return index;
+      }
+      uint8_t octave = index / 4 + 1;
+      uint8_t sub = index % 4;
+      return ((uint32_t)(4 + sub) << (octave - 2)) + (1UL << (octave - 2)) - 1;
+    }
+
+    void record(uint32_t us) {
+      count++;
+      if (us > max) {
+        max = us;
+      }
+      uint8_t index = bucket(us);
+      if (hist[index] < UINT16_MAX) {
+        hist[index]++;
+      }
+    }
+
+    // returns the estimated value below which percent of the recorded values are
+    uint32_t percentile(uint8_t percent) {
+      if (count == 0) {
+        return 0;
+      }
+      uint32_t rank = ((uint64_t)count * percent + 99) / 100; // rounded up, 1 based
+      uint32_t seen = 0;
+      for (uint8_t i = 0; i < MXLATENCY_HIST_SIZE; i++) {
+        seen += hist[i];
+        if (seen >= rank) {
+          uint32_t value = bucketMax(i);
+          return (value < max) ? value : max;
+        }
+      }
+      return max;
+    }
+
+    void reset() {
+      count = 0;
+      max = 0;
+      memset(hist, 0, sizeof(hist));
+    }
+  };
+
+  #define MXPROFILE_CONCAT_(a, b) a##b
+  #define MXPROFILE_CONCAT(a, b) MXPROFILE_CONCAT_(a, b)
+  #ifdef MXPROFILE
+    #define MXPROFILE_SCOPE(name) \
+      static mxProfileStat MXPROFILE_CONCAT(mxProfileStat_, __LINE__)(name); \
+      MXProfileScope MXPROFILE_CONCAT(mxProfileScope_, __LINE__)(MXPROFILE_CONCAT(mxProfileStat_, __LINE__));
+      //measures the time until the end of the enclosing block
+  #else
+    #define MXPROFILE_SCOPE(name)
+  #endif //MXPROFILE
+#endif //MXPROFILER_H
@@ -47,6 +47,8 @@ and copyright notices in any redistribution of this code
     private:
     public:
       MXPubSubClientWrapper(Client& espc);
+      // keep the PubSubClient overloads visible, e.g. publishing a payload with length
+      using PubSubClient::publish;
       bool publish(StringSumHelper topic, String str);
       bool publish(StringSumHelper topic, unsigned int num);
       bool publish(const char* topic, String str);
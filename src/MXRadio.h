@@ -0,0 +1,298 @@
+/****************************************************************************
+MXRadio.h - Frame level radio interface with pluggable backends.
+
+The firmware pipeline only sees frames: a received frame is the destuffed,
+reversed and CRC checked packet with its RSSI and the micros() it arrived,
+a transmission is the zero stuffed bit stream of a packet which the
+backend repeats. Everything below that, SPI, FIFO and registers, stays in
+the backend:
+  - MXRadioRFM69 wraps ETH200RFM69, the RFM69 module of the device. Its
+    transmit() is synchronous, sendFrame() has to keep the FIFO filled to
+    hold the timing of the repeats, so it returns when the last repeat is
+    out and transmitting() is always false.
+  - MXRadioLoopback keeps frames in memory, inject() queues a frame as if
+    it was received, transmit() only accounts the repeats and the airtime
+    (setAirtime(), 0 by default, so it completes at once). With setEcho()
+    every packet sent is received again. No SPI and no codec on the RX
+    side, so the pipeline and the scheduling can be benchmarked on the
+    host at full speed.
+
+Packets are encoded by ETH200RFM69::encodePacket() for every backend, so
+all of them put the same bits on air.
+
+Copyright 2020 mt-mrx <64284703+mt-mrx@users.noreply.github.com>
+*****************************************************************************
+License
+*****************************************************************************
+This program is free software; you can redistribute it
+and/or modify it under the terms of the GNU General
+Public License as published by the Free Software
+Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public
+License for more details.
+
+Licence can be viewed at
+http://www.gnu.org/licenses/gpl-3.0.txt
+
+Please maintain this license information along with authorship
+and copyright notices in any redistribution of this code
+****************************************************************************/
+
+#ifndef MXRADIO_H
+  #define MXRADIO_H
+
+  #include <config.h>            // project settings file, for CFG_RADIO_LOOPBACK_SIZE
+  #include <Arduino.h>
+  #include <ETH200RFM69.h>
+
+  // the counters of every backend are the ones of the RFM69, see ETH200RFM69Stats
+  typedef ETH200RFM69Stats mxRadioStats;
+
+  struct mxRadioFrame {
+    uint8_t data[CFG_ETH200MAXPACKETSIZE] = {0}; // packet without the sync word, CRC checked
+    uint8_t length = 0;
+    int16_t rssi = 0;                            // in dBm
+    uint32_t rxMicros = 0;                       // micros() when the frame arrived
+  };
+
+  class MXRadio {
+    protected:
+      uint8_t _packetCounter = 1;                      // counter of the next packet, see sendPacket()
+      uint8_t _lastSent[CFG_ETH200MAXPACKETSIZE + 1] = {0}; // bytes of the last transmit()
+      uint8_t _lastSentSize = 0;
+    public:
+      virtual ~MXRadio() {}
+      // (re)initializes the radio with CFG_RF69_POWERLEVEL, also after a stall
+      virtual boolean begin() = 0;
+      // repeats of every packet and power level (0 - 31) of the following transmissions
+      virtual void setTxProfile(uint16_t repeats, uint8_t powerLevel) = 0;
+      // true if a frame is waiting for receive(), cheap enough for the esp_delay() predicate
+      virtual boolean available() = 0;
+      // returns true and the next received frame, otherwise keeps the receiver listening
+      virtual boolean receive(mxRadioFrame& frame) = 0;
+      // starts sending stream, numStuffedBits is the number of valid bits in its last
+      // byte (0 - all 8), with the configured repeats. Returns false if it couldn't be
+      // started, a synchronous backend also if sending failed.
+      virtual boolean transmit(uint8_t stream[], uint8_t size, uint8_t numStuffedBits) = 0;
+      // true while the last transmit() is still on air
+      virtual boolean transmitting() = 0;
+      // encodes the packet and transmits it, the packet counter is incremented also if it
+      // failed, the thermostat might have got some of the repeats
+      virtual boolean sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize);
+      // the bytes of the last transmission, returns their number
+      virtual uint8_t lastSent(const uint8_t*& data);
+      virtual mxRadioStats stats() = 0;
+      virtual void resetStats() = 0;
+      // why the last transmission failed, stallNone if it didn't, see MXWatchdog.h
+      virtual ETH200RFM69Stall_t lastStall() { return stallNone; }
+      virtual void clearStall() {}
+      // size bytes of backend state for a post-mortem, e.g. registers
+      virtual void diagnostics(uint8_t info[], uint8_t size) { memset(info, 0, size); }
+      // prints all registers of the backend to Serial, for debugging
+      virtual void printRegisters() {}
+  };
+
+  class MXRadioRFM69 : public MXRadio {
+    private:
+      ETH200RFM69& _radio;
+    public:
+      MXRadioRFM69(ETH200RFM69& radio) : _radio(radio) {}
+      boolean begin();
+      void setTxProfile(uint16_t repeats, uint8_t powerLevel);
+      boolean available() { return ETH200RFM69::dataPending(); }
+      boolean receive(mxRadioFrame& frame);
+      boolean transmit(uint8_t stream[], uint8_t size, uint8_t numStuffedBits);
+      boolean transmitting() { return false; }
+      boolean sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize);
+      uint8_t lastSent(const uint8_t*& data);
+      mxRadioStats stats();
+      void resetStats() { ETH200RFM69::resetStats(); }
+      ETH200RFM69Stall_t lastStall() { return _radio.lastStall; }
+      void clearStall() { _radio.lastStall = stallNone; }
+      void diagnostics(uint8_t info[], uint8_t size);
+      void printRegisters();
+  };
+
+  class MXRadioLoopback : public MXRadio {
+    private:
+      mxRadioFrame _frames[CFG_RADIO_LOOPBACK_SIZE]; // ring buffer of received frames
+      uint8_t _first = 0;
+      uint8_t _count = 0;
+      mxRadioStats _stats;
+      uint16_t _repeats = CFG_ETH200NUMPACKETSENDREPEATS;
+      uint8_t _powerLevel = CFG_RF69_POWERLEVEL;
+      uint32_t _usPerRepeat = 0;
+      boolean _echo = false;
+      unsigned long _txStart = 0;  // micros() of the last transmit()
+      uint32_t _txUs = 0;          // its airtime
+    public:
+      boolean begin();
+      void setTxProfile(uint16_t repeats, uint8_t powerLevel);
+      boolean available() { return _count > 0; }
+      boolean receive(mxRadioFrame& frame);
+      boolean transmit(uint8_t stream[], uint8_t size, uint8_t numStuffedBits);
+      boolean transmitting() { return (_txUs > 0) && (micros() - _txStart < _txUs); }
+      boolean sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize);
+      mxRadioStats stats() { return _stats; }
+      void resetStats() { _stats = mxRadioStats(); }
+      // queues a received frame, arrived now, returns false if the queue is full and the
+      // frame is lost like a frame which arrives before the RFM69 FIFO was read
+      boolean inject(const uint8_t data[], uint8_t length, int16_t rssi);
+      // airtime of every repeat, transmitting() is true for repeats * usPerRepeat
+      void setAirtime(uint32_t usPerRepeat) { _usPerRepeat = usPerRepeat; }
+      // every packet sent by sendPacket() is received again
+      void setEcho(boolean echo) { _echo = echo; }
+      uint16_t repeats() { return _repeats; }
+      uint8_t powerLevel() { return _powerLevel; }
+  };
+
+  inline boolean MXRadio::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize) {
+    uint8_t packet[CFG_ETH200MAXPACKETSIZE];
+    uint8_t packetSize = 0;
+    uint8_t stream[CFG_ETH200MAXPACKETSIZE + 1];
+    uint8_t numStuffedBits = 0;
+    uint8_t size = ETH200RFM69::encodePacket(_packetCounter, deviceType, address, cmd, cmds, cmdsSize, packet, packetSize,
+                                             stream, numStuffedBits);
+    if (size == 0) {
+      return false;
+    }
+    boolean sent = transmit(stream, size, numStuffedBits);
+    _packetCounter = (_packetCounter < 255) ? _packetCounter + 1 : 1;
+    return sent;
+  }
+
+  inline uint8_t MXRadio::lastSent(const uint8_t*& data) {
+    data = _lastSent;
+    return _lastSentSize;
+  }
+
+  inline boolean MXRadioRFM69::begin() {
+    boolean ret = _radio.initialize();
+    _radio.setPowerLevel(CFG_RF69_POWERLEVEL);
+    return ret;
+  }
+
+  inline void MXRadioRFM69::setTxProfile(uint16_t repeats, uint8_t powerLevel) {
+    _radio.numRepeats = repeats;
+    _radio.setPowerLevel(powerLevel);
+  }
+
+  inline boolean MXRadioRFM69::receive(mxRadioFrame& frame) {
+    if (!_radio.receiveDone()) {
+      return false;
+    }
+    frame.length = min((uint8_t)_radio.DATALEN, (uint8_t)CFG_ETH200MAXPACKETSIZE);
+    memcpy(frame.data, (const void*)_radio.DATA, frame.length);
+    frame.rssi = _radio.RSSI;
+    frame.rxMicros = _radio.DATAMICROS;
+    return true;
+  }
+
+  inline boolean MXRadioRFM69::transmit(uint8_t stream[], uint8_t size, uint8_t numStuffedBits) {
+    return _radio.send(stream, size, numStuffedBits);
+  }
+
+  inline boolean MXRadioRFM69::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize) {
+    // the counter and the last packet stay in ETH200RFM69, the host tools use them directly
+    return _radio.sendPacket(deviceType, address, cmd, cmds, cmdsSize);
+  }
+
+  inline uint8_t MXRadioRFM69::lastSent(const uint8_t*& data) {
+    data = _radio.lastSentPacket;
+    return _radio.lastSentPacketSize;
+  }
+
+  inline mxRadioStats MXRadioRFM69::stats() {
+    noInterrupts(); // interrupts is incremented in isr0
+    mxRadioStats snapshot = ETH200RFM69::stats;
+    interrupts();
+    return snapshot;
+  }
+
+  inline void MXRadioRFM69::diagnostics(uint8_t info[], uint8_t size) {
+    const uint8_t regs[] = {REG_OPMODE, REG_IRQFLAGS1, REG_IRQFLAGS2, REG_PAYLOADLENGTH};
+    for (uint8_t i = 0; i < size; i++) {
+      info[i] = (i < sizeof(regs)) ? _radio.readReg(regs[i]) : 0;
+    }
+  }
+
+  inline void MXRadioRFM69::printRegisters() {
+    _radio.readAllRegsCompact();
+    Serial.println();
+    _radio.readAllRegs();
+  }
+
+  inline boolean MXRadioLoopback::begin() {
+    _first = 0;
+    _count = 0;
+    _txUs = 0;
+    _powerLevel = CFG_RF69_POWERLEVEL;
+    return true;
+  }
+
+  inline void MXRadioLoopback::setTxProfile(uint16_t repeats, uint8_t powerLevel) {
+    _repeats = repeats;
+    _powerLevel = powerLevel;
+  }
+
+  inline boolean MXRadioLoopback::inject(const uint8_t data[], uint8_t length, int16_t rssi) {
+    _stats.interrupts++;
+    if ((_count == CFG_RADIO_LOOPBACK_SIZE) || (length > CFG_ETH200MAXPACKETSIZE)) {
+      return false;
+    }
+    mxRadioFrame& frame = _frames[(_first + _count) % CFG_RADIO_LOOPBACK_SIZE];
+    memcpy(frame.data, data, length);
+    frame.length = length;
+    frame.rssi = rssi;
+    frame.rxMicros = micros();
+    _count++;
+    return true;
+  }
+
+  inline boolean MXRadioLoopback::receive(mxRadioFrame& frame) {
+    if (_count == 0) {
+      return false;
+    }
+    frame = _frames[_first];
+    _first = (_first + 1) % CFG_RADIO_LOOPBACK_SIZE;
+    _count--;
+    _stats.fifoReads++;
+    _stats.accepted++;
+    return true;
+  }
+
+  inline boolean MXRadioLoopback::transmit(uint8_t stream[], uint8_t size, uint8_t numStuffedBits) {
+    (void)numStuffedBits; // the airtime is counted per repeat, not per bit
+    if (transmitting() || (size > sizeof(_lastSent))) {
+      return false;
+    }
+    memcpy(_lastSent, stream, size);
+    _lastSentSize = size;
+    _txStart = micros();
+    _txUs = (uint32_t)_repeats * _usPerRepeat;
+    _stats.txFrames++;
+    _stats.txRepeats += _repeats;
+    _stats.txAirtime += _txUs / 1000;
+    return true;
+  }
+
+  inline boolean MXRadioLoopback::sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize) {
+    uint8_t counter = _packetCounter;
+    boolean sent = MXRadio::sendPacket(deviceType, address, cmd, cmds, cmdsSize);
+    if (sent && _echo) {
+      // encoded again for the packet itself, only the stream is kept by transmit()
+      uint8_t packet[CFG_ETH200MAXPACKETSIZE];
+      uint8_t packetSize = 0;
+      uint8_t stream[CFG_ETH200MAXPACKETSIZE + 1];
+      uint8_t numStuffedBits = 0;
+      ETH200RFM69::encodePacket(counter, deviceType, address, cmd, cmds, cmdsSize, packet, packetSize, stream, numStuffedBits);
+      inject(packet, packetSize, 0);
+    }
+    return sent;
+  }
+#endif //MXRADIO_H
@@ -0,0 +1,155 @@
+/****************************************************************************
+MXScheduler.h - Cooperative task scheduler with time budgets.
+
+Every task is a function which does a small unit of work and returns true
+if there is more work left. runSlice() runs all tasks once in priority
+order, a task is called again while it has work left and its time budget
+for the slice isn't used up. Critical tasks (e.g. servicing the radio) run
+before the slice and again after every other task, so their worst case
+latency is the longest single run of any other task.
+
+Nothing is preempted, a run exceeding the budget is only counted as
+overrun. Run times are accumulated per task, so the CPU share of every
+task can be published for tuning the budgets.
+
+Copyright 2020 mt-mrx <64284703+mt-mrx@users.noreply.github.com>
+*****************************************************************************
+License
+*****************************************************************************
+This program is free software; you can redistribute it
+and/or modify it under the terms of the GNU General
+Public License as published by the Free Software
+Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public
+License for more details.
+
+Licence can be viewed at
+http://www.gnu.org/licenses/gpl-3.0.txt
+
+Please maintain this license information along with authorship
+and copyright notices in any redistribution of this code
+****************************************************************************/
+
+#ifndef MXSCHEDULER_H
+    #define MXSCHEDULER_H
+
+  #include <Arduino.h>
+
+  // does a unit of work, returns true if there is more work left
+  typedef boolean (*mxTaskFunc_t)();
+
+  struct mxTask {
+    const char* name;
+    mxTaskFunc_t run;
+    uint8_t priority;       // lower runs first
+    uint32_t budgetUs;      // time per slice, a single run is never interrupted
+    boolean critical;       // also runs after every other task
+    // statistics since the last resetStats()
+    uint32_t runs = 0;
+    uint32_t overruns = 0;  // slices in which the task exceeded its budget
+    uint32_t maxUs = 0;     // longest slice of the task
+    uint64_t busyUs = 0;    // total time spent in the task
+  };
+
+  class MXScheduler {
+    private:
+      mxTask* _tasks;
+      uint8_t _numTasks;
+      unsigned long _statsSince;  // micros() of the last resetStats()
+      uint64_t _windowUs = 0;     // accumulated time since the last resetStats()
+      void runTask(mxTask& task);
+      void runCritical();
+    public:
+      // tasks - sorted by priority in place
+      MXScheduler(mxTask tasks[], uint8_t numTasks);
+      void runSlice();
+      uint8_t numTasks() { return _numTasks; }
+      mxTask& task(uint8_t i) { return _tasks[i]; }
+      // time since the last resetStats() in us
+      uint64_t windowUs();
+      // share of the time since the last resetStats() spent in a task, in percent
+      float cpuShare(uint8_t i);
+      void resetStats();
+  };
+
+  MXScheduler::MXScheduler(mxTask tasks[], uint8_t numTasks) {
+    _tasks = tasks;
+    _numTasks = numTasks;
+    // insertion sort, stable so tasks with the same priority keep their order
+    for (uint8_t i = 1; i < _numTasks; i++) {
+      for (uint8_t j = i; (j > 0) && (_tasks[j - 1].priority > _tasks[j].priority); j--) {
+        mxTask tmp = _tasks[j];
+        _tasks[j] = _tasks[j - 1];
+        _tasks[j - 1] = tmp;
+      }
+    }
+    _statsSince = micros();
+  }
+
+  void MXScheduler::runTask(mxTask& task) {
+    unsigned long start = micros();
+    unsigned long elapsed = 0;
+    boolean more = false;
+    do {
+      more = task.run();
+      elapsed = micros() - start;
+    } while (more && (elapsed < task.budgetUs));
+    task.runs++;
+    task.busyUs += elapsed;
+    if (elapsed > task.maxUs) {
+      task.maxUs = elapsed;
+    }
+    if (elapsed > task.budgetUs) {
+      task.overruns++;
+    }
+  }
+
+  void MXScheduler::runCritical() {
+    for (uint8_t i = 0; i < _numTasks; i++) {
+      if (_tasks[i].critical) {
+        runTask(_tasks[i]);
+      }
+    }
+  }
+
+  void MXScheduler::runSlice() {
+    runCritical();
+    for (uint8_t i = 0; i < _numTasks; i++) {
+      if (!_tasks[i].critical) {
+        yield();
+        runTask(_tasks[i]);
+        runCritical();
+      }
+    }
+    windowUs();
+  }
+
+  uint64_t MXScheduler::windowUs() {
+    // micros() wraps after ~71 minutes, so the window is accumulated
+    unsigned long now = micros();
+    _windowUs += now - _statsSince;
+    _statsSince = now;
+    return _windowUs;
+  }
+
+  float MXScheduler::cpuShare(uint8_t i) {
+    uint64_t window = windowUs();
+    return (window > 0) ? (float)_tasks[i].busyUs * 100 / window : 0;
+  }
+
+  void MXScheduler::resetStats() {
+    for (uint8_t i = 0; i < _numTasks; i++) {
+      _tasks[i].runs = 0;
+      _tasks[i].overruns = 0;
+      _tasks[i].maxUs = 0;
+      _tasks[i].busyUs = 0;
+    }
+    _statsSince = micros();
+    _windowUs = 0;
+  }
+#endif //MXSCHEDULER_H
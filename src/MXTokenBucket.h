@@ -0,0 +1,105 @@
+/****************************************************************************
+MXTokenBucket.h - Simple token bucket for rate limiting.
+
+A bucket holds up to "burst" tokens and gets one token back every
+"refillInterval" ms. Every admitted event takes one token, if the bucket
+is empty the event is rejected. So short bursts are allowed, but the
+long term rate is limited to one event per refillInterval.
+
+Copyright 2020 mt-mrx <64284703+mt-mrx@users.noreply.github.com>
+*****************************************************************************
+License
+*****************************************************************************
+This program is free software; you can redistribute it
+and/or modify it under the terms of the GNU General
+Public License as published by the Free Software
+Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public
+License for more details.
+
+Licence can be viewed at
+http://www.gnu.org/licenses/gpl-3.0.txt
+
+Please maintain this license information along with authorship
+and copyright notices in any redistribution of this code
+****************************************************************************/
+
+#ifndef MXTOKENBUCKET_H
+    #define MXTOKENBUCKET_H
+
+  #include <Arduino.h>
+
+  class MXTokenBucket {
+    private:
+      uint8_t _burst;
+      unsigned long _refillInterval;  // in ms
+      uint8_t _tokens;
+      unsigned long _lastRefill;      // millis() of the last refilled token
+      void refill(unsigned long now);
+    public:
+      MXTokenBucket(uint8_t burst, unsigned long refillInterval);
+      // refills the bucket to burst, e.g. when a slot gets reused
+      void reset();
+      // returns true if a token is available, doesn't take it
+      bool available();
+      // takes a token, returns false if the bucket is empty
+      bool take();
+      uint8_t tokens();
+  };
+
+  MXTokenBucket::MXTokenBucket(uint8_t burst, unsigned long refillInterval) {
+    _burst = burst;
+    _refillInterval = refillInterval;
+    reset();
+  }
+
+  void MXTokenBucket::reset() {
+    _tokens = _burst;
+    _lastRefill = millis();
+  }
+
+  void MXTokenBucket::refill(unsigned long now) {
+    if (_tokens >= _burst) {
+      // a full bucket doesn't collect time, otherwise a long idle period would
+      // be credited as soon as the first token is taken
+      _lastRefill = now;
+      return;
+    }
+    unsigned long elapsed = now - _lastRefill;
+    if (elapsed < _refillInterval) {
+      return;
+    }
+    unsigned long newTokens = elapsed / _refillInterval;
+    if (newTokens >= (unsigned long)(_burst - _tokens)) {
+      _tokens = _burst;
+      _lastRefill = now;
+    } else {
+      _tokens += newTokens;
+      // keep the remainder so the long term rate stays exact
+      _lastRefill += newTokens * _refillInterval;
+    }
+  }
+
+  bool MXTokenBucket::available() {
+    refill(millis());
+    return _tokens > 0;
+  }
+
+  bool MXTokenBucket::take() {
+    if (!available()) {
+      return false;
+    }
+    _tokens--;
+    return true;
+  }
+
+  uint8_t MXTokenBucket::tokens() {
+    refill(millis());
+    return _tokens;
+  }
+#endif //MXTOKENBUCKET_H
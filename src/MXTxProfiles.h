@@ -0,0 +1,258 @@
+/****************************************************************************
+MXTxProfiles.h - Per thermostat TX profiles (repeats and power level), tuned
+by feedback and persisted in the flash emulated EEPROM.
+
+Every thermostat starts with the defaults CFG_ETH200NUMPACKETSENDREPEATS
+and CFG_RF69_POWERLEVEL, which are also the upper limits of a back off. A
+profile can be set to fixed values, up to CFG_TXPROFILE_MAX_REPEATS, or it
+is tuned by feedback about whether the thermostat reacted to the last cmd:
+  - after CFG_TXPROFILE_OK_STREAK "ok" in a row the repeats are lowered by
+    CFG_TXPROFILE_REPEATS_STEP, once they reached CFG_TXPROFILE_MIN_REPEATS
+    the power level is lowered by CFG_TXPROFILE_POWER_STEP down to
+    CFG_TXPROFILE_MIN_POWERLEVEL. Repeats first, they are the airtime.
+  - a "missed" raises the repeats by 3 and the power level by 2 steps, we
+    don't know which of them was too low, and the streak starts over. A
+    back off never lowers a value, a profile fixed above the defaults and
+    set back to auto keeps its values until "ok" walks them down
+So a profile slowly walks down and quickly backs off, it settles a bit
+above the point where the thermostat starts to miss cmds.
+
+Only changes of the repeats or the power level are committed to the flash,
+the sector survives ~10000 writes, the feedback counters are written along
+with them and lag behind after a reboot. Changes are collected and written
+by saveIfDue() at most every CFG_TXPROFILE_SAVE_INTERVAL, so an oscillating
+profile or a chatty automation can't wear out the sector.
+
+Copyright 2020 mt-mrx <64284703+mt-mrx@users.noreply.github.com>
+*****************************************************************************
+License
+*****************************************************************************
+This program is free software; you can redistribute it
+and/or modify it under the terms of the GNU General
+Public License as published by the Free Software
+Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public
+License for more details.
+
+Licence can be viewed at
+http://www.gnu.org/licenses/gpl-3.0.txt
+
+Please maintain this license information along with authorship
+and copyright notices in any redistribution of this code
+****************************************************************************/
+
+#ifndef MXTXPROFILES_H
+    #define MXTXPROFILES_H
+
+  #include <config.h>            // project settings file, for the CFG_TXPROFILE limits
+  #include <Arduino.h>
+  #include <EEPROM.h>
+
+  #define MXTXPROFILES_MAGIC 0x4D585450 // "MXTP"
+
+  // size needs to be a multiple of 4, see calcChecksum()
+  struct mxTxProfile {
+    uint32_t id = 0;                                     // thermostat ID, 0 if this slot is unused
+    uint16_t repeats = CFG_ETH200NUMPACKETSENDREPEATS;   // repeats of every packet
+    uint8_t powerLevel = CFG_RF69_POWERLEVEL;            // 0 - 31, see RFM69::setPowerLevel()
+    uint8_t fixed = 0;                                   // 1 if set manually, feedback doesn't tune it
+    uint16_t ok = 0;                                     // "ok" feedback since the profile was created
+    uint16_t missed = 0;                                 // "missed" feedback since the profile was created
+    uint8_t okStreak = 0;                                // "ok" feedback in a row since the last change
+    uint8_t reserved[3] = {0};
+  };
+
+  // the record stored in the EEPROM
+  struct mxTxProfilesRecord {
+    uint32_t magic = 0;
+    mxTxProfile profiles[CFG_TXPROFILES_SIZE];
+    uint32_t checksum = 0;
+  };
+
+  class MXTxProfiles {
+    private:
+      uint16_t _eepromOffset;
+      mxTxProfilesRecord _rec;     // RAM copy of the EEPROM record
+      boolean _dirty = false;      // _rec changed since the last write
+      boolean _saved = false;      // written since boot
+      unsigned long _lastSave = 0; // millis() of the last write
+      uint32_t calcChecksum();
+    public:
+      MXTxProfiles(uint16_t eepromOffset = 0);
+      // reads the EEPROM record, starts with no profiles if it's missing or broken
+      void begin();
+      // writes the record to the flash, returns false if the commit failed
+      boolean save();
+      // marks the record as changed, it is written by saveIfDue()
+      void changed() { _dirty = true; }
+      // writes a changed record, at most every CFG_TXPROFILE_SAVE_INTERVAL unless force is
+      // true, e.g. before a restart. Returns true if it was written.
+      boolean saveIfDue(boolean force = false);
+      // returns the profile of id, a default profile (id 0) if there is none
+      mxTxProfile get(uint32_t id);
+      // returns the profile of id, if create is true a missing profile is created with
+      // the defaults, NULL if there is none or all slots are in use
+      mxTxProfile* find(uint32_t id, boolean create);
+      // sets fixed values, returns false if they are out of range or all slots are in use
+      boolean set(uint32_t id, uint16_t repeats, uint8_t powerLevel);
+      // lets feedback tune a fixed profile again, starting from its values, returns false
+      // if id has no profile
+      boolean unfix(uint32_t id);
+      // back to the defaults, returns true if id had a profile
+      boolean remove(uint32_t id);
+      // the thermostat reacted (ok) or not to the last cmd, returns true if the
+      // repeats or the power level changed
+      boolean feedback(mxTxProfile& profile, boolean ok);
+  };
+
+  MXTxProfiles::MXTxProfiles(uint16_t eepromOffset) {
+    _eepromOffset = eepromOffset;
+  }
+
+  uint32_t MXTxProfiles::calcChecksum() {
+    // same as MXWatchdog, good enough to detect an erased sector or another layout
+    uint32_t sum = MXTXPROFILES_MAGIC;
+    const uint32_t* data = (const uint32_t*)&_rec;
+    for (uint16_t i = 0; i < (sizeof(_rec) / 4) - 1; i++) {
+      sum = (sum << 1 | sum >> 31) ^ data[i];
+    }
+    return sum;
+  }
+
+  void MXTxProfiles::begin() {
+    EEPROM.begin(_eepromOffset + sizeof(_rec));
+    EEPROM.get(_eepromOffset, _rec);
+    if ((_rec.magic != MXTXPROFILES_MAGIC) || (_rec.checksum != calcChecksum())) {
+      _rec = mxTxProfilesRecord();
+      _rec.magic = MXTXPROFILES_MAGIC;
+    }
+    // profiles fixed by a firmware which allowed fewer repeats, sendFrame() can't send them
+    for (uint8_t i = 0; i < CFG_TXPROFILES_SIZE; i++) {
+      if ((_rec.profiles[i].id != 0) && (_rec.profiles[i].repeats < CFG_TXPROFILE_SET_MIN_REPEATS)) {
+        _rec.profiles[i].repeats = CFG_TXPROFILE_SET_MIN_REPEATS;
+      }
+    }
+  }
+
+  boolean MXTxProfiles::save() {
+    _rec.checksum = calcChecksum();
+    EEPROM.put(_eepromOffset, _rec);
+    return EEPROM.commit();
+  }
+
+  boolean MXTxProfiles::saveIfDue(boolean force) {
+    unsigned long now = millis();
+    if (!_dirty || (!force && _saved && (now - _lastSave < CFG_TXPROFILE_SAVE_INTERVAL))) {
+      return false;
+    }
+    _saved = true;
+    _lastSave = now;
+    // a failed commit is tried again after the next interval
+    _dirty = !save();
+    return !_dirty;
+  }
+
+  mxTxProfile MXTxProfiles::get(uint32_t id) {
+    mxTxProfile* profile = find(id, false);
+    return (profile != NULL) ? *profile : mxTxProfile();
+  }
+
+  mxTxProfile* MXTxProfiles::find(uint32_t id, boolean create) {
+    mxTxProfile* freeSlot = NULL;
+    for (uint8_t i = 0; i < CFG_TXPROFILES_SIZE; i++) {
+      if (_rec.profiles[i].id == id) {
+        return &_rec.profiles[i];
+      }
+      if ((freeSlot == NULL) && (_rec.profiles[i].id == 0)) {
+        freeSlot = &_rec.profiles[i];
+      }
+    }
+    if (!create || (freeSlot == NULL) || (id == 0)) {
+      return NULL;
+    }
+    *freeSlot = mxTxProfile();
+    freeSlot->id = id;
+    return freeSlot;
+  }
+
+  boolean MXTxProfiles::set(uint32_t id, uint16_t repeats, uint8_t powerLevel) {
+    if ((repeats < CFG_TXPROFILE_SET_MIN_REPEATS) || (repeats > CFG_TXPROFILE_MAX_REPEATS) || (powerLevel > 31)) {
+      return false;
+    }
+    mxTxProfile* profile = find(id, true);
+    if (profile == NULL) {
+      return false;
+    }
+    profile->repeats = repeats;
+    profile->powerLevel = powerLevel;
+    profile->fixed = 1;
+    profile->okStreak = 0;
+    return true;
+  }
+
+  boolean MXTxProfiles::unfix(uint32_t id) {
+    mxTxProfile* profile = find(id, false);
+    if (profile == NULL) {
+      return false;
+    }
+    profile->fixed = 0;
+    profile->okStreak = 0;
+    return true;
+  }
+
+  boolean MXTxProfiles::remove(uint32_t id) {
+    mxTxProfile* profile = find(id, false);
+    if (profile == NULL) {
+      return false;
+    }
+    *profile = mxTxProfile();
+    return true;
+  }
+
+  boolean MXTxProfiles::feedback(mxTxProfile& profile, boolean ok) {
+    uint16_t repeats = profile.repeats;
+    uint8_t powerLevel = profile.powerLevel;
+    if (ok) {
+      if (profile.ok < UINT16_MAX) {
+        profile.ok++;
+      }
+      if (profile.okStreak < UINT8_MAX) {
+        profile.okStreak++;
+      }
+      if (profile.fixed || (profile.okStreak < CFG_TXPROFILE_OK_STREAK)) {
+        return false;
+      }
+      profile.okStreak = 0;
+      if (profile.repeats >= CFG_TXPROFILE_MIN_REPEATS + CFG_TXPROFILE_REPEATS_STEP) {
+        profile.repeats -= CFG_TXPROFILE_REPEATS_STEP;
+      } else if (profile.repeats > CFG_TXPROFILE_MIN_REPEATS) {
+        profile.repeats = CFG_TXPROFILE_MIN_REPEATS;
+      } else if (profile.powerLevel >= CFG_TXPROFILE_MIN_POWERLEVEL + CFG_TXPROFILE_POWER_STEP) {
+        profile.powerLevel -= CFG_TXPROFILE_POWER_STEP;
+      } else if (profile.powerLevel > CFG_TXPROFILE_MIN_POWERLEVEL) {
+        profile.powerLevel = CFG_TXPROFILE_MIN_POWERLEVEL;
+      }
+    } else {
+      if (profile.missed < UINT16_MAX) {
+        profile.missed++;
+      }
+      profile.okStreak = 0;
+      if (profile.fixed) {
+        return false;
+      }
+      // up to the defaults, a value above them (fixed and set back to auto) stays
+      uint32_t maxRepeats = max((uint32_t)profile.repeats, (uint32_t)CFG_ETH200NUMPACKETSENDREPEATS);
+      uint32_t maxPowerLevel = max((uint32_t)profile.powerLevel, (uint32_t)CFG_RF69_POWERLEVEL);
+      uint32_t backOffRepeats = (uint32_t)profile.repeats + 3 * CFG_TXPROFILE_REPEATS_STEP;
+      uint32_t backOffPowerLevel = (uint32_t)profile.powerLevel + 2 * CFG_TXPROFILE_POWER_STEP;
+      profile.repeats = (backOffRepeats < maxRepeats) ? backOffRepeats : maxRepeats;
+      profile.powerLevel = (backOffPowerLevel < maxPowerLevel) ? backOffPowerLevel : maxPowerLevel;
+    }
+    return (profile.repeats != repeats) || (profile.powerLevel != powerLevel);
+  }
+#endif //MXTXPROFILES_H
@@ -0,0 +1,170 @@
+/****************************************************************************
+MXWatchdog.h - Software watchdog with per stage time budgets.
+
+Blocking operations are wrapped in enter(stage, budget)/leave(). The stage
+is written to the RTC user memory on enter, so if the ESP is reset while
+inside a stage (soft/hardware WDT, exception) the stage survives the reset
+and is reported as post-mortem after the reboot. If a stage exceeds its
+budget, or a busy wait gives up (see overBudget()), the stall is recorded
+with its duration and some application defined bytes (e.g. radio
+registers) into the RTC memory as well.
+
+The RTC user memory survives resets but not a power loss, a magic value
+and a checksum protect against garbage after a cold boot.
+
+Copyright 2020 mt-mrx <64284703+mt-mrx@users.noreply.github.com>
+*****************************************************************************
+License
+*****************************************************************************
+This program is free software; you can redistribute it
+and/or modify it under the terms of the GNU General
+Public License as published by the Free Software
+Foundation; either version 3 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will
+be useful, but WITHOUT ANY WARRANTY; without even the
+implied warranty of MERCHANTABILITY or FITNESS FOR A
+PARTICULAR PURPOSE. See the GNU General Public
+License for more details.
+
+Licence can be viewed at
+http://www.gnu.org/licenses/gpl-3.0.txt
+
+Please maintain this license information along with authorship
+and copyright notices in any redistribution of this code
+****************************************************************************/
+
+#ifndef MXWATCHDOG_H
+    #define MXWATCHDOG_H
+
+  #include <Arduino.h>
+
+  #define MXWATCHDOG_STAGE_NONE 0
+  #define MXWATCHDOG_MAGIC 0x4D585744 // "MXWD"
+  #define MXWATCHDOG_NUM_INFO 4   // number of application defined bytes stored with a stall
+
+  // the record stored in the RTC user memory, size needs to be a multiple of 4
+  struct mxWatchdogRecord {
+    uint32_t magic = 0;
+    uint8_t activeStage = MXWATCHDOG_STAGE_NONE; // the stage we are currently in
+    uint8_t stallStage = MXWATCHDOG_STAGE_NONE;  // the stage of the last stall
+    uint16_t stalls = 0;                         // stalls since the last report
+    uint32_t activeBudget = 0;                   // budget of the active stage in ms
+    uint32_t stallDuration = 0;                  // in ms
+    uint32_t stallBudget = 0;                    // in ms
+    uint8_t stallInfo[MXWATCHDOG_NUM_INFO] = {0};
+    uint32_t checksum = 0;
+  };
+
+  class MXWatchdog {
+    private:
+      uint32_t _rtcOffset;       // in 4 byte blocks
+      mxWatchdogRecord _rtc;     // RAM copy of the RTC record
+      unsigned long _stageStart = 0;
+      boolean _resetInStage = false; // the last reset happened while a stage was active
+      uint8_t _resetStage = MXWATCHDOG_STAGE_NONE;
+      uint32_t _resetBudget = 0;
+      uint32_t calcChecksum();
+      void save();
+    public:
+      MXWatchdog(uint32_t rtcOffset = 0);
+      // reads the RTC record, needs to be called once during boot
+      // unexpectedReset - true if the last reset was a WDT reset or an exception, only then
+      //                   an active stage counts as stall
+      void begin(boolean unexpectedReset);
+      void enter(uint8_t stage, unsigned long budget);
+      // for busy waits, returns true if the active stage exceeded its budget
+      boolean overBudget();
+      // leaves the active stage, returns true if it exceeded its budget
+      boolean leave();
+      unsigned long elapsed();
+      uint8_t activeStage() { return _rtc.activeStage; }
+      // records a stall of stage, usually activeStage(), with the given info bytes
+      void recordStall(uint8_t stage, const uint8_t info[MXWATCHDOG_NUM_INFO]);
+
+      // post-mortem, a stall and/or a reset inside a stage which wasn't reported yet
+      boolean hasReport() { return _resetInStage || (_rtc.stalls > 0); }
+      boolean resetInStage() { return _resetInStage; }
+      uint8_t resetStage() { return _resetStage; }
+      uint32_t resetBudget() { return _resetBudget; }
+      const mxWatchdogRecord& record() { return _rtc; }
+      // call after the report was published
+      void clearReport();
+  };
+
+  MXWatchdog::MXWatchdog(uint32_t rtcOffset) {
+    _rtcOffset = rtcOffset;
+  }
+
+  uint32_t MXWatchdog::calcChecksum() {
+    // simple sum over everything but the checksum itself, good enough to detect garbage
+    uint32_t sum = MXWATCHDOG_MAGIC;
+    const uint32_t* data = (const uint32_t*)&_rtc;
+    for (uint8_t i = 0; i < (sizeof(_rtc) / 4) - 1; i++) {
+      sum = (sum << 1 | sum >> 31) ^ data[i];
+    }
+    return sum;
+  }
+
+  void MXWatchdog::save() {
+    _rtc.checksum = calcChecksum();
+    ESP.rtcUserMemoryWrite(_rtcOffset, (uint32_t*)&_rtc, sizeof(_rtc));
+  }
+
+  void MXWatchdog::begin(boolean unexpectedReset) {
+    ESP.rtcUserMemoryRead(_rtcOffset, (uint32_t*)&_rtc, sizeof(_rtc));
+    if ((_rtc.magic != MXWATCHDOG_MAGIC) || (_rtc.checksum != calcChecksum())) {
+      // cold boot
+      _rtc = mxWatchdogRecord();
+      _rtc.magic = MXWATCHDOG_MAGIC;
+    }
+    if (unexpectedReset && (_rtc.activeStage != MXWATCHDOG_STAGE_NONE)) {
+      _resetInStage = true;
+      _resetStage = _rtc.activeStage;
+      _resetBudget = _rtc.activeBudget;
+    }
+    _rtc.activeStage = MXWATCHDOG_STAGE_NONE;
+    save();
+  }
+
+  void MXWatchdog::enter(uint8_t stage, unsigned long budget) {
+    _stageStart = millis();
+    _rtc.activeStage = stage;
+    _rtc.activeBudget = budget;
+    save();
+  }
+
+  unsigned long MXWatchdog::elapsed() {
+    return millis() - _stageStart;
+  }
+
+  boolean MXWatchdog::overBudget() {
+    return (_rtc.activeStage != MXWATCHDOG_STAGE_NONE) && (elapsed() > _rtc.activeBudget);
+  }
+
+  boolean MXWatchdog::leave() {
+    boolean over = overBudget();
+    _rtc.activeStage = MXWATCHDOG_STAGE_NONE;
+    save();
+    return over;
+  }
+
+  void MXWatchdog::recordStall(uint8_t stage, const uint8_t info[MXWATCHDOG_NUM_INFO]) {
+    _rtc.stallStage = stage;
+    _rtc.stallDuration = elapsed();
+    _rtc.stallBudget = _rtc.activeBudget;
+    memcpy(_rtc.stallInfo, info, MXWATCHDOG_NUM_INFO);
+    if (_rtc.stalls < UINT16_MAX) {
+      _rtc.stalls++;
+    }
+    save();
+  }
+
+  void MXWatchdog::clearReport() {
+    _resetInStage = false;
+    _rtc.stalls = 0;
+    _rtc.stallStage = MXWATCHDOG_STAGE_NONE;
+    save();
+  }
+#endif //MXWATCHDOG_H
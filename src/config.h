@@ -14,6 +14,16 @@
     //#define MXDEBUG                  // to enable debugging output, does not include MXINFO
     #define MXINFO                   // to enable info output
     //#define MXDEBUG_TIME           // to enable timing debugging output
+    // scoped profiler (MXPROFILE_SCOPE in MXProfiler.h), costs a few cycles per scope,
+    // statistics are published on MQTT set/profile
+    #define MXPROFILE
+    // The RX path logs via a deferred logger (MXLOG_* in MXDebugUtils.h), events are
+    // recorded into a RAM ring and printed by loop() only while no packets arrive.
+    #define CFG_LOG_RING_SIZE 64     // number of events the ring can hold
+    #define CFG_LOG_DRAIN_MAX 8      // max events printed per loop() run
+    // if defined the drained lines are published to MXETHControl/<MAC>/debug instead of
+    // Serial while MQTT is connected
+    //#define CFG_LOG_MQTT
 
     /*** Begin: Firmware Update settings ***/
     // if defined check/apply for firmware update via HTTP at every wake up/reboot, adds ~400ms
@@ -27,7 +37,7 @@
     #define CFG_FW_BASE_URL "http://192.168.199.10/MXETHControl/firmware/"
     // Firmware version, should match the changelog.txt and is used for OTA firmware
     // updates
-    #define CFG_FW_VERSION "2.6"
+    #define CFG_FW_VERSION "4.6"
     /*** End: Firmware Update settings ***/
 
     /*** Begin: MQTT settings ***/
@@ -35,8 +45,24 @@
     #define CFG_MQTT_PORT 1883                   // default non ssl port is 1883
     #define CFG_MQTT_USER "<changeme>"
     #define CFG_MQTT_PASSWORD "<changeme>"
+    // Reconnects are non blocking, loop() does at most one connection attempt per run.
+    // After every failed attempt the delay until the next one is doubled, starting at
+    // CFG_MQTT_RECONNECT_MIN_DELAY up to CFG_MQTT_RECONNECT_MAX_DELAY, plus a random jitter
+    // of up to CFG_MQTT_RECONNECT_JITTER percent so several devices don't hammer a
+    // restarting broker at the same time.
+    #define CFG_MQTT_RECONNECT_MIN_DELAY 1000   // in ms
+    #define CFG_MQTT_RECONNECT_MAX_DELAY 60000  // in ms
+    #define CFG_MQTT_RECONNECT_JITTER 25        // in percent
+    // limits how long a single connection attempt (TCP connect and waiting for the broker
+    // reply) can block the loop, the PubSubClient default of 15 s would starve the radio
+    #define CFG_MQTT_SOCKET_TIMEOUT 2           // in s
     /*** End: MQTT settings ***/
 
+    // if defined the wall clock time of the first packet of a received message is added as
+    // "time" (ms since epoch) to the sensor/<ID>/get json, synced via SNTP in the background
+    //#define CFG_NTP_SERVER "pool.ntp.org"
+    #define CFG_NTP_MIN_VALID_TIME 1577836800   // 2020-01-01, in s since epoch, older means not synced yet
+
     /*** Begin: PIN settings ***/
     /*
     ### Pinout
@@ -79,11 +105,70 @@
     #define CFG_ETH200NUMTHERMOSTATS 7  // 1 to 255
     // number of groups of thermostats to "create"
     #define CFG_ETH200NUMGROUPS 5       // 1 to 255
+    // All thermostats are handled by a single thermostat/+/set/cmd wildcard subscription, the
+    // thermostat ID of every incoming cmd is checked against the IDs 010101, 020202, ...
+    // (CFG_ETH200NUMTHERMOSTATS) and the groups 990101, 990202, ... (CFG_ETH200NUMGROUPS).
+    // Additional IDs can be allowed by a comma separated list of 3 byte IDs.
+    //#define CFG_ETH200THERMOSTATALLOWLIST 0x123456, 0xABCDEF
+    // number of thermostats which can be in use at the same time, a thermostat only gets
+    // a slot when its first cmd arrives. Every ID of the allow list gets a slot too.
+    #ifdef CFG_ETH200THERMOSTATALLOWLIST
+      #include <initializer_list>
+      #define CFG_THERMOSTATS_SIZE (CFG_ETH200NUMTHERMOSTATS + CFG_ETH200NUMGROUPS + \
+                                    std::initializer_list<uint32_t>{CFG_ETH200THERMOSTATALLOWLIST}.size())
+    #else
+      #define CFG_THERMOSTATS_SIZE (CFG_ETH200NUMTHERMOSTATS + CFG_ETH200NUMGROUPS)
+    #endif
+    // per thermostat TX profiles (repeats and power level), see MXTxProfiles.h. A thermostat
+    // starts with CFG_ETH200NUMPACKETSENDREPEATS and CFG_RF69_POWERLEVEL, feedback on
+    // thermostat/<ID>/set/feedback walks them down to the minimums and backs off on a miss.
+    // The profiles are persisted in the flash emulated EEPROM.
+    #define CFG_TXPROFILES_SIZE CFG_THERMOSTATS_SIZE
+    #define CFG_TXPROFILE_MAX_REPEATS 450       // upper limit of set/txprofile
+    // lower limit of set/txprofile, sendFrame() only sees PacketSent after 255 bytes on air
+    // (PayloadLength 0xFF), that takes 29 repeats of the shortest frame (WindowSensor)
+    #define CFG_TXPROFILE_SET_MIN_REPEATS 32
+    #define CFG_TXPROFILE_MIN_REPEATS 200       // lower limit of the feedback tuning
+    #define CFG_TXPROFILE_REPEATS_STEP 10
+    #define CFG_TXPROFILE_MIN_POWERLEVEL 10     // lower limit of the feedback tuning
+    #define CFG_TXPROFILE_POWER_STEP 3          // ~2 dB
+    #define CFG_TXPROFILE_OK_STREAK 5           // "ok" feedback in a row before a step down
+    // changed profiles are written to the flash at most once per interval, the first change
+    // after boot right away, and before set/reset and a firmware update
+    #define CFG_TXPROFILE_SAVE_INTERVAL 3600000 // in ms
+    // the firmware talks to the radio through MXRadio.h, the RFM69 is one backend, the
+    // in-memory loopback for host benchmarks another one. Frames the loopback can queue.
+    #define CFG_RADIO_LOOPBACK_SIZE 8
+
+    // busy waits on the RFM69 give up after these timeouts, the radio is reset then
+    #define CFG_RF69_MODEREADY_TIMEOUT 100    // in ms, a mode change takes < 1ms
+    #define CFG_RF69_TX_FIFO_TIMEOUT 500      // in ms, the FIFO drains ~1 byte per ms at 9.6 kbps
+    #define CFG_RF69_PACKETSENT_TIMEOUT 500   // in ms
+    // software watchdog time budgets of the blocking stages, a stage exceeding its budget
+    // is recorded and published on status/postmortem, also if the ESP got reset within it
+    #define CFG_WD_BUDGET_SEND 15000          // in ms, one cmd takes ~6s (CFG_ETH200NUMPACKETSENDREPEATS)
+    #define CFG_WD_BUDGET_MQTT_CONNECT 5000   // in ms, see CFG_MQTT_SOCKET_TIMEOUT
+    #define CFG_WD_BUDGET_FW_UPDATE 60000     // in ms
 
     // size of messages array to handle parallel incoming messages
     #define CFG_MESSAGES_SIZE 5
     // size of mqttCmds array to handle parallel incoming MQTT Cmds
     #define CFG_MQTTCMDS_SIZE 30
+    // queued cmds older than this are dropped and acked as "expired" on thermostat/<ID>/get/ack
+    #define CFG_MQTTCMD_MAX_AGE 300000  // in ms
+    // max length of a thermostat cmd incl. string termination, longer cmds are ignored
+    #define CFG_MQTTCMD_VALUE_SIZE 20
+    // rate limits for incoming thermostat cmds (token buckets). A cmd is only queued if its
+    // thermostat and the global bucket have a token left, otherwise it is rejected and
+    // published on thermostat/<ID>/get/error. A bucket holds up to BURST tokens and gets
+    // one token back every REFILL_INTERVAL.
+    // per thermostat, protects the other thermostats from a single flooding automation
+    #define CFG_THERMOSTAT_CMD_BURST 3
+    #define CFG_THERMOSTAT_CMD_REFILL_INTERVAL 20000  // in ms
+    // all thermostats together, sending one cmd takes ~6s (CFG_ETH200NUMPACKETSENDREPEATS)
+    // so the burst should stay below CFG_MQTTCMDS_SIZE
+    #define CFG_MQTTCMDS_BURST 20
+    #define CFG_MQTTCMDS_REFILL_INTERVAL 6000  // in ms
     // duration in seconds during which a message is received and how long we should wait before
     // sending it to MQTT. So if any external tool is reacting to that message and sending a new
     // command to the MXETHControl device we are sure we don't start sending if we still receive something.
@@ -91,21 +176,45 @@
     #define CFG_MESSAGE_DELAY 13
 
     /*
-      duration that the ESP uses as delay(x) at the end of each loop.
-      It's a tradeoff between
+      max duration that the ESP waits at the end of each loop if nothing is due.
+      loop() used to delay(x) for a fixed time, which was a tradeoff between
         longer delay  - reduced power consumption
         shorter delay - faster response times (catches more packages)
 
       anyway, debug package output reduces the number of catched packages from ~170 -> ~26
       100ms, reduces power consumption from 88mA -> 40mA, with debug output enabled, reduces received packages 26 -> 14
       500ms, reduces power consumption from 88mA -> 32mA, with debug output enabled, reduces received packages 26 -> 5
+
+      Now loop() waits via esp_delay() (needs the Arduino core 3.x, see platformio.ini) and is woken up right away
+      by the DIO0 interrupt of a received packet, by MQTT data (polled every CFG_EVENT_POLL_INTERVAL)
+      or when the next message/cmd/publish is due, so the delay doesn't cost packets anymore.
     */
-    #define CFG_ESP_LOOP_DELAY 100  // in ms
-    //#define CFG_ESP_LOOP_DELAY 500
+    #define CFG_ESP_LOOP_DELAY 500  // in ms
+    #define CFG_EVENT_POLL_INTERVAL 50  // in ms, how often MQTT data is checked while waiting
+    // if defined the ESP light sleeps while waiting, WiFi wakes up every LISTEN_INTERVAL DTIM
+    // beacons, the DIO0 pin wakes it up for received packets. Increases MQTT latency.
+    //#define CFG_LIGHT_SLEEP
+    #define CFG_LIGHT_SLEEP_LISTEN_INTERVAL 3
 
     // the duration that needs to expire after a (last) packet we got before updating
     // the MQTT status/state topic from "receiving" to "listening"
-    // need to be a factor x longer than CFG_ESP_LOOP_DELAY
+    // loop() wakes up when it expires, so it doesn't depend on CFG_ESP_LOOP_DELAY anymore
     #define CFG_STATE_RECEIVING_MAX_TIME 500  // in ms
+    // min time between two MQTT status/state updates, identical states are never
+    // published twice, the latest state is published once the interval passed
+    #define CFG_STATE_PUBLISH_MIN_INTERVAL 1000  // in ms
+    // loop() runs its work as tasks (MXScheduler.h), a task is run again within a loop() run
+    // while it has work left and its budget isn't used up. The radio is serviced between
+    // all other tasks. CPU share and overruns are published on status/tasks.
+    #define CFG_TASK_BUDGET_RADIO 2000        // in us
+    #define CFG_TASK_BUDGET_MQTT 20000        // in us
+    #define CFG_TASK_BUDGET_CMDS 15000000     // in us, one cmd per run, an absolute temperature takes ~13s
+    #define CFG_TASK_BUDGET_PUBLISH 30000     // in us
+    #define CFG_TASK_BUDGET_STATUS 30000      // in us
+    #define CFG_TASK_BUDGET_LOG 5000          // in us
+    #define CFG_TASK_BUDGET_OTA 60000000      // in us, see CFG_WD_BUDGET_FW_UPDATE
+    // interval for publishing the loop() stage timing (p50, p99, max) to status/perf,
+    // the radio/pipeline counters to status/stats and the heap state to status/heap
+    #define CFG_PERF_PUBLISH_INTERVAL 60000  // in ms
     /*** End: misc settings ***/
 #endif //MXETHCONTROL_CONFIG_H
@@ -81,9 +81,34 @@ and copyright notices in any redistribution of this code
 
 #include <MXPubSubClientWrapper.h>
 
+#include <MXTokenBucket.h>     // for MQTT cmd rate limiting
+
+#include <MXProfiler.h>        // for profiling, see set/profile
+
+#include <MXHeapTracker.h>     // for allocations by call site, see set/heap
+
+#include <MXScheduler.h>       // for running the loop() work as tasks
+
+#ifdef CFG_NTP_SERVER
+  #include <time.h>            // for the wall clock time of received messages
+  #include <sys/time.h>
+#endif //CFG_NTP_SERVER
+
+#include <MXWatchdog.h>        // for stall detection of blocking stages
+#include <MXTxProfiles.h>      // for the per thermostat repeats and power level
+extern "C" {
+  #include <user_interface.h>  // for the reset reason
+  #include <gpio.h>            // for the light sleep wakeup by DIO0
+}
+
 #include <ETH200RFM69.h>
+#include <MXRadio.h>           // frame level radio interface
 
 ETH200RFM69 radio(CFG_RF69_SPI_CS, CFG_RF69_IRQ_PIN, CFG_RF69_ISRFM69HW);
+MXRadioRFM69 rfm69Radio(radio);
+// the firmware uses the radio only through this backend, host tools can point it to an
+// MXRadioLoopback before setup()
+MXRadio* radioBackend = &rfm69Radio;
 
 // for ETH200 packet analysis
 enum deviceType_t {
@@ -111,6 +136,8 @@ enum batteryStatus_t {
 struct message {
   uint8_t hasData = 0;            //if this message has data in it
   unsigned long receiveTime = 0;  //when this message was first received
+  uint32_t firstRxMicros = 0;     //micros() of the DIO0 interrupt of the first packet
+  uint32_t lastRxMicros = 0;      //micros() of the DIO0 interrupt of the latest packet
   uint8_t packetSize = 0;         //different sensors have different packet sizes
   deviceType_t deviceType = deviceType_t::deviceTypeUnknown;
   deviceCmd_t deviceCmd = deviceCmd_t::deviceCmdUnknown;
@@ -133,10 +160,47 @@ message messages[CFG_MESSAGES_SIZE];
 struct mqttCmd {
   uint8_t hasData = 0;            //if this message has data in it
   unsigned long receiveTime = 0;  //when this cmd was received
-  String topic;                   //the topic we got
-  String value;                   //the value/cmd for that topic
+  uint32_t thermostatID = 0;      //the thermostat ID taken from the topic
+  char value[CFG_MQTTCMD_VALUE_SIZE] = {0}; //the value/cmd for that topic
+  // tracing of the cmd through the pipeline, published on get/ack, see publishCmdAck()
+  uint32_t seq = 0;               //sequence number, the queue is handled in this order
+  unsigned long dequeueTime = 0;  //when this cmd was taken out of the queue
+  unsigned long txStartTime = 0;  //when sending the first packet for this cmd started
+  unsigned long txEndTime = 0;    //when sending the last packet for this cmd ended
+  boolean txFailed = false;       //if sending any packet for this cmd failed
 };
 mqttCmd mqttCmds[CFG_MQTTCMDS_SIZE];
+uint32_t mqttCmdSeq = 0;          // sequence number of the last received cmd
+mqttCmd* activeCmd = NULL;        // the cmd currently handled by runMQTTCmdsQueue(), its TX
+                                  // times are recorded by send() and sendPacket()
+
+// message and cmd pipeline counters, only ever incremented, see publishStats()
+// the radio counters are in radioBackend->stats()
+struct pipelineStats {
+  uint32_t messages = 0;      // new messages put into the messages queue
+  uint32_t duplicates = 0;    // packets of a message which is already in the queue
+  uint32_t queueDrops = 0;    // messages dropped because the messages queue was full
+  uint32_t queueMax = 0;      // most messages in the messages queue at the same time, never decreases
+  uint32_t published = 0;     // messages published to MQTT
+  uint32_t cmdsQueued = 0;    // thermostat cmds put into the mqttCmds queue
+  uint32_t cmdsRejected = 0;  // thermostat cmds rejected, rate limit or queue full
+  uint32_t cmdsSent = 0;      // thermostat cmds sent
+};
+pipelineStats pipeline;
+unsigned long statsSince = 0;  // millis() of the last stats reset
+
+// thermostat definition, a slot is only taken when the first cmd for a thermostat arrives
+struct thermostat {
+  uint32_t id = 0;                // 3 byte thermostat ID, 0 if this slot is unused
+  // admission control for the cmds of this thermostat, see mqttHandleThermostat()
+  MXTokenBucket cmdBucket = MXTokenBucket(CFG_THERMOSTAT_CMD_BURST, CFG_THERMOSTAT_CMD_REFILL_INTERVAL);
+};
+thermostat thermostats[CFG_THERMOSTATS_SIZE];
+static_assert(CFG_THERMOSTATS_SIZE <= 255, "the thermostat slots are indexed by uint8_t");
+// repeats and power level of every thermostat, tuned by set/feedback, kept in the EEPROM
+MXTxProfiles txProfiles;
+// admission control for the cmds of all thermostats together
+MXTokenBucket mqttCmdsBucket(CFG_MQTTCMDS_BURST, CFG_MQTTCMDS_REFILL_INTERVAL);
 
 // firmware version
 const char* fwVer = CFG_FW_VERSION;
@@ -196,6 +260,9 @@ String mqtt_root = getMqttRoot();
 #define MQTT_TOPIC_SET_UPDATE "/update"
 #define MQTT_TOPIC_SET_PING "/ping"
 #define MQTT_TOPIC_SET_PONG "/pong"
+#define MQTT_TOPIC_SET_PROFILE "/profile"
+#define MQTT_TOPIC_SET_STATS "/stats"
+#define MQTT_TOPIC_SET_HEAP "/heap"
 #define MQTT_TOPIC_STATUS "/status"
 #define MQTT_TOPIC_STATUS_ONLINE "/online"
 #define MQTT_TOPIC_STATUS_HARDWARE "/hardware"
@@ -203,6 +270,15 @@ String mqtt_root = getMqttRoot();
 #define MQTT_TOPIC_STATUS_IP "/ip"
 #define MQTT_TOPIC_STATUS_MAC "/mac"
 #define MQTT_TOPIC_STATUS_STATE "/state"
+#define MQTT_TOPIC_STATUS_DWELL "/dwell"
+#define MQTT_TOPIC_STATUS_PERF "/perf"
+#define MQTT_TOPIC_STATUS_POSTMORTEM "/postmortem"
+#define MQTT_TOPIC_STATUS_TASKS "/tasks"
+#define MQTT_TOPIC_THERMOSTAT "/thermostat"
+#define MQTT_TOPIC_DEBUG "/debug"
+#define MQTT_TOPIC_THERMOSTAT_CMD "/cmd"
+#define MQTT_TOPIC_THERMOSTAT_FEEDBACK "/feedback"
+#define MQTT_TOPIC_THERMOSTAT_TXPROFILE "/txprofile"
 
 #define MQTT_PRJ_HARDWARE "MXETHControl"
 #define MQTT_PRJ_VERSION fwVer
@@ -312,46 +388,245 @@ boolean isFloat(String str) {
   return true;
 }
 
-// wrapper for radio.send to publish MQTT "status/state = sending" message and toggle LED
+// device states, published via status/state
+enum deviceState_t {
+  stateInitialized,
+  stateListening,
+  stateReceiving,
+  stateSending,
+  stateRestarting,
+  stateCheckingOTA,
+  stateCount, // number of states, needs to be the last entry
+};
+const char* deviceStateNames[stateCount] = {
+  "initialized", "listening", "receiving", "sending", "restarting", "checkingOTA"
+};
+deviceState_t currentState = deviceState_t::stateInitialized; // the state the device is in
+unsigned long currentStateSince = 0;     // millis() when currentState was entered
+int8_t publishedState = -1;              // the state last published, -1 if none
+unsigned long statePublishLastTime = 0;  // millis() of the last status/state publish
+uint64_t stateDwellTime[stateCount] = {0};       // accumulated time spent in each state in ms, 64 bit so it survives the millis() wrap
+
+// adds the time since currentStateSince to the current state, called often enough that
+// now - currentStateSince never wraps
+void accumulateStateDwell(unsigned long now) {
+  stateDwellTime[currentState] += now - currentStateSince;
+  currentStateSince = now;
+}
+
+// publishes the current state and the time spent in each state
+void publishState() {
+  MXHEAP_SITE("publishState");
+  if (!mqttClient.connected()) {
+    // publishedState isn't updated, so runStatePublisher() retries after reconnecting
+    return;
+  }
+  unsigned long now = millis();
+  accumulateStateDwell(now);
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), deviceStateNames[currentState], false);
+
+  // {"initialized":83,"listening":512345,"receiving":8012,...} in ms since boot
+  String jsonMsg = "{";
+  for (uint8_t i = 0; i < stateCount; i++) {
+    // printf of 64 bit values isn't supported everywhere, so it is split into seconds and ms
+    char dwellTime[24];
+    uint64_t seconds = stateDwellTime[i] / 1000;
+    if (seconds > 0) {
+      snprintf(dwellTime, sizeof(dwellTime), "%lu%03u", (unsigned long)seconds, (unsigned int)(stateDwellTime[i] % 1000));
+    } else {
+      snprintf(dwellTime, sizeof(dwellTime), "%u", (unsigned int)stateDwellTime[i]);
+    }
+    jsonMsg = jsonMsg + ((i > 0)? ",":"") + "\"" + deviceStateNames[i] + "\":" + dwellTime;
+  }
+  jsonMsg += "}";
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_DWELL), jsonMsg, false);
+
+  publishedState = currentState;
+  statePublishLastTime = now;
+}
+
+// publishes the current state if it changed since the last publish and if the last
+// publish is at least CFG_STATE_PUBLISH_MIN_INTERVAL ago. Called every loop() so the
+// final state of a burst of state changes is always published.
+// returns true if the state was published
+boolean runStatePublisher() {
+  accumulateStateDwell(millis());
+  if (currentState == publishedState) {
+    return false;
+  }
+  if (millis() - statePublishLastTime < CFG_STATE_PUBLISH_MIN_INTERVAL) {
+    return false;
+  }
+  publishState();
+  return true;
+}
+
+// changes the device state, the update of status/state is rate limited
+// force - publish immediately, needed before blocking operations like sending
+void setState(deviceState_t state, boolean force = false) {
+  unsigned long now = millis();
+  if (state != currentState) {
+    accumulateStateDwell(now);
+    currentState = state;
+  }
+  if (force) {
+    publishState();
+  } else {
+    runStatePublisher();
+  }
+}
+
+// software watchdog stages, every blocking operation gets its own stage and time budget
+// the radio stages are the busy waits inside sendFrame, see ETH200RFM69Stall_t
+enum watchdogStage_t {
+  wdStageNone = MXWATCHDOG_STAGE_NONE,
+  wdStageSend,
+  wdStageMQTTConnect,
+  wdStageFWUpdate,
+  wdStageModeReady,
+  wdStageTxFifo,
+  wdStagePacketSent,
+  wdStageCount, // number of stages, needs to be the last entry
+};
+const char* watchdogStageNames[wdStageCount] = {
+  "none", "send", "mqttConnect", "fwUpdate", "modeReady", "txFifo", "packetSent"
+};
+MXWatchdog watchdog;
+
+// brings the radio back into a known state after a stall
+void recoverRadio() {
+  MXINFO_PRINTLLN(F("Recovering the RFM69 module."));
+  resetRFM69();
+  radioBackend->begin();
+}
+
+// leaves the active watchdog stage. If it exceeded its budget or a busy wait of the
+// radio gave up, the stall is recorded together with the radio registers in the RTC
+// memory, published by runWatchdogReport() and the radio is reset
+void watchdogLeave() {
+  uint8_t stallStage = wdStageNone;
+  ETH200RFM69Stall_t radioStall = radioBackend->lastStall();
+  if (radioStall == ETH200RFM69Stall_t::stallModeReady) {
+    stallStage = wdStageModeReady;
+  } else if (radioStall == ETH200RFM69Stall_t::stallTxFifo) {
+    stallStage = wdStageTxFifo;
+  } else if (radioStall == ETH200RFM69Stall_t::stallPacketSent) {
+    stallStage = wdStagePacketSent;
+  } else if (watchdog.overBudget()) {
+    stallStage = watchdog.activeStage();
+  }
+  radioBackend->clearStall();
+
+  if (stallStage != wdStageNone) {
+    MXINFO_PRINTL(F("ERROR: Watchdog stage stalled: "));
+    MXINFO_PRINTLN(watchdogStageNames[stallStage]);
+    uint8_t registers[MXWATCHDOG_NUM_INFO]; // OPMODE, IRQFLAGS1, IRQFLAGS2, PAYLOADLENGTH of the RFM69
+    radioBackend->diagnostics(registers, MXWATCHDOG_NUM_INFO);
+    watchdog.recordStall(stallStage, registers);
+    recoverRadio();
+  }
+  watchdog.leave();
+}
+
+// publishes the post-mortem of stalls and of resets inside a watchdog stage, retained
+// so it isn't lost if nobody listens when we reconnect after a reboot
+// {"resetReason":"Software Watchdog","resetStage":"send","resetBudget":15000,"stalls":1,
+//  "stallStage":"packetSent","duration":15003,"budget":15000,"regs":"0C B0 00 FF"}
+// returns true if a post-mortem was published
+boolean runWatchdogReport() {
+  if (!watchdog.hasReport() || !mqttClient.connected()) {
+    return false;
+  }
+  const mxWatchdogRecord& rec = watchdog.record();
+  String jsonMsg = (String)"{\"resetReason\":\"" + ESP.getResetReason() + "\"";
+  if (watchdog.resetInStage() && (watchdog.resetStage() < wdStageCount)) {
+    jsonMsg = jsonMsg + ",\"resetStage\":\"" + watchdogStageNames[watchdog.resetStage()] +
+              "\",\"resetBudget\":" + watchdog.resetBudget();
+  }
+  jsonMsg = jsonMsg + ",\"stalls\":" + rec.stalls;
+  if ((rec.stalls > 0) && (rec.stallStage < wdStageCount)) {
+    char regs[3 * MXWATCHDOG_NUM_INFO] = {0};
+    for (uint8_t i = 0; i < MXWATCHDOG_NUM_INFO; i++) {
+      sprintf(regs + 3 * i, (i < MXWATCHDOG_NUM_INFO - 1) ? "%02X " : "%02X", rec.stallInfo[i]);
+    }
+    jsonMsg = jsonMsg + ",\"stallStage\":\"" + watchdogStageNames[rec.stallStage] +
+              "\",\"duration\":" + rec.stallDuration + ",\"budget\":" + rec.stallBudget +
+              ",\"regs\":\"" + regs + "\"";
+  }
+  jsonMsg += "}";
+  // the String publish of the wrapper is limited to 128 characters
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_POSTMORTEM).c_str(), jsonMsg.c_str(), true);
+  watchdog.clearReport();
+  return true;
+}
+
+// wrapper for radioBackend->transmit to publish MQTT "status/state = sending" message and toggle LED
 boolean send(uint8_t buffer[], uint8_t bufferSize, uint8_t numStuffedBits = 0) {
   digitalWrite(LED_BUILTIN, LOW); // turn builtin LED on
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "sending", false);
+  setState(deviceState_t::stateSending, true); // sending blocks the loop, publish it right now
   
-  boolean ret = radio.send(buffer, bufferSize, numStuffedBits);
+  if ((activeCmd != NULL) && (activeCmd->txStartTime == 0)) {
+    activeCmd->txStartTime = millis();
+  }
+  watchdog.enter(wdStageSend, CFG_WD_BUDGET_SEND);
+  boolean ret = radioBackend->transmit(buffer, bufferSize, numStuffedBits);
+  // the cmd trace and the sending state cover the whole transmission, also of a backend
+  // which sends asynchronously
+  while (radioBackend->transmitting()) {
+    delay(1);
+  }
+  watchdogLeave();
+  if (activeCmd != NULL) {
+    activeCmd->txEndTime = millis();
+    activeCmd->txFailed |= !ret;
+  }
 
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "listening", false);
+  setState(deviceState_t::stateListening);
   digitalWrite(LED_BUILTIN, HIGH); // turn builtin LED off
   return ret;
 }
 
-// wrapper for radio.sendPacket to publish MQTT "status/state = sending" message and toggle LED
+// wrapper for radioBackend->sendPacket to publish MQTT "status/state = sending" message and toggle LED
 boolean sendPacket(uint8_t deviceType, uint32_t address, uint8_t cmd, uint8_t cmds[], uint8_t cmdsSize) {
   digitalWrite(LED_BUILTIN, LOW); // turn builtin LED on
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "sending", false);
+  setState(deviceState_t::stateSending, true); // sending blocks the loop, publish it right now
   
-  boolean ret = radio.sendPacket(deviceType, address, cmd, cmds, cmdsSize);
+  if ((activeCmd != NULL) && (activeCmd->txStartTime == 0)) {
+    activeCmd->txStartTime = millis();
+  }
+  watchdog.enter(wdStageSend, CFG_WD_BUDGET_SEND);
+  boolean ret = radioBackend->sendPacket(deviceType, address, cmd, cmds, cmdsSize);
+  while (radioBackend->transmitting()) {
+    delay(1);
+  }
+  watchdogLeave();
+  if (activeCmd != NULL) {
+    activeCmd->txEndTime = millis();
+    activeCmd->txFailed |= !ret;
+  }
 
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "listening", false);
+  setState(deviceState_t::stateListening);
   digitalWrite(LED_BUILTIN, HIGH); // turn builtin LED off
   return ret;
 }
 
+// sets the repeats and the power level of the radio to the TX profile of the thermostat
+void applyTxProfile(uint32_t id) {
+  mxTxProfile profile = txProfiles.get(id);
+  radioBackend->setTxProfile(profile.repeats, profile.powerLevel);
+}
+
 // Handles thermostat cmnds by reacting to MQTT topics and their cmd
 // return true - if handled successfully
 //        false - otherwise
-boolean handleThermostatCmds(String topic, String cmd) {
-  // since the position of the thermostat ID in the MQTT is fixed by using
-  // fixed length MAC address and fixed length IDs, we hard code the substring
-  // if anything changes in the topic syntax this needs to be changed as well
-  // topic :[MXETHControl/BCDDC2248523/thermostat/010101/set/cmd]
-  //                                              ^     ^ end=43
-  //                                              | start=37
-  String thermostatID = topic.substring(37, 43);
-  String thermostatRoot = (String)mqtt_root + "/thermostat/" + thermostatID;
-  uint32_t id = strtoul(thermostatID.c_str(), NULL, 16); // ID as 4 byte integer
+boolean handleThermostatCmds(uint32_t id, String cmd) {
+  char thermostatID[7] = {0}; // ID as a hex string
+  sprintf(thermostatID, "%06X", id);
+  String thermostatRoot = (String)mqtt_root + MQTT_TOPIC_THERMOSTAT + "/" + thermostatID;
   MXDEBUG_PRINTLLN("Got cmd for thermostat");
-  MXDEBUG_PRINTLN("ID:  " + thermostatID + ", as int: " + id);
+  MXDEBUG_PRINTLN((String)"ID:  " + thermostatID + ", as int: " + id);
   MXDEBUG_PRINTLN("CMD: " + cmd);
+  applyTxProfile(id);
 
   boolean cmdSent = false;
 
@@ -425,7 +700,7 @@ boolean handleThermostatCmds(String topic, String cmd) {
     }
   } else {
     MXINFO_PRINTLLN(F("Got unknown CMD, ignoring it!"));
-    MXINFO_PRINTLN("ID:  " + thermostatID + ", as int: " + id);
+    MXINFO_PRINTLN((String)"ID:  " + thermostatID + ", as int: " + id);
     MXINFO_PRINTLN("CMD: " + cmd);
     return false;
   }
@@ -434,10 +709,12 @@ boolean handleThermostatCmds(String topic, String cmd) {
   if (cmdSent == true) {
     // publish also raw packet
     String rawPacket = "";
-    char rawHex[2] = "";
-    for (uint8_t i = 0; i < radio.lastSentPacketSize; i++ ) {
-      sprintf(rawHex, "%02X", radio.lastSentPacket[i]); // padding the hex values with leading 0
-      rawPacket = rawPacket + rawHex + ((i < radio.lastSentPacketSize - 1)? " ":"");
+    char rawHex[3] = ""; // 2 hex digits + terminating null
+    const uint8_t* lastSent = NULL;
+    uint8_t lastSentSize = radioBackend->lastSent(lastSent);
+    for (uint8_t i = 0; i < lastSentSize; i++ ) {
+      sprintf(rawHex, "%02X", lastSent[i]); // padding the hex values with leading 0
+      rawPacket = rawPacket + rawHex + ((i < lastSentSize - 1)? " ":"");
     }
     mqttClient.publish(thermostatRoot + "/get/raw", rawPacket, false);
   }
@@ -466,6 +743,7 @@ boolean handleThermostatCmds(String topic, String cmd) {
     MXINFO_PRINTLN(fwVerUrl);
 
     // Download the version string
+    watchdog.enter(wdStageFWUpdate, CFG_WD_BUDGET_FW_UPDATE);
     HTTPClient httpClient;
     httpClient.begin(wifiClient, fwVerUrl);
     int httpCode = httpClient.GET();
@@ -482,6 +760,7 @@ boolean handleThermostatCmds(String topic, String cmd) {
 
       if (fwVerNew != fwVer) {
         MXINFO_PRINTLN(F("New version available, preparing to update."));
+        txProfiles.saveIfDue(true); // the update reboots
         String fwBinUrl = String(fwBaseUrl);
         fwBinUrl.concat(deviceName);
         fwBinUrl.concat(".bin");
@@ -516,67 +795,65 @@ boolean handleThermostatCmds(String topic, String cmd) {
     }
     MXTIME_PRINT("");
     httpClient.end();
+    watchdogLeave();
   }
 #endif //defined(HTTP_OTA_FW_UPD) || defined(MQTT_HTTP_OTA_FW_UPD)
 
-void mqttReconnect() {
-  // Only do 3 connection retries, if it's not working
-  // we do it again after the next deep sleep phase
-  for (int i=0; i<=2; i++) {
-    if (mqttClient.connected()) {
-      // if we are connected stop the retries
-      break;
+// checks if the ID is one of the configured thermostats or groups
+// thermostats: 010101, 020202, ... up to CFG_ETH200NUMTHERMOSTATS
+// groups     : 990101, 990202, ... up to CFG_ETH200NUMGROUPS
+// or if it is in CFG_ETH200THERMOSTATALLOWLIST
+boolean isThermostatIDAllowed(uint32_t id) {
+  uint8_t idByte1 = id >> 16;
+  uint8_t idByte2 = id >> 8;
+  uint8_t idByte3 = id;
+
+  if ((idByte1 == idByte2) && (idByte2 == idByte3) &&
+      (idByte1 >= 1) && (idByte1 <= CFG_ETH200NUMTHERMOSTATS)) {
+    return true;
+  }
+  if ((idByte1 == 0x99) && (idByte2 == idByte3) &&
+      (idByte2 >= 1) && (idByte2 <= CFG_ETH200NUMGROUPS)) {
+    return true;
+  }
+  #ifdef CFG_ETH200THERMOSTATALLOWLIST
+    const uint32_t allowList[] = {CFG_ETH200THERMOSTATALLOWLIST};
+    for (uint8_t i = 0; i < sizeof(allowList) / sizeof(allowList[0]); i++) {
+      if (allowList[i] == id) {
+        return true;
+      }
     }
-    MXINFO_PRINT(F("MQTT try #"));
-    MXINFO_PRINT(i);
-    MXINFO_PRINTLN(F(" attempting connection."));
-    MXTIME_PRINT(F(""));
-
-    // Attempt to connect
-    MXINFO_PRINT(F("MQTT connecting as client: "));
-    MXINFO_PRINTLN(deviceName);
-
-    String willTopic = mqtt_root; //need to initialize the variable first, otherwise we have garbage
-    willTopic += MQTT_TOPIC_STATUS;
-    willTopic += MQTT_TOPIC_STATUS_ONLINE;
-    const char* willMessage = "0";
-    
-    MXDEBUG_PRINTL(F("Free Heap Size: "));
-    MXDEBUG_PRINTLN(ESP.getFreeHeap());
-    MXDEBUG_PRINTL(F("MQTT user: "));
-    MXDEBUG_PRINTLN(mqtt_user);
-    MXDEBUG_PRINTL(F("MQTT pass: "));
-    MXDEBUG_PRINTLN(mqtt_pass);
-    MXDEBUG_PRINTL(F("MQTT MQTT_MAX_PACKET_SIZE: "));
-    MXDEBUG_PRINTLN(MQTT_MAX_PACKET_SIZE);
-    MXDEBUG_PRINTL(F("MQTT willTopic: "));
-    MXDEBUG_PRINTLN(willTopic);
-    MXDEBUG_PRINTL(F("MQTT willMessage: "));
-    MXDEBUG_PRINTLN(willMessage);
+  #endif //CFG_ETH200THERMOSTATALLOWLIST
+  return false;
+}
 
-    if (mqttClient.connect(\
-          deviceName.c_str(), mqtt_user, mqtt_pass, \
-          willTopic.c_str(), 0, 1, willMessage)) {
-          //the added willTopic,willQos,willRetain,willMessage parameters enable the server
-          //to notify all subscribed clients that this sensor is online=0 (means offline) when
-          //the server looses the connection to it
-      MXINFO_PRINTLN(F("MQTT connected to broker."));
-      yield();
-      mqttClient.subscribe(((String)mqtt_root + MQTT_TOPIC_SET + "/#").c_str());
-      // we also need to retain the updated "online" state, otherwise only the willMessage state of "0" is retained
-      // basically if we retain the LWT message then we need to retain any updates to it as well
-      mqttClient.publish((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_ONLINE, "1", true);
-      yield();
-      mqttClient.loop(); //give the ESP a chance to react to publish messages
-      MXTIME_PRINT(F(""));
-    } else {
-      MXINFO_PRINT(F("MQTT connection failed, rc="));
-      MXINFO_PRINT(mqttClient.state());
-      MXINFO_PRINTLN(F(" trying again in 2 seconds"));
-      // Wait 2 second before retrying
-      delay(2000);
+// returns the thermostat slot of id, if the thermostat isn't in use yet a free
+// slot is taken and the thermostat "created" by publishing its ID once.
+// returns NULL if all slots are in use
+thermostat* getThermostat(uint32_t id) {
+  thermostat* freeSlot = NULL;
+  for (uint8_t i = 0; i < CFG_THERMOSTATS_SIZE; i++) {
+    if (thermostats[i].id == id) {
+      return &thermostats[i];
+    }
+    if ((thermostats[i].id == 0) && (freeSlot == NULL)) {
+      freeSlot = &thermostats[i];
     }
   }
+  if (freeSlot == NULL) {
+    MXINFO_PRINTLLN(F("ERROR: Could not create thermostat. All slots in use"));
+    return NULL;
+  }
+
+  freeSlot->id = id;
+  freeSlot->cmdBucket.reset();
+  char thermostatID[7] = {0}; // ID as a hex string
+  sprintf(thermostatID, "%06X", id);
+  MXDEBUG_PRINTL(F("Created thermostat: "));
+  MXDEBUG_PRINTLN(thermostatID);
+  //MXETHControl/<MAC>/thermostat/<ThermostatID>/get/id
+  mqttClient.publish((String)mqtt_root + MQTT_TOPIC_THERMOSTAT + "/" + thermostatID + MQTT_TOPIC_GET + "/id", thermostatID, true);
+  return freeSlot;
 }
 
 // add an incoming MQTT message to the MQTT cmd queue
@@ -595,63 +872,524 @@ boolean pushMQTTCmdsQueue(mqttCmd cmd) {
   return false;
 }
 
-void mqttCallback(char* topic, byte* payload, unsigned int length) {
-  MXTIME_PRINT(F(""));
-  MXINFO_PRINT(F("MQTT Message arrived topic : ["));
-  MXINFO_PRINT(topic);
-  MXINFO_PRINTLN(F("] "));
+// parses a thermostat ID given as exactly 6 hex characters at the beginning of str
+// returns true if str starts with a valid ID, the ID is returned in id
+boolean parseThermostatID(const char* str, uint32_t* id) {
+  uint32_t result = 0;
+  for (uint8_t i = 0; i < 6; i++) {
+    char c = str[i];
+    uint8_t nibble = 0;
+    if ((c >= '0') && (c <= '9')) {
+      nibble = c - '0';
+    } else if ((c >= 'A') && (c <= 'F')) {
+      nibble = c - 'A' + 10;
+    } else if ((c >= 'a') && (c <= 'f')) {
+      nibble = c - 'a' + 10;
+    } else {
+      // also catches the end of the string
+      return false;
+    }
+    result = result << 4 | nibble;
+  }
+  *id = result;
+  return true;
+}
 
-  char message[length + 1];
-  for (unsigned int i = 0; i < length; i++) {
-    message[i] = (char)payload[i];
+// publishes the final status and the timestamps (millis()) of a cmd to thermostat/<ID>/get/ack
+// {"seq":12,"status":"sent","received":81200,"dequeued":81310,"txStart":81312,"txEnd":87420}
+// status - "sent", "failed", "coalesced", "expired" or "rejected"
+// reason - why the cmd was rejected, see publishThermostatError(), NULL otherwise
+// by     - seq of the cmd which replaced a coalesced cmd, 0 otherwise
+// kept free of String operations, it is called from the mqttHandleThermostat() hot path
+void publishCmdAck(const mqttCmd& cmd, const char* status, const char* reason = NULL, uint32_t by = 0) {
+  //MXETHControl/<MAC>/thermostat/<ThermostatID>/get/ack
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%s" MQTT_TOPIC_THERMOSTAT "/%06X" MQTT_TOPIC_GET "/ack", mqtt_root.c_str(), cmd.thermostatID);
+  char json[192];
+  int len = snprintf(json, sizeof(json), "{\"seq\":%lu,\"status\":\"%s\",\"received\":%lu",
+                     (unsigned long)cmd.seq, status, cmd.receiveTime);
+  if (reason != NULL) {
+    len += snprintf(json + len, sizeof(json) - len, ",\"reason\":\"%s\"", reason);
   }
-  message[length] = '\0';
-  MXINFO_PRINT(F("MQTT Message: "));
-  MXINFO_PRINTLN(message);
+  if (by != 0) {
+    len += snprintf(json + len, sizeof(json) - len, ",\"by\":%lu", (unsigned long)by);
+  }
+  if (cmd.dequeueTime != 0) {
+    len += snprintf(json + len, sizeof(json) - len, ",\"dequeued\":%lu", cmd.dequeueTime);
+  }
+  if (cmd.txStartTime != 0) {
+    len += snprintf(json + len, sizeof(json) - len, ",\"txStart\":%lu,\"txEnd\":%lu", cmd.txStartTime, cmd.txEndTime);
+  }
+  snprintf(json + len, sizeof(json) - len, "}");
+  mqttClient.publish(topic, json, false);
+}
 
-  String topicStr = topic;
-  String check = ((String)mqtt_root + MQTT_TOPIC_SET);
+// publishes why a cmd for a thermostat was rejected to thermostat/<ID>/get/error and
+// the rejection to get/ack
+// error - "rateLimited", "rateLimitedGlobal", "queueFull", "cmdTooLong" or "unknownCmd"
+void publishThermostatError(const mqttCmd& cmd, const char* error) {
+  pipeline.cmdsRejected++;
+  //MXETHControl/<MAC>/thermostat/<ThermostatID>/get/error
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%s" MQTT_TOPIC_THERMOSTAT "/%06X" MQTT_TOPIC_GET "/error", mqtt_root.c_str(), cmd.thermostatID);
+  mqttClient.publish(topic, error, false);
+  publishCmdAck(cmd, "rejected", error);
+}
+
+// the thermostat states an absolute cmd sets, a newer cmd of the same class makes a queued
+// one obsolete. Relative temperatures, "Learn", the test cmds and unknown cmds are
+// cmdClassNone, they add up or need to be sent every time.
+enum cmdClass_t {
+  cmdClassNone,
+  cmdClassMode,   // DayMode, NightMode
+  cmdClassWindow, // WindowOpened, WindowClosed
+  cmdClassTemp    // absolute temperature
+};
 
-  if (topicStr.startsWith((String)check + MQTT_TOPIC_SET_RESET)) {
-    mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "restarting", false);
-    MXINFO_PRINTLLN(F("Received MQTT reset command!"));
-    MXINFO_PRINTLLN(F("RFM69 reset."));
-    resetRFM69();
-    MXINFO_PRINTLLN(F("ESP restart."));
-    #if defined(MXDEBUG) || defined(MXINFO) || defined(MXDEBUG_TIME)
-      Serial.flush();
-    #endif //defined(MXDEBUG) || defined(MXINFO) || defined(MXDEBUG_TIME)
-    ESP.restart();
+// returns the class of a cmd value, an absolute temperature only if handleThermostatCmds()
+// accepts it: unsigned, digits with at most one '.' and up to 29.5
+cmdClass_t getCmdClass(const char* value) {
+  if ((strcmp(value, "DayMode") == 0) || (strcmp(value, "NightMode") == 0)) {
+    return cmdClassMode;
   }
+  if ((strcmp(value, "WindowOpened") == 0) || (strcmp(value, "WindowClosed") == 0)) {
+    return cmdClassWindow;
+  }
+  boolean digits = false;
+  boolean decPt = false;
+  for (const char* c = value; *c != '\0'; c++) {
+    if ((*c >= '0') && (*c <= '9')) {
+      digits = true;
+    } else if ((*c == '.') && !decPt) {
+      decPt = true;
+    } else {
+      return cmdClassNone;
+    }
+  }
+  return (digits && (atof(value) <= 29.5)) ? cmdClassTemp : cmdClassNone;
+}
 
-  if (topicStr.startsWith((String)check + MQTT_TOPIC_SET_PING)) {
-    MXINFO_PRINTLN(F("MQTT Ping ... replying with Pong"));
-    mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_GET + MQTT_TOPIC_SET_PONG), message, false);
+// drops the queued cmds of a thermostat which set the same state as cmd
+// the cmd currently being sent is kept, it can't be taken back anymore
+void coalesceMQTTCmdsQueue(const mqttCmd& cmd) {
+  cmdClass_t cmdClass = getCmdClass(cmd.value);
+  if (cmdClass == cmdClassNone) {
     return;
   }
+  for (uint8_t i = 0; i < CFG_MQTTCMDS_SIZE; i++) {
+    if ((mqttCmds[i].hasData == 1) && (&mqttCmds[i] != activeCmd) &&
+        (mqttCmds[i].thermostatID == cmd.thermostatID) && (getCmdClass(mqttCmds[i].value) == cmdClass)) {
+      publishCmdAck(mqttCmds[i], "coalesced", NULL, cmd.seq);
+      mqttCmds[i] = mqttCmd();
+    }
+  }
+}
+
+// MQTT topic handlers, called by mqttCallback() with the part of the topic following the
+// matched route and the not null terminated payload. Both point into the buffer of
+// mqttClient, which is overwritten by the next publish(), copy what is needed after it.
+void mqttHandleReset(const char* subTopic, const byte* payload, unsigned int length) {
+  (void)subTopic;
+  (void)payload;
+  (void)length;
+  setState(deviceState_t::stateRestarting, true);
+  MXINFO_PRINTLLN(F("Received MQTT reset command!"));
+  txProfiles.saveIfDue(true);
+  MXINFO_PRINTLLN(F("RFM69 reset."));
+  resetRFM69();
+  MXINFO_PRINTLLN(F("ESP restart."));
+  #if defined(MXDEBUG) || defined(MXINFO) || defined(MXDEBUG_TIME)
+    Serial.flush();
+  #endif //defined(MXDEBUG) || defined(MXINFO) || defined(MXDEBUG_TIME)
+  ESP.restart();
+}
 
-  if (topicStr.startsWith((String)check + MQTT_TOPIC_SET_UPDATE)) {
-    #ifdef MQTT_HTTP_OTA_FW_UPD
-      mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "checkingOTA", false);
-      MXINFO_PRINTLN(F("MQTT OTA Requested. Starting update via HTTP."));
-      checkForFWUpdates();
-      // if we reach this point no fw update was done and we continue listening
-      mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "listening", false);
-    #else
-      MXINFO_PRINTLN("MQTT OTA Requested. But it is disabled in firmware via MQTT_HTTP_OTA_FW_UPD.");
-    #endif //MQTT_HTTP_OTA_FW_UPD
+void mqttHandlePing(const char* subTopic, const byte* payload, unsigned int length) {
+  (void)subTopic;
+  MXINFO_PRINTLN(F("MQTT Ping ... replying with Pong"));
+  // publish() builds the packet in the buffer payload points into, so it needs a copy
+  byte pong[length + 1];
+  memcpy(pong, payload, length);
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_GET + MQTT_TOPIC_SET_PONG).c_str(), pong, length, false);
+}
+
+#ifdef MQTT_HTTP_OTA_FW_UPD
+  boolean fwUpdateRequested = false; // set/update was received, see taskOTA()
+#endif //MQTT_HTTP_OTA_FW_UPD
+void mqttHandleUpdate(const char* subTopic, const byte* payload, unsigned int length) {
+  (void)subTopic;
+  (void)payload;
+  (void)length;
+  #ifdef MQTT_HTTP_OTA_FW_UPD
+    // the update check blocks for a while, so it is done by taskOTA() once nothing else is going on
+    MXINFO_PRINTLN(F("MQTT OTA Requested. Scheduling update via HTTP."));
+    fwUpdateRequested = true;
+  #else
+    MXINFO_PRINTLN("MQTT OTA Requested. But it is disabled in firmware via MQTT_HTTP_OTA_FW_UPD.");
+  #endif //MQTT_HTTP_OTA_FW_UPD
+}
+
+// publishes the statistics of all profiling scopes to status/profile/<scope>
+// payload "reset" clears the statistics right after taking the snapshot
+void mqttHandleProfile(const char* subTopic, const byte* payload, unsigned int length) {
+  (void)subTopic;
+  (void)payload; // without MXPROFILE
+  (void)length;
+  #ifdef MXPROFILE
+    boolean reset = (length == 5) && (strncmp((const char*)payload, "reset", 5) == 0);
+    uint32_t ticksPerUs = mxProfileTicksPerUs();
+    for (mxProfileStat* stat = mxProfileList(); stat != NULL; stat = stat->next) {
+      // snapshot and reset together, so no run is lost or counted twice
+      mxProfileStat snapshot = *stat;
+      if (reset) {
+        stat->reset();
+      }
+
+      // {"count":12,"minUs":1.5,"maxUs":9.8,"meanUs":3.1,"ticksPerUs":80,"histFrom":7,"hist":[2,8,2]}
+      // hist[i] counts the runs which took 2^(histFrom + i) to 2^(histFrom + i + 1) - 1 ticks
+      String jsonMsg = (String)"{\"count\":" + snapshot.count;
+      if (snapshot.count > 0) {
+        jsonMsg = jsonMsg + ",\"minUs\":" + String((float)snapshot.min / ticksPerUs, 1) +
+                  ",\"maxUs\":" + String((float)snapshot.max / ticksPerUs, 1) +
+                  ",\"meanUs\":" + String((float)snapshot.sum / snapshot.count / ticksPerUs, 1);
+      }
+      jsonMsg = jsonMsg + ",\"ticksPerUs\":" + ticksPerUs;
+      uint8_t histFrom = 0;
+      uint8_t histTo = 0;
+      for (uint8_t i = 0; i < MXPROFILE_HIST_SIZE; i++) {
+        if (snapshot.hist[i] > 0) {
+          if (histTo == 0) {
+            histFrom = i;
+          }
+          histTo = i + 1;
+        }
+      }
+      jsonMsg = jsonMsg + ",\"histFrom\":" + histFrom + ",\"hist\":[";
+      for (uint8_t i = histFrom; i < histTo; i++) {
+        jsonMsg = jsonMsg + ((i > histFrom)? ",":"") + snapshot.hist[i];
+      }
+      jsonMsg += "]}";
+      // the String publish of the wrapper is limited to 128 characters
+      mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_SET_PROFILE + "/" + snapshot.name).c_str(), jsonMsg.c_str(), false);
+    }
+  #else
+    MXINFO_PRINTLN(F("Profile requested. But it is disabled in firmware via MXPROFILE."));
+  #endif //MXPROFILE
+}
+
+// publishes the radio and pipeline counters to status/stats
+// reset - set all counters to 0 right after taking the snapshot
+void publishStats(boolean reset) {
+  mxRadioStats radioStats = radioBackend->stats();
+  pipelineStats pipeStats = pipeline;
+  unsigned long since = millis() - statsSince;
+  if (reset) {
+    radioBackend->resetStats();
+    pipeline = pipelineStats();
+    statsSince = millis();
   }
 
-  if (topicStr.startsWith((String)mqtt_root + "/thermostat/")) {
-    MXDEBUG_PRINTLLN(F("Got message on thermostat subscription topic. Pushing it into the queue."));
-    mqttCmd msg;
-    msg.hasData = 1;
-    msg.receiveTime = millis();
-    msg.topic = topicStr;
-    msg.value = (String)message;
-    pushMQTTCmdsQueue(msg);
+  // the capture efficiency: share of the FIFO reads with a valid CRC and how many of the
+  // repeated packets of a message we caught, the sensors send the same packet for ~10s
+  float crcOkPct = (radioStats.fifoReads > 0) ? (float)radioStats.accepted * 100 / radioStats.fifoReads : 0;
+  float packetsPerMsg = (pipeStats.messages > 0) ? (float)(pipeStats.messages + pipeStats.duplicates) / pipeStats.messages : 0;
+  // share of the time we were transmitting, the 868 MHz band allows 1% per hour
+  float dutyPct = (since > 0) ? (float)radioStats.txAirtime * 100 / since : 0;
+
+  String jsonMsg = (String)"{\"since\":" + since +
+                   ",\"irqs\":" + radioStats.interrupts +
+                   ",\"fifoReads\":" + radioStats.fifoReads +
+                   ",\"unknownTypes\":" + radioStats.unknownTypes +
+                   ",\"lengthErrors\":" + radioStats.lengthErrors +
+                   ",\"crcErrors\":" + radioStats.crcErrors +
+                   ",\"accepted\":" + radioStats.accepted +
+                   ",\"duplicates\":" + pipeStats.duplicates +
+                   ",\"messages\":" + pipeStats.messages +
+                   ",\"queueDrops\":" + pipeStats.queueDrops +
+                   ",\"queueMax\":" + pipeStats.queueMax +
+                   ",\"published\":" + pipeStats.published +
+                   ",\"cmdsQueued\":" + pipeStats.cmdsQueued +
+                   ",\"cmdsRejected\":" + pipeStats.cmdsRejected +
+                   ",\"cmdsSent\":" + pipeStats.cmdsSent +
+                   ",\"txFrames\":" + radioStats.txFrames +
+                   ",\"txRepeats\":" + radioStats.txRepeats +
+                   ",\"txAirtime\":" + radioStats.txAirtime +
+                   ",\"dutyPct\":" + String(dutyPct, 2) +
+                   ",\"crcOkPct\":" + String(crcOkPct, 1) +
+                   ",\"packetsPerMsg\":" + String(packetsPerMsg, 1) +
+                   "}";
+  // the String publish of the wrapper is limited to 128 characters
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_SET_STATS).c_str(), jsonMsg.c_str(), false);
+}
+
+// lowest free heap seen by sampleHeap() since boot or the last set/heap "reset"
+uint32_t heapMinFree = UINT32_MAX;
+
+// cheap enough to be called every loop(), the minimum shows the worst case between two publishes
+void sampleHeap() {
+  uint32_t freeHeap = ESP.getFreeHeap();
+  if (freeHeap < heapMinFree) {
+    heapMinFree = freeHeap;
   }
-  return;
+}
+
+// publishes the heap state to status/heap and, if MXHEAPTRACK is enabled, the allocations
+// of every call site (MXHEAP_SITE) to status/heap/<site>
+// reset - start the minimum and the call site statistics over after publishing them
+void publishHeap(boolean reset) {
+  MXHEAP_SITE("publishHeap");
+  sampleHeap();
+  // fragmentation is 100 - 100 * largest free block / free heap, a high value means
+  // a long String can fail to allocate although there is enough free heap in total
+  String jsonMsg = (String)"{\"free\":" + ESP.getFreeHeap() +
+                   ",\"minFree\":" + heapMinFree +
+                   ",\"maxBlock\":" + ESP.getMaxFreeBlockSize() +
+                   ",\"frag\":" + ESP.getHeapFragmentation() +
+                   "}";
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_SET_HEAP), jsonMsg, false);
+  if (reset) {
+    heapMinFree = UINT32_MAX;
+  }
+
+  #ifdef MXHEAPTRACK
+    // the list is only extended at its head, so it can be walked while publishing
+    // allocates, the counters of the sites published so far are snapshots anyway
+    for (mxHeapSite* site = mxHeapSiteList(); site != NULL; site = site->next) {
+      mxHeapSite snapshot = *site;
+      if (reset) {
+        site->reset();
+      }
+      float allocsPerCall = (snapshot.calls > 0) ? (float)(snapshot.allocs + snapshot.reallocs) / snapshot.calls : 0;
+      jsonMsg = (String)"{\"calls\":" + snapshot.calls +
+                ",\"allocs\":" + snapshot.allocs +
+                ",\"reallocs\":" + snapshot.reallocs +
+                ",\"bytes\":" + snapshot.bytes +
+                ",\"maxSize\":" + snapshot.maxSize +
+                ",\"allocsPerCall\":" + String(allocsPerCall, 1) +
+                "}";
+      // the String publish of the wrapper is limited to 128 characters
+      mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_SET_HEAP + "/" + snapshot.name).c_str(), jsonMsg.c_str(), false);
+    }
+  #endif //MXHEAPTRACK
+}
+
+// payload "reset" starts the minimum and the call site statistics over after publishing them
+void mqttHandleHeap(const char* subTopic, const byte* payload, unsigned int length) {
+  (void)subTopic;
+  publishHeap((length == 5) && (strncmp((const char*)payload, "reset", 5) == 0));
+}
+
+// payload "reset" sets all counters to 0 after publishing them
+void mqttHandleStats(const char* subTopic, const byte* payload, unsigned int length) {
+  (void)subTopic;
+  publishStats((length == 5) && (strncmp((const char*)payload, "reset", 5) == 0));
+}
+
+// publishes the TX profile of a thermostat to thermostat/<ID>/get/txprofile (retained)
+// {"repeats":300,"power":28,"mode":"auto","ok":12,"missed":1}
+// mode - "default" if the thermostat has no profile, "auto" if feedback tunes it, "fixed"
+void publishTxProfile(uint32_t id) {
+  mxTxProfile profile = txProfiles.get(id);
+  const char* mode = (profile.id == 0) ? "default" : (profile.fixed ? "fixed" : "auto");
+  //MXETHControl/<MAC>/thermostat/<ThermostatID>/get/txprofile
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%s" MQTT_TOPIC_THERMOSTAT "/%06X" MQTT_TOPIC_GET MQTT_TOPIC_THERMOSTAT_TXPROFILE,
+           mqtt_root.c_str(), id);
+  char json[96];
+  snprintf(json, sizeof(json), "{\"repeats\":%u,\"power\":%u,\"mode\":\"%s\",\"ok\":%u,\"missed\":%u}",
+           profile.repeats, profile.powerLevel, mode, profile.ok, profile.missed);
+  mqttClient.publish(topic, json, true);
+}
+
+// publishes why a TX profile topic was ignored to thermostat/<ID>/get/error
+// error - "invalidFeedback", "invalidTxProfile" or "txProfilesFull"
+void publishTxProfileError(uint32_t id, const char* error) {
+  //MXETHControl/<MAC>/thermostat/<ThermostatID>/get/error
+  char topic[64];
+  snprintf(topic, sizeof(topic), "%s" MQTT_TOPIC_THERMOSTAT "/%06X" MQTT_TOPIC_GET "/error", mqtt_root.c_str(), id);
+  mqttClient.publish(topic, error, false);
+}
+
+// payload "ok" - the thermostat reacted to the last cmd, "missed" - it didn't
+// the profile is only written to the flash if the repeats or the power level changed,
+// see MXTxProfiles::saveIfDue()
+void mqttHandleThermostatFeedback(uint32_t id, const byte* payload, unsigned int length) {
+  boolean ok = (length == 2) && (strncmp((const char*)payload, "ok", 2) == 0);
+  boolean missed = (length == 6) && (strncmp((const char*)payload, "missed", 6) == 0);
+  if (!ok && !missed) {
+    MXINFO_PRINTLLN(F("Got invalid thermostat feedback, ignoring it."));
+    publishTxProfileError(id, "invalidFeedback");
+    return;
+  }
+  mxTxProfile* profile = txProfiles.find(id, true);
+  if (profile == NULL) {
+    MXINFO_PRINTLLN(F("ERROR: Could not create TX profile. All slots in use"));
+    publishTxProfileError(id, "txProfilesFull");
+    return;
+  }
+  if (txProfiles.feedback(*profile, ok)) {
+    MXINFO_PRINTL(F("New TX profile, repeats: "));
+    MXINFO_PRINT(profile->repeats);
+    MXINFO_PRINT(F(", power level: "));
+    MXINFO_PRINTLN(profile->powerLevel);
+    txProfiles.changed();
+  }
+  publishTxProfile(id);
+}
+
+// payload "<repeats>,<power level>" - fixed values, feedback doesn't change them
+//         "auto"                    - feedback tunes the profile again, starting from its values
+//         "reset"                   - back to the defaults
+//         ""                        - just publishes the profile
+void mqttHandleThermostatTxProfile(uint32_t id, const byte* payload, unsigned int length) {
+  char value[16] = {0};
+  if (length >= sizeof(value)) {
+    publishTxProfileError(id, "invalidTxProfile");
+    return;
+  }
+  memcpy(value, payload, length);
+  unsigned int repeats = 0;
+  unsigned int powerLevel = 0;
+  char extra = 0;
+  boolean changed = false;
+  if (strcmp(value, "auto") == 0) {
+    changed = txProfiles.unfix(id);
+  } else if (strcmp(value, "reset") == 0) {
+    changed = txProfiles.remove(id);
+  } else if (sscanf(value, "%u,%u%c", &repeats, &powerLevel, &extra) == 2) {
+    if ((repeats > UINT16_MAX) || (powerLevel > UINT8_MAX) || !txProfiles.set(id, repeats, powerLevel)) {
+      MXINFO_PRINTLLN(F("Got TX profile out of range or all slots in use, ignoring it."));
+      publishTxProfileError(id, "invalidTxProfile");
+      return;
+    }
+    changed = true;
+  } else if (length > 0) {
+    MXINFO_PRINTLLN(F("Got invalid TX profile, ignoring it."));
+    publishTxProfileError(id, "invalidTxProfile");
+    return;
+  }
+  if (changed) {
+    txProfiles.changed();
+  }
+  publishTxProfile(id);
+}
+
+// this is the hot path if any automation floods the thermostat topics, so it is
+// kept free of String operations and heap allocations
+void mqttHandleThermostat(const char* subTopic, const byte* payload, unsigned int length) {
+  // subTopic:[010101/set/cmd]
+  uint32_t id = 0;
+  boolean validID = parseThermostatID(subTopic, &id);
+  boolean isCmd = validID && (strcmp(subTopic + 6, MQTT_TOPIC_SET MQTT_TOPIC_THERMOSTAT_CMD) == 0);
+  boolean isFeedback = validID && (strcmp(subTopic + 6, MQTT_TOPIC_SET MQTT_TOPIC_THERMOSTAT_FEEDBACK) == 0);
+  boolean isTxProfile = validID && (strcmp(subTopic + 6, MQTT_TOPIC_SET MQTT_TOPIC_THERMOSTAT_TXPROFILE) == 0);
+  if (!isCmd && !isFeedback && !isTxProfile) {
+    MXINFO_PRINTLLN(F("Got message on invalid thermostat topic, ignoring it."));
+    return;
+  }
+  if (!isThermostatIDAllowed(id)) {
+    MXINFO_PRINTLLN(F("Got cmd for unknown thermostat ID, ignoring it."));
+    return;
+  }
+  // the TX profile topics don't send anything, they bypass the queue and the rate limits
+  if (isFeedback) {
+    mqttHandleThermostatFeedback(id, payload, length);
+    return;
+  }
+  if (isTxProfile) {
+    mqttHandleThermostatTxProfile(id, payload, length);
+    return;
+  }
+  mqttCmd msg;
+  msg.hasData = 1;
+  msg.receiveTime = millis();
+  msg.thermostatID = id;
+  msg.seq = ++mqttCmdSeq;
+  if (length >= CFG_MQTTCMD_VALUE_SIZE) {
+    MXINFO_PRINTLLN(F("Got thermostat cmd which is too long, rejecting it."));
+    publishThermostatError(msg, "cmdTooLong");
+    return;
+  }
+  // payload and subTopic point into the buffer of mqttClient, which every publish()
+  // overwrites, so the cmd is copied before getThermostat() publishes get/id
+  memcpy(msg.value, payload, length);
+  msg.value[length] = '\0';
+  thermostat* therm = getThermostat(id);
+  if (therm == NULL) {
+    return;
+  }
+
+  // admission control, a cmd needs a token of its thermostat and a global one. The
+  // thermostat bucket stops one flooding client from taking all the global tokens,
+  // the global bucket keeps the queue from filling up faster than we can send.
+  if (!therm->cmdBucket.available()) {
+    MXINFO_PRINTLLN(F("Thermostat cmd rate limit exceeded, rejecting cmd."));
+    publishThermostatError(msg, "rateLimited");
+    return;
+  }
+  if (!mqttCmdsBucket.available()) {
+    MXINFO_PRINTLLN(F("Global cmd rate limit exceeded, rejecting cmd."));
+    publishThermostatError(msg, "rateLimitedGlobal");
+    return;
+  }
+
+  MXDEBUG_PRINTLLN(F("Got message on thermostat subscription topic. Pushing it into the queue."));
+  coalesceMQTTCmdsQueue(msg);
+  if (!pushMQTTCmdsQueue(msg)) {
+    publishThermostatError(msg, "queueFull");
+    return;
+  }
+  therm->cmdBucket.take();
+  mqttCmdsBucket.take();
+  pipeline.cmdsQueued++;
+}
+
+// MQTT topic router, maps the topic following mqtt_root to its handler
+// the first route whose topic is a prefix of the received topic wins
+typedef void (*mqttRouteHandler_t)(const char* subTopic, const byte* payload, unsigned int length);
+struct mqttRoute {
+  const char* topic;            // topic without mqtt_root
+  uint8_t topicLength;
+  mqttRouteHandler_t handler;
+};
+#define MQTT_ROUTE(topic, handler) {topic, sizeof(topic) - 1, handler}
+const mqttRoute mqttRoutes[] = {
+  MQTT_ROUTE(MQTT_TOPIC_THERMOSTAT "/", mqttHandleThermostat),
+  MQTT_ROUTE(MQTT_TOPIC_SET MQTT_TOPIC_SET_RESET, mqttHandleReset),
+  MQTT_ROUTE(MQTT_TOPIC_SET MQTT_TOPIC_SET_PING, mqttHandlePing),
+  MQTT_ROUTE(MQTT_TOPIC_SET MQTT_TOPIC_SET_UPDATE, mqttHandleUpdate),
+  MQTT_ROUTE(MQTT_TOPIC_SET MQTT_TOPIC_SET_PROFILE, mqttHandleProfile),
+  MQTT_ROUTE(MQTT_TOPIC_SET MQTT_TOPIC_SET_STATS, mqttHandleStats),
+  MQTT_ROUTE(MQTT_TOPIC_SET MQTT_TOPIC_SET_HEAP, mqttHandleHeap),
+};
+
+void mqttCallback(char* topic, byte* payload, unsigned int length) {
+  MXPROFILE_SCOPE("mqttCallback");
+  MXHEAP_SITE("mqttCallback");
+  MXTIME_PRINT(F(""));
+  MXINFO_PRINT(F("MQTT Message arrived topic : ["));
+  MXINFO_PRINT(topic);
+  MXINFO_PRINTLN(F("] "));
+  #ifdef MXINFO
+    Serial.print(F("MQTT Message: "));
+    Serial.write(payload, length);
+    Serial.println();
+  #endif //MXINFO
+
+  // all our subscriptions are below mqtt_root, so we only need to compare it once
+  // and dispatch on the rest of the topic
+  if (strncmp(topic, mqtt_root.c_str(), mqtt_root.length()) != 0) {
+    MXINFO_PRINTLLN(F("Got message outside of our root topic, ignoring it."));
+    return;
+  }
+  const char* subTopic = topic + mqtt_root.length();
+  for (uint8_t i = 0; i < sizeof(mqttRoutes) / sizeof(mqttRoutes[0]); i++) {
+    if (strncmp(subTopic, mqttRoutes[i].topic, mqttRoutes[i].topicLength) == 0) {
+      mqttRoutes[i].handler(subTopic + mqttRoutes[i].topicLength, payload, length);
+      return;
+    }
+  }
+  MXDEBUG_PRINTLLN(F("No handler for this topic, ignoring it."));
 }
 
 /**
@@ -704,28 +1442,34 @@ void startWiFi() {
   MXINFO_PRINTLN(F(""));
 }
 
-// converts a valid packet into a message structure
-message convertPacket2Message() {
+// converts a received frame into a message structure
+message convertPacket2Message(const mxRadioFrame& frame) {
+  MXPROFILE_SCOPE("convertPacket2Message");
+  MXHEAP_SITE("convertPacket2Message");
   message msg;
   msg.hasData = 1;
-  msg.receiveTime = millis();
-  msg.packetSize = radio.DATALEN;
-  msg.counter = radio.DATA[0];
+  // the packet arrived when the interrupt fired, the loop might have been busy since
+  uint32_t rxAge = micros() - frame.rxMicros;
+  msg.receiveTime = millis() - rxAge / 1000;
+  msg.firstRxMicros = frame.rxMicros;
+  msg.lastRxMicros = frame.rxMicros;
+  msg.packetSize = frame.length;
+  msg.counter = frame.data[0];
 
   //deviceType
-  if (radio.DATA[1] == deviceType_t::RemoteControl) {
+  if (frame.data[1] == deviceType_t::RemoteControl) {
     msg.deviceType = deviceType_t::RemoteControl;
-  } else if (radio.DATA[1] == deviceType_t::WindowSensor) {
+  } else if (frame.data[1] == deviceType_t::WindowSensor) {
     msg.deviceType = deviceType_t::WindowSensor;
   }
   
   //deviceID
-  msg.deviceID = msg.deviceID << 8 | radio.DATA[2];
-  msg.deviceID = msg.deviceID << 8 | radio.DATA[3];
-  msg.deviceID = msg.deviceID << 8 | radio.DATA[4];
+  msg.deviceID = msg.deviceID << 8 | frame.data[2];
+  msg.deviceID = msg.deviceID << 8 | frame.data[3];
+  msg.deviceID = msg.deviceID << 8 | frame.data[4];
 
   //deviceCmd
-  msg.cmdRaw[0] = radio.DATA[5];
+  msg.cmdRaw[0] = frame.data[5];
   if (msg.deviceType == deviceType_t::WindowSensor) {
     switch (msg.cmdRaw[0]) {
       // WindowSensor
@@ -757,7 +1501,7 @@ message convertPacket2Message() {
         msg.deviceCmd = deviceCmd_t::NightMode;
         break;
       case deviceCmd_t::SetTemp:
-        msg.tempOffset = convertHex2Temp(radio.DATA[6]);
+        msg.tempOffset = convertHex2Temp(frame.data[6]);
         msg.deviceCmd = deviceCmd_t::SetTemp;
         break;
     }
@@ -766,11 +1510,11 @@ message convertPacket2Message() {
   // keep a raw copy inside the message struct
   for (uint8_t i = 0; i < msg.packetSize; i++) {
     // copy the full raw packet 
-    msg.packet[i] = radio.DATA[i];
+    msg.packet[i] = frame.data[i];
   }
 
   // also get the signal strength
-  msg.RSSI = radio.RSSI;
+  msg.RSSI = frame.rssi;
 
   return msg;
 }
@@ -786,6 +1530,8 @@ boolean pushMessages(message msg) {
         // no need to continue
         MXDEBUG_PRINTLLN(F("Message already in messages queue. Incrementing numPackets"));
         messages[i].numPackets++;
+        messages[i].lastRxMicros = msg.lastRxMicros;
+        pipeline.duplicates++;
         return false;
       }
     }
@@ -796,40 +1542,70 @@ boolean pushMessages(message msg) {
     if (!messages[i].hasData) {
       messages[i] = msg;
       MXDEBUG_PRINTLLN(F("New received message written into messages queue."));
+      pipeline.messages++;
+      // high-water mark, shows how close we got to CFG_MESSAGES_SIZE
+      uint32_t queued = 0;
+      for (uint8_t j = 0; j < CFG_MESSAGES_SIZE; j++) {
+        queued += messages[j].hasData ? 1 : 0;
+      }
+      if (queued > pipeline.queueMax) {
+        pipeline.queueMax = queued;
+      }
       return true;
     }
   }
   // if we reach this point we didn't find the msg in the queue and couldn't
   // insert it new
   MXDEBUG_PRINTLLN(F("ERROR: Could not write message into messages queue."));
+  pipeline.queueDrops++;
   return false;
 }
 
-// check the MQTT cmd queue and handles the "oldest" entry
+// check the MQTT cmd queue and handles the oldest entry, entries older than
+// CFG_MQTTCMD_MAX_AGE are dropped
 // if no entry was found, returns false
 // if it handled an entry returns true
 boolean runMQTTCmdsQueue() {
-  unsigned long oldestTime = 0;
-  uint8_t oldestIndex = 0;
+  MXHEAP_SITE("runMQTTCmdsQueue");
+  uint8_t oldestIndex = CFG_MQTTCMDS_SIZE;
   uint8_t msgCounter = 0;
+  unsigned long now = millis();
   for (uint8_t i = 0; i < CFG_MQTTCMDS_SIZE; i++) {
-    // search for first free queue slot
     if (mqttCmds[i].hasData == 1) {
+      if (now - mqttCmds[i].receiveTime > CFG_MQTTCMD_MAX_AGE) {
+        MXINFO_PRINTLLN(F("Dropping expired MQTT cmd queue entry."));
+        publishCmdAck(mqttCmds[i], "expired");
+        mqttCmds[i] = mqttCmd();
+        continue;
+      }
       msgCounter++;
-      if (mqttCmds[i].receiveTime > oldestTime) {
-        oldestTime = mqttCmds[i].receiveTime;
+      // the lowest seq is the oldest entry, the difference keeps the order across a wrap around
+      if ((oldestIndex == CFG_MQTTCMDS_SIZE) || ((int32_t)(mqttCmds[i].seq - mqttCmds[oldestIndex].seq) < 0)) {
         oldestIndex = i;
       }
     }
   }
 
-  if (oldestTime > 0) {
+  if (oldestIndex < CFG_MQTTCMDS_SIZE) {
+    mqttCmd& cmd = mqttCmds[oldestIndex];
     MXINFO_PRINTLLN(F("Found MQTT cmd queue entry, handling it."));
     MXDEBUG_PRINTL(F("MQTT cmd queue entry timestamp: "));
-    MXDEBUG_PRINTLN(mqttCmds[oldestIndex].receiveTime);
+    MXDEBUG_PRINTLN(cmd.receiveTime);
     MXDEBUG_PRINTL(F("MQTT cmd queue entries        : "));
     MXDEBUG_PRINTLN(msgCounter);
-    handleThermostatCmds(mqttCmds[oldestIndex].topic, mqttCmds[oldestIndex].value);
+    cmd.dequeueTime = millis();
+    // the entry stays in the queue while it is sent, so cmds arriving meanwhile can't take its slot
+    activeCmd = &cmd;
+    boolean known = handleThermostatCmds(cmd.thermostatID, cmd.value);
+    activeCmd = NULL;
+    if (!known) {
+      publishThermostatError(cmd, "unknownCmd");
+    } else if (cmd.txFailed) {
+      publishCmdAck(cmd, "failed");
+    } else {
+      publishCmdAck(cmd, "sent");
+      pipeline.cmdsSent++;
+    }
     // cleanup MQTT message queue entry
     mqttCmd tmp;
     mqttCmds[oldestIndex] = tmp;
@@ -841,8 +1617,26 @@ boolean runMQTTCmdsQueue() {
   return false;
 }
 
+#ifdef CFG_NTP_SERVER
+// formats the wall clock time of ageUs ago as ms since epoch into buf
+// returns false as long as the time isn't synced via NTP
+boolean formatWallClockMs(uint32_t ageUs, char* buf, size_t bufSize) {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  if (tv.tv_sec < CFG_NTP_MIN_VALID_TIME) {
+    return false;
+  }
+  uint64_t ms = (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000 - ageUs / 1000;
+  // printf of 64 bit values isn't supported everywhere, so it is split into seconds and ms
+  snprintf(buf, bufSize, "%lu%03u", (unsigned long)(ms / 1000), (unsigned int)(ms % 1000));
+  return true;
+}
+#endif //CFG_NTP_SERVER
+
 // takes a message struct and publishes it to MQTT
 boolean publishMessagesMQTT(message msg) {
+  MXPROFILE_SCOPE("publishMessagesMQTT");
+  MXHEAP_SITE("publishMessagesMQTT");
   digitalWrite(LED_BUILTIN, LOW); // turn builtin LED on
   MXINFO_PRINTLLN(F("Sending message to MQTT"));
   #ifdef MXINFO
@@ -903,7 +1697,7 @@ boolean publishMessagesMQTT(message msg) {
 
   // publish also raw packet
   String rawPacket = "";
-  char rawHex[2] = "";
+  char rawHex[3] = ""; // 2 hex digits + terminating null
   for (uint8_t i = 0; i < msg.packetSize; i++ ) {
     sprintf(rawHex, "%02X", msg.packet[i]); // padding the hex values with leading 0
     rawPacket = rawPacket + rawHex + ((i < msg.packetSize - 1)? " ":"");
@@ -915,6 +1709,10 @@ boolean publishMessagesMQTT(message msg) {
 
   // publish also a json string which can be used to listen on and have all published values
   // in a single structured message
+  // rxUs: micros() of the first packet, ageMs: time from the first packet to this publish,
+  // lastMs: time from the first to the last packet, time: wall clock of the first packet
+  // in ms since epoch, only with CFG_NTP_SERVER and once the time is synced
+  uint32_t now = micros();
   String jsonMsg = "";
   jsonMsg = "{\"id\":\"" + (String)sensorID +
             "\",\"type\":\"" + deviceType +
@@ -922,10 +1720,21 @@ boolean publishMessagesMQTT(message msg) {
             "\",\"cmd\":\"" + deviceCmd +
             "\",\"raw\":\"" + rawPacket +
             "\",\"rssi\":" + msg.RSSI +
-            "}";
+            ",\"packets\":" + msg.numPackets +
+            ",\"rxUs\":" + msg.firstRxMicros +
+            ",\"ageMs\":" + ((now - msg.firstRxMicros) / 1000) +
+            ",\"lastMs\":" + ((msg.lastRxMicros - msg.firstRxMicros) / 1000);
+  #ifdef CFG_NTP_SERVER
+    char wallClock[24];
+    if (formatWallClockMs(now - msg.firstRxMicros, wallClock, sizeof(wallClock))) {
+      jsonMsg = jsonMsg + ",\"time\":" + wallClock;
+    }
+  #endif //CFG_NTP_SERVER
+  jsonMsg += "}";
   MXINFO_PRINTLLN("Sending json message to MQTT: ");
   MXINFO_PRINTLN(jsonMsg);
-  mqttClient.publish((sensorRoot), jsonMsg); // directly to /get
+  // the String publish of the wrapper is limited to 128 characters
+  mqttClient.publish(sensorRoot.c_str(), jsonMsg.c_str(), false); // directly to /get
 
   digitalWrite(LED_BUILTIN, HIGH); // turn builtin LED off
   return false;
@@ -933,12 +1742,17 @@ boolean publishMessagesMQTT(message msg) {
 
 // checks if any message time has expired and if yes sends it to MQTT
 boolean publishMessages() {
+  if (!mqttClient.connected()) {
+    // keep the messages queued until we are connected again, otherwise they would be lost
+    return false;
+  }
   unsigned long now = millis();
   for (uint8_t i = 0; i < CFG_MESSAGES_SIZE; i++) {
     if (messages[i].hasData) {
       if (now - messages[i].receiveTime > CFG_MESSAGE_DELAY * 1000) {
         MXDEBUG_PRINTLLN(F("Message timer expired, sending it to MQTT"));
         publishMessagesMQTT(messages[i]);
+        pipeline.published++;
         message tmpMsg; // creating empty message
         messages[i] = tmpMsg; // replacing the message we just published,so removing it from the queue.
 
@@ -950,65 +1764,146 @@ boolean publishMessages() {
   return false;
 }
 
-// initializes the thermostats by publishing once their initial values and
-// subscribes to their cmd topic
+// subscribes to the cmd and the TX profile topics of all thermostats
+// a single wildcard subscription per topic is used, the thermostat IDs are validated when a cmd
+// arrives, the thermostats themselves are created with their first cmd, see getThermostat()
 void initThermostats() {
-  MXINFO_PRINTLLN(F("Initializing thermostats and MQTT subscription setup"));
-  uint32_t deviceID = 0;
-  char thermostatID[7] = {0}; // deviceID as a hex string
-  String thermostatRoot = "";
-  String rawPacket = "00 00"; // initial raw packet
-
-  for (uint8_t i = 1; i <= CFG_ETH200NUMTHERMOSTATS; i++) {
-    // we are pushing the ID number three times into the 3 byte ID value
-    // so that we get something like 010101, 020202, 030303
-    deviceID = 0;
-    deviceID = deviceID << 8 | i;
-    deviceID = deviceID << 8 | i;
-    deviceID = deviceID << 8 | i;
-    sprintf(thermostatID, "%06X", deviceID);
-
-    thermostatRoot = (String)mqtt_root + "/thermostat/" + thermostatID;
-    //MXETHControl/<MAC>/thermostat/<ThermostatID>/
-    //get/
-
-    mqttClient.publish(thermostatRoot + "/get/id", thermostatID, true);
-    //mqttClient.publish(thermostatRoot + "/get/raw", rawPacket, false); //v2.4 we didn't do anything so don't update this value
-
-    // we are subscribing to the "cmd" topic and after that's finished we are "Ready"
-    mqttClient.subscribe((thermostatRoot + "/set/cmd").c_str());
-    //mqttClient.publish(thermostatRoot + "/set/cmd", "Ready", false); //v2.4 removed sending a Ready update
-    // at this point MXETHControl will get the published "Ready" value back because it is already subscribed
-    // MQTT Message arrived topic :[MXETHControl/BCDDC2248523/thermostat/010101/set/cmd] MQTT Message: Ready
-  }
-
-  for (uint8_t i = 1; i <= CFG_ETH200NUMGROUPS; i++) {
-    // we are pushing the ID number three times into the 3 byte ID value
-    // so that we get something like 990101, 990202, 990303
-    deviceID = 0;
-    deviceID = deviceID << 8 | 0x99;
-    deviceID = deviceID << 8 | i;
-    deviceID = deviceID << 8 | i;
-    sprintf(thermostatID, "%06X", deviceID);
-
-    thermostatRoot = (String)mqtt_root + "/thermostat/" + thermostatID;
-    //MXETHControl/<MAC>/thermostat/<ThermostatID>/
-    //get/
-
-    mqttClient.publish(thermostatRoot + "/get/id", thermostatID, true);
-    //mqttClient.publish(thermostatRoot + "/get/raw", rawPacket, false); //v2.4 we didn't do anything so don't update this value
-
-    // we are subscribing to the "cmd" topic and after that's finished we are "Ready"
-    mqttClient.subscribe((thermostatRoot + "/set/cmd").c_str());
-    //mqttClient.publish(thermostatRoot + "/set/cmd", "Ready", false); //v2.4 removed sending a Ready update
-    // at this point MXETHControl will get the published "Ready" value back because it is already subscribed
-    // MQTT Message arrived topic :[MXETHControl/BCDDC2248523/thermostat/FF0101/set/cmd] MQTT Message: Ready
-  }
-  // when we reach this point initialization is finished
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "initialized", false);
+  MXINFO_PRINTLLN(F("Initializing thermostats MQTT subscription setup"));
+  //MXETHControl/<MAC>/thermostat/<ThermostatID>/set/cmd
+  mqttClient.subscribe(((String)mqtt_root + MQTT_TOPIC_THERMOSTAT + "/+" + MQTT_TOPIC_SET + MQTT_TOPIC_THERMOSTAT_CMD).c_str());
+  //MXETHControl/<MAC>/thermostat/<ThermostatID>/set/feedback
+  mqttClient.subscribe(((String)mqtt_root + MQTT_TOPIC_THERMOSTAT + "/+" + MQTT_TOPIC_SET + MQTT_TOPIC_THERMOSTAT_FEEDBACK).c_str());
+  //MXETHControl/<MAC>/thermostat/<ThermostatID>/set/txprofile
+  mqttClient.subscribe(((String)mqtt_root + MQTT_TOPIC_THERMOSTAT + "/+" + MQTT_TOPIC_SET + MQTT_TOPIC_THERMOSTAT_TXPROFILE).c_str());
+}
+
+#ifdef CFG_LOG_MQTT
+  // output of the deferred log, see mxLogSetSink()
+  // returns false if not connected, the line is printed to Serial instead
+  bool mqttLogSink(const char* line) {
+    if (!mqttClient.connected()) {
+      return false;
+    }
+    //MXETHControl/<MAC>/debug
+    return mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_DEBUG).c_str(), line, false);
+  }
+#endif //CFG_LOG_MQTT
+
+// MQTT reconnect state, see mqttReconnect()
+unsigned long mqttReconnectDelay = CFG_MQTT_RECONNECT_MIN_DELAY; // backoff, doubled after every failed attempt
+unsigned long mqttReconnectWait = 0;    // delay incl. jitter until the next attempt is allowed
+unsigned long mqttReconnectLastTry = 0; // millis() of the last connection attempt
+uint16_t mqttReconnectTries = 0;        // failed attempts since the last successful connect
+
+// everything which needs to be done after every (re)connect to the broker,
+// subscriptions are not persistent, so they have to be renewed every time
+void mqttConnected() {
+  mqttClient.subscribe(((String)mqtt_root + MQTT_TOPIC_SET + "/#").c_str());
+  // we also need to retain the updated "online" state, otherwise only the willMessage state of "0" is retained
+  // basically if we retain the LWT message then we need to retain any updates to it as well
+  mqttClient.publish((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_ONLINE, "1", true);
+  yield();
+
+  MXINFO_PRINTLN(F("MQTT sending status data."));
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_HARDWARE), MQTT_PRJ_HARDWARE, true);
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_VERSION), MQTT_PRJ_VERSION, true);
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_MAC), WiFi.macAddress(), true);
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_IP), WiFi.localIP().toString());
+  yield();
+
+  initThermostats();
+
+  // the broker may have missed state changes while we were disconnected
+  publishState();
+  mqttClient.loop(); //give the ESP a chance to react to publish messages
+}
+
+// Non blocking MQTT reconnect, does at most one connection attempt per call.
+// If an attempt fails the next one is delayed by an exponential backoff with jitter,
+// in the meantime loop() keeps servicing the radio and the MQTT cmd queue.
+// returns true if we are connected
+boolean mqttReconnect() {
+  if (mqttClient.connected()) {
+    return true;
+  }
+
+  unsigned long now = millis();
+  if ((mqttReconnectTries > 0) && (now - mqttReconnectLastTry < mqttReconnectWait)) {
+    // still backing off, try again in a later loop
+    return false;
+  }
+  mqttReconnectLastTry = now;
+
+  if (WiFi.status() == WL_CONNECTED) {
+    MXINFO_PRINT(F("MQTT try #"));
+    MXINFO_PRINT(mqttReconnectTries);
+    MXINFO_PRINTLN(F(" attempting connection."));
+    MXTIME_PRINT(F(""));
+
+    // Attempt to connect
+    MXINFO_PRINT(F("MQTT connecting as client: "));
+    MXINFO_PRINTLN(deviceName);
+
+    String willTopic = mqtt_root; //need to initialize the variable first, otherwise we have garbage
+    willTopic += MQTT_TOPIC_STATUS;
+    willTopic += MQTT_TOPIC_STATUS_ONLINE;
+    const char* willMessage = "0";
+
+    MXDEBUG_PRINTL(F("Free Heap Size: "));
+    MXDEBUG_PRINTLN(ESP.getFreeHeap());
+    MXDEBUG_PRINTL(F("MQTT user: "));
+    MXDEBUG_PRINTLN(mqtt_user);
+    MXDEBUG_PRINTL(F("MQTT pass: "));
+    MXDEBUG_PRINTLN(mqtt_pass);
+    MXDEBUG_PRINTL(F("MQTT MQTT_MAX_PACKET_SIZE: "));
+    MXDEBUG_PRINTLN(MQTT_MAX_PACKET_SIZE);
+    MXDEBUG_PRINTL(F("MQTT willTopic: "));
+    MXDEBUG_PRINTLN(willTopic);
+    MXDEBUG_PRINTL(F("MQTT willMessage: "));
+    MXDEBUG_PRINTLN(willMessage);
+
+    watchdog.enter(wdStageMQTTConnect, CFG_WD_BUDGET_MQTT_CONNECT);
+    boolean connected = mqttClient.connect(\
+          deviceName.c_str(), mqtt_user, mqtt_pass, \
+          willTopic.c_str(), 0, 1, willMessage);
+          //the added willTopic,willQos,willRetain,willMessage parameters enable the server
+          //to notify all subscribed clients that this sensor is online=0 (means offline) when
+          //the server looses the connection to it
+    watchdogLeave();
+    if (connected) {
+      MXINFO_PRINTLN(F("MQTT connected to broker."));
+      mqttReconnectTries = 0;
+      mqttReconnectDelay = CFG_MQTT_RECONNECT_MIN_DELAY;
+      yield();
+      mqttConnected();
+      MXTIME_PRINT(F(""));
+      return true;
+    }
+    MXINFO_PRINT(F("MQTT connection failed, rc="));
+    MXINFO_PRINT(mqttClient.state());
+  } else {
+    MXINFO_PRINT(F("MQTT not connecting, WiFi is down"));
+  }
+
+  // calculate when the next attempt is allowed
+  mqttReconnectTries++;
+  mqttReconnectWait = mqttReconnectDelay + random(mqttReconnectDelay * CFG_MQTT_RECONNECT_JITTER / 100 + 1);
+  mqttReconnectDelay = mqttReconnectDelay * 2;
+  if (mqttReconnectDelay > CFG_MQTT_RECONNECT_MAX_DELAY) {
+    mqttReconnectDelay = CFG_MQTT_RECONNECT_MAX_DELAY;
+  }
+  MXINFO_PRINT(F(", trying again in "));
+  MXINFO_PRINT(mqttReconnectWait);
+  MXINFO_PRINTLN(F("ms"));
+  return false;
 }
 
 void setup() {
+  // find out if we got reset inside a watchdog stage, before any stage is entered again
+  uint32_t resetReason = ESP.getResetInfoPtr()->reason;
+  watchdog.begin((resetReason == REASON_WDT_RST) || (resetReason == REASON_EXCEPTION_RST) ||
+                 (resetReason == REASON_SOFT_WDT_RST));
+
   pinMode(LED_BUILTIN, OUTPUT);
   digitalWrite(LED_BUILTIN, LOW); // turn builtin LED on when we start doing stuff
 
@@ -1045,6 +1940,16 @@ void setup() {
 
   startWiFi();
   MXTIME_PRINT(F(""));
+  #ifdef CFG_NTP_SERVER
+    // syncs in the background, messages get their wall clock time once it is synced
+    configTime(0, 0, CFG_NTP_SERVER);
+  #endif //CFG_NTP_SERVER
+  #ifdef CFG_LIGHT_SLEEP
+    // the modem and CPU sleep between the DTIM beacons while loop() waits in waitForEvent(),
+    // DIO0 stays high until the FIFO is read, so the level wakes the ESP up
+    WiFi.setSleepMode(WIFI_LIGHT_SLEEP, CFG_LIGHT_SLEEP_LISTEN_INTERVAL);
+    gpio_pin_wakeup_enable(GPIO_ID_PIN(CFG_RF69_IRQ_PIN), GPIO_PIN_INTR_HILEVEL);
+  #endif //CFG_LIGHT_SLEEP
 
   /* I believe this isn't required.
   // initialize queues
@@ -1068,45 +1973,92 @@ void setup() {
   MXTIME_PRINT(F(""));
   MXINFO_PRINTLN(F(""));
 
-  mqttClient.setServer(mqtt_server, mqtt_port);
-  mqttClient.setCallback(mqttCallback);
-  if (!mqttClient.connected()) {
-    mqttReconnect();
-  }
-  //since we are sleeping all the time we look for any retained messages
-  //in the "set" topic when we wake up and then we act on them
-  //mqttClient.subscribe(((String)mqtt_root + CONFIG_MQTT_TOPIC_SET + "/#").c_str());
-  mqttClient.loop();
-  MXTIME_PRINT(F(""));
-  MXINFO_PRINTLN(F(""));
-  
-  MXTIME_PRINT(F(""));
-  MXINFO_PRINT(F("MQTT sending status data."));
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_HARDWARE), MQTT_PRJ_HARDWARE, true);
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_VERSION), MQTT_PRJ_VERSION, true);
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_MAC), WiFi.macAddress(), true);
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_IP), WiFi.localIP().toString());
-  MXINFO_PRINTLN("");
-  MXTIME_PRINT("");
-  yield();
+  MXINFO_PRINTLN(F("Loading TX profiles."));
+  txProfiles.begin();
 
   MXINFO_PRINTLN(F("Initializing ETH200RFM69 module."));
-  radio.initialize();
-  radio.setPowerLevel(CFG_RF69_POWERLEVEL);
+  radioBackend->begin();
   MXDEBUG_PRINTLLN(F("Finished initializing the ETH200RFM69 module."));
   MXDEBUG_PRINTLLN(F("ETH200RFM69 register readout:"));
   #ifdef MXDEBUG
-    radio.readAllRegsCompact();
-    MXINFO_PRINTLN(F(""));
-    radio.readAllRegs();
+    radioBackend->printRegisters();
   #endif //MXDEBUG
+  MXTIME_PRINT(F(""));
+  yield();
 
-  initThermostats();
+  mqttClient.setServer(mqtt_server, mqtt_port);
+  mqttClient.setCallback(mqttCallback);
+  #ifdef CFG_LOG_MQTT
+    mxLogSetSink(mqttLogSink);
+  #endif //CFG_LOG_MQTT
+  mqttClient.setSocketTimeout(CFG_MQTT_SOCKET_TIMEOUT);
+  wifiClient.setTimeout(CFG_MQTT_SOCKET_TIMEOUT * 1000);
+  // first connection attempt, if the broker isn't reachable we just continue
+  // and loop() keeps retrying, the radio doesn't need the broker to receive packets
+  mqttReconnect();
+  mqttClient.loop();
+  MXTIME_PRINT(F(""));
+  MXINFO_PRINTLN(F(""));
 
-  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "listening", false);
+  // initialization is finished
+  setState(deviceState_t::stateListening);
   digitalWrite(LED_BUILTIN, HIGH); // turn builtin LED off when we stop doing stuff
 }
 
+// loop() stage timing, see runPerfPublisher()
+enum perfStage_t {
+  perfMQTT,       // mqttReconnect() and mqttClient.loop()
+  perfPublish,    // publishMessages()
+  perfCmds,       // runMQTTCmdsQueue(), includes sending to the thermostats
+  perfRadio,      // radioBackend->receive() and handling a received packet
+  perfBusy,       // the whole loop() without the final delay()
+  perfRxGap,      // time between two radioBackend->receive() calls, packets are missed if this gets long
+  perfStageCount, // number of stages, needs to be the last entry
+};
+const char* perfStageNames[perfStageCount] = {
+  "mqtt", "publish", "cmds", "radio", "busy", "rxGap"
+};
+mxLatencyHist perfStages[perfStageCount];
+unsigned long perfWindowStart = 0;  // millis() when the statistics were reset
+unsigned long perfLastRxPoll = 0;   // micros() of the last radioBackend->receive() call
+
+// records the time since start for stage, returns now so the next stage can start there
+unsigned long perfRecord(perfStage_t stage, unsigned long start) {
+  unsigned long now = micros();
+  perfStages[stage].record(now - start);
+  return now;
+}
+
+// publishes p50, p99 and max of every loop() stage to status/perf, the counters to status/stats and
+// the heap state to status/heap every CFG_PERF_PUBLISH_INTERVAL and starts a new window
+// returns true if the statistics were published
+boolean runPerfPublisher() {
+  MXHEAP_SITE("runPerfPublisher");
+  unsigned long now = millis();
+  if (now - perfWindowStart < CFG_PERF_PUBLISH_INTERVAL) {
+    return false;
+  }
+  if (!mqttClient.connected()) {
+    // keep collecting, the window just gets longer
+    return false;
+  }
+  // {"window":60000,"loops":583,"mqtt":{"p50":95,"p99":1250,"max":2210},...} values in us, window in ms
+  String jsonMsg = (String)"{\"window\":" + (now - perfWindowStart) + ",\"loops\":" + perfStages[perfStage_t::perfBusy].count;
+  for (uint8_t i = 0; i < perfStageCount; i++) {
+    jsonMsg = jsonMsg + ",\"" + perfStageNames[i] + "\":{\"p50\":" + perfStages[i].percentile(50) +
+              ",\"p99\":" + perfStages[i].percentile(99) + ",\"max\":" + perfStages[i].max + "}";
+    perfStages[i].reset();
+  }
+  jsonMsg += "}";
+  // the String publish of the wrapper is limited to 128 characters
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_PERF).c_str(), jsonMsg.c_str(), false);
+  perfWindowStart = now;
+  // the counters are monotonic, so they are just published along
+  publishStats(false);
+  publishHeap(false);
+  return true;
+}
+
 int counter = 0;
 int counterLoop = 0;
 int counterBreak = ((CFG_ESP_LOOP_DELAY > 0)? (100000 / (CFG_ESP_LOOP_DELAY * 10)): 100000);
@@ -1114,69 +2066,85 @@ uint8_t receivingSomething = 0; // this is set whenever we received a valid pack
                                 // reset if we haven't received a packet in receivingMaxTime
 unsigned long receivingLastTime = 0; // haven't received anything yet
 
-void loop() {
-  // keep mqtt client connection active
-  if (!mqttClient.connected()) {
-    mqttReconnect();
-  }
-  mqttClient.loop();
-
-  // check if we have any message to publish
-  yield();
-  publishMessages();
-
-  // check if any incoming MQTT cmds need to be handled
-  yield();
-  runMQTTCmdsQueue();
+// returns the ms left until interval has passed since start, 0 if it already passed
+unsigned long remainingTime(unsigned long start, unsigned long interval, unsigned long now) {
+  unsigned long elapsed = now - start;
+  return (elapsed >= interval) ? 0 : interval - elapsed;
+}
 
-  #ifdef MXINFO
-    /*
-    if (counter % 30000 == 0) {
-      // turn off every other second
-      digitalWrite(LED_BUILTIN, HIGH);
-    } else if (counter % 15000 == 0) {
-      // turn on
-      digitalWrite(LED_BUILTIN, LOW);
+// returns how long loop() can wait until its next timed work is due, at most CFG_ESP_LOOP_DELAY
+unsigned long nextLoopDeadline() {
+  if (radioBackend->available()) {
+    return 0;
+  }
+  unsigned long now = millis();
+  unsigned long wait = CFG_ESP_LOOP_DELAY;
+  for (uint8_t i = 0; i < CFG_MQTTCMDS_SIZE; i++) {
+    if (mqttCmds[i].hasData == 1) {
+      // sending is handled one cmd per loop() run
+      return 0;
     }
-    */
-    if (counter >= counterBreak) {
-      MXINFO_PRINT(F("Listening for packets, loop (x"));
-      MXINFO_PRINT(counterBreak);
-      MXINFO_PRINT(F("): "));
-      MXINFO_PRINTLN(counterLoop);
-      counterLoop++;
-      counter = 0;
+  }
+  if (mqttClient.connected()) {
+    for (uint8_t i = 0; i < CFG_MESSAGES_SIZE; i++) {
+      if (messages[i].hasData) {
+        wait = min(wait, remainingTime(messages[i].receiveTime, CFG_MESSAGE_DELAY * 1000UL, now));
+      }
     }
-    counter++;
-  #endif //MXINFO
-  if (radio.receiveDone()) {
+    if (currentState != publishedState) {
+      wait = min(wait, remainingTime(statePublishLastTime, CFG_STATE_PUBLISH_MIN_INTERVAL, now));
+    }
+    wait = min(wait, remainingTime(perfWindowStart, CFG_PERF_PUBLISH_INTERVAL, now));
+  } else if (mqttReconnectTries > 0) {
+    wait = min(wait, remainingTime(mqttReconnectLastTry, mqttReconnectWait, now));
+  } else {
+    return 0;
+  }
+  if (receivingSomething == 1) {
+    wait = min(wait, remainingTime(receivingLastTime, CFG_STATE_RECEIVING_MAX_TIME + 1, now));
+  }
+  return wait;
+}
+
+// instead of a fixed delay() loop() waits here until the next timed work is due, a packet
+// arrived (isr0 calls esp_schedule()) or MQTT data is waiting. The TCP socket can't wake
+// us, so it is polled every CFG_EVENT_POLL_INTERVAL. While waiting the ESP can light sleep,
+// see CFG_LIGHT_SLEEP.
+void waitForEvent(unsigned long timeout) {
+  if (timeout == 0) {
+    yield();
+    return;
+  }
+  esp_delay(timeout, []() {
+    return !radioBackend->available() && (wifiClient.available() == 0);
+  }, CFG_EVENT_POLL_INTERVAL);
+}
+
+// loop() work split into tasks for the scheduler, every task returns true if it has more work
+// the radio FIFO holds a single packet, so the radio is serviced between all other tasks
+boolean taskRadio() {
+  unsigned long start = micros();
+  if (perfLastRxPoll != 0) {
+    perfStages[perfStage_t::perfRxGap].record(start - perfLastRxPoll);
+  }
+  perfLastRxPoll = start;
+  mxRadioFrame frame;
+  if (radioBackend->receive(frame)) {
     if (receivingSomething == 0) {
       // received the first packet, of several packets
       digitalWrite(LED_BUILTIN, LOW); // turn builtin LED on
       receivingSomething = 1;
       receivingLastTime = millis();
-      mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "receiving", false);
+      setState(deviceState_t::stateReceiving);
     } else {
       // we are already in "receiving" state, got another packet, need to reset timer
       receivingLastTime = millis();
     }
-    message msg = convertPacket2Message();
+    message msg = convertPacket2Message(frame);
     pushMessages(msg);
-    MXDEBUG_PRINTLLN(F("Packet received:"));
-    // static printing of sync word
-    #ifdef MXDEBUG
-      printHexWithZeroPad(Serial, (uint8_t)0x7E); // this is hard coded just for output,
-                                                  // otherwise handled directly by RFM69
-      Serial.print(" ");
-      for (byte i = 0; i < radio.DATALEN; i++) {
-        printHexWithZeroPad(Serial, radio.DATA[i]);
-        Serial.print(" ");
-      }
-      Serial.print("   [RX_RSSI:");
-      Serial.print(radio.RSSI);
-      Serial.println("]");
-      Serial.println();
-    #endif //MXDEBUG
+    // the sync word 7E is handled directly by the RFM69 and not part of the frame
+    MXLOG_DEBUG_HEX("Packet received: 7E", frame.data, frame.length);
+    MXLOG_DEBUG("[RX_RSSI:%d]", frame.rssi);
   }
   if (receivingSomething == 1) {
     if (millis() - receivingLastTime > CFG_STATE_RECEIVING_MAX_TIME) {
@@ -1185,11 +2153,139 @@ void loop() {
       receivingSomething = 0;
       receivingLastTime = 0;
       // we are back to listening
-      mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_STATE), "listening", false);
+      setState(deviceState_t::stateListening);
       digitalWrite(LED_BUILTIN, HIGH); // turn builtin LED off
     }
   }
+  perfRecord(perfStage_t::perfRadio, start);
+  return false;
+}
+
+// keep mqtt client connection active, this returns immediately while backing off
+boolean taskMQTT() {
+  unsigned long start = micros();
+  if (mqttReconnect()) {
+    mqttClient.loop();
+  }
+  perfRecord(perfStage_t::perfMQTT, start);
+  return false;
+}
+
+// sends at most one cmd per slice, a cmd blocks for ~6s
+boolean taskCmds() {
+  unsigned long start = micros();
+  runMQTTCmdsQueue();
+  perfRecord(perfStage_t::perfCmds, start);
+  return false;
+}
+
+// publishes one message per run
+boolean taskPublish() {
+  unsigned long start = micros();
+  boolean published = publishMessages();
+  perfRecord(perfStage_t::perfPublish, start);
+  return published;
+}
+
+boolean taskStatus() {
+  // publish the latest state if it was held back by the rate limit
+  runStatePublisher();
+  runWatchdogReport();
+  sampleHeap();
+  runPerfPublisher();
+  txProfiles.saveIfDue();
+  return false;
+}
+
+#if defined(MXDEBUG) || defined(MXINFO)
+  // print the deferred log only while no packets are coming in
+  boolean taskLog() {
+    if (receivingSomething == 0) {
+      return mxLogDrain(CFG_LOG_DRAIN_MAX) > 0;
+    }
+    return false;
+  }
+#endif //defined(MXDEBUG) || defined(MXINFO)
+
+#ifdef MQTT_HTTP_OTA_FW_UPD
+  // checks for a firmware update after set/update, but only while no packets are coming in
+  // and no messages or cmds are waiting, the check blocks for up to CFG_WD_BUDGET_FW_UPDATE
+  boolean taskOTA() {
+    if (!fwUpdateRequested || (receivingSomething == 1) || (nextLoopDeadline() == 0)) {
+      return false;
+    }
+    for (uint8_t i = 0; i < CFG_MESSAGES_SIZE; i++) {
+      if (messages[i].hasData) {
+        return false;
+      }
+    }
+    fwUpdateRequested = false;
+    setState(deviceState_t::stateCheckingOTA, true);
+    MXINFO_PRINTLN(F("Starting requested update via HTTP."));
+    checkForFWUpdates();
+    // if we reach this point no fw update was done and we continue listening
+    setState(deviceState_t::stateListening);
+    return false;
+  }
+#endif //MQTT_HTTP_OTA_FW_UPD
+
+// name, function, priority (lower runs first), budget per slice in us, critical
+mxTask tasks[] = {
+  {"radio", taskRadio, 0, CFG_TASK_BUDGET_RADIO, true},
+  {"mqtt", taskMQTT, 1, CFG_TASK_BUDGET_MQTT, false},
+  {"cmds", taskCmds, 2, CFG_TASK_BUDGET_CMDS, false},
+  {"publish", taskPublish, 3, CFG_TASK_BUDGET_PUBLISH, false},
+  {"status", taskStatus, 4, CFG_TASK_BUDGET_STATUS, false},
+  #if defined(MXDEBUG) || defined(MXINFO)
+    {"log", taskLog, 5, CFG_TASK_BUDGET_LOG, false},
+  #endif //defined(MXDEBUG) || defined(MXINFO)
+  #ifdef MQTT_HTTP_OTA_FW_UPD
+    {"ota", taskOTA, 6, CFG_TASK_BUDGET_OTA, false},
+  #endif //MQTT_HTTP_OTA_FW_UPD
+};
+MXScheduler scheduler(tasks, sizeof(tasks) / sizeof(tasks[0]));
+
+// publishes the CPU share, longest slice and budget overruns of every task to status/tasks
+// every CFG_PERF_PUBLISH_INTERVAL and starts a new window
+// returns true if the statistics were published
+boolean runTaskPublisher() {
+  uint64_t window = scheduler.windowUs();
+  if ((window < CFG_PERF_PUBLISH_INTERVAL * 1000ULL) || !mqttClient.connected()) {
+    return false;
+  }
+  // {"window":60000,"radio":{"share":0.8,"maxUs":1250,"over":0},...} share in %, window in ms
+  String jsonMsg = (String)"{\"window\":" + (unsigned long)(window / 1000);
+  for (uint8_t i = 0; i < scheduler.numTasks(); i++) {
+    mxTask& task = scheduler.task(i);
+    jsonMsg = jsonMsg + ",\"" + task.name + "\":{\"share\":" + String(scheduler.cpuShare(i), 1) +
+              ",\"maxUs\":" + task.maxUs + ",\"over\":" + task.overruns + "}";
+  }
+  jsonMsg += "}";
+  // the String publish of the wrapper is limited to 128 characters
+  mqttClient.publish(((String)mqtt_root + MQTT_TOPIC_STATUS + MQTT_TOPIC_STATUS_TASKS).c_str(), jsonMsg.c_str(), false);
+  scheduler.resetStats();
+  return true;
+}
 
-  // slow down the loop a bit
-  delay(CFG_ESP_LOOP_DELAY); 
-}
\ No newline at end of file
+void loop() {
+  unsigned long loopStart = micros();
+
+  #ifdef MXINFO
+    if (counter >= counterBreak) {
+      MXINFO_PRINT(F("Listening for packets, loop (x"));
+      MXINFO_PRINT(counterBreak);
+      MXINFO_PRINT(F("): "));
+      MXINFO_PRINTLN(counterLoop);
+      counterLoop++;
+      counter = 0;
+    }
+    counter++;
+  #endif //MXINFO
+
+  scheduler.runSlice();
+  runTaskPublisher();
+  perfRecord(perfStage_t::perfBusy, loopStart);
+
+  // sleep until something needs to be done
+  waitForEvent(nextLoopDeadline());
+}